@@ -0,0 +1,180 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "alloc_accounting.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef CONFIG_SPRINKLER_ALLOC_ACCOUNTING
+
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "ALLOC_ACCOUNTING";
+
+typedef struct
+{
+    TaskHandle_t task;
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t allocations;
+    uint32_t bytes;
+    uint32_t frees;
+} task_allocations_t;
+
+// Entry 0 gathers interrupts and the tasks past ALLOC_ACCOUNTING_MAX_TASKS
+static task_allocations_t tasks[ALLOC_ACCOUNTING_MAX_TASKS + 1] = {[0] = {.name = "other"}};
+static size_t task_count = 1;
+static struct
+{
+    size_t size;
+    size_t task;
+    int64_t time_us;
+} last;
+static bool started = false;
+static int64_t started_us = 0;
+static portMUX_TYPE accounting_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Called with the lock held, from any task or interrupt, so it only copies the name once per task
+static IRAM_ATTR task_allocations_t *current_entry(size_t *index)
+{
+    if (xPortInIsrContext())
+    {
+        *index = 0;
+        return &tasks[0];
+    }
+
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    for (size_t i = 1; i < task_count; i++)
+    {
+        if (tasks[i].task == task)
+        {
+            *index = i;
+            return &tasks[i];
+        }
+    }
+    if (task_count > ALLOC_ACCOUNTING_MAX_TASKS)
+    {
+        *index = 0;
+        return &tasks[0];
+    }
+
+    task_allocations_t *entry = &tasks[task_count];
+    entry->task = task;
+    const char *name = pcTaskGetName(task);
+    for (size_t i = 0; i < sizeof(entry->name) - 1 && name[i]; i++)
+    {
+        entry->name[i] = name[i];
+    }
+    *index = task_count++;
+    return entry;
+}
+
+// Heap hooks, enabled by CONFIG_HEAP_USE_HOOKS which the option selects
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    if (!started || !ptr)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL_SAFE(&accounting_lock);
+    size_t index;
+    task_allocations_t *entry = current_entry(&index);
+    entry->allocations++;
+    entry->bytes += size;
+    last.size = size;
+    last.task = index;
+    last.time_us = esp_timer_get_time();
+    portEXIT_CRITICAL_SAFE(&accounting_lock);
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr)
+{
+    if (!started || !ptr)
+    {
+        return;
+    }
+
+    portENTER_CRITICAL_SAFE(&accounting_lock);
+    size_t index;
+    current_entry(&index)->frees++;
+    portEXIT_CRITICAL_SAFE(&accounting_lock);
+}
+
+void alloc_accounting_start(void)
+{
+    started_us = esp_timer_get_time();
+    started = true;
+    ESP_LOGI(TAG, "Counting heap allocations from now on");
+}
+
+void alloc_accounting_to_json(char *buffer, size_t buffer_size)
+{
+    // Copied under the lock and formatted outside of it, only the system info asks so it can be static
+    static task_allocations_t snapshot[ALLOC_ACCOUNTING_MAX_TASKS + 1];
+    size_t count;
+    size_t last_size, last_task;
+    int64_t last_time_us;
+    portENTER_CRITICAL_SAFE(&accounting_lock);
+    count = task_count;
+    memcpy(snapshot, tasks, count * sizeof(task_allocations_t));
+    last_size = last.size;
+    last_task = last.task;
+    last_time_us = last.time_us;
+    portEXIT_CRITICAL_SAFE(&accounting_lock);
+
+    uint32_t allocations = 0, bytes = 0, frees = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        allocations += snapshot[i].allocations;
+        bytes += snapshot[i].bytes;
+        frees += snapshot[i].frees;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    int len = snprintf(buffer, buffer_size,
+                       "\"allocations\": {"
+                       "\"since_boot_done\": \"%lld s\","
+                       "\"total\": \"%lu allocations, %lu bytes, %lu frees\"",
+                       (now_us - started_us) / 1000000, (unsigned long)allocations, (unsigned long)bytes,
+                       (unsigned long)frees);
+    if (allocations && len < buffer_size)
+    {
+        len += snprintf(buffer + len, buffer_size - len, ",\"last\": \"%d bytes by %s %lld s ago\"",
+                        (int)last_size, snapshot[last_task].name, (now_us - last_time_us) / 1000000);
+    }
+    for (size_t i = 0; i < count && len < buffer_size; i++)
+    {
+        if (snapshot[i].allocations || snapshot[i].frees)
+        {
+            len += snprintf(buffer + len, buffer_size - len, ",\"%s\": \"%lu allocations, %lu bytes, %lu frees\"",
+                            snapshot[i].name, (unsigned long)snapshot[i].allocations,
+                            (unsigned long)snapshot[i].bytes, (unsigned long)snapshot[i].frees);
+        }
+    }
+    if (len < buffer_size)
+    {
+        snprintf(buffer + len, buffer_size - len, "}");
+    }
+}
+
+#else
+
+void alloc_accounting_start(void)
+{
+}
+
+void alloc_accounting_to_json(char *buffer, size_t buffer_size)
+{
+    if (buffer_size)
+    {
+        buffer[0] = '\0';
+    }
+}
+
+#endif
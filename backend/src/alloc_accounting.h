@@ -0,0 +1,20 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include <stddef.h>
+#include "sdkconfig.h"
+
+// Allocations are counted per task, tasks past this share one entry
+#define ALLOC_ACCOUNTING_MAX_TASKS 16
+
+/**
+ * @brief Count the heap allocations made from now on, called once the boot stages are done
+ * Only with CONFIG_SPRINKLER_ALLOC_ACCOUNTING, a no-op otherwise.
+ */
+void alloc_accounting_start(void);
+
+/**
+ * @brief "allocations" section of the system info, per task, empty without CONFIG_SPRINKLER_ALLOC_ACCOUNTING
+ */
+void alloc_accounting_to_json(char *buffer, size_t buffer_size);
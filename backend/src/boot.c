@@ -0,0 +1,263 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "boot.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+static const char *TAG = "boot";
+
+#define BOOT_DEFAULT_STACK_SIZE 4096
+#define BOOT_TASK_PRIORITY 5
+
+typedef enum
+{
+    BOOT_STAGE_PENDING,
+    BOOT_STAGE_RUNNING,
+    BOOT_STAGE_DONE,
+    BOOT_STAGE_FAILED,
+    BOOT_STAGE_SKIPPED
+} boot_stage_state_t;
+
+typedef struct
+{
+    const boot_stage_t *stage;
+    boot_stage_state_t state;
+    esp_err_t result;
+    int64_t start_us;
+    int64_t end_us;
+} boot_stage_timing_t;
+
+static const char *milestone_names[BOOT_MILESTONE_COUNT] = {
+    [BOOT_MILESTONE_CONTROLLABLE] = "controllable",
+    [BOOT_MILESTONE_NETWORK] = "network",
+    [BOOT_MILESTONE_TIME_SYNC] = "time_sync"};
+
+static boot_stage_timing_t timings[BOOT_MAX_STAGES];
+static size_t stage_count = 0;
+static int64_t milestones_us[BOOT_MILESTONE_COUNT];
+static EventGroupHandle_t boot_event_group = NULL;
+
+static const char *stage_state_to_string(boot_stage_state_t state)
+{
+    switch (state)
+    {
+    case BOOT_STAGE_PENDING:
+        return "pending";
+    case BOOT_STAGE_RUNNING:
+        return "running";
+    case BOOT_STAGE_DONE:
+        return "done";
+    case BOOT_STAGE_FAILED:
+        return "failed";
+    case BOOT_STAGE_SKIPPED:
+        return "skipped";
+    default:
+        return "unknown";
+    }
+}
+
+static void boot_stage_task(void *pvParameters)
+{
+    boot_stage_timing_t *timing = (boot_stage_timing_t *)pvParameters;
+
+    timing->start_us = esp_timer_get_time();
+    timing->result = timing->stage->run();
+    timing->end_us = esp_timer_get_time();
+    timing->state = timing->result == ESP_OK ? BOOT_STAGE_DONE : BOOT_STAGE_FAILED;
+
+    if (timing->result != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Stage %s failed: %s", timing->stage->name, esp_err_to_name(timing->result));
+    }
+
+    xEventGroupSetBits(boot_event_group, BOOT_STAGE_BIT(timing - timings));
+    vTaskDelete(NULL);
+}
+
+static void log_timeline(void)
+{
+    for (size_t i = 0; i < stage_count; i++)
+    {
+        const boot_stage_timing_t *timing = &timings[i];
+        ESP_LOGI(TAG, "%-12s %-8s %6lld -> %6lld ms (%lld ms)",
+                 timing->stage->name,
+                 stage_state_to_string(timing->state),
+                 timing->start_us / 1000,
+                 timing->end_us / 1000,
+                 (timing->end_us - timing->start_us) / 1000);
+    }
+}
+
+esp_err_t boot_run(const boot_stage_t *stages, size_t count)
+{
+    if (count > BOOT_MAX_STAGES)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    boot_event_group = xEventGroupCreate();
+    if (boot_event_group == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    stage_count = count;
+    for (size_t i = 0; i < count; i++)
+    {
+        timings[i] = (boot_stage_timing_t){.stage = &stages[i], .state = BOOT_STAGE_PENDING};
+    }
+
+    const uint32_t all_stages = (count == 32) ? UINT32_MAX : (BOOT_STAGE_BIT(count) - 1);
+    uint32_t finished = 0;
+    uint32_t succeeded = 0;
+
+    while (finished != all_stages)
+    {
+        // Start or skip every pending stage whose dependencies are resolved. Skipping a stage can
+        // resolve others, so scan until nothing changes
+        bool progress;
+        do
+        {
+            progress = false;
+            for (size_t i = 0; i < count; i++)
+            {
+                boot_stage_timing_t *timing = &timings[i];
+                uint32_t depends_on = stages[i].depends_on;
+
+                if (timing->state != BOOT_STAGE_PENDING || (finished & depends_on) != depends_on)
+                {
+                    continue;
+                }
+
+                if ((succeeded & depends_on) != depends_on)
+                {
+                    ESP_LOGW(TAG, "Skipping stage %s, a dependency failed", stages[i].name);
+                    timing->state = BOOT_STAGE_SKIPPED;
+                    timing->result = ESP_ERR_INVALID_STATE;
+                    timing->start_us = timing->end_us = esp_timer_get_time();
+                    finished |= BOOT_STAGE_BIT(i);
+                    progress = true;
+                    continue;
+                }
+
+                timing->state = BOOT_STAGE_RUNNING;
+                uint32_t stack_size = stages[i].stack_size ? stages[i].stack_size : BOOT_DEFAULT_STACK_SIZE;
+                if (xTaskCreate(boot_stage_task, stages[i].name, stack_size, timing, BOOT_TASK_PRIORITY, NULL) != pdPASS)
+                {
+                    // Not enough memory for a worker, run it inline instead
+                    ESP_LOGW(TAG, "Running stage %s inline", stages[i].name);
+                    timing->start_us = esp_timer_get_time();
+                    timing->result = stages[i].run();
+                    timing->end_us = esp_timer_get_time();
+                    timing->state = timing->result == ESP_OK ? BOOT_STAGE_DONE : BOOT_STAGE_FAILED;
+                    xEventGroupSetBits(boot_event_group, BOOT_STAGE_BIT(i));
+                }
+            }
+        } while (progress);
+
+        if (finished == all_stages)
+        {
+            break;
+        }
+
+        bool any_running = false;
+        for (size_t i = 0; i < count; i++)
+        {
+            any_running |= timings[i].state == BOOT_STAGE_RUNNING ||
+                           ((timings[i].state == BOOT_STAGE_DONE || timings[i].state == BOOT_STAGE_FAILED) && !(finished & BOOT_STAGE_BIT(i)));
+        }
+        if (!any_running)
+        {
+            ESP_LOGE(TAG, "Boot stage dependencies can't be satisfied, check for cycles");
+            break;
+        }
+
+        // Wait for any running stage to complete
+        EventBits_t bits = xEventGroupWaitBits(boot_event_group, all_stages & ~finished, pdFALSE, pdFALSE, portMAX_DELAY);
+        finished |= bits & all_stages;
+
+        succeeded = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (timings[i].state == BOOT_STAGE_DONE)
+            {
+                succeeded |= BOOT_STAGE_BIT(i);
+            }
+        }
+    }
+
+    vEventGroupDelete(boot_event_group);
+    boot_event_group = NULL;
+
+    ESP_LOGI(TAG, "Boot stages completed after %lld ms", esp_timer_get_time() / 1000);
+    log_timeline();
+
+    return succeeded == all_stages ? ESP_OK : ESP_FAIL;
+}
+
+void boot_mark_milestone(boot_milestone_t milestone)
+{
+    if (milestone >= BOOT_MILESTONE_COUNT || milestones_us[milestone] != 0)
+    {
+        return;
+    }
+
+    milestones_us[milestone] = esp_timer_get_time();
+    ESP_LOGI(TAG, "Milestone %s reached after %lld ms", milestone_names[milestone], milestones_us[milestone] / 1000);
+
+    if (milestone == BOOT_MILESTONE_CONTROLLABLE && milestones_us[milestone] / 1000 > BOOT_CONTROLLABLE_TARGET_MS)
+    {
+        ESP_LOGW(TAG, "Valves controllable after %lld ms, over the %d ms target",
+                 milestones_us[milestone] / 1000, BOOT_CONTROLLABLE_TARGET_MS);
+    }
+}
+
+esp_err_t boot_timeline_to_json(char *buffer, size_t buffer_size)
+{
+    int len = snprintf(buffer, buffer_size, "{\"type\":\"boot_timeline\",\"stages\":[");
+
+    for (size_t i = 0; i < stage_count && len < buffer_size; i++)
+    {
+        const boot_stage_timing_t *timing = &timings[i];
+        len += snprintf(buffer + len, buffer_size - len,
+                        "%s{\"name\":\"%s\",\"state\":\"%s\",\"start_ms\":%lld,\"end_ms\":%lld}",
+                        i > 0 ? "," : "",
+                        timing->stage->name,
+                        stage_state_to_string(timing->state),
+                        timing->start_us / 1000,
+                        timing->end_us / 1000);
+    }
+
+    for (int i = 0; i < BOOT_MILESTONE_COUNT && len < buffer_size; i++)
+    {
+        len += snprintf(buffer + len, buffer_size - len, "%s\"%s\":%lld",
+                        i > 0 ? "," : "],\"milestones\":{",
+                        milestone_names[i],
+                        milestones_us[i] ? milestones_us[i] / 1000 : -1);
+    }
+
+    int64_t controllable_ms = milestones_us[BOOT_MILESTONE_CONTROLLABLE] / 1000;
+    if (len < buffer_size)
+    {
+        len += snprintf(buffer + len, buffer_size - len,
+                        "},\"target\":{\"milestone\":\"%s\",\"ms\":%d,\"met\":%s}}",
+                        milestone_names[BOOT_MILESTONE_CONTROLLABLE],
+                        BOOT_CONTROLLABLE_TARGET_MS,
+                        (controllable_ms > 0 && controllable_ms <= BOOT_CONTROLLABLE_TARGET_MS) ? "true" : "false");
+    }
+
+    if (len >= buffer_size)
+    {
+        ESP_LOGE(TAG, "JSON buffer too small for boot timeline");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
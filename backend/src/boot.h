@@ -0,0 +1,56 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define BOOT_MAX_STAGES 16
+
+// Latency budget from power-on until valves can be driven, checked at every boot
+#define BOOT_CONTROLLABLE_TARGET_MS 2000
+
+#define BOOT_STAGE_BIT(stage) (1UL << (stage))
+
+typedef struct
+{
+    const char *name;
+    esp_err_t (*run)(void);
+    uint32_t depends_on; // Bitmask of BOOT_STAGE_BIT() of the stages that must succeed first
+    uint32_t stack_size;
+} boot_stage_t;
+
+typedef enum
+{
+    BOOT_MILESTONE_CONTROLLABLE,
+    BOOT_MILESTONE_NETWORK,
+    BOOT_MILESTONE_TIME_SYNC,
+    BOOT_MILESTONE_COUNT
+} boot_milestone_t;
+
+/**
+ * @brief Run the boot stages, starting each one in its own task as soon as its dependencies succeeded
+ * Stages whose dependencies failed are skipped. Returns once every stage finished or was skipped.
+ *
+ * @param stages Stage table, indexes are the bit positions used in depends_on
+ * @param count Number of stages, at most BOOT_MAX_STAGES
+ * @return esp_err_t ESP_OK if every stage succeeded
+ */
+esp_err_t boot_run(const boot_stage_t *stages, size_t count);
+
+/**
+ * @brief Record the first time a milestone is reached, later calls are ignored
+ *
+ * @param milestone Milestone reached
+ */
+void boot_mark_milestone(boot_milestone_t milestone);
+
+/**
+ * @brief Serialize the boot timeline (stages and milestones, in ms since power-on)
+ *
+ * @param buffer Output buffer
+ * @param buffer_size Output buffer size
+ * @return esp_err_t ESP_ERR_NO_MEM if the buffer is too small
+ */
+esp_err_t boot_timeline_to_json(char *buffer, size_t buffer_size);
@@ -0,0 +1,203 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "buffer_pool.h"
+
+#include <stdbool.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "BUFFER_POOL";
+
+#define BUFFER_LEASE_RETRY_MS 5
+
+#define BUFFER_ALIGN 8 // Every size is a multiple, each buffer can hold any struct
+
+static char small_buffers[BUFFER_SMALL_COUNT][BUFFER_SMALL_SIZE] __attribute__((aligned(BUFFER_ALIGN)));
+static char medium_buffers[BUFFER_MEDIUM_COUNT][BUFFER_MEDIUM_SIZE] __attribute__((aligned(BUFFER_ALIGN)));
+static char large_buffers[BUFFER_LARGE_COUNT][BUFFER_LARGE_SIZE] __attribute__((aligned(BUFFER_ALIGN)));
+
+typedef struct
+{
+    const char *owner;
+    TaskHandle_t task;
+    TickType_t since;
+} buffer_owner_t;
+
+static buffer_owner_t small_owners[BUFFER_SMALL_COUNT];
+static buffer_owner_t medium_owners[BUFFER_MEDIUM_COUNT];
+static buffer_owner_t large_owners[BUFFER_LARGE_COUNT];
+
+typedef struct
+{
+    char *storage;
+    buffer_owner_t *owners;
+    uint32_t leased; // One bit per buffer
+    buffer_pool_stats_t stats;
+} buffer_class_info_t;
+
+_Static_assert(BUFFER_SMALL_SIZE % BUFFER_ALIGN == 0 && BUFFER_MEDIUM_SIZE % BUFFER_ALIGN == 0 && BUFFER_LARGE_SIZE % BUFFER_ALIGN == 0,
+               "Buffers of a class follow each other");
+_Static_assert(BUFFER_SMALL_COUNT <= 32 && BUFFER_MEDIUM_COUNT <= 32 && BUFFER_LARGE_COUNT <= 32,
+               "Leased buffers of a class are a 32-bit mask");
+
+static buffer_class_info_t classes[BUFFER_CLASS_COUNT] = {
+    [BUFFER_SMALL] = {(char *)small_buffers, small_owners, 0, {.size = BUFFER_SMALL_SIZE, .count = BUFFER_SMALL_COUNT}},
+    [BUFFER_MEDIUM] = {(char *)medium_buffers, medium_owners, 0, {.size = BUFFER_MEDIUM_SIZE, .count = BUFFER_MEDIUM_COUNT}},
+    [BUFFER_LARGE] = {(char *)large_buffers, large_owners, 0, {.size = BUFFER_LARGE_SIZE, .count = BUFFER_LARGE_COUNT}},
+};
+
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Called with the lock held, first free buffer of the fitting class or of a larger one
+static char *take_buffer(int first_class, const char *owner)
+{
+    for (int c = first_class; c < BUFFER_CLASS_COUNT; c++)
+    {
+        buffer_class_info_t *info = &classes[c];
+        for (int i = 0; i < info->stats.count; i++)
+        {
+            if (info->leased & (1UL << i))
+            {
+                continue;
+            }
+
+            info->leased |= 1UL << i;
+            info->owners[i] = (buffer_owner_t){
+                .owner = owner,
+                .task = xTaskGetCurrentTaskHandle(),
+                .since = xTaskGetTickCount(),
+            };
+            info->stats.leases++;
+            info->stats.in_use++;
+            if (info->stats.in_use > info->stats.high_water)
+            {
+                info->stats.high_water = info->stats.in_use;
+            }
+            return info->storage + i * info->stats.size;
+        }
+    }
+    return NULL;
+}
+
+// Who holds the buffers a request timed out on, copied under the lock and logged outside of it
+static void log_owners(int first_class)
+{
+    buffer_owner_t owners[BUFFER_SMALL_COUNT + BUFFER_MEDIUM_COUNT + BUFFER_LARGE_COUNT];
+    size_t count = 0;
+
+    taskENTER_CRITICAL(&pool_lock);
+    for (int c = first_class; c < BUFFER_CLASS_COUNT; c++)
+    {
+        for (int i = 0; i < classes[c].stats.count; i++)
+        {
+            if (classes[c].leased & (1UL << i))
+            {
+                owners[count++] = classes[c].owners[i];
+            }
+        }
+    }
+    taskEXIT_CRITICAL(&pool_lock);
+
+    TickType_t now = xTaskGetTickCount();
+    for (size_t i = 0; i < count; i++)
+    {
+        ESP_LOGW(TAG, "Leased by %s (task %s) for %lu ms", owners[i].owner ? owners[i].owner : "?",
+                 pcTaskGetName(owners[i].task), (unsigned long)pdTICKS_TO_MS(now - owners[i].since));
+    }
+}
+
+char *buffer_lease(size_t size, const char *owner)
+{
+    int first_class = 0;
+    while (first_class < BUFFER_CLASS_COUNT && classes[first_class].stats.size < size)
+    {
+        first_class++;
+    }
+    if (first_class == BUFFER_CLASS_COUNT)
+    {
+        ESP_LOGE(TAG, "No buffer of %d bytes for %s", (int)size, owner);
+        return NULL;
+    }
+
+    TickType_t start = xTaskGetTickCount();
+    bool waited = false;
+    while (1)
+    {
+        taskENTER_CRITICAL(&pool_lock);
+        buffer_pool_stats_t *stats = &classes[first_class].stats;
+        if (size > stats->largest_request)
+        {
+            stats->largest_request = size;
+        }
+        char *buffer = take_buffer(first_class, owner);
+        if (!buffer && !waited)
+        {
+            stats->waits++;
+        }
+        bool expired = !buffer && xTaskGetTickCount() - start >= pdMS_TO_TICKS(BUFFER_LEASE_TIMEOUT_MS);
+        if (expired)
+        {
+            stats->failures++;
+        }
+        taskEXIT_CRITICAL(&pool_lock);
+
+        if (buffer)
+        {
+            return buffer;
+        }
+        if (expired)
+        {
+            ESP_LOGE(TAG, "No buffer of %d bytes got free for %s", (int)size, owner);
+            log_owners(first_class);
+            return NULL;
+        }
+
+        waited = true;
+        vTaskDelay(pdMS_TO_TICKS(BUFFER_LEASE_RETRY_MS));
+    }
+}
+
+void buffer_release(char *buffer)
+{
+    if (!buffer)
+    {
+        return;
+    }
+
+    for (int c = 0; c < BUFFER_CLASS_COUNT; c++)
+    {
+        buffer_class_info_t *info = &classes[c];
+        if (buffer < info->storage || buffer >= info->storage + info->stats.count * info->stats.size)
+        {
+            continue;
+        }
+
+        size_t index = (buffer - info->storage) / info->stats.size;
+        bool leased;
+        taskENTER_CRITICAL(&pool_lock);
+        leased = info->leased & (1UL << index);
+        if (leased)
+        {
+            info->leased &= ~(1UL << index);
+            info->owners[index] = (buffer_owner_t){0};
+            info->stats.in_use--;
+        }
+        taskEXIT_CRITICAL(&pool_lock);
+
+        if (!leased)
+        {
+            ESP_LOGE(TAG, "Buffer released twice");
+        }
+        return;
+    }
+
+    ESP_LOGE(TAG, "Released a buffer not from the pool");
+}
+
+void buffer_pool_get_stats(buffer_class_t buffer_class, buffer_pool_stats_t *stats)
+{
+    taskENTER_CRITICAL(&pool_lock);
+    *stats = classes[buffer_class].stats;
+    taskEXIT_CRITICAL(&pool_lock);
+}
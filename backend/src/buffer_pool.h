@@ -0,0 +1,56 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Size classes, a lease gets the smallest class that fits or a larger one when that class is all leased
+#define BUFFER_SMALL_SIZE 256 // Errors and short responses
+#define BUFFER_SMALL_COUNT 4
+#define BUFFER_MEDIUM_SIZE 2304 // Settings, system info, WiFi scans, calendar and file transfer chunks
+#define BUFFER_MEDIUM_COUNT 3
+#define BUFFER_LARGE_SIZE 16384 // Zone and program lists, transaction snapshots
+#define BUFFER_LARGE_COUNT 1
+
+#define BUFFER_LEASE_TIMEOUT_MS 1000 // Leases are held for one message or chunk, waiting longer means one leaked
+
+typedef enum
+{
+    BUFFER_SMALL,
+    BUFFER_MEDIUM,
+    BUFFER_LARGE,
+    BUFFER_CLASS_COUNT
+} buffer_class_t;
+
+typedef struct
+{
+    size_t size;          // Bytes of each buffer
+    uint8_t count;        // Buffers of the class
+    uint8_t in_use;       // Currently leased
+    uint8_t high_water;   // Most ever leased at once
+    uint32_t leases;      // Leases served by the class
+    uint32_t waits;       // Requests for the class that found every fitting buffer leased
+    uint32_t failures;    // Requests for the class that timed out
+    size_t largest_request;
+} buffer_pool_stats_t;
+
+/**
+ * @brief Borrow a buffer of at least size bytes, only while formatting or transferring
+ * Waits up to BUFFER_LEASE_TIMEOUT_MS for one to be released. Not from an ISR.
+ *
+ * @param size Bytes needed, at most BUFFER_LARGE_SIZE
+ * @param owner Name of the borrower, logged when a lease times out
+ * @return char* 8-byte aligned buffer to give back with buffer_release, NULL if none got free in time
+ */
+char *buffer_lease(size_t size, const char *owner);
+
+/**
+ * @brief Give back a leased buffer, NULL is ignored
+ */
+void buffer_release(char *buffer);
+
+/**
+ * @brief Usage of a size class since boot
+ */
+void buffer_pool_get_stats(buffer_class_t buffer_class, buffer_pool_stats_t *stats);
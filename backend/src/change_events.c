@@ -0,0 +1,165 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "change_events.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "sprinkler_storage.h"
+
+static const char *TAG = "CHANGE_EVENTS";
+
+#define CHANGE_EVENTS_TASK_STACK_SIZE 4096
+#define CHANGE_EVENTS_TASK_PRIORITY 5
+
+// Pending changes of one entity and id, merged until the bus task takes them
+typedef struct
+{
+    _Atomic uint32_t fields;
+    _Atomic uint32_t version;
+} change_slot_t;
+
+// Slot 0 of each entity stands for all of its ids
+static change_slot_t zone_slots[MAX_ZONES + 1];
+static change_slot_t program_slots[MAX_PROGRAMS + 1];
+static change_slot_t plan_slots[1];
+
+static const struct
+{
+    change_slot_t *slots;
+    size_t count;
+} entity_slots[CHANGE_ENTITY_COUNT] = {
+    [CHANGE_ZONE] = {zone_slots, MAX_ZONES + 1},
+    [CHANGE_PROGRAM] = {program_slots, MAX_PROGRAMS + 1},
+    [CHANGE_PLAN] = {plan_slots, 1},
+};
+
+static _Atomic uint32_t version = 0;
+
+// Boot stages may subscribe while the bus task delivers, an entry is complete before it is counted
+static struct
+{
+    change_subscriber_t subscriber;
+    void *context;
+} subscribers[CHANGE_EVENTS_MAX_SUBSCRIBERS];
+static _Atomic size_t subscriber_count = 0;
+static portMUX_TYPE subscribe_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t task_handle = NULL;
+
+// Owned by the bus task, at most one event per slot
+static change_event_t events[MAX_ZONES + MAX_PROGRAMS + 3];
+
+void change_events_publish(change_entity_t entity, uint8_t id, uint32_t fields)
+{
+    if (entity >= CHANGE_ENTITY_COUNT || id >= entity_slots[entity].count || !fields)
+    {
+        ESP_LOGW(TAG, "Ignoring change of entity %d id %d", entity, id);
+        return;
+    }
+
+    change_slot_t *slot = &entity_slots[entity].slots[id];
+    atomic_fetch_or(&slot->fields, fields);
+
+    // Two publishers of the same slot may store out of order, only ever raise the version
+    uint32_t published = atomic_fetch_add(&version, 1) + 1;
+    uint32_t current = atomic_load(&slot->version);
+    while (current < published && !atomic_compare_exchange_weak(&slot->version, &current, published))
+    {
+    }
+
+    if (task_handle)
+    {
+        xTaskNotifyGive(task_handle);
+    }
+}
+
+// Take the pending changes, a change published meanwhile is either in this batch or left for the next one
+static size_t collect_events(void)
+{
+    size_t count = 0;
+    for (int entity = 0; entity < CHANGE_ENTITY_COUNT; entity++)
+    {
+        for (size_t id = 0; id < entity_slots[entity].count; id++)
+        {
+            change_slot_t *slot = &entity_slots[entity].slots[id];
+            uint32_t fields = atomic_exchange(&slot->fields, 0);
+            if (fields)
+            {
+                events[count++] = (change_event_t){
+                    .entity = entity,
+                    .id = id,
+                    .fields = fields,
+                    .version = atomic_load(&slot->version),
+                };
+            }
+        }
+    }
+    return count;
+}
+
+static void change_events_task(void *pvParameters)
+{
+    while (1)
+    {
+        // Wait for a change, then let the ones following it join the batch
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        vTaskDelay(pdMS_TO_TICKS(CHANGE_EVENTS_BATCH_MS));
+        ulTaskNotifyTake(pdTRUE, 0);
+
+        size_t count = collect_events();
+        if (!count)
+        {
+            continue;
+        }
+
+        ESP_LOGD(TAG, "Delivering %d changes up to version %lu", count, (unsigned long)atomic_load(&version));
+        size_t subscribed = atomic_load(&subscriber_count);
+        for (size_t i = 0; i < subscribed; i++)
+        {
+            subscribers[i].subscriber(events, count, subscribers[i].context);
+        }
+    }
+}
+
+esp_err_t change_events_subscribe(change_subscriber_t subscriber, void *context)
+{
+    esp_err_t ret = ESP_OK;
+    taskENTER_CRITICAL(&subscribe_lock);
+    size_t index = atomic_load(&subscriber_count);
+    if (index < CHANGE_EVENTS_MAX_SUBSCRIBERS)
+    {
+        subscribers[index].subscriber = subscriber;
+        subscribers[index].context = context;
+        atomic_store(&subscriber_count, index + 1);
+    }
+    else
+    {
+        ret = ESP_ERR_NO_MEM;
+    }
+    taskEXIT_CRITICAL(&subscribe_lock);
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Too many subscribers");
+    }
+    return ret;
+}
+
+esp_err_t change_events_init(void)
+{
+    BaseType_t ret = xTaskCreate(change_events_task, "change_events", CHANGE_EVENTS_TASK_STACK_SIZE, NULL,
+                                 CHANGE_EVENTS_TASK_PRIORITY, &task_handle);
+    if (ret != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create change events task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Changes published before the task existed
+    xTaskNotifyGive(task_handle);
+    return ESP_OK;
+}
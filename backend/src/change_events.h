@@ -0,0 +1,71 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define CHANGE_EVENTS_MAX_SUBSCRIBERS 4
+#define CHANGE_EVENTS_BATCH_MS 50 // Changes published within this window reach the subscribers as one batch
+
+typedef enum
+{
+    CHANGE_ZONE,
+    CHANGE_PROGRAM,
+    CHANGE_PLAN,
+    CHANGE_ENTITY_COUNT
+} change_entity_t;
+
+// What changed, a subscriber only needs to look at the fields it shows
+typedef enum
+{
+    CHANGE_CREATED = 1 << 0,
+    CHANGE_DELETED = 1 << 1,
+    CHANGE_NAME = 1 << 2,
+    CHANGE_ENABLED = 1 << 3,
+    CHANGE_LAST_RUN = 1 << 4,
+    CHANGE_STATUS = 1 << 5,   // Zone running or idle
+    CHANGE_OUTPUT = 1 << 6,   // Zone valve output
+    CHANGE_SCHEDULE = 1 << 7, // Program days and start times
+    CHANGE_ZONES = 1 << 8,    // Program zone list and durations
+    CHANGE_BUDGET = 1 << 9,   // Program water budget
+    CHANGE_NEXT_RUN = 1 << 10,
+    CHANGE_TIMING = 1 << 11, // Durations and conflicts that follow from other changes, budgets or zones
+    CHANGE_RUNS = 1 << 12,   // Planned runs of the finish-by window
+} change_field_t;
+
+typedef struct
+{
+    change_entity_t entity;
+    uint8_t id;       // Zone or program id, 0 for all of them or for the plan
+    uint32_t fields;  // change_field_t bits of every change to it since the last batch
+    uint32_t version; // Bus version of the latest of those changes, increases with every publish
+} change_event_t;
+
+/**
+ * @brief Called from the bus task with the changes of one batch, one event per entity and id
+ */
+typedef void (*change_subscriber_t)(const change_event_t *events, size_t count, void *context);
+
+/**
+ * @brief Start the task delivering the batches, changes published before are delivered once it runs
+ */
+esp_err_t change_events_init(void);
+
+/**
+ * @brief Receive every batch of changes, subscribers are registered at boot and never removed
+ *
+ * @return esp_err_t ESP_ERR_NO_MEM past CHANGE_EVENTS_MAX_SUBSCRIBERS
+ */
+esp_err_t change_events_subscribe(change_subscriber_t subscriber, void *context);
+
+/**
+ * @brief Publish a change, merged with the pending changes of the same entity and id
+ * Never blocks nor allocates, any task can publish while holding its own locks. Not from an ISR.
+ *
+ * @param entity What changed
+ * @param id Zone or program id, 0 for all of them
+ * @param fields change_field_t bits
+ */
+void change_events_publish(change_entity_t entity, uint8_t id, uint32_t fields);
@@ -2,6 +2,17 @@
 
 #include "days_utils.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *schedule_mode_names[] = {
+    [SCHEDULE_MODE_WEEKDAYS] = "weekdays",
+    [SCHEDULE_MODE_INTERVAL] = "interval",
+    [SCHEDULE_MODE_ODD_DAYS] = "odd",
+    [SCHEDULE_MODE_EVEN_DAYS] = "even",
+};
+
 void set_day_mask(uint8_t *days, uint8_t mask)
 {
     *days = mask;
@@ -22,44 +33,83 @@ bool has_day(uint8_t days, day_of_week_t day)
     return (days & (1 << (day))) != 0;
 }
 
-// Calculate next run time for a program
-time_t calculate_next_run(uint8_t days, uint8_t start_hour, uint8_t start_minute)
-{
-    time_t now = time(NULL);
-    struct tm *tm_now = localtime(&now);
+static const char *start_ref_names[] = {
+    [START_REF_SUNRISE] = "sunrise",
+    [START_REF_SUNSET] = "sunset",
+    [START_REF_FINISH_BY_SUNRISE] = "finish_by_sunrise",
+};
 
-    // Create time structure for today's scheduled time
-    struct tm tm_target = *tm_now;
-    tm_target.tm_hour = start_hour;
-    tm_target.tm_min = start_minute;
-    tm_target.tm_sec = 0;
+const char *schedule_mode_to_string(schedule_mode_t mode)
+{
+    if (mode > SCHEDULE_MODE_EVEN_DAYS)
+    {
+        return "unknown";
+    }
+    return schedule_mode_names[mode];
+}
 
-    time_t target_today = mktime(&tm_target);
+bool schedule_mode_from_string(const char *name, schedule_mode_t *mode)
+{
+    for (int i = 0; i <= SCHEDULE_MODE_EVEN_DAYS; i++)
+    {
+        if (strcmp(name, schedule_mode_names[i]) == 0)
+        {
+            *mode = i;
+            return true;
+        }
+    }
+    return false;
+}
 
-    // Check if program should run today and hasn't run yet
-    int today_bit = 1 << tm_now->tm_wday;
-    if (days & today_bit && target_today > now)
+void start_time_to_string(uint16_t start_time, char *buffer, size_t size)
+{
+    start_ref_t ref = start_time_ref(start_time);
+    if (ref == START_REF_CLOCK)
     {
-        return target_today;
+        snprintf(buffer, size, "%02d:%02d", start_time / 60, start_time % 60);
+        return;
     }
 
-    // Find next day this program should run
-    for (int days_ahead = 1; days_ahead <= 7; days_ahead++)
+    int16_t offset = start_time_offset(start_time);
+    if (offset)
     {
-        time_t future_time = now + (days_ahead * 24 * 60 * 60);
-        struct tm *tm_future = localtime(&future_time);
+        snprintf(buffer, size, "%s%+d", start_ref_names[ref], offset);
+    }
+    else
+    {
+        snprintf(buffer, size, "%s", start_ref_names[ref]);
+    }
+}
 
-        int future_day_bit = 1 << tm_future->tm_wday;
-        if (days & future_day_bit)
+bool start_time_from_string(const char *text, uint16_t *start_time)
+{
+    int hour, minute;
+    if (sscanf(text, "%d:%d", &hour, &minute) == 2)
+    {
+        if (hour < 0 || hour > 23 || minute < 0 || minute > 59)
         {
-            struct tm tm_future_target = *tm_future;
-            tm_future_target.tm_hour = start_hour;
-            tm_future_target.tm_min = start_minute;
-            tm_future_target.tm_sec = 0;
-
-            return mktime(&tm_future_target);
+            return false;
         }
+        *start_time = hour * 60 + minute;
+        return true;
     }
 
-    return 0; // Should never reach here if program has valid schedule
-}
\ No newline at end of file
+    // Sun relative, with an optional signed offset in minutes
+    for (int ref = START_REF_SUNRISE; ref <= START_REF_FINISH_BY_SUNRISE; ref++)
+    {
+        size_t len = strlen(start_ref_names[ref]);
+        if (strncmp(text, start_ref_names[ref], len) != 0)
+            continue;
+
+        const char *rest = text + len;
+        char *end;
+        long offset = *rest ? strtol(rest, &end, 10) : 0;
+        if ((*rest && (*end || (*rest != '+' && *rest != '-'))) || offset < -START_TIME_MAX_OFFSET || offset > START_TIME_MAX_OFFSET)
+        {
+            return false;
+        }
+        *start_time = start_time_solar(ref, offset);
+        return true;
+    }
+    return false;
+}
@@ -6,6 +6,8 @@
 #include <stdbool.h>
 #include <time.h>
 
+#include "sprinkler_storage.h"
+
 // Example usage:
 /*
 uint8_t days = 0;
@@ -54,4 +56,11 @@ void add_day(uint8_t *days, day_of_week_t day);
 void remove_day(uint8_t *days, day_of_week_t day);
 bool has_day(uint8_t days, day_of_week_t day);
 
-time_t calculate_next_run(uint8_t days, uint8_t start_hour, uint8_t start_minute);
+const char *schedule_mode_to_string(schedule_mode_t mode);
+bool schedule_mode_from_string(const char *name, schedule_mode_t *mode);
+
+// Start times as "06:30", or relative to the sun as "sunrise-30", "sunset+15", "finish_by_sunrise"
+#define START_TIME_MAX_OFFSET 720
+#define START_TIME_STRING_LEN 24
+void start_time_to_string(uint16_t start_time, char *buffer, size_t size);
+bool start_time_from_string(const char *text, uint16_t *start_time);
@@ -0,0 +1,479 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "heap_diagnostics.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_app_desc.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#ifdef CONFIG_SPRINKLER_HEAP_TRACE
+#include "esp_heap_trace.h"
+#endif
+
+static const char *TAG = "HEAP_DIAGNOSTICS";
+
+#define DIAGNOSTICS_CHUNK_RESERVE 32 // Closing the samples and messages arrays, and the chunk with "final"
+
+typedef struct
+{
+    uint32_t caps;
+    const char *name;
+} heap_capability_t;
+
+static const heap_capability_t capabilities[] = {
+    {MALLOC_CAP_8BIT, "default"},
+    {MALLOC_CAP_INTERNAL, "internal"},
+    {MALLOC_CAP_DMA, "dma"},
+#ifdef CONFIG_SPIRAM
+    {MALLOC_CAP_SPIRAM, "spiram"},
+#endif
+};
+
+#define CAPABILITY_COUNT (sizeof(capabilities) / sizeof(capabilities[0]))
+
+typedef struct
+{
+    uint32_t free;
+    uint32_t largest;
+    uint32_t minimum;
+} heap_figures_t;
+
+typedef struct
+{
+    uint32_t uptime_s;
+    heap_figures_t caps[CAPABILITY_COUNT];
+} heap_sample_t;
+
+typedef struct
+{
+    const char *type;
+    uint32_t count;
+    int32_t retained;     // Sum over the messages of the heap they left allocated, negative when they freed
+    int32_t max_retained; // Most one message left allocated
+} message_heap_t;
+
+static heap_sample_t samples[HEAP_DIAGNOSTICS_SAMPLES];
+static size_t sample_count = 0; // Samples taken since boot, the ring holds the last HEAP_DIAGNOSTICS_SAMPLES
+static portMUX_TYPE samples_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t sample_timer = NULL;
+
+// Handlers all run on the HTTP server task, which is also the only reader
+static message_heap_t messages[HEAP_DIAGNOSTICS_MESSAGES];
+static size_t message_count = 0;
+
+#ifdef CONFIG_SPRINKLER_HEAP_TRACE
+static heap_trace_record_t trace_records[CONFIG_SPRINKLER_HEAP_TRACE_RECORDS];
+static bool trace_initialized = false;
+static bool trace_running = false;
+static char trace_message[32] = ""; // Empty to trace everything
+#endif
+
+static void take_sample(heap_sample_t *sample)
+{
+    sample->uptime_s = (uint32_t)(esp_timer_get_time() / 1000000);
+    for (size_t i = 0; i < CAPABILITY_COUNT; i++)
+    {
+        multi_heap_info_t info;
+        heap_caps_get_info(&info, capabilities[i].caps);
+        sample->caps[i].free = info.total_free_bytes;
+        sample->caps[i].largest = info.largest_free_block;
+        sample->caps[i].minimum = info.minimum_free_bytes;
+    }
+}
+
+static void sample_timer_callback(void *arg)
+{
+    heap_sample_t sample;
+    take_sample(&sample);
+
+    taskENTER_CRITICAL(&samples_lock);
+    samples[sample_count % HEAP_DIAGNOSTICS_SAMPLES] = sample;
+    sample_count++;
+    taskEXIT_CRITICAL(&samples_lock);
+}
+
+void heap_diagnostics_start(void)
+{
+    sample_timer_callback(NULL);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = sample_timer_callback,
+        .name = "heap_samples",
+    };
+    if (esp_timer_create(&timer_args, &sample_timer) != ESP_OK ||
+        esp_timer_start_periodic(sample_timer, (uint64_t)HEAP_DIAGNOSTICS_PERIOD_S * 1000000) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start heap sampling");
+    }
+
+#ifdef CONFIG_SPRINKLER_HEAP_TRACE
+    if (heap_trace_init_standalone(trace_records, CONFIG_SPRINKLER_HEAP_TRACE_RECORDS) == ESP_OK)
+    {
+        trace_initialized = true;
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Failed to set up heap tracing");
+    }
+#endif
+}
+
+size_t heap_diagnostics_message_begin(const char *type)
+{
+#ifdef CONFIG_SPRINKLER_HEAP_TRACE
+    if (trace_running && trace_message[0] && strcmp(type, trace_message) == 0)
+    {
+        heap_trace_resume();
+    }
+#endif
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+}
+
+void heap_diagnostics_message_end(const char *type, size_t mark)
+{
+    // Measured before pausing the trace so the trace and the retention see the same allocations
+    int32_t retained = (int32_t)mark - (int32_t)heap_caps_get_free_size(MALLOC_CAP_8BIT);
+
+#ifdef CONFIG_SPRINKLER_HEAP_TRACE
+    if (trace_running && trace_message[0] && strcmp(type, trace_message) == 0)
+    {
+        heap_trace_stop();
+    }
+#endif
+
+    message_heap_t *entry = NULL;
+    for (size_t i = 0; i < message_count && !entry; i++)
+    {
+        if (messages[i].type == type)
+        {
+            entry = &messages[i];
+        }
+    }
+    if (!entry)
+    {
+        if (message_count >= HEAP_DIAGNOSTICS_MESSAGES)
+        {
+            return;
+        }
+        entry = &messages[message_count++];
+        entry->type = type;
+        entry->max_retained = retained;
+    }
+
+    entry->count++;
+    entry->retained += retained;
+    if (retained > entry->max_retained)
+    {
+        entry->max_retained = retained;
+    }
+}
+
+esp_err_t heap_diagnostics_trace_start(const char *message_type)
+{
+#ifdef CONFIG_SPRINKLER_HEAP_TRACE
+    if (!trace_initialized)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (trace_running)
+    {
+        heap_trace_stop();
+    }
+
+    esp_err_t err = heap_trace_start(HEAP_TRACE_LEAKS);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
+    if (message_type && message_type[0])
+    {
+        // Paused until a handler of the type runs
+        heap_trace_stop();
+        strncpy(trace_message, message_type, sizeof(trace_message) - 1);
+        trace_message[sizeof(trace_message) - 1] = '\0';
+    }
+    else
+    {
+        trace_message[0] = '\0';
+    }
+    trace_running = true;
+    ESP_LOGI(TAG, "Tracing heap allocations of %s", trace_message[0] ? trace_message : "all tasks");
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t heap_diagnostics_trace_stop(void)
+{
+#ifdef CONFIG_SPRINKLER_HEAP_TRACE
+    if (!trace_running)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Already paused between handlers when filtered
+    if (!trace_message[0])
+    {
+        heap_trace_stop();
+    }
+    trace_running = false;
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+static uint32_t fragmentation_pct(const heap_figures_t *figures)
+{
+    return figures->free ? 100 - (uint32_t)((uint64_t)figures->largest * 100 / figures->free) : 0;
+}
+
+static int sample_to_json(char *buffer, size_t buffer_size, const heap_sample_t *sample)
+{
+    int len = snprintf(buffer, buffer_size, "[%lu", (unsigned long)sample->uptime_s);
+    for (size_t i = 0; i < CAPABILITY_COUNT && len < buffer_size; i++)
+    {
+        const heap_figures_t *figures = &sample->caps[i];
+        len += snprintf(buffer + len, buffer_size - len, ",[%lu,%lu,%lu,%lu]",
+                        (unsigned long)figures->free, (unsigned long)figures->largest,
+                        (unsigned long)figures->minimum, (unsigned long)fragmentation_pct(figures));
+    }
+    if (len < buffer_size)
+    {
+        len += snprintf(buffer + len, buffer_size - len, "]");
+    }
+    return len;
+}
+
+#ifdef CONFIG_SPRINKLER_HEAP_TRACE
+static int trace_to_json(char *buffer, size_t buffer_size)
+{
+    typedef struct
+    {
+        uintptr_t pc;
+        uint32_t count;
+        uint32_t bytes;
+    } trace_site_t;
+
+    // Only the HTTP server task asks, so the grouping table can be static
+    static trace_site_t sites[HEAP_DIAGNOSTICS_TRACE_SITES];
+    size_t site_count = 0;
+    uint32_t other_count = 0, other_bytes = 0;
+
+    size_t record_count = heap_trace_get_count();
+    for (size_t i = 0; i < record_count; i++)
+    {
+        heap_trace_record_t record;
+        if (heap_trace_get(i, &record) != ESP_OK || !record.address)
+        {
+            continue;
+        }
+
+        uintptr_t pc = (uintptr_t)record.alloced_by[0];
+        trace_site_t *site = NULL;
+        for (size_t j = 0; j < site_count && !site; j++)
+        {
+            if (sites[j].pc == pc)
+            {
+                site = &sites[j];
+            }
+        }
+        if (!site && site_count < HEAP_DIAGNOSTICS_TRACE_SITES)
+        {
+            site = &sites[site_count++];
+            *site = (trace_site_t){.pc = pc};
+        }
+        if (site)
+        {
+            site->count++;
+            site->bytes += record.size;
+        }
+        else
+        {
+            other_count++;
+            other_bytes += record.size;
+        }
+    }
+
+    // Largest first, there are at most HEAP_DIAGNOSTICS_TRACE_SITES
+    for (size_t i = 1; i < site_count; i++)
+    {
+        trace_site_t site = sites[i];
+        size_t j = i;
+        for (; j > 0 && sites[j - 1].bytes < site.bytes; j--)
+        {
+            sites[j] = sites[j - 1];
+        }
+        sites[j] = site;
+    }
+
+    int len = snprintf(buffer, buffer_size,
+                       "{\"built\":true,\"running\":%s,\"message\":\"%s\",\"capacity\":%d,\"records\":%d,"
+                       "\"other\":{\"count\":%lu,\"bytes\":%lu},\"sites\":[",
+                       trace_running ? "true" : "false", trace_message, CONFIG_SPRINKLER_HEAP_TRACE_RECORDS,
+                       (int)record_count, (unsigned long)other_count, (unsigned long)other_bytes);
+    for (size_t i = 0; i < site_count && len < buffer_size; i++)
+    {
+        len += snprintf(buffer + len, buffer_size - len, "%s{\"pc\":%lu,\"count\":%lu,\"bytes\":%lu}",
+                        i > 0 ? "," : "", (unsigned long)sites[i].pc, (unsigned long)sites[i].count,
+                        (unsigned long)sites[i].bytes);
+    }
+    if (len < buffer_size)
+    {
+        len += snprintf(buffer + len, buffer_size - len, "]}");
+    }
+    return len;
+}
+#endif
+
+esp_err_t heap_diagnostics_to_json(char *buffer, size_t buffer_size, heap_diagnostics_cursor_t *cursor, bool *final)
+{
+    if (buffer_size <= DIAGNOSTICS_CHUNK_RESERVE)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    // Samples, messages and the trace stop short of the end, the rest closes the arrays and the chunk
+    size_t size = buffer_size - DIAGNOSTICS_CHUNK_RESERVE;
+
+    int len = snprintf(buffer, size, "{\"type\":\"heap_diagnostics\",\"chunk\":%u", (unsigned)cursor->chunk);
+    if (cursor->chunk == 0)
+    {
+        const esp_app_desc_t *app = esp_app_get_description();
+        if (len < size)
+        {
+            len += snprintf(buffer + len, size - len,
+                            ",\"firmware\":\"%s\",\"idf\":\"%s\",\"elf_sha256\":\"%02x%02x%02x%02x\",\"period_s\":%d,\"caps\":[",
+                            app->version, app->idf_ver, app->app_elf_sha256[0], app->app_elf_sha256[1],
+                            app->app_elf_sha256[2], app->app_elf_sha256[3], HEAP_DIAGNOSTICS_PERIOD_S);
+        }
+        for (size_t i = 0; i < CAPABILITY_COUNT && len < size; i++)
+        {
+            len += snprintf(buffer + len, size - len, "%s\"%s\"", i > 0 ? "," : "", capabilities[i].name);
+        }
+
+        heap_sample_t sample;
+        take_sample(&sample);
+        if (len < size)
+        {
+            len += snprintf(buffer + len, size - len,
+                            "],\"fields\":[\"free\",\"largest_free_block\",\"minimum_free\",\"fragmentation_pct\"],\"now\":");
+        }
+        if (len < size)
+        {
+            len += sample_to_json(buffer + len, size - len, &sample);
+        }
+
+        taskENTER_CRITICAL(&samples_lock);
+        cursor->sample = sample_count > HEAP_DIAGNOSTICS_SAMPLES ? sample_count - HEAP_DIAGNOSTICS_SAMPLES : 0;
+        taskEXIT_CRITICAL(&samples_lock);
+    }
+    if (len < size)
+    {
+        len += snprintf(buffer + len, size - len, ",\"samples\":[");
+    }
+    if (len >= size)
+    {
+        ESP_LOGE(TAG, "JSON buffer too small for heap diagnostics");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Copied one at a time so the timer never waits on the formatting, whatever doesn't fit goes in the next chunk.
+    // The ring may have moved on since the first chunk
+    size_t added = 0;
+    bool samples_done = false;
+    for (size_t rows = 0;; cursor->sample++, rows++)
+    {
+        heap_sample_t sample;
+        taskENTER_CRITICAL(&samples_lock);
+        size_t oldest = sample_count > HEAP_DIAGNOSTICS_SAMPLES ? sample_count - HEAP_DIAGNOSTICS_SAMPLES : 0;
+        cursor->sample = cursor->sample > oldest ? cursor->sample : oldest;
+        samples_done = cursor->sample >= sample_count;
+        if (!samples_done)
+        {
+            sample = samples[cursor->sample % HEAP_DIAGNOSTICS_SAMPLES];
+        }
+        taskEXIT_CRITICAL(&samples_lock);
+        if (samples_done)
+        {
+            break;
+        }
+
+        int n = snprintf(buffer + len, size - len, "%s", rows ? "," : "");
+        n += sample_to_json(buffer + len + n, size - len - n, &sample);
+        if (len + n >= size)
+        {
+            buffer[len] = '\0';
+            break;
+        }
+        len += n;
+        added++;
+    }
+    len += snprintf(buffer + len, buffer_size - len, "],\"messages\":[");
+
+    bool messages_done = false;
+    for (size_t rows = 0; samples_done && len < size; cursor->message++, rows++)
+    {
+        messages_done = cursor->message >= message_count;
+        if (messages_done)
+        {
+            break;
+        }
+
+        const message_heap_t *message = &messages[cursor->message];
+        int n = snprintf(buffer + len, size - len, "%s{\"type\":\"%s\",\"count\":%lu,\"retained\":%ld,\"max_retained\":%ld}",
+                         rows ? "," : "", message->type, (unsigned long)message->count, (long)message->retained,
+                         (long)message->max_retained);
+        if (len + n >= size)
+        {
+            buffer[len] = '\0';
+            break;
+        }
+        len += n;
+        added++;
+    }
+    len += snprintf(buffer + len, buffer_size - len, "]");
+
+    // The trace goes last, in one piece
+    bool trace_done = false;
+    if (messages_done && len < size)
+    {
+        int n = snprintf(buffer + len, size - len, ",\"trace\":");
+#ifdef CONFIG_SPRINKLER_HEAP_TRACE
+        n += trace_to_json(buffer + len + n, size - len - n);
+#else
+        n += snprintf(buffer + len + n, size - len - n, "{\"built\":false}");
+#endif
+        trace_done = len + n < size;
+        if (trace_done)
+        {
+            len += n;
+            added++;
+        }
+        else
+        {
+            buffer[len] = '\0';
+        }
+    }
+
+    *final = trace_done;
+    cursor->chunk++;
+    snprintf(buffer + len, buffer_size - len, ",\"final\":%s}", *final ? "true" : "false");
+
+    if (!*final && !added)
+    {
+        ESP_LOGE(TAG, "JSON buffer too small for heap diagnostics");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
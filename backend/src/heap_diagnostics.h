@@ -0,0 +1,63 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#define HEAP_DIAGNOSTICS_PERIOD_S 300  // One sample every 5 minutes
+#define HEAP_DIAGNOSTICS_SAMPLES 48    // 4 hours of history
+#define HEAP_DIAGNOSTICS_MESSAGES 32   // Message types tracked, as many as WebSocket callbacks
+#define HEAP_DIAGNOSTICS_TRACE_SITES 16 // Call sites reported from a heap trace, largest first
+
+/**
+ * @brief Take a first sample and one every HEAP_DIAGNOSTICS_PERIOD_S, called once the boot stages are done
+ */
+void heap_diagnostics_start(void);
+
+/**
+ * @brief Mark the start of a WebSocket message handler
+ *
+ * @param type Registered message type, must outlive the server
+ * @return size_t Mark to hand to heap_diagnostics_message_end
+ */
+size_t heap_diagnostics_message_begin(const char *type);
+
+/**
+ * @brief Account the heap the handler kept to its message type
+ */
+void heap_diagnostics_message_end(const char *type, size_t mark);
+
+/**
+ * @brief Start tracing live allocations, previous records are dropped
+ * Needs CONFIG_SPRINKLER_HEAP_TRACE.
+ *
+ * @param message_type Only trace while handlers of this type run, NULL to trace everything
+ * @return esp_err_t ESP_ERR_NOT_SUPPORTED when not built in
+ */
+esp_err_t heap_diagnostics_trace_start(const char *message_type);
+
+/**
+ * @brief Stop tracing, the live records stay reported until the next start
+ */
+esp_err_t heap_diagnostics_trace_stop(void);
+
+typedef struct
+{
+    size_t chunk;   // Chunks serialized so far
+    size_t sample;  // Next sample, counted since boot
+    size_t message; // Next message type
+} heap_diagnostics_cursor_t;
+
+/**
+ * @brief Serialize the next chunk of the samples, per message type retention and trace call sites
+ * Start from a zeroed cursor and call again until final. The first chunk also has the firmware, capabilities
+ * and current figures, the "samples" and "messages" arrays of the chunks add up to the whole history and the
+ * final chunk has the "trace".
+ * Samples are [uptime_s, [free, largest_free_block, minimum_free, fragmentation_pct] per capability].
+ *
+ * @return esp_err_t ESP_ERR_NO_MEM if the buffer can't hold the first chunk header, one sample, message or the trace
+ */
+esp_err_t heap_diagnostics_to_json(char *buffer, size_t buffer_size, heap_diagnostics_cursor_t *cursor, bool *final);
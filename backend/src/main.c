@@ -7,12 +7,22 @@
 #include <esp_event.h>
 #include "esp_netif.h"
 
+#include "boot.h"
 #include "storage.h"
 #include "captdns.h"
 #include "wifi.h"
 #include "webserver.h"
 #include "spiffs.h"
 #include "sntp.h"
+#include "time_service.h"
+#include "timezone.h"
+#include "solar.h"
+#include "watering_plan.h"
+#include "water_budget.h"
+#include "change_events.h"
+#include "alloc_accounting.h"
+#include "heap_diagnostics.h"
+#include "task_telemetry.h"
 
 #include "websocket.h"
 #include "ws_wifi.h"
@@ -24,36 +34,65 @@
 
 static const char *TAG = "main";
 
-void app_main()
+typedef enum
+{
+  STAGE_STORAGE,
+  STAGE_NETIF,
+  STAGE_SPIFFS,
+  STAGE_EVENTS,
+  STAGE_WS_UPDATES,
+  STAGE_REPOSITORY,
+  STAGE_CONTROLLER,
+  STAGE_CLOCK,
+  STAGE_SCHEDULER,
+  STAGE_WIFI,
+  STAGE_SERVER,
+  STAGE_WS_HANDLERS,
+  STAGE_TIME,
+  STAGE_COUNT
+} main_stage_t;
+
+static esp_err_t stage_storage(void)
 {
-  // To disable all logs, use ESP_LOG_NONE
-  esp_log_level_set("*", ESP_LOG_DEBUG);
-
-  ESP_LOGI(TAG, "IDF version: %s", esp_get_idf_version());
-
   // Init NVS storage
   setup_storage();
+  return ESP_OK;
+}
 
+static esp_err_t stage_netif(void)
+{
   // Init TCP/IP stack
   ESP_ERROR_CHECK(esp_netif_init());
   // Init event mechanism
   ESP_ERROR_CHECK(esp_event_loop_create_default());
+  return ESP_OK;
+}
 
+static esp_err_t stage_spiffs(void)
+{
   // Init file storage
   ESP_ERROR_CHECK(setup_spiffs());
 
   // Setup captive portal - automatically opens the page when we connect to the wifi
   // setup_captive_dns();
+  return ESP_OK;
+}
 
-  // Setup wifi access point
-  setup_wifi();
+static esp_err_t stage_wifi(void)
+{
+  // Setup wifi, connection and AP fallback happen in the background
+  return setup_wifi();
+}
 
+static esp_err_t stage_server(void)
+{
   // Setup HTTP server
   setup_server();
+  return ESP_OK;
+}
 
-  sprinkler_repository_init();
-  ws_update_system_init();
-
+static esp_err_t stage_ws_handlers(void)
+{
   // Register websocket callbacks
   register_callback("wifi_status", ws_handle_wifi_status);
   register_callback("wifi_scan", ws_handle_wifi_scan);
@@ -62,6 +101,8 @@ void app_main()
 
   register_callback("get_zones", ws_handle_get_zones);
   register_callback("get_programs", ws_handle_get_programs);
+  register_callback("get_calendar", ws_handle_get_calendar);
+  register_callback("get_plan", ws_handle_get_plan);
 
   register_callback("create_or_update_zone", ws_handle_create_or_update_zone);
   register_callback("delete_zone", ws_handle_delete_zone);
@@ -71,15 +112,86 @@ void app_main()
   register_callback("delete_program", ws_handle_delete_program);
 
   register_callback("enable", ws_handle_enable);
+  register_callback("batch", ws_handle_batch);
 
   register_callback("get_settings", ws_handle_get_settings);
   register_callback("time_update", ws_handle_time_update);
+  register_callback("set_timezone", ws_handle_set_timezone);
+  register_callback("set_location", ws_handle_set_location);
+  register_callback("set_queue_policy", ws_handle_set_queue_policy);
+  register_callback("set_finish_by", ws_handle_set_finish_by);
+  register_callback("set_water_budget", ws_handle_set_water_budget);
+  register_callback("set_valve_sequence", ws_handle_set_valve_sequence);
+  register_callback("set_valve_driver", ws_handle_set_valve_driver);
   register_callback("get_system_info", ws_handle_system_info);
+  register_callback("get_boot_timeline", ws_handle_boot_timeline);
+  register_callback("get_heap_diagnostics", ws_handle_heap_diagnostics);
+  register_callback("heap_trace", ws_handle_heap_trace);
+  register_callback("get_task_telemetry", ws_handle_task_telemetry);
+  return ESP_OK;
+}
 
-  // Init sprinkler controller
-  sprinkler_controller_init();
+static esp_err_t stage_clock(void)
+{
+  // Apply the stored timezone, location, finish-by window and water budget, then restore the wall clock from the RTC or from the last persisted time
+  timezone_init();
+  solar_init();
+  watering_plan_init();
+  water_budget_init();
+  time_service_restore();
+  time_service_register_callback(sprinkler_controller_on_time_changed);
+  return ESP_OK;
+}
 
-  // Retrieve time from network and start sprinkler
+static esp_err_t stage_scheduler(void)
+{
+  // Start scheduling right away with the restored time, it is re-planned when a better time arrives
+  if (time_service_get_confidence() < TIME_CONFIDENCE_SCHEDULE)
+  {
+    ESP_LOGW(TAG, "No usable time yet, scheduler starts on first time sync");
+    return ESP_OK;
+  }
+  return sprinkler_controller_start();
+}
+
+static esp_err_t stage_time(void)
+{
+  // Retrieve time from network, NTP corrections go through the time service which re-plans the sprinkler
   start_ntp_sync();
-  register_time_sync_callback(sprinkler_controller_start);
+  return ESP_OK;
+}
+
+// Boot dependency graph, stages without pending dependencies run concurrently
+static const boot_stage_t boot_stages[STAGE_COUNT] = {
+    [STAGE_STORAGE] = {.name = "nvs", .run = stage_storage},
+    [STAGE_NETIF] = {.name = "netif", .run = stage_netif},
+    [STAGE_SPIFFS] = {.name = "spiffs", .run = stage_spiffs},
+    [STAGE_EVENTS] = {.name = "events", .run = change_events_init},
+    [STAGE_WS_UPDATES] = {.name = "ws_updates", .run = ws_update_system_init, .depends_on = BOOT_STAGE_BIT(STAGE_EVENTS)},
+    [STAGE_REPOSITORY] = {.name = "repository", .run = sprinkler_repository_init, .depends_on = BOOT_STAGE_BIT(STAGE_STORAGE)},
+    [STAGE_CONTROLLER] = {.name = "controller", .run = sprinkler_controller_init, .depends_on = BOOT_STAGE_BIT(STAGE_REPOSITORY)},
+    [STAGE_CLOCK] = {.name = "clock", .run = stage_clock, .depends_on = BOOT_STAGE_BIT(STAGE_STORAGE)},
+    [STAGE_SCHEDULER] = {.name = "scheduler", .run = stage_scheduler, .depends_on = BOOT_STAGE_BIT(STAGE_CONTROLLER) | BOOT_STAGE_BIT(STAGE_CLOCK) | BOOT_STAGE_BIT(STAGE_WS_UPDATES)},
+    [STAGE_WIFI] = {.name = "wifi", .run = stage_wifi, .depends_on = BOOT_STAGE_BIT(STAGE_STORAGE) | BOOT_STAGE_BIT(STAGE_NETIF)},
+    [STAGE_SERVER] = {.name = "server", .run = stage_server, .depends_on = BOOT_STAGE_BIT(STAGE_NETIF)},
+    [STAGE_WS_HANDLERS] = {.name = "ws_handlers", .run = stage_ws_handlers, .depends_on = BOOT_STAGE_BIT(STAGE_SERVER) | BOOT_STAGE_BIT(STAGE_WS_UPDATES) | BOOT_STAGE_BIT(STAGE_CLOCK) | BOOT_STAGE_BIT(STAGE_CONTROLLER)},
+    [STAGE_TIME] = {.name = "time", .run = stage_time, .depends_on = BOOT_STAGE_BIT(STAGE_WIFI) | BOOT_STAGE_BIT(STAGE_SCHEDULER)},
+};
+
+void app_main()
+{
+  // To disable all logs, use ESP_LOG_NONE
+  esp_log_level_set("*", ESP_LOG_DEBUG);
+
+  ESP_LOGI(TAG, "IDF version: %s", esp_get_idf_version());
+
+  if (boot_run(boot_stages, STAGE_COUNT) != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Some boot stages failed, see boot timeline");
+  }
+
+  // From here on the firmware runs on what boot set aside
+  heap_diagnostics_start();
+  task_telemetry_start();
+  alloc_accounting_start();
 }
@@ -0,0 +1,148 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "message_arena.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+
+static const char *TAG = "MESSAGE_ARENA";
+
+#define MESSAGE_ARENA_ALIGN 8 // cJSON nodes hold doubles
+
+typedef struct
+{
+    TaskHandle_t task; // Bound task, NULL when free
+    int depth;
+    size_t used;
+    uint8_t memory[MESSAGE_ARENA_SIZE] __attribute__((aligned(MESSAGE_ARENA_ALIGN)));
+} message_arena_t;
+
+static message_arena_t arenas[MESSAGE_ARENA_WORKERS];
+static message_arena_stats_t stats = {.size = MESSAGE_ARENA_SIZE};
+static portMUX_TYPE arena_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Only the bound task writes its own handle, any task can look for its arena without the lock
+static message_arena_t *current_arena(void)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < MESSAGE_ARENA_WORKERS; i++)
+    {
+        if (arenas[i].task == task)
+        {
+            return &arenas[i];
+        }
+    }
+    return NULL;
+}
+
+void message_arena_begin(void)
+{
+    message_arena_t *arena = current_arena();
+    if (arena)
+    {
+        arena->depth++;
+        return;
+    }
+
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    taskENTER_CRITICAL(&arena_lock);
+    for (int i = 0; i < MESSAGE_ARENA_WORKERS && !arena; i++)
+    {
+        if (!arenas[i].task)
+        {
+            arena = &arenas[i];
+            arena->task = task;
+            arena->depth = 1;
+            arena->used = 0;
+        }
+    }
+    taskEXIT_CRITICAL(&arena_lock);
+
+    if (!arena)
+    {
+        ESP_LOGW(TAG, "No free arena for task %s", pcTaskGetName(task));
+    }
+}
+
+void message_arena_end(void)
+{
+    message_arena_t *arena = current_arena();
+    if (!arena || --arena->depth > 0)
+    {
+        return;
+    }
+
+    taskENTER_CRITICAL(&arena_lock);
+    stats.messages++;
+    if (arena->used > stats.high_water)
+    {
+        stats.high_water = arena->used;
+    }
+    arena->used = 0;
+    arena->task = NULL;
+    taskEXIT_CRITICAL(&arena_lock);
+}
+
+void *message_arena_alloc(size_t size)
+{
+    message_arena_t *arena = current_arena();
+    if (arena)
+    {
+        size_t start = (arena->used + MESSAGE_ARENA_ALIGN - 1) & ~(size_t)(MESSAGE_ARENA_ALIGN - 1);
+        if (start + size <= MESSAGE_ARENA_SIZE)
+        {
+            arena->used = start + size;
+            return &arena->memory[start];
+        }
+    }
+
+    taskENTER_CRITICAL(&arena_lock);
+    if (arena)
+    {
+        stats.overflows++;
+    }
+    else
+    {
+        stats.unbound++;
+    }
+    taskEXIT_CRITICAL(&arena_lock);
+
+    if (arena)
+    {
+        ESP_LOGW(TAG, "Arena full, %d bytes from the heap", (int)size);
+    }
+    return malloc(size);
+}
+
+void message_arena_free(void *ptr)
+{
+    for (int i = 0; i < MESSAGE_ARENA_WORKERS; i++)
+    {
+        if ((uint8_t *)ptr >= arenas[i].memory && (uint8_t *)ptr < arenas[i].memory + MESSAGE_ARENA_SIZE)
+        {
+            return;
+        }
+    }
+    free(ptr);
+}
+
+void message_arena_get_stats(message_arena_stats_t *out)
+{
+    taskENTER_CRITICAL(&arena_lock);
+    *out = stats;
+    taskEXIT_CRITICAL(&arena_lock);
+}
+
+void message_arena_init(void)
+{
+    // Memory cJSON got before the hooks is still freed to the heap, message_arena_free tells them apart
+    cJSON_Hooks hooks = {
+        .malloc_fn = message_arena_alloc,
+        .free_fn = message_arena_free,
+    };
+    cJSON_InitHooks(&hooks);
+}
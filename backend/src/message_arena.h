@@ -0,0 +1,50 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MESSAGE_ARENA_SIZE 8192 // A received frame and its JSON tree, a batch of a few dozen commands
+#define MESSAGE_ARENA_WORKERS 1 // The HTTP server handles every frame from its one task
+
+typedef struct
+{
+    size_t size;          // Bytes of each arena
+    size_t high_water;    // Most bytes a message used
+    uint32_t messages;    // Messages handled in an arena
+    uint32_t overflows;   // Allocations of a message that did not fit and went to the heap
+    uint32_t unbound;     // Allocations made outside of a message, they go to the heap
+} message_arena_stats_t;
+
+/**
+ * @brief Route the cJSON allocations through the arena of the calling task
+ */
+void message_arena_init(void);
+
+/**
+ * @brief Bind an arena to the calling task until message_arena_end, calls may nest
+ * Without a free arena the allocations of the message go to the heap.
+ */
+void message_arena_begin(void);
+
+/**
+ * @brief Drop everything allocated since the outermost message_arena_begin and unbind the arena
+ */
+void message_arena_end(void);
+
+/**
+ * @brief Scratch memory for the message being handled, 8-byte aligned
+ * Falls back to the heap when the arena is full or the task has none, NULL only if the heap is out too.
+ */
+void *message_arena_alloc(size_t size);
+
+/**
+ * @brief Free memory from message_arena_alloc, a no-op for arena memory which goes with the message
+ */
+void message_arena_free(void *ptr);
+
+/**
+ * @brief Arena usage since boot
+ */
+void message_arena_get_stats(message_arena_stats_t *stats);
@@ -0,0 +1,498 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "schedule_engine.h"
+
+#include "timezone.h"
+#include "solar.h"
+#include "water_budget.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "SCHEDULE_ENGINE";
+
+// Per program start index and watering duration. Weekdays programs at clock times repeat every week
+// and are indexed by minute of the week, other modes and sun relative starts are walked day by day.
+typedef struct
+{
+    uint16_t starts[SCHEDULE_MAX_STARTS_PER_PROGRAM]; // Weekdays mode, sorted minutes of the week
+    uint8_t start_count;
+    uint16_t start_times[MAX_START_TIMES]; // Sorted, see start_ref_t
+    uint8_t daily_count;
+    bool by_day;
+    uint8_t mode;
+    uint8_t days;
+    uint8_t interval_days;
+    int32_t interval_anchor;
+    bool crosses_midnight;
+    uint16_t duration_minutes; // As entered, the budget of the day applies on top
+    uint8_t budget_percent;
+    int16_t window_start[MAX_START_TIMES]; // Watering windows in minutes of the day, repeated on window_days
+    uint16_t window_minutes[MAX_START_TIMES];
+    uint8_t window_count;
+    uint8_t window_days;
+    uint32_t conflicts; // Bit i set when the program overlaps program i + 1
+} program_schedule_t;
+
+_Static_assert(MAX_PROGRAMS <= 32, "Program conflict sets are 32-bit masks");
+
+static program_schedule_t program_schedules[MAX_PROGRAMS];
+
+static int32_t positive_mod(int32_t value, int32_t divisor)
+{
+    return (value % divisor + divisor) % divisor;
+}
+
+// Minutes of the week one program waters, conflicts are found by testing the others against it
+static uint64_t window_bitmap[SCHEDULE_BITMAP_WORDS];
+
+// Set the minutes [start, end) of the week, or only test whether any of them is set
+static bool range_bits(uint64_t *bitmap, uint32_t start, uint32_t end, bool set)
+{
+    while (start < end)
+    {
+        uint32_t bit = start % 64;
+        uint32_t count = min(64 - bit, end - start);
+        uint64_t mask = (count == 64 ? ~0ULL : (1ULL << count) - 1) << bit;
+        if (set)
+        {
+            bitmap[start / 64] |= mask;
+        }
+        else if (bitmap[start / 64] & mask)
+        {
+            return true;
+        }
+        start += count;
+    }
+    return false;
+}
+
+// Set or test every watering window of a program on the week, split in two when one wraps around it
+static bool window_bits(const program_schedule_t *schedule, bool set)
+{
+    for (int day = 0; day < 7; day++)
+    {
+        if (!(schedule->window_days & (1 << day)))
+            continue;
+
+        for (int k = 0; k < schedule->window_count; k++)
+        {
+            // Finish by sunrise windows can start the day before
+            uint32_t start = positive_mod(day * MINUTES_PER_DAY + schedule->window_start[k], MINUTES_PER_WEEK);
+            uint32_t length = schedule->window_minutes[k];
+            uint32_t end = min(start + length, (uint32_t)MINUTES_PER_WEEK);
+            if (range_bits(window_bitmap, start, end, set) || range_bits(window_bitmap, 0, start + length - end, set))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static int32_t gcd(int32_t a, int32_t b)
+{
+    while (b)
+    {
+        int32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Whether a program waters on a local day (days since epoch)
+static bool day_matches(const program_schedule_t *schedule, int64_t day)
+{
+    int year, month, day_of_month;
+    switch (schedule->mode)
+    {
+    case SCHEDULE_MODE_INTERVAL:
+        return positive_mod(day - schedule->interval_anchor, schedule->interval_days) == 0;
+    case SCHEDULE_MODE_ODD_DAYS:
+        timezone_date_from_days(day, &year, &month, &day_of_month);
+        return day_of_month % 2 == 1;
+    case SCHEDULE_MODE_EVEN_DAYS:
+        timezone_date_from_days(day, &year, &month, &day_of_month);
+        return day_of_month % 2 == 0;
+    default:
+        return schedule->days & (1 << timezone_local_weekday(day * SECONDS_PER_DAY));
+    }
+}
+
+// Longest gap between two watering days
+static int32_t period_days(const program_schedule_t *schedule)
+{
+    switch (schedule->mode)
+    {
+    case SCHEDULE_MODE_INTERVAL:
+        return schedule->interval_days;
+    case SCHEDULE_MODE_ODD_DAYS:
+    case SCHEDULE_MODE_EVEN_DAYS:
+        // Jan 30 to Feb 2 for even dates
+        return 3;
+    default:
+        return 7;
+    }
+}
+
+// False when two programs never water on the same day, a window past midnight spills into the next one
+static bool programs_share_days(const program_schedule_t *a, const program_schedule_t *b)
+{
+    if (a->crosses_midnight || b->crosses_midnight)
+    {
+        return true;
+    }
+    if ((a->mode == SCHEDULE_MODE_ODD_DAYS && b->mode == SCHEDULE_MODE_EVEN_DAYS) ||
+        (a->mode == SCHEDULE_MODE_EVEN_DAYS && b->mode == SCHEDULE_MODE_ODD_DAYS))
+    {
+        return false;
+    }
+    if (a->mode == SCHEDULE_MODE_INTERVAL && b->mode == SCHEDULE_MODE_INTERVAL)
+    {
+        // Both cycles meet only if their anchors agree modulo the gcd of the intervals
+        return positive_mod(a->interval_anchor - b->interval_anchor, gcd(a->interval_days, b->interval_days)) == 0;
+    }
+    return true;
+}
+
+// UTC time of a start on a local day, false when it doesn't happen (no location, polar day or night)
+static bool start_on_day(const program_schedule_t *schedule, uint16_t start_time, int64_t day, time_t *start)
+{
+    start_ref_t ref = start_time_ref(start_time);
+    if (ref == START_REF_CLOCK)
+    {
+        *start = timezone_to_utc(day * SECONDS_PER_DAY + start_time * 60);
+        return true;
+    }
+
+    time_t sunrise, sunset;
+    if (!solar_get_times(day, &sunrise, &sunset))
+    {
+        return false;
+    }
+
+    int32_t offset = start_time_offset(start_time) * 60;
+    switch (ref)
+    {
+    case START_REF_SUNSET:
+        *start = sunset + offset;
+        break;
+    case START_REF_FINISH_BY_SUNRISE:
+    {
+        // Budgeted like the run will be, the budget can follow the month
+        int year, month, month_day;
+        timezone_date_from_days(day, &year, &month, &month_day);
+        uint16_t budget_percent = water_budget_percent(schedule->budget_percent, month);
+        *start = sunrise + offset - water_budget_zone_seconds(schedule->duration_minutes, budget_percent, 100);
+        break;
+    }
+    default:
+        *start = sunrise + offset;
+        break;
+    }
+    return true;
+}
+
+// Range of local minutes of the day a sun relative start falls on over the coming year, for conflicts
+static bool solar_start_range(const program_schedule_t *schedule, uint16_t start_time, int32_t *earliest, int32_t *latest)
+{
+    int64_t today = timezone_local_day(timezone_to_local(time(NULL)));
+    bool found = false;
+    for (int64_t day = today; day < today + SOLAR_TABLE_DAYS; day++)
+    {
+        time_t start;
+        if (!start_on_day(schedule, start_time, day, &start))
+            continue;
+
+        int32_t minute = (int32_t)((timezone_to_local(start) - day * SECONDS_PER_DAY) / 60);
+        if (!found || minute < *earliest)
+        {
+            *earliest = minute;
+        }
+        if (!found || minute > *latest)
+        {
+            *latest = minute;
+        }
+        found = true;
+    }
+    return found;
+}
+
+static uint16_t program_duration_minutes(const sprinkler_data_t *data, const program_t *program)
+{
+    uint32_t total = 0;
+    for (int j = 0; j < program->zone_count; j++)
+    {
+        const program_zone_t *pz = &sprinkler_program_zones(data, program)[j];
+        if (pz->zone_id > 0 && pz->zone_id <= MAX_ZONES && data->zones[pz->zone_id - 1].enabled)
+        {
+            total += pz->duration;
+        }
+    }
+    return total < MINUTES_PER_WEEK ? total : MINUTES_PER_WEEK;
+}
+
+esp_err_t schedule_engine_compile(const sprinkler_data_t *data)
+{
+    memset(program_schedules, 0, sizeof(program_schedules));
+
+    for (int i = 0; i < MAX_PROGRAMS; i++)
+    {
+        const program_t *program = &data->programs[i];
+        program_schedule_t *schedule = &program_schedules[i];
+        if (!program->id || !program->enabled)
+            continue;
+
+        const schedule_t *source = &program->schedule;
+        schedule->duration_minutes = program_duration_minutes(data, program);
+        schedule->budget_percent = program->budget_percent;
+        schedule->mode = source->mode;
+        schedule->days = source->days;
+        schedule->interval_days = source->interval_days ? source->interval_days : 1;
+        schedule->interval_anchor = source->interval_anchor;
+        for (int k = 0; k < source->start_count && k < MAX_START_TIMES; k++)
+        {
+            uint16_t start_time = source->start_times[k];
+            if (start_time_ref(start_time) == START_REF_CLOCK && start_time >= MINUTES_PER_DAY)
+                continue;
+            schedule->start_times[schedule->daily_count++] = start_time;
+            schedule->by_day |= start_time_ref(start_time) != START_REF_CLOCK;
+        }
+        schedule->by_day |= schedule->mode != SCHEDULE_MODE_WEEKDAYS;
+
+        // Watering windows in minutes of the day, sun relative ones cover where the start moves over the year
+        // and all of them last as long as the largest budget of the year makes them
+        uint16_t max_budget_percent = water_budget_max_percent(schedule->budget_percent);
+        int32_t budgeted_minutes = (water_budget_zone_seconds(schedule->duration_minutes, max_budget_percent, 100) + 59) / 60;
+        for (int k = 0; k < schedule->daily_count; k++)
+        {
+            uint16_t start_time = schedule->start_times[k];
+            int32_t earliest = start_time, latest = start_time;
+            if (start_time_ref(start_time) != START_REF_CLOCK && !solar_start_range(schedule, start_time, &earliest, &latest))
+            {
+                ESP_LOGW(TAG, "Program %d has a sunrise or sunset start but no location", program->id);
+                continue;
+            }
+
+            schedule->window_start[schedule->window_count] = earliest;
+            schedule->window_minutes[schedule->window_count] = min(latest + budgeted_minutes - earliest, MINUTES_PER_WEEK);
+            if (earliest < 0 || latest + budgeted_minutes > MINUTES_PER_DAY)
+            {
+                schedule->crosses_midnight = true;
+            }
+            schedule->window_count++;
+        }
+
+        // Only programs with a weekly pattern are placed on the week, the others can water on any weekday
+        // so their windows are repeated on all of them for conflict detection
+        bool weekly = schedule->mode == SCHEDULE_MODE_WEEKDAYS;
+        schedule->window_days = weekly ? schedule->days : 0x7F;
+
+        // Days then times are walked in order, so starts come out sorted
+        for (int day = 0; day < 7 && !schedule->by_day; day++)
+        {
+            if (!(schedule->window_days & (1 << day)))
+                continue;
+
+            for (int k = 0; k < schedule->window_count; k++)
+            {
+                int32_t minute = day * MINUTES_PER_DAY + schedule->window_start[k];
+                schedule->starts[schedule->start_count++] = minute;
+            }
+        }
+        // Programs walked day by day only need to know they have starts
+        if (schedule->by_day && (!weekly || schedule->days))
+        {
+            schedule->start_count = schedule->daily_count;
+        }
+    }
+
+    // Each program's windows are laid on the week, then the windows of the later programs are tested against them.
+    // Overlapping windows only conflict if both programs can water on the same day.
+    for (int i = 0; i < MAX_PROGRAMS; i++)
+    {
+        if (!program_schedules[i].window_count)
+            continue;
+
+        memset(window_bitmap, 0, sizeof(window_bitmap));
+        window_bits(&program_schedules[i], true);
+        for (int j = i + 1; j < MAX_PROGRAMS; j++)
+        {
+            if (program_schedules[j].window_count && programs_share_days(&program_schedules[i], &program_schedules[j]) &&
+                window_bits(&program_schedules[j], false))
+            {
+                program_schedules[i].conflicts |= 1UL << j;
+                program_schedules[j].conflicts |= 1UL << i;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+// Local seconds of the current week's start (Sunday 00:00) and the minute of the week of now
+static int64_t local_week_start(time_t now, uint32_t *minute)
+{
+    int64_t local_now = timezone_to_local(now);
+    int64_t week_start = (timezone_local_day(local_now) - timezone_local_weekday(local_now)) * SECONDS_PER_DAY;
+    *minute = (uint32_t)((local_now - week_start) / 60);
+    return week_start;
+}
+
+// Earliest start of a local day after now, 0 if none
+static time_t earliest_start_after(const program_schedule_t *schedule, int64_t day, time_t now)
+{
+    if (!day_matches(schedule, day))
+    {
+        return 0;
+    }
+
+    // A start skipped by DST moves past the next ones and sun relative starts are not ordered
+    // with clock ones, so take the earliest rather than the first
+    time_t earliest = 0;
+    for (int k = 0; k < schedule->daily_count; k++)
+    {
+        time_t start;
+        if (start_on_day(schedule, schedule->start_times[k], day, &start) && start > now && (!earliest || start < earliest))
+        {
+            earliest = start;
+        }
+    }
+    return earliest;
+}
+
+// Latest start of a local day at or before now, 0 if none
+static time_t latest_start_before(const program_schedule_t *schedule, int64_t day, time_t now)
+{
+    if (!day_matches(schedule, day))
+    {
+        return 0;
+    }
+
+    time_t latest = 0;
+    for (int k = 0; k < schedule->daily_count; k++)
+    {
+        time_t start;
+        if (start_on_day(schedule, schedule->start_times[k], day, &start) && start <= now && start > latest)
+        {
+            latest = start;
+        }
+    }
+    return latest;
+}
+
+// Walk days from yesterday for schedules that aren't in the weekly index, one period plus a day for DST shifts.
+// A start of yesterday skipped by DST can land after now, and a finish by sunrise start can fall on the day
+// before, so the following day is checked too.
+static time_t next_run_by_day(const program_schedule_t *schedule, time_t now)
+{
+    int64_t today = timezone_local_day(timezone_to_local(now));
+    for (int64_t day = today - 1; day <= today + period_days(schedule) + 1; day++)
+    {
+        time_t earliest = earliest_start_after(schedule, day, now);
+        if (earliest)
+        {
+            time_t following = earliest_start_after(schedule, day + 1, now);
+            return following && following < earliest ? following : earliest;
+        }
+    }
+    return 0;
+}
+
+time_t schedule_engine_next_run(uint8_t program_id, time_t now)
+{
+    if (program_id == 0 || program_id > MAX_PROGRAMS)
+    {
+        return 0;
+    }
+
+    const program_schedule_t *schedule = &program_schedules[program_id - 1];
+    if (!schedule->start_count)
+    {
+        return 0;
+    }
+
+    if (schedule->by_day)
+    {
+        return next_run_by_day(schedule, now);
+    }
+
+    uint32_t minute;
+    int64_t week_start = local_week_start(now, &minute);
+
+    // A start skipped by DST moves forward, possibly past now and past the starts that follow it,
+    // so the walk begins one change before the current minute and keeps the earliest start after now
+    int32_t from = (int32_t)minute - TIMEZONE_MAX_SHIFT_MINUTES;
+    int64_t first_week = 0;
+    if (from < 0)
+    {
+        from += MINUTES_PER_WEEK;
+        first_week = -1;
+    }
+    int first = 0;
+    while (first < schedule->start_count && schedule->starts[first] <= from)
+    {
+        first++;
+    }
+
+    time_t earliest = 0;
+    int64_t earliest_local = 0;
+    for (int k = 0; k <= 2 * schedule->start_count; k++)
+    {
+        int index = (first + k) % schedule->start_count;
+        int64_t weeks = first_week + (first + k) / schedule->start_count;
+        int64_t local = week_start + weeks * MINUTES_PER_WEEK * 60 + (int64_t)schedule->starts[index] * 60;
+        if (earliest && local > earliest_local + TIMEZONE_MAX_SHIFT_MINUTES * 60)
+        {
+            break;
+        }
+
+        time_t next = timezone_to_utc(local);
+        if (next > now && (!earliest || next < earliest))
+        {
+            earliest = next;
+            earliest_local = local;
+        }
+    }
+
+    return earliest;
+}
+
+time_t schedule_engine_last_start(uint8_t program_id, time_t now)
+{
+    if (program_id == 0 || program_id > MAX_PROGRAMS)
+    {
+        return 0;
+    }
+
+    const program_schedule_t *schedule = &program_schedules[program_id - 1];
+    if (!schedule->start_count)
+    {
+        return 0;
+    }
+
+    // Tomorrow's finish by sunrise start may already have begun today
+    int64_t today = timezone_local_day(timezone_to_local(now));
+    for (int64_t day = today + 1; day >= today - period_days(schedule); day--)
+    {
+        time_t latest = latest_start_before(schedule, day, now);
+        if (latest)
+        {
+            time_t previous = latest_start_before(schedule, day - 1, now);
+            return previous > latest ? previous : latest;
+        }
+    }
+    return 0;
+}
+
+uint32_t schedule_engine_get_conflicts(uint8_t program_id)
+{
+    if (program_id == 0 || program_id > MAX_PROGRAMS)
+    {
+        return 0;
+    }
+    return program_schedules[program_id - 1].conflicts;
+}
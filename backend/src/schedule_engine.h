@@ -0,0 +1,52 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "sprinkler_storage.h"
+
+#define MINUTES_PER_DAY 1440
+#define MINUTES_PER_WEEK (7 * MINUTES_PER_DAY)
+#define SCHEDULE_BITMAP_WORDS ((MINUTES_PER_WEEK + 63) / 64)
+
+// Start times a weekdays program can have in a week
+#define SCHEDULE_MAX_STARTS_PER_PROGRAM (7 * MAX_START_TIMES)
+
+/**
+ * @brief Compile all programs into the weekly start index and their conflicts
+ * Must be called with the sprinkler data locked, after any change to schedules, zones or enabled states.
+ *
+ * @param data Sprinkler data
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t schedule_engine_compile(const sprinkler_data_t *data);
+
+/**
+ * @brief Next time a program starts after now
+ *
+ * @param program_id Program to query
+ * @param now Current time
+ * @return time_t Next start, 0 if the program never runs (disabled or no day selected)
+ */
+time_t schedule_engine_next_run(uint8_t program_id, time_t now);
+
+/**
+ * @brief Most recent start of a program at or before now, looking back one schedule period
+ *
+ * @param program_id Program to query
+ * @param now Current time
+ * @return time_t Last start, 0 if the program did not start within its period
+ */
+time_t schedule_engine_last_start(uint8_t program_id, time_t now);
+
+/**
+ * @brief Programs whose watering windows overlap a program's, found at compile time
+ *
+ * @param program_id Program to query
+ * @return uint32_t Bit i set when the program overlaps program i + 1
+ */
+uint32_t schedule_engine_get_conflicts(uint8_t program_id);
@@ -16,6 +16,8 @@
 #include "lwip/sys.h"
 
 #include "wifi.h"
+#include "boot.h"
+#include "time_service.h"
 
 static const char *TAG = "NTP_TIME";
 
@@ -43,6 +45,7 @@ static void get_and_print_time(void)
 static void time_sync_notification_cb(struct timeval *tv)
 {
     ESP_LOGI(TAG, "Notification of a time synchronization event");
+    boot_mark_milestone(BOOT_MILESTONE_TIME_SYNC);
     get_and_print_time();
 
     if (user_time_sync_callback != NULL)
@@ -51,13 +54,18 @@ static void time_sync_notification_cb(struct timeval *tv)
     }
 }
 
+// Overrides the weak SNTP hook, so NTP corrections go through the time service instead of stepping the clock
+void sntp_sync_time(struct timeval *tv)
+{
+    time_service_submit(TIME_SOURCE_NTP, tv);
+    sntp_set_sync_status(SNTP_SYNC_STATUS_COMPLETED);
+    time_sync_notification_cb(tv);
+}
+
 static void initialize_sntp(void)
 {
     ESP_LOGI(TAG, "Initializing SNTP");
 
-    // Set the callback function for time synchronization
-    sntp_set_time_sync_notification_cb(time_sync_notification_cb);
-
     // Set the operating mode
     esp_sntp_setoperatingmode(SNTP_OPMODE_POLL);
 
@@ -71,14 +79,10 @@ static void initialize_sntp(void)
 static void ntp_time_task(void *pvParameters)
 {
     ESP_LOGI(TAG, "Waiting for WiFi connection...");
-    while (!wait_wifi_connection())
-        ESP_LOGI(TAG, "Waiting for WiFi connection...");
+    wait_wifi_sta_connected();
 
     ESP_LOGI(TAG, "WiFi connected, starting NTP sync");
 
-    setenv("TZ", NTP_TIMEZONE, 1);
-    tzset();
-
     initialize_sntp();
 
     vTaskDelete(NULL);
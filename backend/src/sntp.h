@@ -8,7 +8,7 @@
 
 // NTP server configuration
 #define NTP_SERVER "pool.ntp.org"
-// Set timezone. Examples:
+// Default timezone, changed at runtime with set_timezone. Examples:
 // "EST5EDT,M3.2.0/2,M11.1.0" - Eastern Time
 // "PST8PDT,M3.2.0,M11.1.0" - Pacific Time
 // "CET-1CEST,M3.5.0,M10.5.0/3" - Central European Time
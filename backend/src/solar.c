@@ -0,0 +1,158 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "solar.h"
+
+#include "storage.h"
+#include "timezone.h"
+
+#include <math.h>
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "SOLAR";
+
+#define SOLAR_KEY "solar"
+
+// Marks a day without sunrise or sunset (polar day or night)
+#define SOLAR_NONE INT16_MIN
+
+// Minutes from UTC midnight of the date, negative or past 1440 far from Greenwich
+typedef struct
+{
+    float latitude;
+    float longitude;
+    int16_t sunrise[SOLAR_TABLE_DAYS];
+    int16_t sunset[SOLAR_TABLE_DAYS];
+} solar_table_t;
+
+// Double buffered like the timezone table, the scheduler reads without locking
+static solar_table_t tables[2];
+static solar_table_t *volatile active_table = NULL;
+static SemaphoreHandle_t solar_mutex = NULL;
+
+// NOAA sunrise equation, a minute or two of accuracy is plenty for watering
+static void build_table(solar_table_t *table, float latitude, float longitude)
+{
+    const double to_radians = M_PI / 180.0;
+    const double zenith = 90.833 * to_radians; // Refraction and solar disc radius
+    const double phi = latitude * to_radians;
+
+    table->latitude = latitude;
+    table->longitude = longitude;
+
+    for (int day = 0; day < SOLAR_TABLE_DAYS; day++)
+    {
+        // Fractional year at noon
+        double gamma = 2.0 * M_PI / 365.0 * day;
+        double equation_of_time = 229.18 * (0.000075 + 0.001868 * cos(gamma) - 0.032077 * sin(gamma) -
+                                            0.014615 * cos(2 * gamma) - 0.040849 * sin(2 * gamma));
+        double declination = 0.006918 - 0.399912 * cos(gamma) + 0.070257 * sin(gamma) - 0.006758 * cos(2 * gamma) +
+                             0.000907 * sin(2 * gamma) - 0.002697 * cos(3 * gamma) + 0.00148 * sin(3 * gamma);
+
+        double cos_hour_angle = cos(zenith) / (cos(phi) * cos(declination)) - tan(phi) * tan(declination);
+        if (cos_hour_angle < -1.0 || cos_hour_angle > 1.0)
+        {
+            table->sunrise[day] = SOLAR_NONE;
+            table->sunset[day] = SOLAR_NONE;
+            continue;
+        }
+
+        double hour_angle = acos(cos_hour_angle) / to_radians;
+        table->sunrise[day] = (int16_t)lround(720.0 - 4.0 * (longitude + hour_angle) - equation_of_time);
+        table->sunset[day] = (int16_t)lround(720.0 - 4.0 * (longitude - hour_angle) - equation_of_time);
+    }
+}
+
+static bool is_valid_location(float latitude, float longitude)
+{
+    return latitude >= -90.0f && latitude <= 90.0f && longitude >= -180.0f && longitude <= 180.0f;
+}
+
+esp_err_t solar_init(void)
+{
+    solar_mutex = xSemaphoreCreateMutex();
+    if (!solar_mutex)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    size_t required_size = sizeof(solar_table_t);
+    esp_err_t ret = read_blob(SOLAR_KEY, &tables[0], &required_size);
+    if (ret != ESP_OK || required_size != sizeof(solar_table_t) ||
+        !is_valid_location(tables[0].latitude, tables[0].longitude))
+    {
+        ESP_LOGI(TAG, "No location set, sunrise and sunset starts are disabled");
+        return ESP_OK;
+    }
+
+    active_table = &tables[0];
+    ESP_LOGI(TAG, "Location: %.4f, %.4f", tables[0].latitude, tables[0].longitude);
+    return ESP_OK;
+}
+
+esp_err_t solar_set_location(float latitude, float longitude)
+{
+    if (!is_valid_location(latitude, longitude))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (xSemaphoreTake(solar_mutex, portMAX_DELAY) != pdTRUE)
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    solar_table_t *table = (active_table == &tables[0]) ? &tables[1] : &tables[0];
+    build_table(table, latitude, longitude);
+
+    // The whole table is stored, boot never runs the trigonometry
+    esp_err_t ret = write_blob(SOLAR_KEY, table, sizeof(solar_table_t));
+    if (ret == ESP_OK)
+    {
+        active_table = table;
+        ESP_LOGI(TAG, "Location set to %.4f, %.4f", latitude, longitude);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Failed to save location: %s", esp_err_to_name(ret));
+    }
+
+    xSemaphoreGive(solar_mutex);
+    return ret;
+}
+
+bool solar_get_location(float *latitude, float *longitude)
+{
+    const solar_table_t *table = active_table;
+    if (!table)
+    {
+        return false;
+    }
+    *latitude = table->latitude;
+    *longitude = table->longitude;
+    return true;
+}
+
+bool solar_get_times(int64_t day, time_t *sunrise, time_t *sunset)
+{
+    const solar_table_t *table = active_table;
+    if (!table)
+    {
+        return false;
+    }
+
+    int year, month, day_of_month;
+    timezone_date_from_days(day, &year, &month, &day_of_month);
+    int day_of_year = (int)(day - timezone_days_from_date(year, 1, 1));
+    if (table->sunrise[day_of_year] == SOLAR_NONE)
+    {
+        return false;
+    }
+
+    time_t midnight = (time_t)(day * SECONDS_PER_DAY);
+    *sunrise = midnight + table->sunrise[day_of_year] * 60;
+    *sunset = midnight + table->sunset[day_of_year] * 60;
+    return true;
+}
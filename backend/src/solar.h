@@ -0,0 +1,42 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+
+// One entry per day of the year, index 365 is only used on leap years
+#define SOLAR_TABLE_DAYS 366
+
+/**
+ * @brief Load the location and its sunrise/sunset table from NVS
+ */
+esp_err_t solar_init(void);
+
+/**
+ * @brief Validate and persist a location, then build and publish its sunrise/sunset table
+ *
+ * @param latitude Degrees, north positive
+ * @param longitude Degrees, east positive
+ * @return esp_err_t ESP_ERR_INVALID_ARG if out of range
+ */
+esp_err_t solar_set_location(float latitude, float longitude);
+
+/**
+ * @brief Configured location
+ *
+ * @return bool false if no location is set, solar start times never run then
+ */
+bool solar_get_location(float *latitude, float *longitude);
+
+/**
+ * @brief Sunrise and sunset of a local date, from the precomputed table
+ *
+ * @param day Local day, days since 1970-01-01
+ * @param sunrise UTC sunrise
+ * @param sunset UTC sunset
+ * @return bool false without a location, or when the sun doesn't rise or set that day
+ */
+bool solar_get_times(int64_t day, time_t *sunrise, time_t *sunset);
@@ -2,25 +2,34 @@
 
 #include "sprinkler_controller.h"
 
-#include "ws_sprinkler.h"
-#include "days_utils.h"
+#include "change_events.h"
+#include "schedule_engine.h"
+#include "watering_plan.h"
+#include "water_budget.h"
+#include "valve_sequencer.h"
+#include "valve_outputs.h"
 #include "sprinkler_repository.h"
+#include "boot.h"
+#include "time_service.h"
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "freertos/timers.h"
-#include "driver/gpio.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <time.h>
 #include <sys/time.h>
 #include <string.h>
+#include <stdatomic.h>
 
 static const char *TAG = "SPRINKLER_CTRL";
 
 #define EXECUTOR_TASK_STACK_SIZE 12288
 #define EXECUTION_QUEUE_SIZE 10
 #define ZONE_TIMER_PERIOD_MS 100
+#define SCHEDULE_GRACE_SECONDS 300 // A due program still starts if it's late by less than this
+#define QUEUE_POLICY_KEY "queue_policy"
 
 // Task handles
 static TaskHandle_t executor_task_handle = NULL;
@@ -29,12 +38,16 @@ static TimerHandle_t zone_timer = NULL;
 
 static bool controller_running = false;
 
+// Set by whichever task reports a clock change, the executor re-plans and resumes from its own loop
+static _Atomic bool time_changed = false;
+
 // Execution command structure
 typedef struct
 {
     uint8_t program_id;
     uint8_t zone_index;
     uint16_t duration_minutes;
+    uint8_t scale_percent; // Zone durations of a program start, below 100 when squeezed into the finish-by window
     bool is_program_start;
     bool is_program_end;
 } execution_cmd_t;
@@ -46,15 +59,16 @@ typedef struct
     uint8_t current_program_id;
     uint8_t current_zone_id;
     uint8_t current_zone_index;
-    time_t zone_start_time;
-    uint16_t zone_duration_seconds;
+    int64_t zone_start_us; // Monotonic, so zone timing is unaffected by clock corrections
+    uint32_t zone_duration_seconds;
+    uint16_t budget_percent; // Water budget of the current run, taken when it starts
+    uint8_t scale_percent;
 } execution_state_t;
 
 // Param used when safely accessing the sprinkler data structure
 typedef struct
 {
-    int zone_id;
-    bool turn_on;
+    uint8_t zone_id; // Zone to open, 0 to close them all
 } update_gpio_context_t;
 
 // Structure to pass data for executor operations
@@ -70,6 +84,7 @@ typedef struct
     uint8_t zone_id;
     int zone_duration_minutes;
     bool zone_enabled;
+    uint16_t budget_percent;
 } executor_operation_data_t;
 
 typedef struct
@@ -77,41 +92,63 @@ typedef struct
     bool should_resume;
     uint8_t program_id;
     uint8_t zone_index;
-    uint16_t remaining_minutes;
+    uint16_t budget_percent;
+    uint8_t scale_percent;
+    uint32_t remaining_seconds;
 } program_recovery_t;
 
+typedef struct
+{
+    uint8_t due_program_id;
+    uint8_t due_scale_percent;
+    bool has_stale;
+} due_program_check_t;
+
+typedef struct
+{
+    uint8_t program_id;
+    uint8_t scale_percent;
+} pending_program_t;
+
 static execution_state_t exec_state = {0};
 
+// Scheduled programs waiting for the current run to complete, in order
+static program_queue_policy_t queue_policy = PROGRAM_QUEUE_APPEND;
+static pending_program_t pending_programs[PROGRAM_QUEUE_DEPTH];
+static uint8_t pending_count = 0;
+static portMUX_TYPE pending_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void check_scheduled_programs(void);
+static void resume_interrupted_program(void);
+
 esp_err_t init_zone_gpio(const zone_t *zone)
 {
-    gpio_config_t io_conf = {
-        .intr_type = GPIO_INTR_DISABLE,
-        .mode = GPIO_MODE_OUTPUT,
-        .pin_bit_mask = (1ULL << zone->output),
-        .pull_down_en = 0,
-        .pull_up_en = 0,
-    };
-
-    esp_err_t ret = gpio_config(&io_conf);
+    esp_err_t ret = valve_outputs_configure(VALVE_OUTPUT_BIT(zone->output));
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to configure GPIO %d for zone %d", zone->output, zone->id);
         return ret;
     }
 
-    // Initialize to OFF state
-    gpio_set_level(zone->output, 0);
-    ESP_LOGI(TAG, "Initialized GPIO %d for zone %d (%s)", zone->output, zone->id, zone->name);
-
+    ESP_LOGI(TAG, "Initialized output %d for zone %d", zone->output, zone->id);
     return ESP_OK;
 }
 
-// Function to initialize GPIO pins for zones
-static esp_err_t init_all_zones_gpio(const sprinkler_data_t *sprinkler_data, void *user_data)
+// Collect the zone outputs, configured together with the master valve and pump
+static esp_err_t collect_zone_outputs(const sprinkler_data_t *sprinkler_data, void *user_data)
 {
-    for (int i = 0; i < sprinkler_data->zone_count; i++)
+    uint64_t *zone_outputs = (uint64_t *)user_data;
+    for (int i = 0; i < MAX_ZONES; i++)
     {
-        init_zone_gpio(&sprinkler_data->zones[i]);
+        const zone_t *zone = &sprinkler_data->zones[i];
+        if (zone->id && valve_outputs_is_valid(zone->output))
+        {
+            *zone_outputs |= VALVE_OUTPUT_BIT(zone->output);
+        }
+        else if (zone->id)
+        {
+            ESP_LOGE(TAG, "GPIO %d of zone %d can't drive a valve", zone->output, zone->id);
+        }
     }
 
     return ESP_OK;
@@ -120,39 +157,60 @@ static esp_err_t init_all_zones_gpio(const sprinkler_data_t *sprinkler_data, voi
 static esp_err_t update_gpio_state(const sprinkler_data_t *sprinkler_data, void *user_data)
 {
     update_gpio_context_t *gpio_context = (update_gpio_context_t *)user_data;
-    zone_t zone = sprinkler_data->zones[gpio_context->zone_id - 1];
+    uint8_t output = VALVE_OUTPUT_NONE;
 
-    if (!zone.id)
+    if (gpio_context->zone_id)
     {
-        ESP_LOGE(TAG, "Zone %d not found", gpio_context->zone_id);
-        return ESP_ERR_NOT_FOUND;
+        const zone_t *zone = &sprinkler_data->zones[gpio_context->zone_id - 1];
+        if (!zone->id)
+        {
+            ESP_LOGE(TAG, "Zone %d not found", gpio_context->zone_id);
+            return ESP_ERR_NOT_FOUND;
+        }
+        output = zone->output;
     }
 
-    exec_state.is_running = gpio_context->turn_on;
-    exec_state.current_zone_id = gpio_context->turn_on ? gpio_context->zone_id : 0;
-    exec_state.zone_start_time = time(NULL);
-    gpio_set_level(zone.output, gpio_context->turn_on ? 1 : 0);
+    exec_state.is_running = gpio_context->zone_id != 0;
+    exec_state.current_zone_id = gpio_context->zone_id;
+    exec_state.zone_start_us = esp_timer_get_time();
+    esp_err_t ret = valve_sequencer_switch(output);
 
-    ESP_LOGI(TAG, "Zone %d (%s) turned %s", gpio_context->zone_id, zone.name, gpio_context->turn_on ? "ON" : "OFF");
+    if (gpio_context->zone_id)
+    {
+        ESP_LOGI(TAG, "Zone %d (%s) turned ON", gpio_context->zone_id, sprinkler_name(sprinkler_data, sprinkler_data->zones[gpio_context->zone_id - 1].name));
+    }
+    else
+    {
+        ESP_LOGI(TAG, "All zones turned OFF");
+    }
 
-    return ESP_OK;
+    return ret;
 }
 
-// Function to turn zone on/off
-static esp_err_t control_zone(uint8_t zone_id, bool turn_on)
+// Hand watering over from one zone to another, make before break, or close everything with zone 0.
+// The outputs are switched first, the zone status saves come after so they can't widen the handover.
+static esp_err_t switch_zone(uint8_t previous_zone_id, uint8_t zone_id)
 {
-    if (zone_id > MAX_ZONES || zone_id == 0)
+    if (zone_id > MAX_ZONES || previous_zone_id > MAX_ZONES)
     {
         return ESP_ERR_INVALID_STATE;
     }
 
     update_gpio_context_t params = {
-        .zone_id = zone_id,
-        .turn_on = turn_on};
+        .zone_id = zone_id};
     esp_err_t ret = safe_sprinklerdata_operation(update_gpio_state, &params);
-    if (ret == ESP_OK)
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    if (previous_zone_id && previous_zone_id != zone_id)
+    {
+        sprinkler_update_zone_status(previous_zone_id, false);
+    }
+    if (zone_id)
     {
-        ret = sprinkler_update_zone_status(zone_id, turn_on);
+        ret = sprinkler_update_zone_status(zone_id, true);
     }
 
     return ret;
@@ -169,8 +227,8 @@ static void zone_timer_callback(TimerHandle_t xTimer)
         // Manual zone - just turn off the current zone
         if (exec_state.current_zone_id != 0)
         {
-            control_zone(exec_state.current_zone_id, false);
             ESP_LOGI(TAG, "Manual zone %d timer expired, turning off", exec_state.current_zone_id);
+            switch_zone(exec_state.current_zone_id, 0);
         }
         // Reset execution state
         memset(&exec_state, 0, sizeof(exec_state));
@@ -210,14 +268,15 @@ static esp_err_t executor_get_program_zone_operation(const sprinkler_data_t *dat
 
     // Program found, copy basic info
     op_data->program_found = true;
-    strncpy(op_data->program_name, program->name, sizeof(op_data->program_name) - 1);
+    strncpy(op_data->program_name, sprinkler_name(data, program->name), sizeof(op_data->program_name) - 1);
     op_data->program_name[sizeof(op_data->program_name) - 1] = '\0';
     op_data->zone_count = program->zone_count;
+    op_data->budget_percent = water_budget_percent_at(program->budget_percent, time(NULL));
 
     // Find the next enabled zone starting from the requested index
     for (int i = op_data->zone_index; i < program->zone_count; i++)
     {
-        const program_zone_t *pz = &program->zones[i];
+        const program_zone_t *pz = &sprinkler_program_zones(data, program)[i];
 
         // Check if zone is enabled
         if (pz->zone_id > 0 && pz->zone_id <= MAX_ZONES)
@@ -243,13 +302,35 @@ static esp_err_t executor_get_program_zone_operation(const sprinkler_data_t *dat
     return ESP_OK;
 }
 
+// Zone duration in the current run, at least a second so the zone timer has a period
+static uint32_t scaled_zone_seconds(int minutes)
+{
+    uint32_t seconds = water_budget_zone_seconds(minutes, exec_state.budget_percent, exec_state.scale_percent);
+    return seconds ? seconds : 1;
+}
+
 static void executor_task(void *pvParameters)
 {
     execution_cmd_t cmd;
     ESP_LOGI(TAG, "Executor task started");
 
+    // Only this task touches the execution state, a run cut by the restart resumes before anything else starts
+    resume_interrupted_program();
+
     while (controller_running)
     {
+        if (atomic_exchange(&time_changed, false))
+        {
+            // Re-plan, only programs whose next run moved are saved and published
+            sprinkler_controller_update_all_next_runs();
+            if (!exec_state.current_program_id)
+            {
+                resume_interrupted_program();
+            }
+        }
+
+        check_scheduled_programs();
+
         if (xQueueReceive(execution_queue, &cmd, pdMS_TO_TICKS(1000)) == pdTRUE)
         {
             executor_operation_data_t op_data = {
@@ -281,20 +362,29 @@ static void executor_task(void *pvParameters)
                 ESP_LOGI(TAG, "Executing program %d (%s)", op_data.program_id, op_data.program_name);
                 exec_state.current_program_id = op_data.program_id;
                 exec_state.current_zone_index = op_data.zone_index; // Use the actual found zone index
+                exec_state.budget_percent = op_data.budget_percent;
+                exec_state.scale_percent = cmd.scale_percent;
 
-                // Start first enabled zone if found
-                if (op_data.zone_enabled)
+                // Start first enabled zone if found, a 0% budget waters nothing
+                if (op_data.zone_enabled && !op_data.budget_percent)
+                {
+                    ESP_LOGI(TAG, "Water budget of program %d is 0%%, skipping", op_data.program_id);
+                    sprinkler_update_program_next_run(op_data.program_id);
+                    exec_state.current_program_id = 0;
+                    exec_state.current_zone_index = 0;
+                }
+                else if (op_data.zone_enabled)
                 {
-                    exec_state.zone_duration_seconds = op_data.zone_duration_minutes * 60;
+                    exec_state.zone_duration_seconds = scaled_zone_seconds(op_data.zone_duration_minutes);
                     exec_state.current_zone_id = op_data.zone_id;
 
-                    control_zone(op_data.zone_id, true);
+                    switch_zone(0, op_data.zone_id);
 
                     // Start timer for this zone
                     xTimerChangePeriod(zone_timer, pdMS_TO_TICKS(exec_state.zone_duration_seconds * 1000), 0);
                     xTimerStart(zone_timer, 0);
 
-                    ESP_LOGI(TAG, "Started zone %d (index %d) for %d minutes", op_data.zone_id, op_data.zone_index, op_data.zone_duration_minutes);
+                    ESP_LOGI(TAG, "Started zone %d (index %d) for %lu seconds", op_data.zone_id, op_data.zone_index, (unsigned long)exec_state.zone_duration_seconds);
                 }
                 else
                 {
@@ -306,27 +396,27 @@ static void executor_task(void *pvParameters)
             }
             else
             {
-                // Turn off current zone
-                control_zone(exec_state.current_zone_id, false);
+                uint8_t previous_zone_id = exec_state.current_zone_id;
 
                 // Check if we found another enabled zone
                 if (op_data.zone_enabled)
                 {
                     exec_state.current_zone_index = op_data.zone_index; // Use the actual found zone index
-                    exec_state.zone_duration_seconds = op_data.zone_duration_minutes * 60;
-                    exec_state.current_zone_id = op_data.zone_id;
+                    exec_state.zone_duration_seconds = scaled_zone_seconds(op_data.zone_duration_minutes);
 
-                    control_zone(op_data.zone_id, true);
+                    // Next zone opens before the current one closes, flow never stops between zones
+                    switch_zone(previous_zone_id, op_data.zone_id);
 
                     // Start timer for this zone
                     xTimerChangePeriod(zone_timer, pdMS_TO_TICKS(exec_state.zone_duration_seconds * 1000), 0);
                     xTimerStart(zone_timer, 0);
 
-                    ESP_LOGI(TAG, "Running zone %d (index %d) for %d minutes", op_data.zone_id, op_data.zone_index, op_data.zone_duration_minutes);
+                    ESP_LOGI(TAG, "Running zone %d (index %d) for %lu seconds", op_data.zone_id, op_data.zone_index, (unsigned long)exec_state.zone_duration_seconds);
                 }
                 else
                 {
                     // Program completed - no more enabled zones
+                    switch_zone(previous_zone_id, 0);
                     ESP_LOGI(TAG, "Program %d completed", op_data.program_id);
                     sprinkler_update_program_next_run(op_data.program_id);
 
@@ -346,7 +436,6 @@ static esp_err_t check_program_recovery_operation(const sprinkler_data_t *data,
 {
     program_recovery_t *recovery = (program_recovery_t *)user_data;
     time_t now = time(NULL);
-    struct tm *tm_now = localtime(&now);
 
     recovery->should_resume = false;
 
@@ -357,60 +446,58 @@ static esp_err_t check_program_recovery_operation(const sprinkler_data_t *data,
         if (!program->id || !program->enabled)
             continue;
 
-        // Check if program should run today
-        int today_bit = 1 << tm_now->tm_wday;
-        if (!(program->schedule.days & today_bit))
+        // Latest start of this program, planned or scheduled, possibly yesterday if it crosses midnight
+        time_t program_start = watering_plan_last_start(program->id, now);
+        if (!program_start)
             continue;
 
-        // Calculate today's start time for this program
-        struct tm tm_start = *tm_now;
-        tm_start.tm_hour = program->schedule.start_hour;
-        tm_start.tm_min = program->schedule.start_minute;
-        tm_start.tm_sec = 0;
-        time_t program_start = mktime(&tm_start);
-
-        // Calculate total program duration
-        uint16_t total_duration_minutes = 0;
+        // Calculate total program duration, budgeted and scaled like the executor did when the run started
+        uint16_t budget_percent = water_budget_percent_at(program->budget_percent, program_start);
+        uint8_t scale_percent = watering_plan_scale(program->id, program_start);
+        uint32_t total_duration_seconds = 0;
         for (int j = 0; j < program->zone_count; j++)
         {
-            const program_zone_t *pz = &program->zones[j];
+            const program_zone_t *pz = &sprinkler_program_zones(data, program)[j];
             if (pz->zone_id > 0 && pz->zone_id <= MAX_ZONES)
             {
                 const zone_t *zone = &data->zones[pz->zone_id - 1];
                 if (zone->enabled)
                 {
-                    total_duration_minutes += pz->duration;
+                    total_duration_seconds += water_budget_zone_seconds(pz->duration, budget_percent, scale_percent);
                 }
             }
         }
 
-        time_t program_end = program_start + (total_duration_minutes * 60);
+        time_t program_end = program_start + total_duration_seconds;
 
         // Check if we're currently within program execution window
         if (now >= program_start && now < program_end)
         {
             // Calculate elapsed time and find current zone
-            uint16_t elapsed_minutes = (now - program_start) / 60;
-            uint16_t cumulative_minutes = 0;
+            uint32_t elapsed_seconds = now - program_start;
+            uint32_t cumulative_seconds = 0;
 
             for (int j = 0; j < program->zone_count; j++)
             {
-                const program_zone_t *pz = &program->zones[j];
+                const program_zone_t *pz = &sprinkler_program_zones(data, program)[j];
                 if (pz->zone_id > 0 && pz->zone_id <= MAX_ZONES)
                 {
                     const zone_t *zone = &data->zones[pz->zone_id - 1];
                     if (zone->enabled)
                     {
-                        if (elapsed_minutes < cumulative_minutes + pz->duration)
+                        uint32_t zone_seconds = water_budget_zone_seconds(pz->duration, budget_percent, scale_percent);
+                        if (elapsed_seconds < cumulative_seconds + zone_seconds)
                         {
                             // Found the zone we should be running
                             recovery->should_resume = true;
                             recovery->program_id = program->id;
                             recovery->zone_index = j;
-                            recovery->remaining_minutes = cumulative_minutes + pz->duration - elapsed_minutes;
+                            recovery->budget_percent = budget_percent;
+                            recovery->scale_percent = scale_percent;
+                            recovery->remaining_seconds = cumulative_seconds + zone_seconds - elapsed_seconds;
                             return ESP_OK;
                         }
-                        cumulative_minutes += pz->duration;
+                        cumulative_seconds += zone_seconds;
                     }
                 }
             }
@@ -423,8 +510,22 @@ static esp_err_t check_program_recovery_operation(const sprinkler_data_t *data,
 // Public API functions
 esp_err_t sprinkler_controller_init()
 {
-    // Initialize GPIO for zones
-    esp_err_t ret = safe_sprinklerdata_operation(init_all_zones_gpio, NULL);
+    // Driver first, the outputs that exist depend on it. If it fails, zones stay visible but never water.
+    esp_err_t ret = valve_outputs_init();
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Valve driver unavailable: %s", esp_err_to_name(ret));
+    }
+
+    uint64_t zone_outputs = 0;
+    ret = safe_sprinklerdata_operation(collect_zone_outputs, &zone_outputs);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    // Zone, master valve and pump outputs, sequenced around the zones
+    ret = valve_sequencer_init(zone_outputs);
     if (ret != ESP_OK)
     {
         return ret;
@@ -447,35 +548,45 @@ esp_err_t sprinkler_controller_init()
         return ESP_ERR_NO_MEM;
     }
 
-    ESP_LOGI(TAG, "Sprinkler controller initialized");
+    uint8_t stored_policy;
+    size_t required_size = sizeof(stored_policy);
+    if (read_blob(QUEUE_POLICY_KEY, &stored_policy, &required_size) == ESP_OK && stored_policy <= PROGRAM_QUEUE_SKIP)
+    {
+        queue_policy = stored_policy;
+    }
+
+    ESP_LOGI(TAG, "Sprinkler controller initialized, queue policy: %s", program_queue_policy_to_string(queue_policy));
     return ESP_OK;
 }
 
 static esp_err_t update_all_programs_next_run_operation(const sprinkler_data_t *data, void *user_data)
 {
-    bool *any_updated = (bool *)user_data;
-    *any_updated = false;
+    time_t now = time(NULL);
+
+    // Sun relative starts depend on the clock, timezone and location, all of which may have changed,
+    // and so does the finish-by plan. Also reached when the planned window is over, to plan the next one.
+    schedule_engine_compile(data);
+    watering_plan_rebuild(data, now);
 
     for (int i = 0; i < MAX_PROGRAMS; i++)
     {
         program_t *program = &sprinkler_data.programs[i];
-        if (!program->id || !program->enabled)
+        if (!program->id)
             continue;
 
-        // Calculate what the next run should be
-        time_t new_next_run = calculate_next_run(program->schedule.days,
-                                                 program->schedule.start_hour,
-                                                 program->schedule.start_minute);
+        // Calculate what the next run should be, disabled programs never run
+        time_t from = sprinkler_program_next_run_from(program, now);
+        uint32_t new_next_run = sprinkler_time_to_offset(watering_plan_next_run(program->id, from));
 
         // Update if it's different from stored value
         if (program->next_run != new_next_run)
         {
             program->next_run = new_next_run;
-            esp_err_t ret = sprinkler_save_program(program);
+            esp_err_t ret = sprinkler_save_program(data, program);
             if (ret == ESP_OK)
             {
-                *any_updated = true;
-                ESP_LOGI(TAG, "Updated next run for program %d (%s)", program->id, program->name);
+                change_events_publish(CHANGE_PROGRAM, program->id, CHANGE_NEXT_RUN);
+                ESP_LOGI(TAG, "Updated next run for program %d (%s)", program->id, sprinkler_name(data, program->name));
             }
             else
             {
@@ -489,53 +600,238 @@ static esp_err_t update_all_programs_next_run_operation(const sprinkler_data_t *
 
 esp_err_t sprinkler_controller_update_all_next_runs(void)
 {
-    bool any_updated = false;
-    esp_err_t ret = safe_sprinklerdata_operation(update_all_programs_next_run_operation, &any_updated);
+    return safe_sprinklerdata_operation(update_all_programs_next_run_operation, NULL);
+}
 
-    if (ret == ESP_OK && any_updated)
+static esp_err_t find_due_program_operation(const sprinkler_data_t *data, void *user_data)
+{
+    due_program_check_t *check = (due_program_check_t *)user_data;
+    time_t now = time(NULL);
+
+    check->due_program_id = 0;
+    check->due_scale_percent = 100;
+
+    // Once the finish-by deadline passes, the next window gets planned along with the stale next runs
+    check->has_stale = watering_plan_expired(now);
+
+    for (int i = 0; i < MAX_PROGRAMS; i++)
     {
-        broadcast_program_update();
+        const program_t *program = &data->programs[i];
+        time_t next_run = sprinkler_time_from_offset(program->next_run);
+        if (!program->id || !program->enabled || !next_run || now < next_run)
+            continue;
+
+        // A start at or before the last run already watered, the clock went back or is a lower bound
+        if (next_run <= sprinkler_time_from_offset(program->last_run))
+        {
+            check->has_stale = true;
+            continue;
+        }
+
+        if (now - next_run <= SCHEDULE_GRACE_SECONDS)
+        {
+            if (!check->due_program_id)
+            {
+                check->due_program_id = program->id;
+                check->due_scale_percent = watering_plan_scale(program->id, next_run);
+            }
+        }
+        else
+        {
+            // Missed while off, busy or before a clock correction
+            check->has_stale = true;
+        }
     }
 
-    return ret;
+    return ESP_OK;
 }
 
-esp_err_t sprinkler_controller_start(void)
+static bool enqueue_pending_program(uint8_t program_id, uint8_t scale_percent)
 {
-    if (controller_running)
+    bool queued = false;
+    taskENTER_CRITICAL(&pending_lock);
+    bool already_queued = false;
+    for (int i = 0; i < pending_count; i++)
     {
-        return ESP_ERR_INVALID_STATE;
+        already_queued |= pending_programs[i].program_id == program_id;
+    }
+    if (!already_queued && pending_count < PROGRAM_QUEUE_DEPTH)
+    {
+        pending_programs[pending_count++] = (pending_program_t){.program_id = program_id, .scale_percent = scale_percent};
+        queued = true;
     }
+    taskEXIT_CRITICAL(&pending_lock);
+    return queued;
+}
 
-    controller_running = true;
+static pending_program_t dequeue_pending_program(void)
+{
+    pending_program_t pending = {0};
+    taskENTER_CRITICAL(&pending_lock);
+    if (pending_count)
+    {
+        pending = pending_programs[0];
+        memmove(pending_programs, pending_programs + 1, --pending_count * sizeof(pending_program_t));
+    }
+    taskEXIT_CRITICAL(&pending_lock);
+    return pending;
+}
 
-    // Update all program next runs first (in case ESP32 was off for a while)
-    esp_err_t ret = sprinkler_controller_update_all_next_runs();
-    if (ret != ESP_OK)
+static void clear_pending_programs(void)
+{
+    taskENTER_CRITICAL(&pending_lock);
+    pending_count = 0;
+    taskEXIT_CRITICAL(&pending_lock);
+}
+
+static void start_program(uint8_t program_id, uint8_t scale_percent)
+{
+    execution_cmd_t cmd = {
+        .program_id = program_id,
+        .zone_index = 0,
+        .scale_percent = scale_percent,
+        .is_program_start = true,
+        .is_program_end = false};
+
+    if (xQueueSend(execution_queue, &cmd, 0) == pdTRUE)
     {
-        ESP_LOGW(TAG, "Failed to update program next runs on startup");
+        // Mark the program as taken so it isn't started again on the next iteration
+        exec_state.current_program_id = program_id;
+        sprinkler_update_program_last_run(program_id);
+        sprinkler_update_program_next_run(program_id);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Failed to queue program %d", program_id);
     }
+}
 
-    // Create executor task
-    if (xTaskCreate(executor_task, "sprinkler_executor", EXECUTOR_TASK_STACK_SIZE, NULL, 6, &executor_task_handle) != pdPASS)
+// Stop the current run, zones off and state reset, without touching queued programs
+static void stop_current_run(void)
+{
+    uint8_t zone_id = exec_state.current_zone_id;
+    uint8_t program_id = exec_state.current_program_id;
+
+    // Reset execution state
+    memset(&exec_state, 0, sizeof(exec_state));
+
+    // Stop running zone
+    if (zone_id != 0)
     {
-        ESP_LOGE(TAG, "Failed to create executor task");
-        controller_running = false;
-        return ESP_ERR_NO_MEM;
+        switch_zone(zone_id, 0);
+        xTimerStop(zone_timer, 0);
+    }
+
+    // Update program status
+    if (program_id != 0 && program_id != 255)
+    {
+        sprinkler_update_program_next_run(program_id);
+    }
+}
+
+// Apply the queue policy to a program that is due while another one runs
+static bool handle_busy_due_program(uint8_t program_id, uint8_t scale_percent)
+{
+    switch (queue_policy)
+    {
+    case PROGRAM_QUEUE_PREEMPT:
+        ESP_LOGI(TAG, "Program %d preempts program %d", program_id, exec_state.current_program_id);
+        stop_current_run();
+        return true;
+
+    case PROGRAM_QUEUE_APPEND:
+        if (enqueue_pending_program(program_id, scale_percent))
+        {
+            ESP_LOGI(TAG, "Program %d queued behind program %d", program_id, exec_state.current_program_id);
+        }
+        else
+        {
+            ESP_LOGW(TAG, "Program queue full, skipping program %d", program_id);
+        }
+        break;
+
+    case PROGRAM_QUEUE_SKIP:
+    default:
+        ESP_LOGI(TAG, "Program %d overlaps program %d, skipping", program_id, exec_state.current_program_id);
+        break;
+    }
+
+    // Either queued or skipped, this occurrence is handled
+    sprinkler_update_program_next_run(program_id);
+    return false;
+}
+
+// Start programs whose next run is due, called from the executor loop
+static void check_scheduled_programs(void)
+{
+    if (time_service_get_confidence() < TIME_CONFIDENCE_SCHEDULE)
+    {
+        return;
+    }
+
+    due_program_check_t check = {0};
+    if (safe_sprinklerdata_operation(find_due_program_operation, &check) != ESP_OK)
+    {
+        return;
+    }
+
+    if (check.has_stale)
+    {
+        sprinkler_controller_update_all_next_runs();
+    }
+
+    // Programs queued behind the previous run go first, back to back
+    if (!exec_state.current_program_id)
+    {
+        pending_program_t pending = dequeue_pending_program();
+        if (pending.program_id)
+        {
+            ESP_LOGI(TAG, "Starting queued program %d", pending.program_id);
+            start_program(pending.program_id, pending.scale_percent);
+            return;
+        }
+    }
+
+    if (!check.due_program_id)
+    {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Program %d is due", check.due_program_id);
+
+    if (exec_state.current_program_id && !handle_busy_due_program(check.due_program_id, check.due_scale_percent))
+    {
+        return;
+    }
+
+    start_program(check.due_program_id, check.due_scale_percent);
+}
+
+// Called from the executor task only
+static void resume_interrupted_program(void)
+{
+    // Resuming mid-window relies on the current time being right, a lower bound isn't enough
+    if (time_service_get_confidence() < TIME_CONFIDENCE_RECOVERY)
+    {
+        ESP_LOGW(TAG, "Time confidence too low (%s), not resuming interrupted programs",
+                 time_confidence_to_string(time_service_get_confidence()));
+        return;
     }
 
     // Check if we need to resume a program
     program_recovery_t recovery = {0};
-    ret = safe_sprinklerdata_operation(check_program_recovery_operation, &recovery);
+    esp_err_t ret = safe_sprinklerdata_operation(check_program_recovery_operation, &recovery);
 
     if (ret == ESP_OK && recovery.should_resume)
     {
-        ESP_LOGI(TAG, "Resuming program %d at zone index %d for %d minutes",
-                 recovery.program_id, recovery.zone_index, recovery.remaining_minutes);
+        ESP_LOGI(TAG, "Resuming program %d at zone index %d for %lu seconds",
+                 recovery.program_id, recovery.zone_index, (unsigned long)recovery.remaining_seconds);
 
         // Set up execution state for recovery
         exec_state.current_program_id = recovery.program_id;
         exec_state.current_zone_index = recovery.zone_index;
+        exec_state.budget_percent = recovery.budget_percent;
+        exec_state.scale_percent = recovery.scale_percent;
 
         // Start the zone directly (bypass normal program start)
         executor_operation_data_t op_data = {
@@ -546,10 +842,10 @@ esp_err_t sprinkler_controller_start(void)
         ret = safe_sprinklerdata_operation(executor_get_program_zone_operation, &op_data);
         if (ret == ESP_OK && op_data.program_found && op_data.zone_enabled)
         {
-            exec_state.zone_duration_seconds = recovery.remaining_minutes * 60;
+            exec_state.zone_duration_seconds = recovery.remaining_seconds;
             exec_state.current_zone_id = op_data.zone_id;
 
-            control_zone(op_data.zone_id, true);
+            switch_zone(0, op_data.zone_id);
 
             // Start timer for remaining time
             xTimerChangePeriod(zone_timer, pdMS_TO_TICKS(exec_state.zone_duration_seconds * 1000), 0);
@@ -557,14 +853,52 @@ esp_err_t sprinkler_controller_start(void)
 
             sprinkler_update_program_last_run(recovery.program_id);
 
-            ESP_LOGI(TAG, "Resumed zone %d for %d minutes", op_data.zone_id, recovery.remaining_minutes);
+            ESP_LOGI(TAG, "Resumed zone %d for %lu seconds", op_data.zone_id, (unsigned long)exec_state.zone_duration_seconds);
         }
     }
+}
+
+esp_err_t sprinkler_controller_start(void)
+{
+    if (controller_running)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    controller_running = true;
+
+    // Update all program next runs first (in case ESP32 was off for a while)
+    esp_err_t ret = sprinkler_controller_update_all_next_runs();
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to update program next runs on startup");
+    }
 
+    // Create executor task
+    if (xTaskCreate(executor_task, "sprinkler_executor", EXECUTOR_TASK_STACK_SIZE, NULL, 6, &executor_task_handle) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create executor task");
+        controller_running = false;
+        return ESP_ERR_NO_MEM;
+    }
+
+    boot_mark_milestone(BOOT_MILESTONE_CONTROLLABLE);
     ESP_LOGI(TAG, "Sprinkler controller started");
     return ESP_OK;
 }
 
+esp_err_t sprinkler_controller_on_time_changed(void)
+{
+    if (!controller_running)
+    {
+        return sprinkler_controller_start();
+    }
+
+    // Already running: the executor re-plans on its next pass, at most a second away, so it never races a start
+    atomic_store(&time_changed, true);
+    return ESP_OK;
+}
+
 esp_err_t sprinkler_controller_stop(void)
 {
     if (!controller_running)
@@ -573,11 +907,12 @@ esp_err_t sprinkler_controller_stop(void)
     }
 
     controller_running = false;
+    clear_pending_programs();
 
     // Stop any running zones
     if (exec_state.is_running && exec_state.current_zone_id != 0)
     {
-        control_zone(exec_state.current_zone_id, false);
+        switch_zone(exec_state.current_zone_id, 0);
         xTimerStop(zone_timer, 0);
     }
 
@@ -597,6 +932,11 @@ esp_err_t sprinkler_controller_manual_zone(uint8_t zone_id, uint16_t duration_se
         return ESP_ERR_INVALID_STATE;
     }
 
+    if (zone_id == 0)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
     // Stop any current program execution
     sprinkler_controller_stop_pending();
 
@@ -605,7 +945,7 @@ esp_err_t sprinkler_controller_manual_zone(uint8_t zone_id, uint16_t duration_se
     exec_state.current_program_id = 255; // Special value for manual
 
     // Start manual zone
-    esp_err_t ret = control_zone(zone_id, true);
+    esp_err_t ret = switch_zone(0, zone_id);
     if (ret != ESP_OK)
     {
         return ret;
@@ -629,15 +969,18 @@ esp_err_t sprinkler_controller_manual_program(uint8_t program_id)
     // Stop any current program execution
     sprinkler_controller_stop_pending();
 
-    // Queue program start command
+    // Queue program start command, manual runs water for the full durations
     execution_cmd_t cmd = {
         .program_id = program_id,
         .zone_index = 0,
+        .scale_percent = 100,
         .is_program_start = true,
         .is_program_end = false};
 
     if (xQueueSend(execution_queue, &cmd, pdMS_TO_TICKS(1000)) == pdTRUE)
     {
+        // Taken right away, so the scheduler doesn't start a queued program in between
+        exec_state.current_program_id = program_id;
         sprinkler_update_program_last_run(program_id);
     }
     else
@@ -655,24 +998,8 @@ esp_err_t sprinkler_controller_stop_pending(void)
         return ESP_ERR_INVALID_STATE;
     }
 
-    uint8_t zone_id = exec_state.current_zone_id;
-    uint8_t program_id = exec_state.current_program_id;
-
-    // Reset execution state
-    memset(&exec_state, 0, sizeof(exec_state));
-
-    // Stop running zone
-    if (zone_id != 0)
-    {
-        control_zone(zone_id, false);
-        xTimerStop(zone_timer, 0);
-    }
-
-    // Update program status
-    if (program_id != 0)
-    {
-        sprinkler_update_program_next_run(program_id);
-    }
+    clear_pending_programs();
+    stop_current_run();
 
     ESP_LOGI(TAG, "All zones stopped");
     return ESP_OK;
@@ -688,19 +1015,80 @@ esp_err_t sprinkler_controller_get_status(sprinkler_controller_status_t *status)
     status->is_running = exec_state.is_running;
     status->current_program_id = exec_state.current_program_id;
     status->current_zone_id = exec_state.current_zone_id;
-    status->zone_start_time = exec_state.zone_start_time;
     status->zone_duration_seconds = exec_state.zone_duration_seconds;
 
-    if (exec_state.is_running && exec_state.zone_start_time > 0)
+    if (exec_state.is_running && exec_state.zone_start_us > 0)
     {
-        time_t now = time(NULL);
-        uint16_t elapsed = now - exec_state.zone_start_time;
+        // Elapsed time comes from the monotonic clock, the wall clock start is only derived for display
+        uint32_t elapsed = (esp_timer_get_time() - exec_state.zone_start_us) / 1000000;
+        status->zone_start_time = time(NULL) - elapsed;
         status->zone_remaining_seconds = (elapsed < exec_state.zone_duration_seconds) ? (exec_state.zone_duration_seconds - elapsed) : 0;
     }
     else
     {
+        status->zone_start_time = 0;
         status->zone_remaining_seconds = 0;
     }
 
     return ESP_OK;
 }
+
+esp_err_t sprinkler_controller_set_queue_policy(program_queue_policy_t policy)
+{
+    if (policy > PROGRAM_QUEUE_SKIP)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t stored_policy = policy;
+    esp_err_t ret = write_blob(QUEUE_POLICY_KEY, &stored_policy, sizeof(stored_policy));
+    if (ret == ESP_OK)
+    {
+        queue_policy = policy;
+        ESP_LOGI(TAG, "Queue policy set to %s", program_queue_policy_to_string(policy));
+    }
+    return ret;
+}
+
+program_queue_policy_t sprinkler_controller_get_queue_policy(void)
+{
+    return queue_policy;
+}
+
+bool sprinkler_controller_is_program_queued(uint8_t program_id)
+{
+    bool queued = false;
+    taskENTER_CRITICAL(&pending_lock);
+    for (int i = 0; i < pending_count; i++)
+    {
+        queued |= pending_programs[i].program_id == program_id;
+    }
+    taskEXIT_CRITICAL(&pending_lock);
+    return queued;
+}
+
+const char *program_queue_policy_to_string(program_queue_policy_t policy)
+{
+    switch (policy)
+    {
+    case PROGRAM_QUEUE_PREEMPT:
+        return "preempt";
+    case PROGRAM_QUEUE_SKIP:
+        return "skip";
+    default:
+        return "append";
+    }
+}
+
+esp_err_t program_queue_policy_from_string(const char *value, program_queue_policy_t *policy)
+{
+    for (program_queue_policy_t candidate = PROGRAM_QUEUE_APPEND; candidate <= PROGRAM_QUEUE_SKIP; candidate++)
+    {
+        if (!strcmp(value, program_queue_policy_to_string(candidate)))
+        {
+            *policy = candidate;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_ARG;
+}
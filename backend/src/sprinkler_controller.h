@@ -9,14 +9,25 @@
 
 #include "sprinkler_storage.h"
 
+// What happens when a scheduled program is due while another one runs
+typedef enum
+{
+    PROGRAM_QUEUE_APPEND,  // Run it once the current program completes
+    PROGRAM_QUEUE_PREEMPT, // Stop the current program and start it
+    PROGRAM_QUEUE_SKIP     // Skip this occurrence
+} program_queue_policy_t;
+
+// Maximum number of programs waiting behind the current run
+#define PROGRAM_QUEUE_DEPTH 4
+
 typedef struct
 {
     bool is_running;
     uint8_t current_program_id; // 255 = manual mode
     uint8_t current_zone_id;
     time_t zone_start_time;
-    uint16_t zone_duration_seconds;
-    uint16_t zone_remaining_seconds;
+    uint32_t zone_duration_seconds;
+    uint32_t zone_remaining_seconds;
 } sprinkler_controller_status_t;
 
 /**
@@ -42,6 +53,22 @@ esp_err_t init_zone_gpio(const zone_t *zone);
  */
 esp_err_t sprinkler_controller_start(void);
 
+/**
+ * @brief Notify the controller that the wall clock changed or became more trustworthy
+ * Starts the controller if needed, otherwise has the executor task re-plan next runs and resume an interrupted program
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t sprinkler_controller_on_time_changed(void);
+
+/**
+ * @brief Recompute the next run of every enabled program, e.g. after a timezone change
+ * Only programs whose next run moved are saved and broadcast
+ *
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t sprinkler_controller_update_all_next_runs(void);
+
 /**
  * @brief Stop the sprinkler controller and all zones
  *
@@ -80,3 +107,22 @@ esp_err_t sprinkler_controller_stop_pending(void);
  * @return esp_err_t ESP_OK on success
  */
 esp_err_t sprinkler_controller_get_status(sprinkler_controller_status_t *status);
+
+
+/**
+ * @brief Set and persist the policy applied when a scheduled program is due while another one runs
+ * Manual runs always preempt.
+ *
+ * @param policy Queue policy
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t sprinkler_controller_set_queue_policy(program_queue_policy_t policy);
+program_queue_policy_t sprinkler_controller_get_queue_policy(void);
+
+/**
+ * @brief Whether a program is waiting for the current run to complete
+ */
+bool sprinkler_controller_is_program_queued(uint8_t program_id);
+
+const char *program_queue_policy_to_string(program_queue_policy_t policy);
+esp_err_t program_queue_policy_from_string(const char *value, program_queue_policy_t *policy);
@@ -0,0 +1,201 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "sprinkler_model.h"
+
+#include <string.h>
+#include "esp_log.h"
+
+static const char *TAG = "SPRINKLER_MODEL";
+
+// Every zone and program can hold a name
+#define MAX_NAMES (MAX_ZONES + MAX_PROGRAMS)
+
+_Static_assert(MAX_PROGRAMS <= 32, "The zone to programs index is a 32-bit mask");
+
+void sprinkler_model_init(sprinkler_data_t *data)
+{
+    memset(data, 0, sizeof(sprinkler_data_t));
+    data->names_used = 1;
+}
+
+// Names of the zones and programs in use
+static int collect_names(sprinkler_data_t *data, sprinkler_name_t **names)
+{
+    int count = 0;
+    for (int i = 0; i < MAX_ZONES; i++)
+    {
+        if (data->zones[i].id && data->zones[i].name)
+        {
+            names[count++] = &data->zones[i].name;
+        }
+    }
+    for (int i = 0; i < MAX_PROGRAMS; i++)
+    {
+        if (data->programs[i].id && data->programs[i].name)
+        {
+            names[count++] = &data->programs[i].name;
+        }
+    }
+    return count;
+}
+
+// Move the names in use to the start of the pool in their current order, dropping the released ones.
+// Names only move down, so copying them in pool order never overwrites one not yet moved.
+static void compact_names(sprinkler_data_t *data)
+{
+    sprinkler_name_t *names[MAX_NAMES];
+    int count = collect_names(data, names);
+
+    // Sorted by offset, a few dozen entries
+    for (int i = 1; i < count; i++)
+    {
+        sprinkler_name_t *name = names[i];
+        int j = i - 1;
+        while (j >= 0 && *names[j] > *name)
+        {
+            names[j + 1] = names[j];
+            j--;
+        }
+        names[j + 1] = name;
+    }
+
+    uint16_t used = 1;
+    for (int i = 0; i < count;)
+    {
+        // Interned names are shared, every handle on the same offset follows it
+        sprinkler_name_t from = *names[i];
+        size_t size = strlen(&data->names[from]) + 1;
+        memmove(&data->names[used], &data->names[from], size);
+        for (; i < count && *names[i] == from; i++)
+        {
+            *names[i] = used;
+        }
+        used += size;
+    }
+
+    ESP_LOGI(TAG, "Name pool compacted from %d to %d bytes", data->names_used, used);
+    data->names_used = used;
+}
+
+// Offset of a name already in the pool, used or released, 0 if there is none
+static sprinkler_name_t find_name(const sprinkler_data_t *data, const char *value, size_t length)
+{
+    for (uint16_t offset = 1; offset < data->names_used;)
+    {
+        size_t size = strlen(&data->names[offset]) + 1;
+        if (size == length + 1 && !memcmp(&data->names[offset], value, length))
+        {
+            return offset;
+        }
+        offset += size;
+    }
+    return 0;
+}
+
+esp_err_t sprinkler_model_set_name(sprinkler_data_t *data, sprinkler_name_t *name, const char *value)
+{
+    size_t length = strnlen(value, MAX_ZONE_NAME_LEN - 1);
+    *name = 0;
+    if (!length)
+    {
+        return ESP_OK;
+    }
+
+    sprinkler_name_t existing = find_name(data, value, length);
+    if (existing)
+    {
+        *name = existing;
+        return ESP_OK;
+    }
+
+    if (data->names_used + length + 1 > SPRINKLER_NAME_POOL_SIZE)
+    {
+        compact_names(data);
+        if (data->names_used + length + 1 > SPRINKLER_NAME_POOL_SIZE)
+        {
+            ESP_LOGE(TAG, "Name pool is full");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    *name = data->names_used;
+    memcpy(&data->names[data->names_used], value, length);
+    data->names[data->names_used + length] = '\0';
+    data->names_used += length + 1;
+    return ESP_OK;
+}
+
+// Zone ids come from the client and the pool may list deleted zones, only known ids are indexed
+static void set_zone_program(sprinkler_data_t *data, uint8_t zone_id, uint32_t bit, bool listed)
+{
+    if (zone_id == 0 || zone_id > MAX_ZONES)
+    {
+        return;
+    }
+    if (listed)
+    {
+        data->zone_programs[zone_id - 1] |= bit;
+    }
+    else
+    {
+        data->zone_programs[zone_id - 1] &= ~bit;
+    }
+}
+
+esp_err_t sprinkler_model_set_program_zones(sprinkler_data_t *data, program_t *program, const program_zone_t *zones,
+                                            uint8_t count)
+{
+    if (count > MAX_ZONES_PER_PROGRAM || data->program_zones_used - program->zone_count + count > MAX_PROGRAM_ZONES)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Close the gap left by the current list, the lists after it move down
+    uint32_t bit = 1UL << (program->id - 1);
+    if (program->zone_count)
+    {
+        uint16_t start = program->zones;
+        uint16_t removed = program->zone_count;
+        for (int i = 0; i < removed; i++)
+        {
+            set_zone_program(data, data->program_zones[start + i].zone_id, bit, false);
+        }
+        memmove(&data->program_zones[start], &data->program_zones[start + removed],
+                (data->program_zones_used - start - removed) * sizeof(program_zone_t));
+        data->program_zones_used -= removed;
+        for (int i = 0; i < MAX_PROGRAMS; i++)
+        {
+            program_t *other = &data->programs[i];
+            if (other->zone_count && other->zones > start)
+            {
+                other->zones -= removed;
+            }
+        }
+    }
+
+    // Then the new list goes at the end
+    program->zones = count ? data->program_zones_used : 0;
+    program->zone_count = count;
+    if (count)
+    {
+        memcpy(&data->program_zones[program->zones], zones, count * sizeof(program_zone_t));
+        data->program_zones_used += count;
+        for (int i = 0; i < count; i++)
+        {
+            set_zone_program(data, zones[i].zone_id, bit, true);
+        }
+    }
+    return ESP_OK;
+}
+
+void sprinkler_model_clear_zone(sprinkler_data_t *data, zone_t *zone)
+{
+    // Its name is reclaimed by the next compaction
+    memset(zone, 0, sizeof(zone_t));
+}
+
+void sprinkler_model_clear_program(sprinkler_data_t *data, program_t *program)
+{
+    sprinkler_model_set_program_zones(data, program, NULL, 0);
+    memset(program, 0, sizeof(program_t));
+}
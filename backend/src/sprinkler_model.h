@@ -0,0 +1,39 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include "sprinkler_storage.h"
+
+/**
+ * @brief Empty the data, with the empty name at the start of the name pool
+ */
+void sprinkler_model_init(sprinkler_data_t *data);
+
+/**
+ * @brief Point a name at an interned copy of value, shared with any zone or program already named the same
+ * Names are cut to MAX_ZONE_NAME_LEN - 1 characters. Names no longer used are only reclaimed when the
+ * pool fills up and gets compacted, which moves names but never changes one.
+ *
+ * @param name Name of a zone or program in data, its previous value is released
+ * @param value New name
+ * @return esp_err_t ESP_ERR_NO_MEM if the pool is full even once compacted, name is left empty
+ */
+esp_err_t sprinkler_model_set_name(sprinkler_data_t *data, sprinkler_name_t *name, const char *value);
+
+/**
+ * @brief Replace the zone list of a program, the lists of all programs are kept back to back
+ * The zone to programs index follows the new list.
+ *
+ * @param program Program in data, with its id set
+ * @param zones New zone list, NULL when count is 0
+ * @param count Number of zones, at most MAX_ZONES_PER_PROGRAM
+ * @return esp_err_t ESP_ERR_NO_MEM if the programs together would exceed MAX_PROGRAM_ZONES, the list is unchanged
+ */
+esp_err_t sprinkler_model_set_program_zones(sprinkler_data_t *data, program_t *program, const program_zone_t *zones,
+                                            uint8_t count);
+
+/**
+ * @brief Release what a zone or program holds in the pools and empty its slot
+ */
+void sprinkler_model_clear_zone(sprinkler_data_t *data, zone_t *zone);
+void sprinkler_model_clear_program(sprinkler_data_t *data, program_t *program);
@@ -3,483 +3,749 @@
 #include "sprinkler_repository.h"
 
 #include "sprinkler_storage.h"
+#include "sprinkler_model.h"
 #include "sprinkler_controller.h"
-#include "ws_sprinkler.h"
+#include "change_events.h"
+#include "schedule_engine.h"
+#include "watering_plan.h"
 #include "days_utils.h"
+#include "water_budget.h"
+#include "valve_outputs.h"
+#include "buffer_pool.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include "esp_log.h"
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 
 static const char *TAG = "SPRINKLER_REPOSITORY";
+
+_Static_assert(sizeof(sprinkler_data_t) <= BUFFER_LARGE_SIZE, "Transaction snapshots are leased buffers");
 sprinkler_data_t sprinkler_data;
 
 static SemaphoreHandle_t sprinkler_data_mutex = NULL;
 
-static esp_err_t sprinkler_remove_zone_from_program(uint8_t program_id,
-                                                    uint8_t zone_id);
+// Changes staged in sprinkler_data under the mutex. Each repository call is a change of its own, or part of an
+// explicit transaction. Nothing is saved or published until the outermost change ends, then all at once.
+typedef struct
+{
+    int depth;
+    esp_err_t result;                      // First failure, the changes are dropped
+    uint64_t zones;                        // Zones to save, or delete once gone
+    uint64_t outputs;                      // Zones whose output must be configured
+    uint32_t programs;                     // Programs to save, or delete once gone
+    uint32_t schedules;                    // Programs whose schedule or zones changed, their conflicts are reported
+    uint16_t zone_fields[MAX_ZONES];       // change_field_t bits published once saved
+    uint16_t program_fields[MAX_PROGRAMS]; // Same for the programs
+    bool reschedule;                       // Start times, durations or the plan may have moved
+    sprinkler_data_t *snapshot;            // Data before an explicit transaction, restored when it fails
+} transaction_t;
+
+static transaction_t transaction;
+
+static esp_err_t sprinkler_remove_zone_from_program(program_t *program, uint8_t zone_id);
+
+static void mark_zone(uint8_t zone_id, uint16_t fields)
+{
+    transaction.zones |= 1ULL << (zone_id - 1);
+    transaction.zone_fields[zone_id - 1] |= fields;
+}
 
-esp_err_t sprinkler_repository_init(void)
+static void mark_program(uint8_t program_id, uint16_t fields)
 {
-    // Create mutex for protecting sprinkler_data
-    sprinkler_data_mutex = xSemaphoreCreateMutex();
-    if (sprinkler_data_mutex == NULL)
+    transaction.programs |= 1UL << (program_id - 1);
+    transaction.program_fields[program_id - 1] |= fields;
+}
+
+static zone_t *find_zone(uint8_t zone_id)
+{
+    if (zone_id == 0 || zone_id > MAX_ZONES || !sprinkler_data.zones[zone_id - 1].id)
     {
-        ESP_LOGE(TAG, "Failed to create sprinkler data mutex");
-        return ESP_ERR_NO_MEM;
+        return NULL;
     }
+    return &sprinkler_data.zones[zone_id - 1];
+}
 
-    sprinkler_load_all_data(&sprinkler_data);
+static program_t *find_program(uint8_t program_id)
+{
+    if (program_id == 0 || program_id > MAX_PROGRAMS || !sprinkler_data.programs[program_id - 1].id)
+    {
+        return NULL;
+    }
+    return &sprinkler_data.programs[program_id - 1];
+}
 
-    return ESP_OK;
+// Recompile the start index and re-plan the finish-by window, with the data locked.
+// A new plan moves the planned starts of every program in the window, not only the one that changed.
+static void compile_schedules(void)
+{
+    time_t now = time(NULL);
+    schedule_engine_compile(&sprinkler_data);
+    watering_plan_rebuild(&sprinkler_data, now);
+
+    for (int i = 0; i < MAX_PROGRAMS; i++)
+    {
+        program_t *program = &sprinkler_data.programs[i];
+        time_t from = sprinkler_program_next_run_from(program, now);
+        uint32_t next_run = program->id ? sprinkler_time_to_offset(watering_plan_next_run(program->id, from)) : 0;
+        if (program->id && program->next_run != next_run)
+        {
+            program->next_run = next_run;
+            mark_program(program->id, CHANGE_NEXT_RUN);
+        }
+    }
 }
 
-esp_err_t sprinkler_create_or_update_zone(uint8_t zone_id, const char *name, uint8_t output)
+// Overlapping programs are allowed, the controller queue policy decides at runtime, so they are only reported
+static void log_program_conflicts(uint8_t program_id)
 {
-    // Update existing zone
-    if (zone_id)
+    uint32_t conflicts = schedule_engine_get_conflicts(program_id);
+    for (int i = 0; i < MAX_PROGRAMS; i++)
     {
-        if (xSemaphoreTake(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
+        if (conflicts & (1UL << i))
         {
-            ESP_LOGE(TAG, "Failed to take mutex in sprinkler_remove_zone");
-            return ESP_ERR_TIMEOUT;
+            ESP_LOGW(TAG, "Program %d overlaps program %d", program_id, i + 1);
         }
+    }
+}
+
+// Sort and deduplicate start times, the schedule engine walks them in order
+static esp_err_t normalize_schedule(const schedule_t *input, schedule_t *schedule)
+{
+    if (input->mode > SCHEDULE_MODE_EVEN_DAYS || input->start_count == 0 || input->start_count > MAX_START_TIMES)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (input->mode == SCHEDULE_MODE_INTERVAL && (input->interval_days == 0 || input->interval_days > MAX_INTERVAL_DAYS))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
 
-        zone_t *zone = &sprinkler_data.zones[zone_id - 1];
-        if (zone->id == 0)
+    *schedule = *input;
+    schedule->start_count = 0;
+    for (int i = 0; i < input->start_count; i++)
+    {
+        uint16_t minute = input->start_times[i];
+        if (start_time_ref(minute) == START_REF_CLOCK ? minute >= 24 * 60 : abs(start_time_offset(minute)) > START_TIME_MAX_OFFSET)
         {
-            xSemaphoreGive(sprinkler_data_mutex);
-            return ESP_ERR_INVALID_STATE;
+            return ESP_ERR_INVALID_ARG;
         }
-        strncpy(zone->name, name, MAX_ZONE_NAME_LEN - 1);
-        zone->output = output;
-        esp_err_t ret = sprinkler_save_zone(zone);
-        xSemaphoreGive(sprinkler_data_mutex);
 
-        init_zone_gpio(zone);
+        bool duplicate = false;
+        for (int j = 0; j < schedule->start_count; j++)
+        {
+            duplicate |= schedule->start_times[j] == minute;
+        }
+        if (duplicate)
+        {
+            continue;
+        }
 
-        if (ret == ESP_OK)
+        int j = schedule->start_count;
+        while (j > 0 && schedule->start_times[j - 1] > minute)
         {
-            broadcast_zone_update();
+            schedule->start_times[j] = schedule->start_times[j - 1];
+            j--;
         }
-        return ret;
+        schedule->start_times[j] = minute;
+        schedule->start_count++;
     }
+    return ESP_OK;
+}
 
-    if (sprinkler_data.zone_count >= MAX_ZONES)
+static void publish_changes(void)
+{
+    for (int i = 0; i < MAX_ZONES; i++)
     {
-        return ESP_ERR_NO_MEM;
+        if (transaction.zone_fields[i])
+        {
+            change_events_publish(CHANGE_ZONE, i + 1, transaction.zone_fields[i]);
+        }
     }
-
-    // Find the first available slot (could have holes from deleted zones)
-    int available_slot = -1;
-
-    for (int i = 0; i < MAX_ZONES; i++)
+    for (int i = 0; i < MAX_PROGRAMS; i++)
     {
-        if (sprinkler_data.zones[i].id == 0) // Empty slot
+        if (transaction.program_fields[i])
         {
-            available_slot = i;
-            break;
+            change_events_publish(CHANGE_PROGRAM, i + 1, transaction.program_fields[i]);
         }
     }
 
-    if (available_slot == -1)
+    // Durations and conflicts of every program follow the schedules, even when none of them changed
+    if (transaction.reschedule)
     {
-        return ESP_ERR_NO_MEM;
+        change_events_publish(CHANGE_PROGRAM, 0, CHANGE_TIMING);
     }
+}
 
-    zone_t *zone = &sprinkler_data.zones[available_slot];
-    zone->id = available_slot + 1;
-    strncpy(zone->name, name, MAX_ZONE_NAME_LEN - 1);
-    zone->name[MAX_ZONE_NAME_LEN - 1] = '\0';
-    zone->output = output;
-    zone->enabled = true;
-    zone->last_run = 0;
-
-    // Save the new zone immediately
-    esp_err_t err = sprinkler_save_zone(zone);
-    if (err == ESP_OK)
+// Save, configure and publish what the changes touched, or drop them
+static esp_err_t finish_transaction(void)
+{
+    esp_err_t ret = transaction.result;
+    if (ret != ESP_OK)
     {
-        init_zone_gpio(zone);
-        sprinkler_data.zone_count++;
-        xSemaphoreGive(sprinkler_data_mutex);
-        broadcast_zone_update();
+        if (transaction.snapshot)
+        {
+            memcpy(&sprinkler_data, transaction.snapshot, sizeof(sprinkler_data_t));
+            ESP_LOGW(TAG, "Transaction rolled back: %s", esp_err_to_name(ret));
+        }
     }
     else
     {
-        xSemaphoreGive(sprinkler_data_mutex);
+        if (transaction.reschedule)
+        {
+            compile_schedules();
+        }
+        for (int i = 0; i < MAX_PROGRAMS; i++)
+        {
+            if ((transaction.schedules & (1UL << i)) && sprinkler_data.programs[i].id)
+            {
+                log_program_conflicts(i + 1);
+            }
+        }
+        for (int i = 0; i < MAX_ZONES; i++)
+        {
+            if ((transaction.outputs & (1ULL << i)) && sprinkler_data.zones[i].id)
+            {
+                init_zone_gpio(&sprinkler_data.zones[i]);
+            }
+        }
+
+        ret = sprinkler_save_changes(&sprinkler_data, transaction.zones, transaction.programs);
+        if (ret == ESP_OK)
+        {
+            publish_changes();
+        }
+        else if (transaction.snapshot)
+        {
+            // Records written before the failure are already on flash, write the snapshot's back over them so the
+            // next boot loads what memory goes back to
+            esp_err_t restore = sprinkler_save_changes(transaction.snapshot, transaction.zones, transaction.programs);
+            if (restore != ESP_OK)
+            {
+                ESP_LOGE(TAG, "Failed to restore saved records, flash holds part of the transaction: %s",
+                         esp_err_to_name(restore));
+            }
+            memcpy(&sprinkler_data, transaction.snapshot, sizeof(sprinkler_data_t));
+            if (transaction.reschedule)
+            {
+                compile_schedules();
+            }
+            for (int i = 0; i < MAX_ZONES; i++)
+            {
+                if ((transaction.outputs & (1ULL << i)) && sprinkler_data.zones[i].id)
+                {
+                    init_zone_gpio(&sprinkler_data.zones[i]);
+                }
+            }
+            ESP_LOGE(TAG, "Failed to save changes, rolled back: %s", esp_err_to_name(ret));
+        }
+        else
+        {
+            // A single change has nothing to roll back to, it stays live and is reported as not persisted
+            publish_changes();
+            ESP_LOGE(TAG, "Changes applied but not saved: %s", esp_err_to_name(ret));
+        }
     }
 
-    return err;
+    buffer_release((char *)transaction.snapshot);
+    memset(&transaction, 0, sizeof(transaction));
+    return ret;
 }
 
-esp_err_t sprinkler_remove_zone(uint8_t zone_id)
+// Lock the data for a change, nested inside the current transaction if this task holds one
+static esp_err_t begin_change(const char *caller)
 {
-    if (xSemaphoreTake(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
+    if (xSemaphoreTakeRecursive(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
     {
-        ESP_LOGE(TAG, "Failed to take mutex in sprinkler_remove_zone");
+        ESP_LOGE(TAG, "Failed to take mutex in %s", caller);
         return ESP_ERR_TIMEOUT;
     }
+    transaction.depth++;
+    return ESP_OK;
+}
 
-    // Remove zone from memory
-    memset(&sprinkler_data.zones[zone_id - 1], 0, sizeof(zone_t));
-    sprinkler_data.zone_count--;
-
-    // Remove zone from storage
-    esp_err_t err = sprinkler_delete_zone(zone_id);
-    if (err != ESP_OK)
+// A failed change fails the transaction it is part of, the outermost one reports how the whole went
+static esp_err_t end_change(esp_err_t ret)
+{
+    if (ret != ESP_OK && transaction.result == ESP_OK)
     {
-        xSemaphoreGive(sprinkler_data_mutex);
-        ESP_LOGI(TAG, "Failed to delete zone %d", zone_id);
-        return err;
+        transaction.result = ret;
     }
+    if (--transaction.depth == 0)
+    {
+        ret = finish_transaction();
+    }
+    xSemaphoreGiveRecursive(sprinkler_data_mutex);
+    return ret;
+}
 
-    // Remove zone if used in a program and reorder the zones in the program to fill the gap
-    for (int i = 1; i <= MAX_PROGRAMS; i++)
+esp_err_t sprinkler_repository_init(void)
+{
+    // Recursive, the changes of a transaction lock the data again from the task holding it
+    sprinkler_data_mutex = xSemaphoreCreateRecursiveMutex();
+    if (sprinkler_data_mutex == NULL)
     {
-        sprinkler_remove_zone_from_program(i, zone_id);
+        ESP_LOGE(TAG, "Failed to create sprinkler data mutex");
+        return ESP_ERR_NO_MEM;
     }
 
-    xSemaphoreGive(sprinkler_data_mutex);
+    sprinkler_load_all_data(&sprinkler_data);
 
-    broadcast_zone_update();
-    broadcast_program_update();
+    // The finish-by plan waits for the controller, it needs a trusted clock
+    schedule_engine_compile(&sprinkler_data);
 
-    return err;
+    return ESP_OK;
 }
 
-esp_err_t sprinkler_enable_zone(uint8_t zone_id, bool is_enabled)
+esp_err_t sprinkler_transaction_begin(void)
 {
-    if (xSemaphoreTake(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
+    // The snapshot is leased before taking the lock like the other large buffers, so none waits on the other in reverse.
+    // A nested transaction already has one.
+    bool nested = xSemaphoreGetMutexHolder(sprinkler_data_mutex) == xTaskGetCurrentTaskHandle();
+    char *snapshot = nested ? NULL : buffer_lease(sizeof(sprinkler_data_t), TAG);
+
+    esp_err_t ret = begin_change(__func__);
+    if (ret != ESP_OK || transaction.depth > 1)
     {
-        ESP_LOGE(TAG, "Failed to take mutex in sprinkler_enable_zone");
-        return ESP_ERR_TIMEOUT;
+        buffer_release(snapshot);
+        return ret;
     }
 
-    zone_t *zone = &sprinkler_data.zones[zone_id - 1];
-    zone->enabled = is_enabled;
-
-    esp_err_t err = sprinkler_save_zone(zone);
-    xSemaphoreGive(sprinkler_data_mutex);
-
-    if (err == ESP_OK)
+    transaction.snapshot = (sprinkler_data_t *)snapshot;
+    if (!transaction.snapshot)
     {
-        broadcast_zone_update();
+        ESP_LOGE(TAG, "No memory for a transaction");
+        transaction.depth--;
+        xSemaphoreGiveRecursive(sprinkler_data_mutex);
+        return ESP_ERR_NO_MEM;
     }
+    memcpy(transaction.snapshot, &sprinkler_data, sizeof(sprinkler_data_t));
+    return ESP_OK;
+}
+
+esp_err_t sprinkler_transaction_commit(void)
+{
+    return end_change(ESP_OK);
+}
 
-    return err;
+void sprinkler_transaction_abort(void)
+{
+    end_change(ESP_ERR_INVALID_STATE);
 }
 
-esp_err_t sprinkler_create_or_update_program(uint8_t program_id, const char *name, uint8_t days,
-                                             uint8_t start_hour, uint8_t start_minute, const program_zone_t *zones, uint8_t zone_count)
+esp_err_t sprinkler_create_or_update_zone(uint8_t zone_id, const char *name, uint8_t output)
 {
-    if (xSemaphoreTake(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
+    // Outputs are numbered by the valve driver, GPIO numbers or shift register bits
+    if (!valve_outputs_is_valid(output))
     {
-        ESP_LOGE(TAG, "Failed to take mutex in sprinkler_create_or_update_program");
-        return ESP_ERR_TIMEOUT;
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = begin_change(__func__);
+    if (ret != ESP_OK)
+    {
+        return ret;
     }
 
     // Update existing zone
-    if (program_id)
+    if (zone_id)
     {
-        program_t *program = &sprinkler_data.programs[program_id - 1];
-        if (program->id == 0)
+        zone_t *zone = find_zone(zone_id);
+        sprinkler_name_t zone_name = zone ? zone->name : 0;
+        ret = zone ? sprinkler_model_set_name(&sprinkler_data, &zone_name, name) : ESP_ERR_INVALID_STATE;
+        if (ret == ESP_OK)
         {
-            xSemaphoreGive(sprinkler_data_mutex);
-            return ESP_ERR_INVALID_STATE;
+            zone->name = zone_name;
+            zone->output = output;
+            mark_zone(zone_id, CHANGE_NAME | CHANGE_OUTPUT);
+            transaction.outputs |= 1ULL << (zone_id - 1);
         }
-        strncpy(program->name, name, MAX_ZONE_NAME_LEN - 1);
-        program->schedule.days = days;
-        program->schedule.start_hour = start_hour;
-        program->schedule.start_minute = start_minute;
-
-        // Update zones
-        program->zone_count = zone_count;
-        for (int i = 0; i < zone_count; i++)
+        return end_change(ret);
+    }
+
+    // Find the first available slot (could have holes from deleted zones)
+    int available_slot = -1;
+
+    for (int i = 0; i < MAX_ZONES; i++)
+    {
+        if (sprinkler_data.zones[i].id == 0) // Empty slot
         {
-            program_zone_t *zone = &program->zones[i];
-            zone->zone_id = zones[i].zone_id;
-            zone->order = zones[i].order;
-            zone->duration = zones[i].duration;
+            available_slot = i;
+            break;
         }
+    }
+
+    if (available_slot == -1)
+    {
+        return end_change(ESP_ERR_NO_MEM);
+    }
 
-        program->next_run = calculate_next_run(days, start_hour, start_minute);
+    zone_t *zone = &sprinkler_data.zones[available_slot];
+    zone->id = available_slot + 1;
+    zone->output = output;
+    zone->enabled = true;
+    zone->last_run = 0;
+    ret = sprinkler_model_set_name(&sprinkler_data, &zone->name, name);
+    if (ret == ESP_OK)
+    {
+        sprinkler_data.zone_count++;
+        mark_zone(zone->id, CHANGE_CREATED);
+        transaction.outputs |= 1ULL << available_slot;
+    }
+    else
+    {
+        sprinkler_model_clear_zone(&sprinkler_data, zone);
+    }
 
-        esp_err_t ret = sprinkler_save_program(program);
-        xSemaphoreGive(sprinkler_data_mutex);
+    return end_change(ret);
+}
 
-        if (ret == ESP_OK)
-        {
-            broadcast_program_update();
-        }
+esp_err_t sprinkler_remove_zone(uint8_t zone_id)
+{
+    esp_err_t ret = begin_change(__func__);
+    if (ret != ESP_OK)
+    {
         return ret;
     }
 
-    if (sprinkler_data.program_count >= MAX_PROGRAMS)
+    zone_t *zone = find_zone(zone_id);
+    if (!zone)
     {
-        xSemaphoreGive(sprinkler_data_mutex);
-        return ESP_ERR_NO_MEM;
+        return end_change(ESP_ERR_INVALID_ARG);
     }
 
-    // Find the first available slot (could have holes from deleted zones)
-    int available_slot = -1;
-
+    // Remove zone from the programs using it and reorder their zones to fill the gap, the others are untouched
+    uint32_t programs = sprinkler_zone_programs(&sprinkler_data, zone_id);
     for (int i = 0; i < MAX_PROGRAMS; i++)
     {
-        if (sprinkler_data.programs[i].id == 0) // Empty slot
+        if (programs & (1UL << i))
         {
-            available_slot = i;
-            break;
+            sprinkler_remove_zone_from_program(&sprinkler_data.programs[i], zone_id);
         }
     }
+    transaction.reschedule |= programs != 0;
 
-    if (available_slot == -1)
+    // Remove zone from memory, and from storage when the change ends
+    sprinkler_model_clear_zone(&sprinkler_data, zone);
+    sprinkler_data.zone_count--;
+    mark_zone(zone_id, CHANGE_DELETED);
+
+    return end_change(ESP_OK);
+}
+
+esp_err_t sprinkler_enable_zone(uint8_t zone_id, bool is_enabled)
+{
+    esp_err_t ret = begin_change(__func__);
+    if (ret != ESP_OK)
     {
-        xSemaphoreGive(sprinkler_data_mutex);
-        return ESP_ERR_NO_MEM;
+        return ret;
     }
 
-    program_t *program = &sprinkler_data.programs[available_slot];
-    program->id = available_slot + 1;
-    strncpy(program->name, name, MAX_PROGRAM_NAME_LEN - 1);
-    program->name[MAX_PROGRAM_NAME_LEN - 1] = '\0';
-    program->enabled = true;
+    zone_t *zone = find_zone(zone_id);
+    if (!zone)
+    {
+        return end_change(ESP_ERR_INVALID_ARG);
+    }
 
-    program->schedule.days = days;
-    program->schedule.start_hour = start_hour;
-    program->schedule.start_minute = start_minute;
+    // Only the programs running the zone change duration, with none the plan stays as is
+    zone->enabled = is_enabled;
+    transaction.reschedule |= sprinkler_zone_programs(&sprinkler_data, zone_id) != 0;
+    mark_zone(zone_id, CHANGE_ENABLED);
+
+    return end_change(ESP_OK);
+}
 
-    // Update zones
-    program->zone_count = zone_count;
+// Programs only list zones that exist, as staged so far when in a transaction
+static bool zones_exist(const program_zone_t *zones, uint8_t zone_count)
+{
     for (int i = 0; i < zone_count; i++)
     {
-        program_zone_t *zone = &program->zones[i];
-        zone->zone_id = zones[i].zone_id;
-        zone->order = zones[i].order;
-        zone->duration = zones[i].duration;
+        if (!find_zone(zones[i].zone_id))
+        {
+            ESP_LOGE(TAG, "Zone %d doesn't exist", zones[i].zone_id);
+            return false;
+        }
     }
+    return true;
+}
 
-    program->last_run = 0;
-    program->next_run = calculate_next_run(days, start_hour, start_minute);
+esp_err_t sprinkler_create_or_update_program(uint8_t program_id, const char *name, const schedule_t *input_schedule,
+                                             const program_zone_t *zones, uint8_t zone_count, uint8_t budget_percent)
+{
+    schedule_t schedule;
+    if (normalize_schedule(input_schedule, &schedule) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Invalid schedule for program %s", name);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (budget_percent == 0 || budget_percent > WATER_BUDGET_MAX_PERCENT)
+    {
+        ESP_LOGE(TAG, "Invalid water budget for program %s", name);
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    // Save the new program immediately
-    esp_err_t err = sprinkler_save_program(program);
+    esp_err_t ret = begin_change(__func__);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    if (!zones_exist(zones, zone_count))
+    {
+        return end_change(ESP_ERR_INVALID_ARG);
+    }
 
-    if (err == ESP_OK)
+    program_t *program;
+    if (program_id)
     {
-        sprinkler_data.program_count++;
-        xSemaphoreGive(sprinkler_data_mutex);
-        broadcast_program_update();
+        // Update existing program, left as it was if the new zones or name don't fit
+        program = find_program(program_id);
+        if (!program)
+        {
+            return end_change(ESP_ERR_INVALID_STATE);
+        }
+        sprinkler_name_t program_name = program->name;
+        ret = sprinkler_model_set_name(&sprinkler_data, &program_name, name);
+        if (ret == ESP_OK)
+        {
+            ret = sprinkler_model_set_program_zones(&sprinkler_data, program, zones, zone_count);
+        }
+        if (ret != ESP_OK)
+        {
+            return end_change(ret);
+        }
+        program->name = program_name;
+        mark_program(program->id, CHANGE_NAME | CHANGE_SCHEDULE | CHANGE_ZONES | CHANGE_BUDGET);
     }
     else
     {
-        xSemaphoreGive(sprinkler_data_mutex);
+        // Find the first available slot (could have holes from deleted programs)
+        int available_slot = -1;
+
+        for (int i = 0; i < MAX_PROGRAMS; i++)
+        {
+            if (sprinkler_data.programs[i].id == 0) // Empty slot
+            {
+                available_slot = i;
+                break;
+            }
+        }
+
+        if (available_slot == -1)
+        {
+            return end_change(ESP_ERR_NO_MEM);
+        }
+
+        program = &sprinkler_data.programs[available_slot];
+        program->id = available_slot + 1;
+        program->enabled = true;
+        program->last_run = 0;
+        program->next_run = 0;
+        ret = sprinkler_model_set_program_zones(&sprinkler_data, program, zones, zone_count);
+        if (ret == ESP_OK)
+        {
+            ret = sprinkler_model_set_name(&sprinkler_data, &program->name, name);
+        }
+        if (ret != ESP_OK)
+        {
+            sprinkler_model_clear_program(&sprinkler_data, program);
+            return end_change(ret);
+        }
+        sprinkler_data.program_count++;
+        mark_program(program->id, CHANGE_CREATED);
     }
 
-    return err;
+    // Next run and conflicts follow once the schedules are compiled
+    program->schedule = schedule;
+    program->budget_percent = budget_percent;
+    transaction.schedules |= 1UL << (program->id - 1);
+    transaction.reschedule = true;
+
+    return end_change(ESP_OK);
 }
 
 esp_err_t sprinkler_remove_program(uint8_t program_id)
 {
-    if (xSemaphoreTake(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
+    esp_err_t ret = begin_change(__func__);
+    if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to take mutex in sprinkler_remove_program");
-        return ESP_ERR_TIMEOUT;
+        return ret;
     }
 
-    // Remove program from memory
-    memset(&sprinkler_data.programs[program_id - 1], 0, sizeof(program_t));
-    sprinkler_data.program_count--;
-
-    // Remove zone from storage
-    esp_err_t err = sprinkler_delete_program(program_id);
-    xSemaphoreGive(sprinkler_data_mutex);
-
-    if (err == ESP_OK)
+    program_t *program = find_program(program_id);
+    if (!program)
     {
-        broadcast_program_update();
+        return end_change(ESP_ERR_INVALID_ARG);
     }
 
-    return err;
+    // Remove program from memory, and from storage when the change ends
+    sprinkler_model_clear_program(&sprinkler_data, program);
+    sprinkler_data.program_count--;
+    mark_program(program_id, CHANGE_DELETED);
+    transaction.reschedule = true;
+
+    return end_change(ESP_OK);
 }
 
 esp_err_t sprinkler_enable_program(uint8_t program_id, bool is_enabled)
 {
-    if (xSemaphoreTake(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
+    esp_err_t ret = begin_change(__func__);
+    if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to take mutex in sprinkler_enable_program");
-        return ESP_ERR_TIMEOUT;
+        return ret;
     }
 
-    program_t *program = &sprinkler_data.programs[program_id - 1];
-    program->enabled = is_enabled;
-
-    esp_err_t err = sprinkler_save_program(program);
-    xSemaphoreGive(sprinkler_data_mutex);
-
-    if (err == ESP_OK)
+    program_t *program = find_program(program_id);
+    if (!program)
     {
-        broadcast_program_update();
+        return end_change(ESP_ERR_INVALID_ARG);
     }
 
-    return err;
+    program->enabled = is_enabled;
+    mark_program(program_id, CHANGE_ENABLED);
+    transaction.reschedule = true;
+
+    return end_change(ESP_OK);
 }
 
 esp_err_t sprinkler_add_zone_to_program(uint8_t program_id,
                                         uint8_t zone_id, uint16_t duration, uint8_t order)
 {
-    if (xSemaphoreTake(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
+    esp_err_t ret = begin_change(__func__);
+    if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to take mutex in sprinkler_add_zone_to_program");
-        return ESP_ERR_TIMEOUT;
+        return ret;
     }
 
-    if (program_id > sprinkler_data.program_count || program_id == 0)
+    program_t *program = find_program(program_id);
+    if (!program || !find_zone(zone_id))
     {
-        xSemaphoreGive(sprinkler_data_mutex);
-        return ESP_ERR_INVALID_ARG;
+        return end_change(ESP_ERR_INVALID_ARG);
     }
-
-    program_t *program = &sprinkler_data.programs[program_id - 1];
     if (program->zone_count >= MAX_ZONES_PER_PROGRAM)
     {
-        xSemaphoreGive(sprinkler_data_mutex);
-        return ESP_ERR_NO_MEM;
+        return end_change(ESP_ERR_NO_MEM);
     }
 
-    program_zone_t *prog_zone = &program->zones[program->zone_count];
-    prog_zone->zone_id = zone_id;
-    prog_zone->duration = duration;
-    prog_zone->order = order;
-
-    program->zone_count++;
-
-    // Save the updated program immediately
-    esp_err_t ret = sprinkler_save_program(program);
-    xSemaphoreGive(sprinkler_data_mutex);
+    // The list is rewritten at the end of the packed program zones with the new zone appended
+    program_zone_t zones[MAX_ZONES_PER_PROGRAM];
+    memcpy(zones, sprinkler_program_zones(&sprinkler_data, program), program->zone_count * sizeof(program_zone_t));
+    zones[program->zone_count] = (program_zone_t){
+        .zone_id = zone_id,
+        .order = order,
+        .duration = duration,
+    };
 
+    ret = sprinkler_model_set_program_zones(&sprinkler_data, program, zones, program->zone_count + 1);
     if (ret == ESP_OK)
     {
-        broadcast_program_update();
+        mark_program(program_id, CHANGE_ZONES);
+        transaction.schedules |= 1UL << (program_id - 1);
+        transaction.reschedule = true;
     }
-    return ret;
+    return end_change(ret);
 }
 
 esp_err_t sprinkler_update_zone_status(uint8_t zone_id, bool turn_on)
 {
-    if (xSemaphoreTake(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
+    esp_err_t ret = begin_change(__func__);
+    if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to take mutex in sprinkler_update_zone_status");
-        return ESP_ERR_TIMEOUT;
+        return ret;
     }
 
-    if (turn_on)
+    zone_t *zone = find_zone(zone_id);
+    if (!zone)
     {
-        time(&sprinkler_data.zones[zone_id - 1].last_run);
+        return end_change(ESP_ERR_INVALID_ARG);
     }
 
-    // Save the updated zone immediately
-    esp_err_t ret = sprinkler_save_zone(&sprinkler_data.zones[zone_id - 1]);
-    xSemaphoreGive(sprinkler_data_mutex);
-
-    if (ret == ESP_OK)
+    if (turn_on)
     {
-        broadcast_zone_update();
+        zone->last_run = sprinkler_time_to_offset(time(NULL));
     }
-    return ret;
+    mark_zone(zone_id, CHANGE_STATUS | (turn_on ? CHANGE_LAST_RUN : 0));
+
+    return end_change(ESP_OK);
 }
 
 esp_err_t sprinkler_update_program_next_run(uint8_t program_id)
 {
-    if (xSemaphoreTake(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
+    esp_err_t ret = begin_change(__func__);
+    if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to take mutex in sprinkler_update_program_next_run");
-        return ESP_ERR_TIMEOUT;
+        return ret;
     }
 
-    program_t *program = &sprinkler_data.programs[program_id - 1];
-    program->next_run = calculate_next_run(program->schedule.days, program->schedule.start_hour, program->schedule.start_minute);
+    program_t *program = find_program(program_id);
+    if (!program)
+    {
+        return end_change(ESP_ERR_INVALID_ARG);
+    }
 
-    esp_err_t ret = sprinkler_save_program(&sprinkler_data.programs[program_id - 1]);
-    xSemaphoreGive(sprinkler_data_mutex);
+    time_t from = sprinkler_program_next_run_from(program, time(NULL));
+    program->next_run = sprinkler_time_to_offset(watering_plan_next_run(program_id, from));
+    mark_program(program_id, CHANGE_NEXT_RUN);
 
+    ret = end_change(ESP_OK);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to save program next run");
-        return ret;
     }
-
-    broadcast_program_update();
-    return ESP_OK;
+    return ret;
 }
 
 esp_err_t sprinkler_update_program_last_run(uint8_t program_id)
 {
-    if (xSemaphoreTake(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
+    esp_err_t ret = begin_change(__func__);
+    if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to take mutex in sprinkler_update_program_last_run");
-        return ESP_ERR_TIMEOUT;
+        return ret;
+    }
+
+    program_t *program = find_program(program_id);
+    if (!program)
+    {
+        return end_change(ESP_ERR_INVALID_ARG);
     }
 
-    time(&sprinkler_data.programs[program_id - 1].last_run);
-    esp_err_t ret = sprinkler_save_program(&sprinkler_data.programs[program_id - 1]);
-    xSemaphoreGive(sprinkler_data_mutex);
+    program->last_run = sprinkler_time_to_offset(time(NULL));
+    mark_program(program_id, CHANGE_LAST_RUN);
 
+    ret = end_change(ESP_OK);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to save program last run");
-        return ret;
     }
-
-    broadcast_program_update();
-    return ESP_OK;
+    return ret;
 }
 
-// Note: This function is called from sprinkler_remove_zone which already holds the mutex
-// So we don't need to acquire it again here
-static esp_err_t sprinkler_remove_zone_from_program(uint8_t program_id,
-                                                    uint8_t zone_id)
+// Called from sprinkler_remove_zone with the change already begun
+static esp_err_t sprinkler_remove_zone_from_program(program_t *program, uint8_t zone_id)
 {
-    if (program_id > sprinkler_data.program_count || program_id == 0)
-    {
-        return ESP_ERR_INVALID_ARG;
-    }
-
-    program_t *program = &sprinkler_data.programs[program_id - 1];
-    bool program_modified = false;
+    const program_zone_t *current = sprinkler_program_zones(&sprinkler_data, program);
 
-    // Find and remove the zone from this program
+    // Keep the other zones, the ones after a removed zone move up in the order to fill the gap
+    program_zone_t zones[MAX_ZONES_PER_PROGRAM];
+    uint8_t zone_count = 0;
     for (int j = 0; j < program->zone_count; j++)
     {
-        if (program->zones[j].zone_id == zone_id)
+        if (current[j].zone_id != zone_id)
         {
-            // Shift all subsequent zones left to fill the gap
-            for (int k = j; k < program->zone_count - 1; k++)
-            {
-                program->zones[k] = program->zones[k + 1];
-                program->zones[k].order -= 1;
-            }
-            program->zone_count--;
-            program_modified = true;
-            j--; // Decrement j to check the same position again (now contains the next zone)
+            zones[zone_count] = current[j];
+            zones[zone_count].order -= j - zone_count;
+            zone_count++;
         }
     }
-
-    // Save the modified program if it was changed
-    if (program_modified)
+    if (zone_count == program->zone_count)
     {
-        esp_err_t ret = sprinkler_save_program(program);
-        if (ret != ESP_OK)
-        {
-            ESP_LOGI(TAG, "Failed to save program %d", program->id);
-        }
-        else
-        {
-            ESP_LOGI(TAG, "Removed zone %d from program %d", zone_id, program->id);
-        }
-        return ret;
+        return ESP_OK;
     }
 
+    // A shorter list always fits
+    sprinkler_model_set_program_zones(&sprinkler_data, program, zones, zone_count);
+    mark_program(program->id, CHANGE_ZONES);
+    ESP_LOGI(TAG, "Removed zone %d from program %d", zone_id, program->id);
     return ESP_OK;
 }
 
@@ -487,10 +753,10 @@ esp_err_t safe_sprinklerdata_operation(esp_err_t (*operation)(const sprinkler_da
 {
     esp_err_t ret = ESP_FAIL;
 
-    if (xSemaphoreTake(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) == pdTRUE)
+    if (xSemaphoreTakeRecursive(sprinkler_data_mutex, pdMS_TO_TICKS(1000)) == pdTRUE)
     {
         ret = operation(&sprinkler_data, user_data);
-        xSemaphoreGive(sprinkler_data_mutex);
+        xSemaphoreGiveRecursive(sprinkler_data_mutex);
     }
     else
     {
@@ -498,4 +764,4 @@ esp_err_t safe_sprinklerdata_operation(esp_err_t (*operation)(const sprinkler_da
     }
 
     return ret;
-}
\ No newline at end of file
+}
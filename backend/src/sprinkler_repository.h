@@ -8,11 +8,30 @@ extern sprinkler_data_t sprinkler_data;
 
 esp_err_t sprinkler_repository_init(void);
 
+/**
+ * @brief Group the repository changes that follow into one transaction, until committed or aborted
+ * Each change is validated against the ones staged before it. Nothing is saved or published until the commit,
+ * which saves every touched record and publishes one change event per zone or program. The data stays locked for the
+ * other tasks in between. Transactions nest, only the outermost one commits.
+ * Saving is not atomic on flash: if a record fails, the ones already written are rewritten from the rollback copy.
+ *
+ * @return esp_err_t ESP_ERR_NO_MEM without room for the rollback copy, no transaction is open
+ */
+esp_err_t sprinkler_transaction_begin(void);
+
+/**
+ * @brief Commit the transaction, or roll every change back if one of them failed or saving did
+ *
+ * @return esp_err_t Error of the first failed change, or of saving
+ */
+esp_err_t sprinkler_transaction_commit(void);
+void sprinkler_transaction_abort(void);
+
 esp_err_t sprinkler_create_or_update_zone(uint8_t zone_id, const char *name, uint8_t output);
 esp_err_t sprinkler_remove_zone(uint8_t zone_id);
 esp_err_t sprinkler_enable_zone(uint8_t zone_id, bool is_enabled);
-esp_err_t sprinkler_create_or_update_program(uint8_t program_id, const char *name, uint8_t days,
-                                             uint8_t start_hour, uint8_t start_minute, const program_zone_t *zones, uint8_t zone_count);
+esp_err_t sprinkler_create_or_update_program(uint8_t program_id, const char *name, const schedule_t *schedule,
+                                             const program_zone_t *zones, uint8_t zone_count, uint8_t budget_percent);
 esp_err_t sprinkler_remove_program(uint8_t program_id);
 esp_err_t sprinkler_enable_program(uint8_t program_id, bool is_enabled);
 esp_err_t sprinkler_add_zone_to_program(uint8_t program_id,
@@ -2,6 +2,11 @@
 
 #include "sprinkler_serialization.h"
 
+#include "schedule_engine.h"
+#include "watering_plan.h"
+#include "days_utils.h"
+#include "timezone.h"
+
 #include "esp_log.h"
 #include <stdio.h>
 #include <string.h>
@@ -75,6 +80,38 @@ const char *zone_status_to_string(zone_t *zone, sprinkler_controller_status_t *s
     return "idle";
 }
 
+// Program ids of a mask as a JSON array
+static void start_times_to_json(const schedule_t *schedule, char *buffer, size_t size)
+{
+    size_t len = snprintf(buffer, size, "[");
+    for (int i = 0; i < schedule->start_count && len < size; i++)
+    {
+        char start_time[START_TIME_STRING_LEN];
+        start_time_to_string(schedule->start_times[i], start_time, sizeof(start_time));
+        len += snprintf(buffer + len, size - len, "%s\"%s\"", i ? "," : "", start_time);
+    }
+    if (len < size)
+    {
+        snprintf(buffer + len, size - len, "]");
+    }
+}
+
+static void program_mask_to_json(uint32_t mask, char *buffer, size_t size)
+{
+    size_t len = snprintf(buffer, size, "[");
+    for (int i = 0; i < MAX_PROGRAMS && len < size; i++)
+    {
+        if (mask & (1UL << i))
+        {
+            len += snprintf(buffer + len, size - len, "%s%d", len > 1 ? "," : "", i + 1);
+        }
+    }
+    if (len < size)
+    {
+        snprintf(buffer + len, size - len, "]");
+    }
+}
+
 const char *program_status_to_string(program_t *program, sprinkler_controller_status_t *sprinkler_status)
 {
     if (!program->enabled)
@@ -85,6 +122,10 @@ const char *program_status_to_string(program_t *program, sprinkler_controller_st
     {
         return "running";
     }
+    if (sprinkler_controller_is_program_queued(program->id))
+    {
+        return "queued";
+    }
     return "scheduled";
 }
 
@@ -108,10 +149,10 @@ esp_err_t sprinkler_zones_to_json(const sprinkler_data_t *data, char *json_buffe
                  "%s{\"id\":%d,\"name\":\"%s\",\"output\":%d,\"enabled\":%s,\"lastRun\":%lld,\"status\":\"%s\"}",
                  (first ? "" : ","),
                  zone->id,
-                 zone->name,
+                 sprinkler_name(data, zone->name),
                  zone->output,
                  zone->enabled ? "true" : "false",
-                 zone->last_run,
+                 (long long)sprinkler_time_from_offset(zone->last_run),
                  zone_status_to_string(zone, &sprinkler_status));
 
         // Check if we have enough space
@@ -137,6 +178,7 @@ esp_err_t sprinkler_programs_to_json(const sprinkler_data_t *data, char *json_bu
     char entry[JSON_ENTRY_SIZE];
     char zone_entry[64];
     char days_buffer[16];
+    char start_times_buffer[(START_TIME_STRING_LEN + 3) * MAX_START_TIMES + 3];
 
     sprinkler_controller_get_status(&sprinkler_status);
 
@@ -151,17 +193,23 @@ esp_err_t sprinkler_programs_to_json(const sprinkler_data_t *data, char *json_bu
 
         program_t *prog = (program_t *)&data->programs[program_id - 1];
         days_to_json(prog->schedule.days, days_buffer, sizeof(days_buffer));
+        start_times_to_json(&prog->schedule, start_times_buffer, sizeof(start_times_buffer));
+        int year, month, day;
+        timezone_date_from_days(prog->schedule.interval_anchor, &year, &month, &day);
 
         // Start program entry
         snprintf(entry, sizeof(entry),
-                 "%s{\"id\":%d,\"name\":\"%s\",\"enabled\":%s,\"schedule\":{\"days\":%s,\"startTime\":\"%02d:%02d\"},\"zones\":[",
+                 "%s{\"id\":%d,\"name\":\"%s\",\"enabled\":%s,\"schedule\":{\"mode\":\"%s\",\"days\":%s,\"startTimes\":%s,"
+                 "\"interval\":%d,\"startDate\":\"%04d-%02d-%02d\"},\"zones\":[",
                  (first ? "" : ","),
                  prog->id,
-                 prog->name,
+                 sprinkler_name(data, prog->name),
                  prog->enabled ? "true" : "false",
+                 schedule_mode_to_string(prog->schedule.mode),
                  days_buffer,
-                 prog->schedule.start_hour,
-                 prog->schedule.start_minute);
+                 start_times_buffer,
+                 prog->schedule.interval_days,
+                 year, month, day);
 
         if (strlen(json_buffer) + strlen(entry) >= buffer_size - 100)
         {
@@ -172,9 +220,10 @@ esp_err_t sprinkler_programs_to_json(const sprinkler_data_t *data, char *json_bu
         strncat(json_buffer, entry, buffer_size - strlen(json_buffer) - 1);
 
         // Add zones for this program
+        const program_zone_t *zones = sprinkler_program_zones(data, prog);
         for (int j = 0; j < prog->zone_count; j++)
         {
-            program_zone_t *pz = (program_zone_t *)&prog->zones[j];
+            const program_zone_t *pz = &zones[j];
             snprintf(zone_entry, sizeof(zone_entry),
                      "%s{\"id\":%d,\"duration\":%d,\"order\":%d}",
                      (j > 0 ? "," : ""),
@@ -191,11 +240,17 @@ esp_err_t sprinkler_programs_to_json(const sprinkler_data_t *data, char *json_bu
             strncat(json_buffer, zone_entry, buffer_size - strlen(json_buffer) - 1);
         }
 
+        // Programs whose watering windows overlap this one
+        char conflicts_buffer[4 * MAX_PROGRAMS + 3];
+        program_mask_to_json(schedule_engine_get_conflicts(prog->id), conflicts_buffer, sizeof(conflicts_buffer));
+
         // Close zones array and add program metadata
         snprintf(entry, sizeof(entry),
-                 "],\"lastRun\":%lld,\"nextRun\":%lld,\"status\":\"%s\"}",
-                 prog->last_run,
-                 prog->next_run,
+                 "],\"budget\":%d,\"lastRun\":%lld,\"nextRun\":%lld,\"conflicts\":%s,\"status\":\"%s\"}",
+                 prog->budget_percent,
+                 (long long)sprinkler_time_from_offset(prog->last_run),
+                 (long long)sprinkler_time_from_offset(prog->next_run),
+                 conflicts_buffer,
                  program_status_to_string(prog, &sprinkler_status));
 
         if (strlen(json_buffer) + strlen(entry) >= buffer_size - 10)
@@ -214,3 +269,31 @@ esp_err_t sprinkler_programs_to_json(const sprinkler_data_t *data, char *json_bu
     ESP_LOGI(TAG, "Generated programs JSON (%d bytes)", strlen(json_buffer));
     return ESP_OK;
 }
+
+esp_err_t sprinkler_plan_to_json(const sprinkler_data_t *data, char *json_buffer, size_t buffer_size)
+{
+    const watering_plan_t *plan = watering_plan_get();
+
+    // Compact [start,program,seconds,scale,nominal] tuples, like the calendar
+    int len = snprintf(json_buffer, buffer_size,
+                       "{\"type\":\"plan\",\"windowOpen\":%lld,\"deadline\":%lld,\"scalePercent\":%d,\"runs\":[",
+                       (long long)plan->window_open, (long long)plan->deadline, plan->deadline ? plan->scale_percent : 100);
+    for (int i = 0; i < plan->run_count && len < buffer_size; i++)
+    {
+        const planned_run_t *run = &plan->runs[i];
+        len += snprintf(json_buffer + len, buffer_size - len, "%s[%lld,%d,%lu,%d,%lld]",
+                        i ? "," : "", (long long)run->start, run->program_id, (unsigned long)run->seconds,
+                        run->scale_percent, (long long)run->nominal);
+    }
+    if (len < buffer_size)
+    {
+        len += snprintf(json_buffer + len, buffer_size - len, "]}");
+    }
+    if (len >= buffer_size)
+    {
+        ESP_LOGE(TAG, "JSON buffer too small for plan");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
@@ -5,12 +5,13 @@
 #include "sprinkler_storage.h"
 #include "sprinkler_controller.h"
 
-#define JSON_BUFFER_SIZE 2048
-#define JSON_ENTRY_SIZE 256
+#define JSON_BUFFER_SIZE 16384 // Zone and program lists at full capacity with typical names
+#define JSON_ENTRY_SIZE 384
 
 // Function prototypes for JSON serialization
 esp_err_t sprinkler_zones_to_json(const sprinkler_data_t *data, char *json_buffer, size_t buffer_size);
 esp_err_t sprinkler_programs_to_json(const sprinkler_data_t *data, char *json_buffer, size_t buffer_size);
+esp_err_t sprinkler_plan_to_json(const sprinkler_data_t *data, char *json_buffer, size_t buffer_size);
 
 // Helper functions for time formatting
 int days_to_json(uint8_t days, char *buffer, size_t buffer_size);
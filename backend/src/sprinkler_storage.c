@@ -2,7 +2,8 @@
 
 #include "sprinkler_storage.h"
 
-#include "ws_sprinkler.h"
+#include "sprinkler_model.h"
+#include "water_budget.h"
 
 #include "nvs_flash.h"
 #include "nvs.h"
@@ -11,36 +12,266 @@
 
 static const char *TAG = "SPRINKLER_STORAGE";
 
+// Zones and programs are saved with their names and zone lists inline, pool offsets don't survive a reboot
+typedef struct
+{
+    uint8_t id;
+    uint8_t output;
+    bool enabled;
+    char name[MAX_ZONE_NAME_LEN];
+    uint32_t last_run;
+} zone_record_t;
+
+typedef struct
+{
+    uint8_t id;
+    bool enabled;
+    uint8_t budget_percent;
+    uint8_t zone_count;
+    char name[MAX_PROGRAM_NAME_LEN];
+    schedule_t schedule;
+    uint32_t last_run;
+    uint32_t next_run;
+    program_zone_t zones[MAX_ZONES_PER_PROGRAM];
+} program_record_t;
+
+// Layouts saved before the name pool, with inline names and time_t timestamps
+typedef struct
+{
+    uint8_t id;
+    char name[MAX_ZONE_NAME_LEN];
+    uint8_t output;
+    bool enabled;
+    time_t last_run;
+} zone_v1_t;
+
+typedef struct
+{
+    uint8_t zone_id;
+    uint16_t duration;
+    uint8_t order;
+} program_zone_v1_t;
+
+#define MAX_ZONES_PER_PROGRAM_V1 8
+
+// Program layout saved before schedules had several start times and day modes
+typedef struct
+{
+    uint8_t days;
+    uint8_t start_hour;
+    uint8_t start_minute;
+} schedule_v1_t;
+
+typedef struct
+{
+    uint8_t id;
+    char name[MAX_PROGRAM_NAME_LEN];
+    bool enabled;
+    schedule_v1_t schedule;
+    program_zone_v1_t zones[MAX_ZONES_PER_PROGRAM_V1];
+    uint8_t zone_count;
+    time_t last_run;
+    time_t next_run;
+} program_v1_t;
+
+// Then with multi-start schedules and the water budget
+typedef struct
+{
+    uint8_t id;
+    char name[MAX_PROGRAM_NAME_LEN];
+    bool enabled;
+    schedule_t schedule;
+    program_zone_v1_t zones[MAX_ZONES_PER_PROGRAM_V1];
+    uint8_t zone_count;
+    uint8_t budget_percent;
+    time_t last_run;
+    time_t next_run;
+} program_v2_t;
+
+_Static_assert(sizeof(zone_v1_t) != sizeof(zone_record_t), "Zone layouts must be told apart by size");
+_Static_assert(sizeof(program_v1_t) != sizeof(program_record_t) && sizeof(program_v2_t) != sizeof(program_record_t) &&
+                   sizeof(program_v1_t) != sizeof(program_v2_t),
+               "Program layouts must be told apart by size");
+
+static void migrate_zones_v1(const program_zone_v1_t *old, uint8_t count, program_record_t *record)
+{
+    record->zone_count = count < MAX_ZONES_PER_PROGRAM_V1 ? count : MAX_ZONES_PER_PROGRAM_V1;
+    for (int i = 0; i < record->zone_count; i++)
+    {
+        record->zones[i] = (program_zone_t){
+            .zone_id = old[i].zone_id,
+            .order = old[i].order,
+            .duration = old[i].duration,
+        };
+    }
+}
+
+static void migrate_program_v1(const program_v1_t *old, program_record_t *record)
+{
+    memset(record, 0, sizeof(program_record_t));
+    record->id = old->id;
+    memcpy(record->name, old->name, sizeof(record->name));
+    record->enabled = old->enabled;
+    record->schedule.mode = SCHEDULE_MODE_WEEKDAYS;
+    record->schedule.days = old->schedule.days;
+    record->schedule.interval_days = 1;
+    record->schedule.start_count = 1;
+    record->schedule.start_times[0] = old->schedule.start_hour * 60 + old->schedule.start_minute;
+    migrate_zones_v1(old->zones, old->zone_count, record);
+    record->budget_percent = WATER_BUDGET_DEFAULT_PERCENT;
+    record->last_run = sprinkler_time_to_offset(old->last_run);
+    record->next_run = sprinkler_time_to_offset(old->next_run);
+}
+
+static void migrate_program_v2(const program_v2_t *old, program_record_t *record)
+{
+    memset(record, 0, sizeof(program_record_t));
+    record->id = old->id;
+    memcpy(record->name, old->name, sizeof(record->name));
+    record->enabled = old->enabled;
+    record->schedule = old->schedule;
+    migrate_zones_v1(old->zones, old->zone_count, record);
+    record->budget_percent = old->budget_percent;
+    record->last_run = sprinkler_time_to_offset(old->last_run);
+    record->next_run = sprinkler_time_to_offset(old->next_run);
+}
+
+static esp_err_t load_zone(uint8_t zone_id, zone_record_t *record)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "zone_%d", zone_id);
+
+    union
+    {
+        zone_record_t current;
+        zone_v1_t v1;
+    } blob;
+    size_t required_size = sizeof(blob);
+    esp_err_t ret = read_blob(key, &blob, &required_size);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    if (required_size == sizeof(zone_record_t))
+    {
+        *record = blob.current;
+        return ESP_OK;
+    }
+    if (required_size == sizeof(zone_v1_t))
+    {
+        // Converted in memory, written back in the new layout on the next save
+        zone_v1_t old = blob.v1;
+        memset(record, 0, sizeof(zone_record_t));
+        record->id = old.id;
+        record->output = old.output;
+        record->enabled = old.enabled;
+        memcpy(record->name, old.name, sizeof(record->name));
+        record->last_run = sprinkler_time_to_offset(old.last_run);
+        return ESP_OK;
+    }
+
+    ESP_LOGE(TAG, "Zone %d has an unknown layout (%d bytes)", zone_id, required_size);
+    return ESP_ERR_INVALID_SIZE;
+}
+
+static esp_err_t load_program(uint8_t program_id, program_record_t *record)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "prog_%d", program_id);
+
+    union
+    {
+        program_record_t current;
+        program_v1_t v1;
+        program_v2_t v2;
+    } blob;
+    size_t required_size = sizeof(blob);
+    esp_err_t ret = read_blob(key, &blob, &required_size);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    if (required_size == sizeof(program_record_t))
+    {
+        *record = blob.current;
+    }
+    else if (required_size == sizeof(program_v2_t))
+    {
+        ESP_LOGI(TAG, "Migrating program %d to the compact layout", program_id);
+        migrate_program_v2(&blob.v2, record);
+
+        // Programs saved before budgets existed have zeroed padding there
+        if (!record->budget_percent || record->budget_percent > WATER_BUDGET_MAX_PERCENT)
+        {
+            record->budget_percent = WATER_BUDGET_DEFAULT_PERCENT;
+        }
+    }
+    else if (required_size == sizeof(program_v1_t))
+    {
+        ESP_LOGI(TAG, "Migrating program %d to multi-start schedule", program_id);
+        migrate_program_v1(&blob.v1, record);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Program %d has an unknown layout (%d bytes)", program_id, required_size);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    record->zone_count = record->zone_count < MAX_ZONES_PER_PROGRAM ? record->zone_count : MAX_ZONES_PER_PROGRAM;
+    return ESP_OK;
+}
+
 esp_err_t sprinkler_load_all_data(sprinkler_data_t *data)
 {
     esp_err_t err = ESP_OK;
 
     // Initialize data structure
-    memset(data, 0, sizeof(sprinkler_data_t));
+    sprinkler_model_init(data);
 
     // Load all zones
     for (uint8_t i = 1; i <= MAX_ZONES; i++)
     {
-        zone_t zone;
-        if (sprinkler_load_zone(i, &zone) == ESP_OK)
-        {
-            data->zones[zone.id - 1] = zone;
-            data->zone_count++;
-        }
+        zone_record_t record;
+        if (load_zone(i, &record) != ESP_OK || record.id != i)
+            continue;
+
+        zone_t *zone = &data->zones[i - 1];
+        zone->id = record.id;
+        zone->output = record.output;
+        zone->enabled = record.enabled;
+        zone->last_run = record.last_run;
+        record.name[MAX_ZONE_NAME_LEN - 1] = '\0';
+        sprinkler_model_set_name(data, &zone->name, record.name);
+        data->zone_count++;
     }
 
     // Load all programs
     for (uint8_t i = 1; i <= MAX_PROGRAMS; i++)
     {
-        program_t program;
-        if (sprinkler_load_program(i, &program) == ESP_OK)
+        program_record_t record;
+        if (load_program(i, &record) != ESP_OK || record.id != i)
+            continue;
+
+        program_t *program = &data->programs[i - 1];
+        program->id = record.id;
+        program->enabled = record.enabled;
+        program->budget_percent = record.budget_percent;
+        program->schedule = record.schedule;
+        program->last_run = record.last_run;
+        program->next_run = record.next_run;
+        record.name[MAX_PROGRAM_NAME_LEN - 1] = '\0';
+        sprinkler_model_set_name(data, &program->name, record.name);
+        if (sprinkler_model_set_program_zones(data, program, record.zones, record.zone_count) != ESP_OK)
         {
-            data->programs[program.id - 1] = program;
-            data->program_count++;
+            ESP_LOGE(TAG, "No room left for the zones of program %d", i);
         }
+        data->program_count++;
     }
 
-    ESP_LOGI(TAG, "Loaded %d zones and %d programs", data->zone_count, data->program_count);
+    ESP_LOGI(TAG, "Loaded %d zones and %d programs, %d name bytes and %d program zones in use", data->zone_count,
+             data->program_count, data->names_used, data->program_zones_used);
     return err;
 }
 
@@ -61,19 +292,19 @@ void sprinkler_delete_all_data(void)
     ESP_LOGI(TAG, "Deleted all zones and all programs");
 }
 
-esp_err_t sprinkler_save_zone(const zone_t *zone)
+esp_err_t sprinkler_save_zone(const sprinkler_data_t *data, const zone_t *zone)
 {
-    char key[16];
-    snprintf(key, sizeof(key), "zone_%d", zone->id);
-    return write_blob(key, zone, sizeof(zone_t));
-}
+    zone_record_t record = {
+        .id = zone->id,
+        .output = zone->output,
+        .enabled = zone->enabled,
+        .last_run = zone->last_run,
+    };
+    strncpy(record.name, sprinkler_name(data, zone->name), sizeof(record.name) - 1);
 
-esp_err_t sprinkler_load_zone(uint8_t zone_id, zone_t *zone)
-{
     char key[16];
-    snprintf(key, sizeof(key), "zone_%d", zone_id);
-    size_t required_size = sizeof(zone_t);
-    return read_blob(key, zone, &required_size);
+    snprintf(key, sizeof(key), "zone_%d", zone->id);
+    return write_blob(key, &record, sizeof(record));
 }
 
 esp_err_t sprinkler_delete_zone(uint8_t zone_id)
@@ -83,24 +314,75 @@ esp_err_t sprinkler_delete_zone(uint8_t zone_id)
     return delete_blob(key);
 }
 
-esp_err_t sprinkler_save_program(const program_t *program)
+esp_err_t sprinkler_save_program(const sprinkler_data_t *data, const program_t *program)
 {
+    program_record_t record = {
+        .id = program->id,
+        .enabled = program->enabled,
+        .budget_percent = program->budget_percent,
+        .zone_count = program->zone_count,
+        .schedule = program->schedule,
+        .last_run = program->last_run,
+        .next_run = program->next_run,
+    };
+    strncpy(record.name, sprinkler_name(data, program->name), sizeof(record.name) - 1);
+    memcpy(record.zones, sprinkler_program_zones(data, program), program->zone_count * sizeof(program_zone_t));
+
     char key[16];
     snprintf(key, sizeof(key), "prog_%d", program->id);
-    return write_blob(key, program, sizeof(program_t));
+    return write_blob(key, &record, sizeof(record));
 }
 
-esp_err_t sprinkler_load_program(uint8_t program_id, program_t *program)
+esp_err_t sprinkler_delete_program(uint8_t program_id)
 {
     char key[16];
     snprintf(key, sizeof(key), "prog_%d", program_id);
-    size_t required_size = sizeof(program_t);
-    return read_blob(key, program, &required_size);
+    return delete_blob(key);
 }
 
-esp_err_t sprinkler_delete_program(uint8_t program_id)
+esp_err_t sprinkler_save_changes(const sprinkler_data_t *data, uint64_t zones, uint32_t programs)
 {
-    char key[16];
-    snprintf(key, sizeof(key), "prog_%d", program_id);
-    return delete_blob(key);
+    if (!zones && !programs)
+    {
+        return ESP_OK;
+    }
+
+    esp_err_t ret = storage_batch_begin();
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    // Each record reaches flash as it is written, stop at the first failure so the caller knows where to undo from
+    esp_err_t result = ESP_OK;
+    for (int i = 0; i < MAX_ZONES && result == ESP_OK; i++)
+    {
+        if (zones & (1ULL << i))
+        {
+            const zone_t *zone = &data->zones[i];
+            ret = zone->id ? sprinkler_save_zone(data, zone) : sprinkler_delete_zone(i + 1);
+            // A zone created and deleted in the same batch was never saved
+            if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND)
+            {
+                ESP_LOGE(TAG, "Failed to save zone %d: %s", i + 1, esp_err_to_name(ret));
+                result = ret;
+            }
+        }
+    }
+    for (int i = 0; i < MAX_PROGRAMS && result == ESP_OK; i++)
+    {
+        if (programs & (1UL << i))
+        {
+            const program_t *program = &data->programs[i];
+            ret = program->id ? sprinkler_save_program(data, program) : sprinkler_delete_program(i + 1);
+            if (ret != ESP_OK && ret != ESP_ERR_NVS_NOT_FOUND)
+            {
+                ESP_LOGE(TAG, "Failed to save program %d: %s", i + 1, esp_err_to_name(ret));
+                result = ret;
+            }
+        }
+    }
+
+    ret = storage_batch_commit();
+    return result == ESP_OK ? ret : result;
 }
@@ -8,12 +8,16 @@
 #include <time.h>
 #include "storage.h"
 
-#define MAX_ZONES 8
-#define MAX_PROGRAMS 4
+#define MAX_ZONES 64
+#define MAX_PROGRAMS 32
 #define MAX_ZONE_NAME_LEN 32
 #define MAX_PROGRAM_NAME_LEN 32
-#define MAX_ZONES_PER_PROGRAM 8
+#define MAX_ZONES_PER_PROGRAM 16
+#define MAX_PROGRAM_ZONES 256    // Zone entries of all programs together, see sprinkler_data_t
+#define SPRINKLER_NAME_POOL_SIZE 1536 // Characters of all zone and program names together, terminators included
 #define MAX_DAYS_LEN 16
+#define MAX_START_TIMES 4
+#define MAX_INTERVAL_DAYS 30
 
 typedef enum
 {
@@ -31,56 +35,144 @@ typedef enum
     PROGRAM_STATUS_COMPLETED
 } program_status_t;
 
+// Timestamps are kept as 32-bit seconds after 2024-01-01 UTC, until 2160, 0 meaning never
+#define SPRINKLER_EPOCH 1704067200
+
+static inline uint32_t sprinkler_time_to_offset(time_t timestamp)
+{
+    return timestamp > SPRINKLER_EPOCH ? (uint32_t)(timestamp - SPRINKLER_EPOCH) : 0;
+}
+
+static inline time_t sprinkler_time_from_offset(uint32_t offset)
+{
+    return offset ? SPRINKLER_EPOCH + (time_t)offset : 0;
+}
+
+// Names are offsets in the interned name pool of sprinkler_data_t, 0 is the empty name
+typedef uint16_t sprinkler_name_t;
+
 typedef struct
 {
     uint8_t id;
-    char name[MAX_ZONE_NAME_LEN];
     uint8_t output;
     bool enabled;
-    time_t last_run;
+    sprinkler_name_t name;
+    uint32_t last_run; // See sprinkler_time_to_offset
 } zone_t;
 
 typedef struct
 {
     uint8_t zone_id;
-    uint16_t duration; // in minutes
     uint8_t order;
+    uint16_t duration; // in minutes
 } program_zone_t;
 
+typedef enum
+{
+    SCHEDULE_MODE_WEEKDAYS, // Selected days of the week
+    SCHEDULE_MODE_INTERVAL, // Every N days
+    SCHEDULE_MODE_ODD_DAYS, // Odd dates of the month
+    SCHEDULE_MODE_EVEN_DAYS // Even dates of the month
+} schedule_mode_t;
+
+// Start times are minutes after local midnight, or relative to the sun when a reference is set in the top bits
+typedef enum
+{
+    START_REF_CLOCK,            // Minutes after local midnight
+    START_REF_SUNRISE,          // Start at sunrise + offset
+    START_REF_SUNSET,           // Start at sunset + offset
+    START_REF_FINISH_BY_SUNRISE // Finish at sunrise + offset, starting the program's duration earlier
+} start_ref_t;
+
+#define START_REF_SHIFT 14
+#define START_OFFSET_MASK ((1 << START_REF_SHIFT) - 1)
+#define START_OFFSET_BIAS (1 << (START_REF_SHIFT - 1)) // Offsets are stored biased, -8192 to 8191 minutes
+
+static inline uint16_t start_time_solar(start_ref_t ref, int16_t offset_minutes)
+{
+    return (uint16_t)((ref << START_REF_SHIFT) | ((offset_minutes + START_OFFSET_BIAS) & START_OFFSET_MASK));
+}
+
+static inline start_ref_t start_time_ref(uint16_t start_time)
+{
+    return (start_ref_t)(start_time >> START_REF_SHIFT);
+}
+
+static inline int16_t start_time_offset(uint16_t start_time)
+{
+    return (int16_t)((start_time & START_OFFSET_MASK) - START_OFFSET_BIAS);
+}
+
 typedef struct
 {
-    uint8_t days; // Bitfield: bit 0=Sun, bit 1=Mon, ..., bit 6=Sat
-    uint8_t start_hour;
-    uint8_t start_minute;
+    uint8_t mode;          // schedule_mode_t
+    uint8_t days;          // Weekdays mode, bitfield: bit 0=Sun, bit 1=Mon, ..., bit 6=Sat
+    uint8_t interval_days; // Interval mode, 1 to MAX_INTERVAL_DAYS
+    uint8_t start_count;
+    uint16_t start_times[MAX_START_TIMES]; // Sorted, see start_ref_t
+    int32_t interval_anchor;               // Interval mode, a local day (days since epoch) that waters
 } schedule_t;
 
 typedef struct
 {
     uint8_t id;
-    char name[MAX_PROGRAM_NAME_LEN];
     bool enabled;
-    schedule_t schedule;
-    program_zone_t zones[MAX_ZONES_PER_PROGRAM];
+    uint8_t budget_percent; // Scales the zone durations
     uint8_t zone_count;
-    time_t last_run;
-    time_t next_run;
+    sprinkler_name_t name;
+    uint16_t zones; // First of zone_count entries in the program zones of sprinkler_data_t
+    schedule_t schedule;
+    uint32_t last_run; // See sprinkler_time_to_offset
+    uint32_t next_run;
 } program_t;
 
+// Zones and programs are found by id at index id - 1. Variable length fields live in shared pools
+// kept packed by sprinkler_model.c, so capacity doesn't cost a worst case name and zone list per entry.
 typedef struct
 {
     zone_t zones[MAX_ZONES];
-    uint8_t zone_count;
     program_t programs[MAX_PROGRAMS];
+    program_zone_t program_zones[MAX_PROGRAM_ZONES]; // Zone lists of the programs, back to back
+    char names[SPRINKLER_NAME_POOL_SIZE];            // Interned names, names[0] is the empty name
+    uint32_t zone_programs[MAX_ZONES];               // Reverse index, bit i set when program i + 1 lists the zone
+    uint16_t program_zones_used;
+    uint16_t names_used;
+    uint8_t zone_count;
     uint8_t program_count;
 } sprinkler_data_t;
 
+static inline const char *sprinkler_name(const sprinkler_data_t *data, sprinkler_name_t name)
+{
+    return &data->names[name];
+}
+
+static inline const program_zone_t *sprinkler_program_zones(const sprinkler_data_t *data, const program_t *program)
+{
+    return &data->program_zones[program->zones];
+}
+
+// Programs listing a zone as a mask of program id - 1 bits, 0 for an unknown zone
+static inline uint32_t sprinkler_zone_programs(const sprinkler_data_t *data, uint8_t zone_id)
+{
+    return zone_id && zone_id <= MAX_ZONES ? data->zone_programs[zone_id - 1] : 0;
+}
+
+// Time a program's next run is searched after: now, or its last run while that is ahead of the clock. The
+// clock restored after a power loss is behind, and would otherwise replay starts that already watered.
+static inline time_t sprinkler_program_next_run_from(const program_t *program, time_t now)
+{
+    time_t last_run = sprinkler_time_from_offset(program->last_run);
+    return last_run > now ? last_run : now;
+}
+
 // Function prototypes
 esp_err_t sprinkler_load_all_data(sprinkler_data_t *data);
 void sprinkler_delete_all_data(void);
-esp_err_t sprinkler_save_zone(const zone_t *zone);
-esp_err_t sprinkler_load_zone(uint8_t zone_id, zone_t *zone);
+esp_err_t sprinkler_save_zone(const sprinkler_data_t *data, const zone_t *zone);
 esp_err_t sprinkler_delete_zone(uint8_t zone_id);
-esp_err_t sprinkler_save_program(const program_t *program);
-esp_err_t sprinkler_load_program(uint8_t program_id, program_t *program);
+esp_err_t sprinkler_save_program(const sprinkler_data_t *data, const program_t *program);
 esp_err_t sprinkler_delete_program(uint8_t program_id);
+// Save the zones and programs of the masks, bit i for id i + 1, or delete those no longer in use, under one NVS handle.
+// Not atomic: each record is on flash once written. Stops at the first failure, the records before it are saved.
+esp_err_t sprinkler_save_changes(const sprinkler_data_t *data, uint64_t zones, uint32_t programs);
 esp_err_t sprinkler_clear_all_data(void);
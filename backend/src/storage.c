@@ -5,9 +5,17 @@
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 
 static const char *NVS_NAMESPACE = "storage";
 
+// Open batch, only used by the task that opened it, writes of other tasks still commit on their own.
+// The owner is claimed and released under the lock, so two tasks can't both open one.
+static nvs_handle_t batch_handle;
+static TaskHandle_t batch_owner = NULL;
+static portMUX_TYPE batch_lock = portMUX_INITIALIZER_UNLOCKED;
+
 // Long term storage that survives restart
 
 void setup_storage(void)
@@ -50,6 +58,11 @@ esp_err_t read_blob(const char *key, void *outValue, size_t *required_size)
 
 esp_err_t write_blob(const char *key, const void *value, size_t required_size)
 {
+  if (batch_owner && batch_owner == xTaskGetCurrentTaskHandle())
+  {
+    return nvs_set_blob(batch_handle, key, value, required_size);
+  }
+
   nvs_handle_t nvs_handle;
   esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
   if (ret != ESP_OK)
@@ -69,6 +82,11 @@ esp_err_t write_blob(const char *key, const void *value, size_t required_size)
 
 esp_err_t delete_blob(const char *key)
 {
+  if (batch_owner && batch_owner == xTaskGetCurrentTaskHandle())
+  {
+    return nvs_erase_key(batch_handle, key);
+  }
+
   nvs_handle_t nvs_handle;
   esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
   if (ret != ESP_OK)
@@ -84,4 +102,46 @@ esp_err_t delete_blob(const char *key)
 
   nvs_close(nvs_handle);
   return ret;
-}
\ No newline at end of file
+}
+
+esp_err_t storage_batch_begin(void)
+{
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  taskENTER_CRITICAL(&batch_lock);
+  bool claimed = batch_owner == NULL;
+  if (claimed)
+  {
+    batch_owner = self;
+  }
+  taskEXIT_CRITICAL(&batch_lock);
+  if (!claimed)
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+
+  // The handle is only used by the owner, and only once it's open
+  esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &batch_handle);
+  if (ret != ESP_OK)
+  {
+    printf("Error (%s) opening NVS handle!\n", esp_err_to_name(ret));
+    taskENTER_CRITICAL(&batch_lock);
+    batch_owner = NULL;
+    taskEXIT_CRITICAL(&batch_lock);
+    return ret;
+  }
+  return ESP_OK;
+}
+
+esp_err_t storage_batch_commit(void)
+{
+  if (batch_owner != xTaskGetCurrentTaskHandle())
+  {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t ret = nvs_commit(batch_handle);
+  nvs_close(batch_handle);
+  taskENTER_CRITICAL(&batch_lock);
+  batch_owner = NULL;
+  taskEXIT_CRITICAL(&batch_lock);
+  return ret;
+}
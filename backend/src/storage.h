@@ -11,4 +11,11 @@ esp_err_t write_float(const char *key, float value);
 
 esp_err_t read_blob(const char *key, void *outValue, size_t *required_size);
 esp_err_t write_blob(const char *key, const void *value, size_t required_size);
-esp_err_t delete_blob(const char *key);
\ No newline at end of file
+esp_err_t delete_blob(const char *key);
+
+// Writes and deletes of the calling task between these share one handle and a single commit. Each of them still
+// reaches flash on its own, the batch is not atomic.
+// Every write of that task joins the batch, so only sprinkler_save_changes opens one, around its own record
+// writes. ESP_ERR_INVALID_STATE while another batch is open.
+esp_err_t storage_batch_begin(void);
+esp_err_t storage_batch_commit(void);
\ No newline at end of file
@@ -0,0 +1,335 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "task_telemetry.h"
+
+#ifdef CONFIG_SPRINKLER_TASK_TELEMETRY
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "TASK_TELEMETRY";
+
+#define TELEMETRY_CHUNK_RESERVE 32 // Closing the tasks and samples arrays, and the chunk with "final"
+
+typedef struct
+{
+    UBaseType_t number; // Unique to each task created, unlike its handle which can be reused
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t sampled_at; // Last pass that saw the task
+    uint32_t stack_free; // Lowest free stack ever, in bytes
+    configRUN_TIME_COUNTER_TYPE run_time;
+    uint8_t priority;
+    int8_t core;
+    uint8_t state;
+} task_entry_t;
+
+typedef struct
+{
+    uint32_t uptime_s;
+    int16_t load[TASK_TELEMETRY_MAX_TASKS]; // Per mille of one core, by task entry, -1 when absent
+} task_sample_t;
+
+_Static_assert(TASK_TELEMETRY_MAX_TASKS <= 32, "Reused entries are tracked in a 32-bit mask");
+
+// Entries keep their index for as long as the task lives, so the sample columns line up
+static task_entry_t tasks[TASK_TELEMETRY_MAX_TASKS];
+static size_t task_count = 0;
+static task_sample_t samples[TASK_TELEMETRY_SAMPLES];
+static size_t sample_count = 0;
+static uint32_t pass = 0;
+static uint32_t skipped = 0;
+static portMUX_TYPE telemetry_lock = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t sample_timer = NULL;
+
+// Only the esp_timer task touches these once started, it works on them unlocked and publishes under the lock
+static task_entry_t working[TASK_TELEMETRY_MAX_TASKS];
+static size_t working_count = 0;
+static uint32_t working_pass = 0;
+static configRUN_TIME_COUNTER_TYPE last_total = 0;
+
+static task_entry_t *find_entry(const TaskStatus_t *status, uint32_t *reused)
+{
+    for (size_t i = 0; i < working_count; i++)
+    {
+        if (working[i].number == status->xTaskNumber)
+        {
+            return &working[i];
+        }
+    }
+
+    size_t index = working_count;
+    if (working_count < TASK_TELEMETRY_MAX_TASKS)
+    {
+        working_count++;
+    }
+    else
+    {
+        // Reuse the entry of a task the previous pass did not see, its history goes with it
+        for (index = 0; index < working_count && working[index].sampled_at + 1 >= working_pass; index++)
+        {
+        }
+        if (index == working_count)
+        {
+            return NULL;
+        }
+        *reused |= 1u << index;
+    }
+
+    task_entry_t *entry = &working[index];
+    memset(entry, 0, sizeof(*entry));
+    entry->number = status->xTaskNumber;
+    strncpy(entry->name, status->pcTaskName, sizeof(entry->name) - 1);
+    entry->stack_free = UINT32_MAX;
+    return entry;
+}
+
+static void sample_timer_callback(void *arg)
+{
+    static TaskStatus_t statuses[TASK_TELEMETRY_MAX_TASKS];
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    UBaseType_t count = uxTaskGetSystemState(statuses, TASK_TELEMETRY_MAX_TASKS, &total);
+    if (count == 0)
+    {
+        ESP_LOGW(TAG, "More than %d tasks, sample skipped", TASK_TELEMETRY_MAX_TASKS);
+        taskENTER_CRITICAL(&telemetry_lock);
+        skipped++;
+        taskEXIT_CRITICAL(&telemetry_lock);
+        return;
+    }
+
+    task_sample_t sample = {.uptime_s = (uint32_t)(esp_timer_get_time() / 1000000)};
+    for (size_t i = 0; i < TASK_TELEMETRY_MAX_TASKS; i++)
+    {
+        sample.load[i] = -1;
+    }
+
+    working_pass++;
+    uint32_t reused = 0;
+    configRUN_TIME_COUNTER_TYPE elapsed = total - last_total;
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        const TaskStatus_t *status = &statuses[i];
+        task_entry_t *entry = find_entry(status, &reused);
+        if (!entry)
+        {
+            continue;
+        }
+
+        // Counters wrap, the difference stays right as long as a period is shorter than a wrap
+        if (working_pass > 1 && entry->sampled_at + 1 == working_pass && elapsed)
+        {
+            uint64_t load = (uint64_t)(configRUN_TIME_COUNTER_TYPE)(status->ulRunTimeCounter - entry->run_time) * 1000 / elapsed;
+            sample.load[entry - working] = load > 1000 ? 1000 : (int16_t)load;
+        }
+
+        entry->sampled_at = working_pass;
+        entry->run_time = status->ulRunTimeCounter;
+        entry->priority = status->uxCurrentPriority;
+        entry->core = status->xCoreID == tskNO_AFFINITY ? -1 : status->xCoreID;
+        entry->state = status->eCurrentState;
+        if (status->usStackHighWaterMark < entry->stack_free)
+        {
+            entry->stack_free = status->usStackHighWaterMark;
+        }
+    }
+    last_total = total;
+
+    taskENTER_CRITICAL(&telemetry_lock);
+    memcpy(tasks, working, working_count * sizeof(task_entry_t));
+    task_count = working_count;
+    pass = working_pass;
+    for (size_t index = 0; reused; index++, reused >>= 1)
+    {
+        if (reused & 1)
+        {
+            for (size_t i = 0; i < TASK_TELEMETRY_SAMPLES; i++)
+            {
+                samples[i].load[index] = -1;
+            }
+        }
+    }
+
+    // The first pass only sets the baseline
+    if (working_pass > 1)
+    {
+        samples[sample_count % TASK_TELEMETRY_SAMPLES] = sample;
+        sample_count++;
+    }
+    taskEXIT_CRITICAL(&telemetry_lock);
+}
+
+void task_telemetry_start(void)
+{
+    sample_timer_callback(NULL);
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = sample_timer_callback,
+        .name = "task_samples",
+    };
+    if (esp_timer_create(&timer_args, &sample_timer) != ESP_OK ||
+        esp_timer_start_periodic(sample_timer, (uint64_t)TASK_TELEMETRY_PERIOD_S * 1000000) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start task sampling");
+    }
+}
+
+static const char *task_state_to_string(eTaskState state)
+{
+    switch (state)
+    {
+    case eRunning:
+        return "running";
+    case eReady:
+        return "ready";
+    case eBlocked:
+        return "blocked";
+    case eSuspended:
+        return "suspended";
+    case eDeleted:
+        return "deleted";
+    default:
+        return "unknown";
+    }
+}
+
+static int sample_to_json(char *buffer, size_t buffer_size, const task_sample_t *sample, size_t entries)
+{
+    int len = snprintf(buffer, buffer_size, "[%lu", (unsigned long)sample->uptime_s);
+    for (size_t j = 0; j < entries && len < buffer_size; j++)
+    {
+        len += snprintf(buffer + len, buffer_size - len, ",%d", sample->load[j]);
+    }
+    if (len < buffer_size)
+    {
+        len += snprintf(buffer + len, buffer_size - len, "]");
+    }
+    return len;
+}
+
+esp_err_t task_telemetry_to_json(char *buffer, size_t buffer_size, task_telemetry_cursor_t *cursor, bool *final)
+{
+    if (buffer_size <= TELEMETRY_CHUNK_RESERVE)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    // Tasks and samples stop short of the end, the rest closes the arrays and the chunk
+    size_t size = buffer_size - TELEMETRY_CHUNK_RESERVE;
+
+    taskENTER_CRITICAL(&telemetry_lock);
+    if (cursor->chunk == 0)
+    {
+        cursor->entries = task_count;
+        cursor->sample = sample_count > TASK_TELEMETRY_SAMPLES ? sample_count - TASK_TELEMETRY_SAMPLES : 0;
+    }
+    uint32_t current_pass = pass;
+    uint32_t skipped_count = skipped;
+    taskEXIT_CRITICAL(&telemetry_lock);
+
+    int len = snprintf(buffer, size, "{\"type\":\"task_telemetry\",\"chunk\":%u", (unsigned)cursor->chunk);
+    if (cursor->chunk == 0 && len < size)
+    {
+        len += snprintf(buffer + len, size - len, ",\"period_s\":%d,\"cores\":%d,\"uptime_s\":%lld,\"skipped\":%lu",
+                        TASK_TELEMETRY_PERIOD_S, configNUMBER_OF_CORES, esp_timer_get_time() / 1000000,
+                        (unsigned long)skipped_count);
+    }
+    if (len < size)
+    {
+        len += snprintf(buffer + len, size - len, ",\"tasks\":[");
+    }
+    if (len >= size)
+    {
+        ESP_LOGE(TAG, "JSON buffer too small for task telemetry");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Copied one at a time so the timer never waits on the formatting, whatever doesn't fit goes in the next chunk
+    size_t tasks_added = 0, samples_added = 0;
+    bool full = false;
+    for (; cursor->task < cursor->entries && !full; cursor->task++)
+    {
+        taskENTER_CRITICAL(&telemetry_lock);
+        task_entry_t entry = tasks[cursor->task];
+        taskEXIT_CRITICAL(&telemetry_lock);
+        int n = snprintf(buffer + len, size - len,
+                         "%s{\"name\":\"%s\",\"priority\":%d,\"core\":%d,\"state\":\"%s\",\"stack_free\":%lu,\"alive\":%s}",
+                         tasks_added ? "," : "", entry.name, entry.priority, entry.core,
+                         task_state_to_string((eTaskState)entry.state), (unsigned long)entry.stack_free,
+                         entry.sampled_at == current_pass ? "true" : "false");
+        full = len + n >= size;
+        if (full)
+        {
+            buffer[len] = '\0';
+            break;
+        }
+        len += n;
+        tasks_added++;
+    }
+    len += snprintf(buffer + len, buffer_size - len, "],\"samples\":[");
+
+    // Samples follow the tasks, the ring may have moved on since the first chunk
+    bool samples_done = false;
+    for (; cursor->task >= cursor->entries && !full; cursor->sample++)
+    {
+        task_sample_t sample;
+        taskENTER_CRITICAL(&telemetry_lock);
+        size_t oldest = sample_count > TASK_TELEMETRY_SAMPLES ? sample_count - TASK_TELEMETRY_SAMPLES : 0;
+        cursor->sample = cursor->sample > oldest ? cursor->sample : oldest;
+        samples_done = cursor->sample >= sample_count;
+        if (!samples_done)
+        {
+            sample = samples[cursor->sample % TASK_TELEMETRY_SAMPLES];
+        }
+        taskEXIT_CRITICAL(&telemetry_lock);
+        if (samples_done)
+        {
+            break;
+        }
+
+        int n = 0;
+        if (len < size)
+        {
+            n = snprintf(buffer + len, size - len, "%s", samples_added ? "," : "");
+            n += sample_to_json(buffer + len + n, size - len - n, &sample, cursor->entries);
+        }
+        full = len + n >= size;
+        if (full)
+        {
+            buffer[len] = '\0';
+            break;
+        }
+        len += n;
+        samples_added++;
+    }
+
+    *final = samples_done;
+    cursor->chunk++;
+    snprintf(buffer + len, buffer_size - len, "],\"final\":%s}", *final ? "true" : "false");
+
+    if (!*final && !tasks_added && !samples_added)
+    {
+        ESP_LOGE(TAG, "JSON buffer too small for task telemetry");
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+#else
+
+void task_telemetry_start(void)
+{
+}
+
+esp_err_t task_telemetry_to_json(char *buffer, size_t buffer_size, task_telemetry_cursor_t *cursor, bool *final)
+{
+    *final = true;
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
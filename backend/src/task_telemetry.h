@@ -0,0 +1,37 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#define TASK_TELEMETRY_PERIOD_S 10  // CPU load is averaged over one period
+#define TASK_TELEMETRY_SAMPLES 30   // 5 minutes of history
+#define TASK_TELEMETRY_MAX_TASKS 32 // Tasks sampled, more and the sample is skipped
+
+/**
+ * @brief Sample the tasks every TASK_TELEMETRY_PERIOD_S, called once the boot stages are done
+ * Only with CONFIG_SPRINKLER_TASK_TELEMETRY, a no-op otherwise.
+ */
+void task_telemetry_start(void);
+
+typedef struct
+{
+    size_t chunk;   // Chunks serialized so far
+    size_t entries; // Task columns, fixed by the first chunk so every sample row lines up
+    size_t task;    // Next task entry
+    size_t sample;  // Next sample, counted since boot
+} task_telemetry_cursor_t;
+
+/**
+ * @brief Serialize the next chunk of the tasks and their CPU load history
+ * Start from a zeroed cursor and call again until final. The first chunk also has the period, cores,
+ * uptime and skipped samples, the "tasks" and "samples" arrays of the chunks add up to the whole history.
+ * Each task has its priority, core (-1 when not pinned), state and lowest free stack in bytes.
+ * Samples are [uptime_s, CPU load of each task in per mille of one core, -1 when it did not exist].
+ *
+ * @return esp_err_t ESP_ERR_NOT_SUPPORTED when not built in, ESP_ERR_NO_MEM if the buffer can't hold one task or sample
+ */
+esp_err_t task_telemetry_to_json(char *buffer, size_t buffer_size, task_telemetry_cursor_t *cursor, bool *final);
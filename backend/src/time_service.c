@@ -0,0 +1,296 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "time_service.h"
+
+#include "storage.h"
+#include "sntp.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char *TAG = "TIME_SERVICE";
+
+#define TIME_SNAPSHOT_KEY "time_snap"
+#define TIME_SNAPSHOT_MAGIC 0x54534e31 // "TSN1"
+#define TIME_PERSIST_TASK_STACK_SIZE 3072
+#define TIME_PERSIST_TASK_PRIORITY 2
+
+// Persisted clock state
+typedef struct
+{
+    uint32_t magic;
+    int64_t wall_time; // Last known wall clock, in seconds
+    int64_t last_sync; // Wall clock of the last NTP sync, 0 if never synced
+    int32_t drift_ppm; // Local clock drift measured between two NTP syncs, logged only: it says nothing of power off time
+} time_snapshot_t;
+
+static time_snapshot_t snapshot = {0};
+static time_source_t current_source = TIME_SOURCE_NONE;
+static int64_t source_updated_us = 0; // Monotonic time of the last accepted submission
+static SemaphoreHandle_t time_mutex = NULL;
+static esp_err_t (*time_changed_callback)(void) = NULL;
+
+// Reference of the previous NTP sync, on the monotonic clock, to measure drift
+static int64_t last_sync_mono_us = 0;
+static int64_t last_sync_wall_us = 0;
+
+static int64_t wall_time_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static void persist_snapshot(void)
+{
+    if (current_source == TIME_SOURCE_NONE)
+    {
+        return;
+    }
+
+    snapshot.magic = TIME_SNAPSHOT_MAGIC;
+    snapshot.wall_time = time(NULL);
+
+    esp_err_t ret = write_blob(TIME_SNAPSHOT_KEY, &snapshot, sizeof(snapshot));
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to persist time snapshot: %s", esp_err_to_name(ret));
+    }
+}
+
+// NVS writes block on flash and must not hold up the esp_timer task, so the clock is persisted from its own task
+static void persist_task(void *arg)
+{
+    while (true)
+    {
+        vTaskDelay(pdMS_TO_TICKS(TIME_PERSIST_INTERVAL_MS));
+        if (xSemaphoreTake(time_mutex, portMAX_DELAY) == pdTRUE)
+        {
+            persist_snapshot();
+            xSemaphoreGive(time_mutex);
+        }
+    }
+}
+
+static esp_err_t notify_time_changed(void)
+{
+    if (time_changed_callback != NULL)
+    {
+        return time_changed_callback();
+    }
+    return ESP_OK;
+}
+
+time_confidence_t time_service_restore(void)
+{
+    time_mutex = xSemaphoreCreateMutex();
+
+    size_t required_size = sizeof(snapshot);
+    if (read_blob(TIME_SNAPSHOT_KEY, &snapshot, &required_size) != ESP_OK || snapshot.magic != TIME_SNAPSHOT_MAGIC)
+    {
+        memset(&snapshot, 0, sizeof(snapshot));
+    }
+
+    if (is_time_set())
+    {
+        current_source = TIME_SOURCE_RTC;
+        ESP_LOGI(TAG, "Clock kept by RTC across reset");
+    }
+    else if (snapshot.wall_time > 0)
+    {
+        // Power was lost, the last persisted time plus uptime is a lower bound of the real time: it misses how
+        // long power was off and up to TIME_PERSIST_INTERVAL_MS before that. The clock is only ever behind,
+        // so the scheduler may start late but never early, and doesn't replay starts up to each program's
+        // last run, see sprinkler_program_next_run_from
+        int64_t uptime_us = esp_timer_get_time();
+        struct timeval tv = {
+            .tv_sec = snapshot.wall_time + uptime_us / 1000000,
+            .tv_usec = uptime_us % 1000000};
+        settimeofday(&tv, NULL);
+        current_source = TIME_SOURCE_PERSISTED;
+        ESP_LOGI(TAG, "Clock restored from persisted time %lld, a lower bound until a better source", snapshot.wall_time);
+    }
+    else
+    {
+        ESP_LOGW(TAG, "No time available, waiting for NTP or a browser");
+    }
+    source_updated_us = esp_timer_get_time();
+
+    if (xTaskCreate(persist_task, "time_persist", TIME_PERSIST_TASK_STACK_SIZE, NULL, TIME_PERSIST_TASK_PRIORITY, NULL) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create time persistence task");
+    }
+
+    return time_service_get_confidence();
+}
+
+static void update_drift_estimate(int64_t reference_wall_us)
+{
+    int64_t mono_us = esp_timer_get_time();
+
+    // Compare how far the local clock moved since the previous sync with how far NTP says it moved
+    if (last_sync_mono_us != 0 && mono_us > last_sync_mono_us)
+    {
+        int64_t local_elapsed_us = mono_us - last_sync_mono_us;
+        int64_t ntp_elapsed_us = reference_wall_us - last_sync_wall_us;
+        snapshot.drift_ppm = (int32_t)((local_elapsed_us - ntp_elapsed_us) * 1000000 / local_elapsed_us);
+        ESP_LOGI(TAG, "Measured clock drift: %ld ppm", (long)snapshot.drift_ppm);
+    }
+    last_sync_mono_us = mono_us;
+    last_sync_wall_us = reference_wall_us;
+    snapshot.last_sync = reference_wall_us / 1000000;
+}
+
+static bool source_outranked(time_source_t source)
+{
+    if (source >= current_source)
+    {
+        return false;
+    }
+
+    // A better source that went quiet for too long doesn't get to block corrections forever
+    return esp_timer_get_time() - source_updated_us < (int64_t)TIME_SOURCE_STALE_SECONDS * 1000000;
+}
+
+time_adjust_t time_service_submit(time_source_t source, const struct timeval *tv)
+{
+    if (time_mutex == NULL || xSemaphoreTake(time_mutex, pdMS_TO_TICKS(1000)) != pdTRUE)
+    {
+        ESP_LOGE(TAG, "Time service not ready");
+        return TIME_ADJUST_IGNORED;
+    }
+
+    if (source_outranked(source))
+    {
+        ESP_LOGI(TAG, "Ignoring %s time, clock follows %s", time_source_to_string(source), time_source_to_string(current_source));
+        xSemaphoreGive(time_mutex);
+        return TIME_ADJUST_IGNORED;
+    }
+
+    int64_t reference_us = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec;
+    int64_t offset_us = reference_us - wall_time_us();
+    bool confidence_improved = source > current_source;
+    time_adjust_t adjust;
+
+    if (llabs(offset_us) < 1000000 / 2)
+    {
+        adjust = TIME_ADJUST_NONE;
+    }
+    else if (current_source >= TIME_SOURCE_BROWSER && llabs(offset_us) <= (int64_t)TIME_SLEW_MAX_SECONDS * 1000000)
+    {
+        // Small error on a clock we already trust: slew, so wall time stays monotonic and nothing re-plans
+        struct timeval delta = {
+            .tv_sec = offset_us / 1000000,
+            .tv_usec = offset_us % 1000000};
+        adjtime(&delta, NULL);
+        adjust = TIME_ADJUST_SLEWED;
+    }
+    else
+    {
+        struct timeval step = *tv;
+        settimeofday(&step, NULL);
+        adjust = TIME_ADJUST_STEPPED;
+    }
+
+    if (source == TIME_SOURCE_NTP)
+    {
+        update_drift_estimate(reference_us);
+    }
+
+    current_source = source;
+    source_updated_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "%s time: offset %lld ms, %s", time_source_to_string(source), offset_us / 1000, time_adjust_to_string(adjust));
+
+    // Persist right away when the time got better, otherwise the periodic timer will do it
+    if (adjust == TIME_ADJUST_STEPPED || confidence_improved)
+    {
+        persist_snapshot();
+    }
+    xSemaphoreGive(time_mutex);
+
+    // Slewing keeps every schedule valid, only steps and better confidence need a re-plan
+    if (adjust == TIME_ADJUST_STEPPED || confidence_improved)
+    {
+        notify_time_changed();
+    }
+
+    return adjust;
+}
+
+time_source_t time_service_get_source(void)
+{
+    return current_source;
+}
+
+time_confidence_t time_service_get_confidence(void)
+{
+    switch (current_source)
+    {
+    case TIME_SOURCE_NTP:
+        return TIME_CONFIDENCE_HIGH;
+    case TIME_SOURCE_RTC:
+    case TIME_SOURCE_BROWSER:
+        return TIME_CONFIDENCE_MEDIUM;
+    case TIME_SOURCE_PERSISTED:
+        return TIME_CONFIDENCE_LOW;
+    default:
+        return TIME_CONFIDENCE_NONE;
+    }
+}
+
+const char *time_confidence_to_string(time_confidence_t value)
+{
+    switch (value)
+    {
+    case TIME_CONFIDENCE_LOW:
+        return "low";
+    case TIME_CONFIDENCE_MEDIUM:
+        return "medium";
+    case TIME_CONFIDENCE_HIGH:
+        return "high";
+    default:
+        return "none";
+    }
+}
+
+const char *time_source_to_string(time_source_t source)
+{
+    switch (source)
+    {
+    case TIME_SOURCE_PERSISTED:
+        return "persisted";
+    case TIME_SOURCE_BROWSER:
+        return "browser";
+    case TIME_SOURCE_RTC:
+        return "rtc";
+    case TIME_SOURCE_NTP:
+        return "ntp";
+    default:
+        return "none";
+    }
+}
+
+const char *time_adjust_to_string(time_adjust_t adjust)
+{
+    switch (adjust)
+    {
+    case TIME_ADJUST_NONE:
+        return "in sync";
+    case TIME_ADJUST_SLEWED:
+        return "slewed";
+    case TIME_ADJUST_STEPPED:
+        return "stepped";
+    default:
+        return "ignored";
+    }
+}
+
+void time_service_register_callback(esp_err_t (*callback)(void))
+{
+    time_changed_callback = callback;
+}
@@ -0,0 +1,79 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/time.h>
+#include "esp_err.h"
+
+// How often the wall clock is persisted, to restore it after a power loss
+#define TIME_PERSIST_INTERVAL_MS (15 * 60 * 1000)
+
+// Corrections up to this are slewed with adjtime(), larger ones step the clock
+#define TIME_SLEW_MAX_SECONDS 30
+
+// A source stops outranking lower ones once it wasn't refreshed for this long
+#define TIME_SOURCE_STALE_SECONDS (24 * 60 * 60)
+
+// Time sources, ordered by rank
+typedef enum
+{
+    TIME_SOURCE_NONE,
+    TIME_SOURCE_PERSISTED, // Last persisted value plus uptime after a power loss, lower bound only
+    TIME_SOURCE_BROWSER,   // Sent by a connected browser
+    TIME_SOURCE_RTC,       // Kept by the RTC across a reset
+    TIME_SOURCE_NTP        // Synchronized with NTP during this power cycle
+} time_source_t;
+
+typedef enum
+{
+    TIME_CONFIDENCE_NONE,
+    TIME_CONFIDENCE_LOW,
+    TIME_CONFIDENCE_MEDIUM,
+    TIME_CONFIDENCE_HIGH
+} time_confidence_t;
+
+// Outcome of a submitted time
+typedef enum
+{
+    TIME_ADJUST_IGNORED, // Current source outranks the submitted one
+    TIME_ADJUST_NONE,    // Already in sync
+    TIME_ADJUST_SLEWED,  // Small error, clock is being slewed
+    TIME_ADJUST_STEPPED  // Large error, clock was stepped
+} time_adjust_t;
+
+// Confidence required before the scheduler starts programs and resumes interrupted ones. Scheduling on a
+// low confidence clock is safe because it is a lower bound: starts may run late, and starts up to each
+// program's last run are never replayed.
+#define TIME_CONFIDENCE_SCHEDULE TIME_CONFIDENCE_LOW
+#define TIME_CONFIDENCE_RECOVERY TIME_CONFIDENCE_MEDIUM
+
+/**
+ * @brief Restore the wall clock at boot, from the RTC if it survived, otherwise from the persisted value
+ * The persisted value is a lower bound, it misses the time power was off. Starts the task persisting the clock.
+ *
+ * @return time_confidence_t Confidence in the restored time
+ */
+time_confidence_t time_service_restore(void);
+
+/**
+ * @brief Submit a time from a source, the clock is only corrected if the source ranks high enough
+ * Small errors are slewed, large ones step the clock and notify the listener to re-plan.
+ *
+ * @param source Where the time comes from
+ * @param tv Time reported by the source
+ * @return time_adjust_t What was done with the submitted time
+ */
+time_adjust_t time_service_submit(time_source_t source, const struct timeval *tv);
+
+time_source_t time_service_get_source(void);
+time_confidence_t time_service_get_confidence(void);
+const char *time_confidence_to_string(time_confidence_t confidence);
+const char *time_source_to_string(time_source_t source);
+const char *time_adjust_to_string(time_adjust_t adjust);
+
+/**
+ * @brief Register the function called whenever the clock stepped or became more trustworthy
+ */
+void time_service_register_callback(esp_err_t (*callback)(void));
@@ -0,0 +1,280 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "timezone.h"
+
+#include "storage.h"
+#include "sntp.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "TIMEZONE";
+
+#define TIMEZONE_KEY "timezone"
+
+// Transitions are only looked up from here, earlier clocks are not worth a table
+#define TIMEZONE_TABLE_MIN_START 1735689600 // 2025-01-01
+
+// DST rules never change offset twice within this step
+#define TIMEZONE_SCAN_STEP (7 * SECONDS_PER_DAY)
+
+typedef struct
+{
+    time_t utc;         // First second with the new offset
+    int64_t local;      // First local time resolved with the new offset, ordered like utc
+    int32_t offset;     // Offset from UTC from this transition on, in seconds
+} tz_transition_t;
+
+typedef struct
+{
+    time_t start;  // Table covers [start, end), outside falls back to libc
+    time_t end;
+    int32_t initial_offset;
+    uint8_t count;
+    tz_transition_t transitions[TIMEZONE_MAX_TRANSITIONS];
+} tz_table_t;
+
+// Double buffered, readers never block and the writer swaps the published table once it is built
+static tz_table_t tables[2];
+static tz_table_t *volatile active_table = NULL;
+static char current_tz[TIMEZONE_MAX_LEN] = NTP_TIMEZONE;
+static SemaphoreHandle_t tz_mutex = NULL;
+
+// Offset from UTC at a given time, computed the slow way through libc
+static int32_t libc_offset(time_t utc)
+{
+    struct tm tm;
+    localtime_r(&utc, &tm);
+    int64_t local = timezone_days_from_date(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * SECONDS_PER_DAY +
+                    tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+    return (int32_t)(local - utc);
+}
+
+static void build_table(tz_table_t *table)
+{
+    time_t now = time(NULL);
+    time_t start = now > TIMEZONE_TABLE_MIN_START ? now : TIMEZONE_TABLE_MIN_START;
+    start -= 366 * SECONDS_PER_DAY;
+
+    table->start = start;
+    table->end = start + (time_t)(TIMEZONE_TABLE_YEARS + 1) * 366 * SECONDS_PER_DAY;
+    table->initial_offset = libc_offset(start);
+    table->count = 0;
+
+    int32_t offset = table->initial_offset;
+    for (time_t t = start; t < table->end && table->count < TIMEZONE_MAX_TRANSITIONS; t += TIMEZONE_SCAN_STEP)
+    {
+        time_t next = t + TIMEZONE_SCAN_STEP;
+        int32_t next_offset = libc_offset(next);
+        if (next_offset == offset)
+        {
+            continue;
+        }
+
+        // Bisect down to the first second with the new offset
+        time_t low = t, high = next;
+        while (high - low > 1)
+        {
+            time_t mid = low + (high - low) / 2;
+            if (libc_offset(mid) == offset)
+            {
+                low = mid;
+            }
+            else
+            {
+                high = mid;
+            }
+        }
+
+        tz_transition_t *transition = &table->transitions[table->count++];
+        transition->utc = high;
+        transition->offset = next_offset;
+        // Local times skipped by the change resolve with the old offset (moving forward),
+        // repeated ones too (first occurrence), so the new offset starts at the later of both
+        transition->local = (int64_t)high + (next_offset > offset ? next_offset : offset);
+        offset = next_offset;
+    }
+
+    ESP_LOGI(TAG, "Precomputed %d DST transitions for %s", table->count, current_tz);
+}
+
+// Apply the current TZ string to libc and publish a fresh transition table
+static void apply_timezone(void)
+{
+    setenv("TZ", current_tz, 1);
+    tzset();
+
+    tz_table_t *table = (active_table == &tables[0]) ? &tables[1] : &tables[0];
+    build_table(table);
+    active_table = table;
+}
+
+static bool is_valid_timezone(const char *tz)
+{
+    size_t len = strnlen(tz, TIMEZONE_MAX_LEN);
+    if (len == 0 || len >= TIMEZONE_MAX_LEN)
+    {
+        return false;
+    }
+
+    // POSIX TZ strings start with a zone name (or <...>) and only contain printable characters
+    if (!isalpha((unsigned char)tz[0]) && tz[0] != '<')
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!isprint((unsigned char)tz[i]) || isspace((unsigned char)tz[i]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+esp_err_t timezone_init(void)
+{
+    tz_mutex = xSemaphoreCreateMutex();
+    if (!tz_mutex)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    char stored[TIMEZONE_MAX_LEN] = {0};
+    size_t required_size = sizeof(stored);
+    if (read_blob(TIMEZONE_KEY, stored, &required_size) == ESP_OK)
+    {
+        stored[TIMEZONE_MAX_LEN - 1] = '\0';
+        if (is_valid_timezone(stored))
+        {
+            strlcpy(current_tz, stored, sizeof(current_tz));
+        }
+    }
+
+    ESP_LOGI(TAG, "Timezone: %s", current_tz);
+    apply_timezone();
+    return ESP_OK;
+}
+
+esp_err_t timezone_set(const char *tz)
+{
+    if (!tz || !is_valid_timezone(tz))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (xSemaphoreTake(tz_mutex, portMAX_DELAY) != pdTRUE)
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    esp_err_t ret = write_blob(TIMEZONE_KEY, tz, strlen(tz) + 1);
+    if (ret == ESP_OK)
+    {
+        strlcpy(current_tz, tz, sizeof(current_tz));
+        apply_timezone();
+        ESP_LOGI(TAG, "Timezone set to %s", current_tz);
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Failed to save timezone: %s", esp_err_to_name(ret));
+    }
+
+    xSemaphoreGive(tz_mutex);
+    return ret;
+}
+
+const char *timezone_get(void)
+{
+    return current_tz;
+}
+
+int64_t timezone_to_local(time_t utc)
+{
+    const tz_table_t *table = active_table;
+    if (!table || utc < table->start || utc >= table->end)
+    {
+        return (int64_t)utc + libc_offset(utc);
+    }
+
+    // Last transition at or before utc
+    int low = 0, high = table->count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (table->transitions[mid].utc <= utc)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    int32_t offset = low ? table->transitions[low - 1].offset : table->initial_offset;
+    return (int64_t)utc + offset;
+}
+
+time_t timezone_to_utc(int64_t local)
+{
+    const tz_table_t *table = active_table;
+    if (!table || local < (int64_t)table->start || local >= (int64_t)table->end)
+    {
+        // Same resolution as the table through libc: skipped and repeated times keep the offset from before
+        // the transition, the offsets a day apart bracket it
+        int32_t before = libc_offset((time_t)(local - SECONDS_PER_DAY));
+        int32_t after = libc_offset((time_t)(local + SECONDS_PER_DAY));
+        int32_t widest = before > after ? before : after;
+        int32_t offset = libc_offset((time_t)(local - widest)) == before ? before : after;
+        return (time_t)(local - offset);
+    }
+
+    // Last transition whose local start is at or before local
+    int low = 0, high = table->count;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (table->transitions[mid].local <= local)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    int32_t offset = low ? table->transitions[low - 1].offset : table->initial_offset;
+    return (time_t)(local - offset);
+}
+
+// Gregorian calendar arithmetic on 400-year eras of 146097 days, with years starting in March
+int64_t timezone_days_from_date(int64_t year, int month, int day)
+{
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const unsigned year_of_era = (unsigned)(year - era * 400);
+    const unsigned day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const unsigned day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + (int64_t)day_of_era - 719468;
+}
+
+void timezone_date_from_days(int64_t days, int *year, int *month, int *day)
+{
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned day_of_era = (unsigned)(days - era * 146097);
+    const unsigned year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    const unsigned day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    const unsigned month_index = (5 * day_of_year + 2) / 153;
+
+    *day = day_of_year - (153 * month_index + 2) / 5 + 1;
+    *month = month_index < 10 ? month_index + 3 : month_index - 9;
+    *year = (int)(year_of_era + era * 400 + (*month <= 2));
+}
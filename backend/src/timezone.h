@@ -0,0 +1,69 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+
+// Maximum length of a POSIX TZ string, including terminator
+#define TIMEZONE_MAX_LEN 64
+
+// Years of DST transitions precomputed when the timezone is applied
+#define TIMEZONE_TABLE_YEARS 8
+
+// Maximum number of transitions in the table, two per year plus margin
+#define TIMEZONE_MAX_TRANSITIONS (TIMEZONE_TABLE_YEARS * 2 + 4)
+
+#define SECONDS_PER_DAY 86400
+
+// Largest DST change in use, so the furthest a skipped local time moves forward
+#define TIMEZONE_MAX_SHIFT_MINUTES 120
+
+/**
+ * @brief Load the timezone from NVS, or the default one, and build its transition table
+ */
+esp_err_t timezone_init(void);
+
+/**
+ * @brief Validate, persist and apply a POSIX TZ string, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+ *
+ * @param tz POSIX TZ string
+ * @return esp_err_t ESP_ERR_INVALID_ARG if the string is empty, too long or malformed
+ */
+esp_err_t timezone_set(const char *tz);
+
+const char *timezone_get(void);
+
+/**
+ * @brief Convert a UTC time to local seconds since the epoch, using the precomputed transitions
+ */
+int64_t timezone_to_local(time_t utc);
+
+/**
+ * @brief Convert local seconds since the epoch to UTC
+ * Local times skipped by a DST change move forward, repeated ones resolve to the first occurrence.
+ */
+time_t timezone_to_utc(int64_t local);
+
+/**
+ * @brief Days since 1970-01-01 of a Gregorian date, month 1-12 and day 1-31
+ */
+int64_t timezone_days_from_date(int64_t year, int month, int day);
+
+/**
+ * @brief Gregorian date of a day since 1970-01-01, inverse of timezone_days_from_date
+ */
+void timezone_date_from_days(int64_t days, int *year, int *month, int *day);
+
+// Day helpers on local seconds since the epoch
+static inline int64_t timezone_local_day(int64_t local)
+{
+    return local >= 0 ? local / SECONDS_PER_DAY : (local - SECONDS_PER_DAY + 1) / SECONDS_PER_DAY;
+}
+
+static inline int timezone_local_weekday(int64_t local)
+{
+    // 1970-01-01 was a Thursday
+    return (int)(((timezone_local_day(local) + 4) % 7 + 7) % 7);
+}
@@ -0,0 +1,35 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include "valve_outputs.h"
+
+// Hardware behind the valve outputs, only used by valve_outputs.c which serializes every call
+typedef struct
+{
+    const char *name;
+    esp_err_t (*init)(const valve_driver_config_t *config); // Outputs must be off when it returns
+    bool (*is_valid)(uint8_t output);
+    esp_err_t (*configure)(uint64_t mask);                                  // Make outputs drivable, they are off
+    esp_err_t (*write)(uint64_t set_mask, uint64_t clear_mask, uint64_t state); // State is what must be on afterwards
+    void (*get_stats)(valve_bus_stats_t *stats);                               // NULL for drivers without a bus
+} valve_backend_t;
+
+// Bytes shifted out for the state of a 74HC595 chain, MSB first. The chip furthest from the ESP32 goes first, so
+// after chip_count bytes output 0 lands on Q0 of the closest one.
+static inline void valve_shift_register_frame(uint64_t state, uint8_t chip_count, uint8_t *frame)
+{
+    for (int i = 0; i < chip_count; i++)
+    {
+        frame[i] = (uint8_t)(state >> (8 * (chip_count - 1 - i)));
+    }
+}
+
+#ifdef VALVE_OUTPUTS_MOCK
+extern const valve_backend_t valve_backend_mock;
+#else
+extern const valve_backend_t valve_backend_gpio;
+extern const valve_backend_t valve_backend_shift_register;
+extern const valve_backend_t valve_backend_mcp23017;
+extern const valve_backend_t valve_backend_pcf8575;
+#endif
@@ -0,0 +1,68 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#ifndef VALVE_OUTPUTS_MOCK
+
+#include "valve_backend.h"
+
+#include "driver/gpio.h"
+#include "soc/gpio_reg.h"
+#include "soc/soc_caps.h"
+
+// Outputs are GPIO numbers, driven directly
+static esp_err_t gpio_backend_init(const valve_driver_config_t *config)
+{
+    return ESP_OK;
+}
+
+static bool gpio_backend_is_valid(uint8_t output)
+{
+    return output < VALVE_OUTPUTS_MAX && GPIO_IS_VALID_OUTPUT_GPIO(output);
+}
+
+static esp_err_t gpio_backend_configure(uint64_t mask)
+{
+    gpio_config_t io_conf = {
+        .intr_type = GPIO_INTR_DISABLE,
+        .mode = GPIO_MODE_OUTPUT,
+        .pin_bit_mask = mask,
+        .pull_down_en = 0,
+        .pull_up_en = 0,
+    };
+    return gpio_config(&io_conf);
+}
+
+// Write-one registers, other pins are never read back and rewritten
+static esp_err_t gpio_backend_write(uint64_t set_mask, uint64_t clear_mask, uint64_t state)
+{
+    if ((uint32_t)set_mask)
+    {
+        REG_WRITE(GPIO_OUT_W1TS_REG, (uint32_t)set_mask);
+    }
+#if SOC_GPIO_PIN_COUNT > 32
+    if (set_mask >> 32)
+    {
+        REG_WRITE(GPIO_OUT1_W1TS_REG, (uint32_t)(set_mask >> 32));
+    }
+#endif
+    if ((uint32_t)clear_mask)
+    {
+        REG_WRITE(GPIO_OUT_W1TC_REG, (uint32_t)clear_mask);
+    }
+#if SOC_GPIO_PIN_COUNT > 32
+    if (clear_mask >> 32)
+    {
+        REG_WRITE(GPIO_OUT1_W1TC_REG, (uint32_t)(clear_mask >> 32));
+    }
+#endif
+    return ESP_OK;
+}
+
+const valve_backend_t valve_backend_gpio = {
+    .name = "gpio",
+    .init = gpio_backend_init,
+    .is_valid = gpio_backend_is_valid,
+    .configure = gpio_backend_configure,
+    .write = gpio_backend_write,
+};
+
+#endif
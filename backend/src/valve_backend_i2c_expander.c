@@ -0,0 +1,286 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#ifndef VALVE_OUTPUTS_MOCK
+
+#include "valve_backend.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/i2c_master.h"
+
+static const char *TAG = "VALVE_I2C";
+
+#define EXPANDER_CLOCK_HZ 400000
+#define EXPANDER_TIMEOUT_MS 20
+#define EXPANDER_ATTEMPTS 3 // First try and two retries, a valve write is never dropped on a single NACK
+#define EXPANDER_PINS 16
+
+// MCP23017 registers with IOCON.BANK = 0 as after reset, the B register follows A in a two byte transfer
+#define MCP23017_IODIRA 0x00
+#define MCP23017_GPIOA 0x12
+#define MCP23017_OLATA 0x14
+
+typedef struct
+{
+    i2c_master_dev_handle_t device;
+    uint16_t outputs;  // Pins configured as valve outputs, the only ones checked on readback
+    uint16_t port;     // Last port value written and read back
+    bool port_known;   // False until a write succeeds, so the next one is never skipped
+} expander_t;
+
+static valve_driver_type_t chip_type;
+static i2c_master_bus_handle_t bus = NULL;
+static expander_t expanders[VALVE_EXPANDER_MAX_CHIPS];
+static uint8_t chip_count = 0;
+
+static valve_bus_stats_t stats;
+static uint64_t total_us = 0;
+
+static esp_err_t write_register(expander_t *expander, uint8_t reg, uint16_t value)
+{
+    uint8_t buffer[] = {reg, (uint8_t)value, (uint8_t)(value >> 8)};
+    return i2c_master_transmit(expander->device, buffer, sizeof(buffer), EXPANDER_TIMEOUT_MS);
+}
+
+static esp_err_t write_port(expander_t *expander, uint16_t port)
+{
+    if (chip_type == VALVE_DRIVER_MCP23017)
+    {
+        return write_register(expander, MCP23017_OLATA, port);
+    }
+
+    // PCF8575 takes P00-07 then P10-17 with no register address
+    uint8_t buffer[] = {(uint8_t)port, (uint8_t)(port >> 8)};
+    return i2c_master_transmit(expander->device, buffer, sizeof(buffer), EXPANDER_TIMEOUT_MS);
+}
+
+// Pin levels, not the output latch, so a shorted or unpowered output shows up
+static esp_err_t read_port(expander_t *expander, uint16_t *port)
+{
+    uint8_t buffer[2];
+    esp_err_t ret;
+    if (chip_type == VALVE_DRIVER_MCP23017)
+    {
+        uint8_t reg = MCP23017_GPIOA;
+        ret = i2c_master_transmit_receive(expander->device, &reg, 1, buffer, sizeof(buffer), EXPANDER_TIMEOUT_MS);
+    }
+    else
+    {
+        ret = i2c_master_receive(expander->device, buffer, sizeof(buffer), EXPANDER_TIMEOUT_MS);
+    }
+    *port = buffer[0] | (buffer[1] << 8);
+    return ret;
+}
+
+// One transaction: write the port and read it back, retried on NACK, timeout or mismatch
+static esp_err_t transfer_port(int chip, uint16_t port)
+{
+    expander_t *expander = &expanders[chip];
+    int64_t start = esp_timer_get_time();
+    esp_err_t ret = ESP_FAIL;
+    for (int attempt = 0; attempt < EXPANDER_ATTEMPTS; attempt++)
+    {
+        if (attempt > 0)
+        {
+            stats.retries++;
+            ESP_LOGW(TAG, "Retrying expander %d: %s", chip, esp_err_to_name(ret));
+        }
+
+        uint16_t readback = 0;
+        ret = write_port(expander, port);
+        if (ret == ESP_OK)
+        {
+            ret = read_port(expander, &readback);
+        }
+        // PCF8575 pins only pull up weakly, valves must sit behind a buffer or they read back low
+        if (ret == ESP_OK && ((readback ^ port) & expander->outputs))
+        {
+            ret = ESP_ERR_INVALID_RESPONSE;
+        }
+        if (ret == ESP_OK)
+        {
+            break;
+        }
+    }
+
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start);
+    stats.transactions++;
+    stats.last_us = elapsed_us;
+    stats.max_us = elapsed_us > stats.max_us ? elapsed_us : stats.max_us;
+    total_us += elapsed_us;
+    ESP_LOGD(TAG, "Expander %d port 0x%04x in %lu us", chip, port, (unsigned long)elapsed_us);
+
+    expander->port = port;
+    expander->port_known = ret == ESP_OK;
+    if (ret != ESP_OK)
+    {
+        stats.failures++;
+    }
+    return ret;
+}
+
+static void remove_expanders(void)
+{
+    for (int i = 0; i < VALVE_EXPANDER_MAX_CHIPS; i++)
+    {
+        if (expanders[i].device)
+        {
+            i2c_master_bus_rm_device(expanders[i].device);
+        }
+    }
+    memset(expanders, 0, sizeof(expanders));
+    i2c_del_master_bus(bus);
+    bus = NULL;
+    chip_count = 0;
+}
+
+static esp_err_t expander_init(const valve_driver_config_t *config)
+{
+    i2c_master_bus_config_t bus_config = {
+        .i2c_port = -1,
+        .sda_io_num = config->data_pin,
+        .scl_io_num = config->clock_pin,
+        .clk_source = I2C_CLK_SRC_DEFAULT,
+        .glitch_ignore_cnt = 7,
+        .flags.enable_internal_pullup = true,
+    };
+    esp_err_t ret = i2c_new_master_bus(&bus_config, &bus);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to initialize I2C bus: %s", esp_err_to_name(ret));
+        bus = NULL;
+        return ret;
+    }
+
+    chip_count = config->chip_count;
+    for (int i = 0; i < chip_count && ret == ESP_OK; i++)
+    {
+        i2c_device_config_t device_config = {
+            .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+            .device_address = config->address + i,
+            .scl_speed_hz = EXPANDER_CLOCK_HZ,
+        };
+        ret = i2c_master_bus_add_device(bus, &device_config, &expanders[i].device);
+
+        // Latches cleared before anything else, an MCP23017 keeps its directions across an ESP32 reset.
+        // A PCF8575 powers up with its pins weakly high, nothing can hold them low before this write.
+        if (ret == ESP_OK)
+        {
+            ret = transfer_port(i, 0);
+        }
+        if (ret == ESP_OK && chip_type == VALVE_DRIVER_MCP23017)
+        {
+            ret = write_register(&expanders[i], MCP23017_IODIRA, 0xFFFF);
+        }
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Expander at 0x%02x not responding: %s", config->address + i, esp_err_to_name(ret));
+        }
+    }
+
+    if (ret != ESP_OK)
+    {
+        remove_expanders();
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "%d %s at 0x%02x, %d outputs", chip_count, chip_type == VALVE_DRIVER_MCP23017 ? "MCP23017" : "PCF8575",
+             config->address, chip_count * EXPANDER_PINS);
+    return ESP_OK;
+}
+
+static esp_err_t mcp23017_init(const valve_driver_config_t *config)
+{
+    chip_type = VALVE_DRIVER_MCP23017;
+    return expander_init(config);
+}
+
+static esp_err_t pcf8575_init(const valve_driver_config_t *config)
+{
+    chip_type = VALVE_DRIVER_PCF8575;
+    return expander_init(config);
+}
+
+// Nothing is valid if the expanders didn't come up
+static bool expander_is_valid(uint8_t output)
+{
+    return bus && output < chip_count * EXPANDER_PINS;
+}
+
+static esp_err_t expander_configure(uint64_t mask)
+{
+    for (int i = 0; i < chip_count; i++)
+    {
+        uint16_t pins = (uint16_t)(mask >> (EXPANDER_PINS * i));
+        if (!(pins & ~expanders[i].outputs))
+        {
+            continue;
+        }
+
+        // Quasi-bidirectional PCF8575 pins are outputs as soon as they are written low, an MCP23017 needs IODIR
+        if (chip_type == VALVE_DRIVER_MCP23017)
+        {
+            esp_err_t ret = write_register(&expanders[i], MCP23017_IODIRA, (uint16_t)~(expanders[i].outputs | pins));
+            if (ret != ESP_OK)
+            {
+                return ret;
+            }
+        }
+        expanders[i].outputs |= pins;
+    }
+    return ESP_OK;
+}
+
+// Every change of one apply goes out in a single transaction per expander, unchanged expanders are skipped
+static esp_err_t expander_write(uint64_t set_mask, uint64_t clear_mask, uint64_t state)
+{
+    if (!bus)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    esp_err_t result = ESP_OK;
+    for (int i = 0; i < chip_count; i++)
+    {
+        uint16_t port = (uint16_t)(state >> (EXPANDER_PINS * i));
+        if (expanders[i].port_known && expanders[i].port == port)
+        {
+            continue;
+        }
+
+        esp_err_t ret = transfer_port(i, port);
+        if (ret != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to write expander %d port 0x%04x: %s", i, port, esp_err_to_name(ret));
+            result = result == ESP_OK ? ret : result;
+        }
+    }
+    return result;
+}
+
+static void expander_get_stats(valve_bus_stats_t *out)
+{
+    *out = stats;
+    out->average_us = stats.transactions ? (uint32_t)(total_us / stats.transactions) : 0;
+}
+
+const valve_backend_t valve_backend_mcp23017 = {
+    .name = "mcp23017",
+    .init = mcp23017_init,
+    .is_valid = expander_is_valid,
+    .configure = expander_configure,
+    .write = expander_write,
+    .get_stats = expander_get_stats,
+};
+
+const valve_backend_t valve_backend_pcf8575 = {
+    .name = "pcf8575",
+    .init = pcf8575_init,
+    .is_valid = expander_is_valid,
+    .configure = expander_configure,
+    .write = expander_write,
+    .get_stats = expander_get_stats,
+};
+
+#endif
@@ -0,0 +1,59 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#ifdef VALVE_OUTPUTS_MOCK
+
+#include "valve_backend.h"
+
+#include <string.h>
+#include "esp_timer.h"
+
+// Host backend, outputs are only recorded so sequencing can be checked off target
+static valve_outputs_write_t history[VALVE_OUTPUTS_MOCK_HISTORY];
+static int history_count = 0;
+
+static esp_err_t mock_init(const valve_driver_config_t *config)
+{
+    history_count = 0;
+    return ESP_OK;
+}
+
+static bool mock_is_valid(uint8_t output)
+{
+    return output < VALVE_OUTPUTS_MAX;
+}
+
+static esp_err_t mock_configure(uint64_t mask)
+{
+    return ESP_OK;
+}
+
+static esp_err_t mock_write(uint64_t set_mask, uint64_t clear_mask, uint64_t state)
+{
+    if (history_count == VALVE_OUTPUTS_MOCK_HISTORY)
+    {
+        memmove(history, history + 1, --history_count * sizeof(history[0]));
+    }
+    history[history_count++] = (valve_outputs_write_t){
+        .time_us = esp_timer_get_time(),
+        .set_mask = set_mask,
+        .clear_mask = clear_mask,
+        .state = state,
+    };
+    return ESP_OK;
+}
+
+const valve_outputs_write_t *valve_outputs_mock_history(int *count)
+{
+    *count = history_count;
+    return history;
+}
+
+const valve_backend_t valve_backend_mock = {
+    .name = "mock",
+    .init = mock_init,
+    .is_valid = mock_is_valid,
+    .configure = mock_configure,
+    .write = mock_write,
+};
+
+#endif
@@ -0,0 +1,187 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#ifndef VALVE_OUTPUTS_MOCK
+
+#include "valve_backend.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+
+static const char *TAG = "VALVE_595";
+
+#define SHIFT_REGISTER_HOST SPI2_HOST
+#define SHIFT_REGISTER_CLOCK_HZ (5 * 1000 * 1000) // 64 outputs shift in under 13 us, well within 74HC595 timing at 3.3 V
+
+static spi_device_handle_t chain = NULL;
+static uint8_t chip_count = 0;
+static uint8_t enable_pin = VALVE_DRIVER_PIN_NONE;
+static bool outputs_disabled = false; // OE held high after a failed shift, until a full shift succeeds
+
+static valve_bus_stats_t stats;
+static uint64_t total_us = 0;
+
+// DMA reads the frame from internal memory
+static WORD_ALIGNED_ATTR DRAM_ATTR uint8_t frame[VALVE_SHIFT_REGISTER_MAX_CHIPS];
+
+// Outputs off by disabling the chain, when its content can't be trusted
+static void disable_outputs(void)
+{
+    outputs_disabled = true;
+    if (enable_pin != VALVE_DRIVER_PIN_NONE)
+    {
+        gpio_set_level(enable_pin, 1);
+    }
+}
+
+static void enable_outputs(void)
+{
+    outputs_disabled = false;
+    if (enable_pin != VALVE_DRIVER_PIN_NONE)
+    {
+        gpio_set_level(enable_pin, 0);
+    }
+}
+
+static esp_err_t shift_out(uint64_t state)
+{
+    valve_shift_register_frame(state, chip_count, frame);
+
+    // The latch is the chip select, its rising edge after the last bit updates every output at once
+    spi_transaction_t transaction = {
+        .length = chip_count * 8,
+        .tx_buffer = frame,
+    };
+    return spi_device_polling_transmit(chain, &transaction);
+}
+
+static esp_err_t shift_register_init(const valve_driver_config_t *config)
+{
+    chip_count = config->chip_count;
+    enable_pin = config->enable_pin;
+
+    // Keep the outputs disabled until the chain holds zeros, the pull-up on OE covers the time before this
+    if (enable_pin != VALVE_DRIVER_PIN_NONE)
+    {
+        gpio_config_t io_conf = {
+            .intr_type = GPIO_INTR_DISABLE,
+            .mode = GPIO_MODE_OUTPUT,
+            .pin_bit_mask = 1ULL << enable_pin,
+            .pull_down_en = 0,
+            .pull_up_en = 1,
+        };
+        gpio_set_level(enable_pin, 1);
+        esp_err_t ret = gpio_config(&io_conf);
+        if (ret != ESP_OK)
+        {
+            return ret;
+        }
+    }
+
+    spi_bus_config_t bus_config = {
+        .mosi_io_num = config->data_pin,
+        .miso_io_num = -1,
+        .sclk_io_num = config->clock_pin,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+        .max_transfer_sz = VALVE_SHIFT_REGISTER_MAX_CHIPS,
+    };
+    esp_err_t ret = spi_bus_initialize(SHIFT_REGISTER_HOST, &bus_config, SPI_DMA_CH_AUTO);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to initialize SPI bus: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    spi_device_interface_config_t device_config = {
+        .mode = 0,
+        .clock_speed_hz = SHIFT_REGISTER_CLOCK_HZ,
+        .spics_io_num = config->latch_pin,
+        .queue_size = 1,
+    };
+    ret = spi_bus_add_device(SHIFT_REGISTER_HOST, &device_config, &chain);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to add shift register chain: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = shift_out(0);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to clear shift register chain: %s", esp_err_to_name(ret));
+        spi_bus_remove_device(chain);
+        chain = NULL;
+        return ret;
+    }
+
+    // Zeros are latched, outputs can follow the chain from now on
+    enable_outputs();
+
+    ESP_LOGI(TAG, "%d chained 74HC595, %d outputs", chip_count, chip_count * 8);
+    return ESP_OK;
+}
+
+// Nothing is valid if the chain didn't come up
+static bool shift_register_is_valid(uint8_t output)
+{
+    return chain && output < chip_count * 8;
+}
+
+static esp_err_t shift_register_configure(uint64_t mask)
+{
+    return ESP_OK;
+}
+
+// The whole chain is rewritten, a failed shift leaves it undefined so it is disabled until the next
+// shift succeeds. Each write is a full shift, so that one brings back every output the state asks for.
+static esp_err_t shift_register_write(uint64_t set_mask, uint64_t clear_mask, uint64_t state)
+{
+    if (!chain)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    esp_err_t ret = shift_out(state);
+    uint32_t elapsed_us = (uint32_t)(esp_timer_get_time() - start_us);
+    stats.transactions++;
+    stats.last_us = elapsed_us;
+    stats.max_us = elapsed_us > stats.max_us ? elapsed_us : stats.max_us;
+    total_us += elapsed_us;
+
+    if (ret != ESP_OK)
+    {
+        stats.failures++;
+        ESP_LOGE(TAG, "Failed to shift outputs 0x%llx, disabling the chain: %s", (unsigned long long)state,
+                 esp_err_to_name(ret));
+        disable_outputs();
+    }
+    else if (outputs_disabled)
+    {
+        ESP_LOGW(TAG, "Shifted outputs 0x%llx, enabling the chain again", (unsigned long long)state);
+        enable_outputs();
+    }
+    return ret;
+}
+
+// Shifts are never retried, failures counts the ones that left the chain disabled
+static void shift_register_get_stats(valve_bus_stats_t *out)
+{
+    *out = stats;
+    out->average_us = stats.transactions ? (uint32_t)(total_us / stats.transactions) : 0;
+}
+
+const valve_backend_t valve_backend_shift_register = {
+    .name = "74hc595",
+    .init = shift_register_init,
+    .is_valid = shift_register_is_valid,
+    .configure = shift_register_configure,
+    .write = shift_register_write,
+    .get_stats = shift_register_get_stats,
+};
+
+#endif
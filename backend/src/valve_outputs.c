@@ -0,0 +1,252 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "valve_outputs.h"
+
+#include "valve_backend.h"
+#include "storage.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "VALVE_OUTPUTS";
+
+#define VALVE_DRIVER_KEY "valve_driver"
+
+static valve_driver_config_t driver_config = {
+    .type = VALVE_DRIVER_GPIO,
+    .data_pin = VALVE_DRIVER_PIN_NONE,
+    .clock_pin = VALVE_DRIVER_PIN_NONE,
+    .latch_pin = VALVE_DRIVER_PIN_NONE,
+    .enable_pin = VALVE_DRIVER_PIN_NONE,
+};
+static bool driver_running = false; // The stored configuration is the one in use
+
+#ifdef VALVE_OUTPUTS_MOCK
+static const valve_backend_t *backend = &valve_backend_mock;
+#else
+static const valve_backend_t *backend = &valve_backend_gpio;
+#endif
+
+// Desired state of every output, written to the driver along with it. A mutex rather than a spinlock,
+// shifting out the chain blocks on the SPI transaction.
+static SemaphoreHandle_t output_mutex = NULL;
+static uint64_t output_state = 0;
+static uint64_t configured_mask = 0;
+
+static bool is_valid_pin(uint8_t pin)
+{
+    return pin < VALVE_OUTPUTS_MAX;
+}
+
+static bool is_valid_driver(const valve_driver_config_t *config)
+{
+    if (config->type == VALVE_DRIVER_GPIO)
+    {
+        return true;
+    }
+    if (config->type == VALVE_DRIVER_MCP23017 || config->type == VALVE_DRIVER_PCF8575)
+    {
+        return is_valid_pin(config->data_pin) && is_valid_pin(config->clock_pin) && config->data_pin != config->clock_pin &&
+               config->chip_count >= 1 && config->chip_count <= VALVE_EXPANDER_MAX_CHIPS &&
+               config->address >= VALVE_EXPANDER_MIN_ADDRESS &&
+               config->address + config->chip_count - 1 <= VALVE_EXPANDER_MAX_ADDRESS;
+    }
+    if (config->type != VALVE_DRIVER_SHIFT_REGISTER)
+    {
+        return false;
+    }
+
+    bool valid = is_valid_pin(config->data_pin) && is_valid_pin(config->clock_pin) && is_valid_pin(config->latch_pin) &&
+                 (config->enable_pin == VALVE_DRIVER_PIN_NONE || is_valid_pin(config->enable_pin)) &&
+                 config->chip_count >= 1 && config->chip_count <= VALVE_SHIFT_REGISTER_MAX_CHIPS;
+    uint8_t pins[] = {config->data_pin, config->clock_pin, config->latch_pin, config->enable_pin};
+    for (int i = 0; valid && i < 4; i++)
+    {
+        for (int j = i + 1; j < 4; j++)
+        {
+            valid &= pins[i] == VALVE_DRIVER_PIN_NONE || pins[i] != pins[j];
+        }
+    }
+    return valid;
+}
+
+esp_err_t valve_outputs_init(void)
+{
+    output_mutex = xSemaphoreCreateMutex();
+    if (!output_mutex)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    valve_driver_config_t stored;
+    size_t required_size = sizeof(stored);
+    if (read_blob(VALVE_DRIVER_KEY, &stored, &required_size) == ESP_OK && required_size == sizeof(stored) &&
+        is_valid_driver(&stored))
+    {
+        driver_config = stored;
+    }
+
+#ifndef VALVE_OUTPUTS_MOCK
+    switch (driver_config.type)
+    {
+    case VALVE_DRIVER_SHIFT_REGISTER:
+        backend = &valve_backend_shift_register;
+        break;
+    case VALVE_DRIVER_MCP23017:
+        backend = &valve_backend_mcp23017;
+        break;
+    case VALVE_DRIVER_PCF8575:
+        backend = &valve_backend_pcf8575;
+        break;
+    default:
+        break;
+    }
+#endif
+
+    // No fallback to GPIO when the driver fails, zone outputs would land on unrelated pins.
+    // The driver then reports every output as invalid and nothing waters.
+    esp_err_t ret = backend->init(&driver_config);
+    driver_running = ret == ESP_OK;
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to start the %s driver, valves are disabled: %s", backend->name, esp_err_to_name(ret));
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Valve outputs on the %s driver", backend->name);
+    return ESP_OK;
+}
+
+esp_err_t valve_outputs_set_driver(const valve_driver_config_t *config)
+{
+    if (!is_valid_driver(config))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = write_blob(VALVE_DRIVER_KEY, config, sizeof(*config));
+    if (ret == ESP_OK)
+    {
+        driver_config = *config;
+        driver_running = false;
+        ESP_LOGI(TAG, "Valve driver set to %s, applied on restart", valve_driver_type_to_string(config->type));
+    }
+    return ret;
+}
+
+bool valve_outputs_get_driver(valve_driver_config_t *config)
+{
+    *config = driver_config;
+    return driver_running;
+}
+
+bool valve_outputs_is_valid(uint8_t output)
+{
+    return backend->is_valid(output);
+}
+
+esp_err_t valve_outputs_configure(uint64_t mask)
+{
+    for (uint8_t output = 0; output < VALVE_OUTPUTS_MAX; output++)
+    {
+        if ((mask & VALVE_OUTPUT_BIT(output)) && !backend->is_valid(output))
+        {
+            ESP_LOGE(TAG, "Output %d doesn't exist on the %s driver", output, backend->name);
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    xSemaphoreTake(output_mutex, portMAX_DELAY);
+    uint64_t new_mask = mask & ~configured_mask;
+    esp_err_t ret = ESP_OK;
+    if (new_mask)
+    {
+        // Off before they become outputs, so a valve never blips open while configuring
+        output_state &= ~new_mask;
+        backend->write(0, new_mask, output_state);
+        ret = backend->configure(new_mask);
+        configured_mask |= ret == ESP_OK ? new_mask : 0;
+    }
+    xSemaphoreGive(output_mutex);
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to configure outputs 0x%llx: %s", (unsigned long long)new_mask, esp_err_to_name(ret));
+    }
+    else if (new_mask)
+    {
+        ESP_LOGI(TAG, "Configured outputs 0x%llx", (unsigned long long)new_mask);
+    }
+    return ret;
+}
+
+uint64_t valve_outputs_apply(uint64_t set_mask, uint64_t clear_mask)
+{
+    // A bit in both masks ends up off, like the registers would leave it
+    xSemaphoreTake(output_mutex, portMAX_DELAY);
+    output_state = (output_state | set_mask) & ~clear_mask;
+    backend->write(set_mask, clear_mask, output_state);
+    uint64_t state = output_state;
+    xSemaphoreGive(output_mutex);
+    return state;
+}
+
+bool valve_outputs_get_bus_stats(valve_bus_stats_t *stats)
+{
+    if (!backend->get_stats)
+    {
+        return false;
+    }
+
+    xSemaphoreTake(output_mutex, portMAX_DELAY);
+    backend->get_stats(stats);
+    xSemaphoreGive(output_mutex);
+    return true;
+}
+
+uint64_t valve_outputs_get(void)
+{
+    xSemaphoreTake(output_mutex, portMAX_DELAY);
+    uint64_t state = output_state;
+    xSemaphoreGive(output_mutex);
+    return state;
+}
+
+const char *valve_driver_type_to_string(valve_driver_type_t type)
+{
+    switch (type)
+    {
+    case VALVE_DRIVER_SHIFT_REGISTER:
+        return "shift_register";
+    case VALVE_DRIVER_MCP23017:
+        return "mcp23017";
+    case VALVE_DRIVER_PCF8575:
+        return "pcf8575";
+    default:
+        return "gpio";
+    }
+}
+
+esp_err_t valve_driver_type_from_string(const char *value, valve_driver_type_t *type)
+{
+    for (valve_driver_type_t candidate = VALVE_DRIVER_GPIO; candidate <= VALVE_DRIVER_PCF8575; candidate++)
+    {
+        if (!strcmp(value, valve_driver_type_to_string(candidate)))
+        {
+            *type = candidate;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+#ifdef VALVE_OUTPUTS_MOCK
+void valve_outputs_mock_reset(void)
+{
+    output_state = 0;
+    configured_mask = 0;
+    backend->init(&driver_config);
+}
+#endif
@@ -0,0 +1,140 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Outputs are virtual, numbered by the driver: GPIO numbers, or bit n of a shift register chain or expander ports
+#define VALVE_OUTPUT_BIT(output) (1ULL << (output))
+#define VALVE_OUTPUTS_MAX 64
+
+// Pin of the driver that isn't wired
+#define VALVE_DRIVER_PIN_NONE 0xFF
+
+// 74HC595 chains longer than this would not fit the 64-bit output state
+#define VALVE_SHIFT_REGISTER_MAX_CHIPS 8
+
+// 16-bit I2C expanders, at consecutive addresses from the configured one
+#define VALVE_EXPANDER_MAX_CHIPS 4
+#define VALVE_EXPANDER_MIN_ADDRESS 0x20
+#define VALVE_EXPANDER_MAX_ADDRESS 0x27
+
+typedef enum
+{
+    VALVE_DRIVER_GPIO,          // Outputs are ESP32 GPIO numbers
+    VALVE_DRIVER_SHIFT_REGISTER, // Outputs are the bits of chained 74HC595, shifted out over SPI
+    VALVE_DRIVER_MCP23017,       // Outputs are the GPA0-7 then GPB0-7 pins of each MCP23017 on I2C
+    VALVE_DRIVER_PCF8575         // Outputs are the P00-07 then P10-17 pins of each PCF8575 on I2C
+} valve_driver_type_t;
+
+typedef struct
+{
+    valve_driver_type_t type;
+    // Shift register or expander wiring, unused by the GPIO driver
+    uint8_t data_pin;   // SER, SPI MOSI. SDA for expanders
+    uint8_t clock_pin;  // SRCLK, SPI clock. SCL for expanders
+    uint8_t latch_pin;  // RCLK, the SPI chip select so the outputs latch on its rising edge after the last bit
+    uint8_t enable_pin; // OE, active low and pulled up so outputs stay off until the chain holds zeros
+    uint8_t chip_count; // 8 outputs per 74HC595, output 0 is Q0 of the chip closest to the ESP32. 16 per expander
+    uint8_t address;    // 7-bit I2C address of the first expander, output 0 is its first pin
+} valve_driver_config_t;
+
+// Transactions of a driver behind a bus, a transaction being a write and its readback with retries
+typedef struct
+{
+    uint32_t transactions;
+    uint32_t retries;  // Attempts repeated after a NACK, timeout or readback mismatch
+    uint32_t failures; // Transactions that still failed after the last retry
+    uint32_t last_us;  // Latency of the last transaction, retries included
+    uint32_t max_us;
+    uint32_t average_us;
+} valve_bus_stats_t;
+
+#ifdef VALVE_OUTPUTS_MOCK
+// Writes remembered by the host backend, oldest dropped first
+#define VALVE_OUTPUTS_MOCK_HISTORY 64
+
+typedef struct
+{
+    int64_t time_us;
+    uint64_t set_mask;
+    uint64_t clear_mask;
+    uint64_t state; // Outputs on after the write
+} valve_outputs_write_t;
+#endif
+
+/**
+ * @brief Load the driver configuration from NVS and bring its outputs up, all off
+ * If the configured driver fails to start, none of its outputs is valid. The host build always uses the mock backend.
+ */
+esp_err_t valve_outputs_init(void);
+
+/**
+ * @brief Validate and persist the driver configuration, applied on the next boot
+ * Outputs can't change driver while valves may be open, and zones must be renumbered for the new one.
+ *
+ * @param config New configuration
+ * @return esp_err_t ESP_ERR_INVALID_ARG if a pin is invalid or shared, or the chain length is out of range
+ */
+esp_err_t valve_outputs_set_driver(const valve_driver_config_t *config);
+
+/**
+ * @brief Stored driver configuration, and whether it is the one running
+ */
+bool valve_outputs_get_driver(valve_driver_config_t *config);
+
+/**
+ * @brief Configure outputs, new ones start off
+ * Outputs configured before are left as they are, so this can be called while valves are open.
+ *
+ * @param mask Outputs to configure
+ * @return esp_err_t ESP_ERR_INVALID_ARG if one of them doesn't exist on the driver
+ */
+esp_err_t valve_outputs_configure(uint64_t mask);
+
+/**
+ * @brief Turn outputs on and off in the same instant, set before clear
+ * One write per GPIO register bank, one latched shift of the whole chain, or one I2C transaction per
+ * expander whose pins change. The state is updated
+ * with it so concurrent callers never interleave.
+ * Waits on the output mutex and, for the I2C expanders, on the bus with retries, so it is only called
+ * from tasks, never from an esp_timer callback or an ISR.
+ *
+ * @param set_mask Outputs to turn on
+ * @param clear_mask Outputs to turn off
+ * @return uint64_t Outputs on after the write
+ */
+uint64_t valve_outputs_apply(uint64_t set_mask, uint64_t clear_mask);
+
+/**
+ * @brief Bus transaction counters and latency of the running driver
+ *
+ * @return bool false if the driver has no bus, such as GPIO
+ */
+bool valve_outputs_get_bus_stats(valve_bus_stats_t *stats);
+
+/**
+ * @brief Outputs currently on
+ */
+uint64_t valve_outputs_get(void);
+
+/**
+ * @brief Whether an output exists on the running driver
+ */
+bool valve_outputs_is_valid(uint8_t output);
+
+const char *valve_driver_type_to_string(valve_driver_type_t type);
+esp_err_t valve_driver_type_from_string(const char *value, valve_driver_type_t *type);
+
+#ifdef VALVE_OUTPUTS_MOCK
+/**
+ * @brief Writes applied so far on the host backend, in order
+ *
+ * @param count Number of writes returned
+ * @return const valve_outputs_write_t* Oldest first
+ */
+const valve_outputs_write_t *valve_outputs_mock_history(int *count);
+void valve_outputs_mock_reset(void);
+#endif
@@ -0,0 +1,238 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "valve_sequencer.h"
+
+#include "valve_outputs.h"
+#include "storage.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static const char *TAG = "VALVE_SEQ";
+
+#define VALVE_SEQUENCE_KEY "valve_seq"
+
+// Longest sequence is a start: master valve, zone, pump
+#define MAX_SEQUENCE_STEPS 3
+
+// Above the executor, so a step that falls due isn't held up by the switch that scheduled it.
+// The stack covers the I2C master driver and the expander retry logs.
+#define SEQUENCE_TASK_STACK_SIZE 4096
+#define SEQUENCE_TASK_PRIORITY 7
+
+// Outputs written together at one point on the monotonic clock
+typedef struct
+{
+    int64_t due_us;
+    uint64_t set_mask;
+    uint64_t clear_mask;
+    uint64_t open_zones; // Zone outputs open once the step is applied
+} sequence_step_t;
+
+static valve_sequence_t sequence = {
+    .master_output = VALVE_OUTPUT_NONE,
+    .pump_output = VALVE_OUTPUT_NONE,
+};
+
+// Everything below is only touched with the mutex held, from callers and from the sequencer task
+static SemaphoreHandle_t sequence_mutex = NULL;
+static esp_timer_handle_t sequence_timer = NULL;
+static TaskHandle_t sequence_task = NULL;
+static sequence_step_t steps[MAX_SEQUENCE_STEPS];
+static int step_count = 0;
+static int next_step = 0;
+static uint64_t open_zones = 0;
+
+static uint64_t output_bit(uint8_t output)
+{
+    return output == VALVE_OUTPUT_NONE ? 0 : VALVE_OUTPUT_BIT(output);
+}
+
+static bool is_valid_output(uint8_t output)
+{
+    return output == VALVE_OUTPUT_NONE || valve_outputs_is_valid(output);
+}
+
+static bool is_valid_sequence(const valve_sequence_t *candidate)
+{
+    bool shared = candidate->master_output != VALVE_OUTPUT_NONE && candidate->master_output == candidate->pump_output;
+    return is_valid_output(candidate->master_output) && is_valid_output(candidate->pump_output) && !shared &&
+           candidate->master_lead_ms <= VALVE_SEQUENCE_MAX_DELAY_MS && candidate->pump_delay_ms <= VALVE_SEQUENCE_MAX_DELAY_MS &&
+           candidate->overlap_ms <= VALVE_SEQUENCE_MAX_DELAY_MS;
+}
+
+static void add_step(int64_t due_us, uint64_t set_mask, uint64_t clear_mask, uint64_t zones)
+{
+    steps[step_count++] = (sequence_step_t){
+        .due_us = due_us,
+        .set_mask = set_mask,
+        .clear_mask = clear_mask,
+        .open_zones = zones,
+    };
+}
+
+// Apply the steps that are due and arm the timer for the next one, with the mutex held
+static void run_due_steps(void)
+{
+    int64_t now = esp_timer_get_time();
+    while (next_step < step_count && steps[next_step].due_us <= now)
+    {
+        const sequence_step_t *step = &steps[next_step++];
+        valve_outputs_apply(step->set_mask, step->clear_mask);
+        open_zones = step->open_zones;
+    }
+
+    esp_timer_stop(sequence_timer);
+    if (next_step < step_count)
+    {
+        esp_timer_start_once(sequence_timer, steps[next_step].due_us - now);
+    }
+}
+
+// Only wakes the sequencer task: the esp_timer task is shared and must not wait on the mutex or the bus
+static void sequence_timer_callback(void *arg)
+{
+    xTaskNotifyGive(sequence_task);
+}
+
+static void sequence_task_loop(void *arg)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        xSemaphoreTake(sequence_mutex, portMAX_DELAY);
+        run_due_steps();
+        xSemaphoreGive(sequence_mutex);
+    }
+}
+
+esp_err_t valve_sequencer_init(uint64_t zone_outputs)
+{
+    sequence_mutex = xSemaphoreCreateMutex();
+    if (!sequence_mutex)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    if (xTaskCreate(sequence_task_loop, "valve_seq", SEQUENCE_TASK_STACK_SIZE, NULL, SEQUENCE_TASK_PRIORITY, &sequence_task) !=
+        pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create sequencer task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = sequence_timer_callback,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "valve_seq",
+    };
+    esp_err_t ret = esp_timer_create(&timer_args, &sequence_timer);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to create sequencing timer: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    valve_sequence_t stored;
+    size_t required_size = sizeof(stored);
+    if (read_blob(VALVE_SEQUENCE_KEY, &stored, &required_size) == ESP_OK && required_size == sizeof(stored) &&
+        is_valid_sequence(&stored))
+    {
+        sequence = stored;
+    }
+
+    // Zones, master valve and pump configured in a single call
+    ret = valve_outputs_configure(zone_outputs | output_bit(sequence.master_output) | output_bit(sequence.pump_output));
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+    ESP_LOGI(TAG, "Master valve %d, pump %d, lead %d ms, pump delay %d ms, overlap %d ms", sequence.master_output,
+             sequence.pump_output, sequence.master_lead_ms, sequence.pump_delay_ms, sequence.overlap_ms);
+    return ESP_OK;
+}
+
+esp_err_t valve_sequencer_set(const valve_sequence_t *candidate)
+{
+    if (!is_valid_sequence(candidate))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = write_blob(VALVE_SEQUENCE_KEY, candidate, sizeof(*candidate));
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    // Outputs that are on keep being driven until the next stop, which closes everything that is on
+    xSemaphoreTake(sequence_mutex, portMAX_DELAY);
+    sequence = *candidate;
+    valve_outputs_configure(output_bit(sequence.master_output) | output_bit(sequence.pump_output));
+    xSemaphoreGive(sequence_mutex);
+
+    ESP_LOGI(TAG, "Sequence set: master valve %d, pump %d, lead %d ms, pump delay %d ms, overlap %d ms",
+             candidate->master_output, candidate->pump_output, candidate->master_lead_ms, candidate->pump_delay_ms,
+             candidate->overlap_ms);
+    return ESP_OK;
+}
+
+void valve_sequencer_get(valve_sequence_t *config)
+{
+    xSemaphoreTake(sequence_mutex, portMAX_DELAY);
+    *config = sequence;
+    xSemaphoreGive(sequence_mutex);
+}
+
+esp_err_t valve_sequencer_switch(uint8_t output)
+{
+    if (!is_valid_output(output))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(sequence_mutex, portMAX_DELAY);
+
+    // Pending edges of an unfinished sequence are dropped, the new one starts from the outputs as they are
+    uint64_t target = output_bit(output);
+    uint64_t master = output_bit(sequence.master_output);
+    uint64_t pump = output_bit(sequence.pump_output);
+    int64_t now = esp_timer_get_time();
+    step_count = 0;
+    next_step = 0;
+
+    if (!target)
+    {
+        // Pump first so it never runs against closed valves
+        add_step(now, 0, pump, open_zones);
+        add_step(now + sequence.pump_delay_ms * 1000LL, 0, valve_outputs_get() | master, 0);
+    }
+    else if (!open_zones)
+    {
+        add_step(now, master, 0, 0);
+        add_step(now + sequence.master_lead_ms * 1000LL, target, 0, target);
+        add_step(now + (sequence.master_lead_ms + sequence.pump_delay_ms) * 1000LL, pump, 0, target);
+    }
+    else
+    {
+        // Make before break, the handover is a single step when there is no overlap
+        uint64_t previous = open_zones & ~target;
+        if (sequence.overlap_ms)
+        {
+            add_step(now, target | master | pump, 0, open_zones | target);
+            add_step(now + sequence.overlap_ms * 1000LL, 0, previous, target);
+        }
+        else
+        {
+            add_step(now, target | master | pump, previous, target);
+        }
+    }
+
+    run_due_steps();
+    xSemaphoreGive(sequence_mutex);
+    return ESP_OK;
+}
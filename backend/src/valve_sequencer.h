@@ -0,0 +1,53 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+// Master valve or pump output that isn't wired
+#define VALVE_OUTPUT_NONE 0xFF
+
+// Longest configurable delay, so a misconfigured sequence can't hold water on for minutes
+#define VALVE_SEQUENCE_MAX_DELAY_MS 10000
+
+// Outputs switched around the zone valves and their timing
+typedef struct
+{
+    uint8_t master_output;   // Master valve output, VALVE_OUTPUT_NONE if there is none
+    uint8_t pump_output;     // Pump relay output, VALVE_OUTPUT_NONE if there is none
+    uint16_t master_lead_ms; // Master valve opens this long before the first zone
+    uint16_t pump_delay_ms;  // Pump starts this long after the first zone opens, and stops this long before the last one closes
+    uint16_t overlap_ms;     // Next zone opens this long before the previous one closes, 0 switches both in the same write
+} valve_sequence_t;
+
+/**
+ * @brief Load the sequence from NVS, configure every output at once and create the sequencing timer and task
+ *
+ * @param zone_outputs Outputs of the zones, see VALVE_OUTPUT_BIT
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t valve_sequencer_init(uint64_t zone_outputs);
+
+/**
+ * @brief Validate and persist the sequence, it applies from the next zone switch
+ *
+ * @param sequence New sequence
+ * @return esp_err_t ESP_ERR_INVALID_ARG if an output is out of range, shared, or a delay is too long
+ */
+esp_err_t valve_sequencer_set(const valve_sequence_t *sequence);
+void valve_sequencer_get(valve_sequence_t *sequence);
+
+/**
+ * @brief Make output the only open zone valve, or close them all with VALVE_OUTPUT_NONE
+ * From no zone open: master valve, then the zone, then the pump. From another zone: make before break,
+ * the previous zone closes overlap_ms after the next one opens. To none: pump off, then zones and master valve.
+ * Edges are timed on the monotonic clock and each one is a single valve_outputs_apply, a switch arriving
+ * mid sequence starts over from the outputs as they are. Edges due now are applied by the caller, later
+ * ones by the sequencer task when its timer fires.
+ *
+ * @param output Zone output to open, VALVE_OUTPUT_NONE to stop watering
+ * @return esp_err_t ESP_ERR_INVALID_ARG if the output doesn't exist on the valve driver
+ */
+esp_err_t valve_sequencer_switch(uint8_t output);
@@ -0,0 +1,119 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "water_budget.h"
+
+#include "storage.h"
+#include "timezone.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "WATER_BUDGET";
+
+#define WATER_BUDGET_KEY "water_budget"
+
+// Double buffered like the timezone table, the executor and the schedule engine read the published one without locking
+static water_budget_t budgets[2] = {{.percent = WATER_BUDGET_DEFAULT_PERCENT}};
+static water_budget_t *volatile active_budget = &budgets[0];
+static SemaphoreHandle_t budget_mutex = NULL;
+
+static bool is_valid_budget(const water_budget_t *budget)
+{
+    bool valid = budget->percent <= WATER_BUDGET_MAX_PERCENT;
+    for (int i = 0; i < WATER_BUDGET_MONTHS; i++)
+    {
+        valid &= budget->monthly_percent[i] <= WATER_BUDGET_MAX_PERCENT;
+    }
+    return valid;
+}
+
+static uint8_t global_percent(const water_budget_t *budget, int month)
+{
+    return budget->monthly ? budget->monthly_percent[(month - 1) % WATER_BUDGET_MONTHS] : budget->percent;
+}
+
+esp_err_t water_budget_init(void)
+{
+    budget_mutex = xSemaphoreCreateMutex();
+    if (!budget_mutex)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    water_budget_t stored;
+    size_t required_size = sizeof(stored);
+    if (read_blob(WATER_BUDGET_KEY, &stored, &required_size) != ESP_OK || required_size != sizeof(stored) ||
+        !is_valid_budget(&stored))
+    {
+        ESP_LOGI(TAG, "No water budget set, programs water for their full durations");
+        return ESP_OK;
+    }
+
+    budgets[1] = stored;
+    active_budget = &budgets[1];
+    ESP_LOGI(TAG, "Water budget %d%%%s", stored.percent, stored.monthly ? ", monthly schedule" : "");
+    return ESP_OK;
+}
+
+esp_err_t water_budget_set(const water_budget_t *budget)
+{
+    if (!is_valid_budget(budget))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (xSemaphoreTake(budget_mutex, portMAX_DELAY) != pdTRUE)
+    {
+        return ESP_ERR_TIMEOUT;
+    }
+
+    water_budget_t *next = (active_budget == &budgets[0]) ? &budgets[1] : &budgets[0];
+    *next = *budget;
+    esp_err_t ret = write_blob(WATER_BUDGET_KEY, next, sizeof(*next));
+    if (ret == ESP_OK)
+    {
+        active_budget = next;
+        ESP_LOGI(TAG, "Water budget set to %d%%%s", next->percent, next->monthly ? ", monthly schedule" : "");
+    }
+    else
+    {
+        ESP_LOGE(TAG, "Failed to save water budget: %s", esp_err_to_name(ret));
+    }
+
+    xSemaphoreGive(budget_mutex);
+    return ret;
+}
+
+void water_budget_get(water_budget_t *budget)
+{
+    *budget = *active_budget;
+}
+
+uint16_t water_budget_percent(uint8_t program_percent, int month)
+{
+    return (uint16_t)global_percent(active_budget, month) * program_percent / 100;
+}
+
+uint16_t water_budget_percent_at(uint8_t program_percent, time_t when)
+{
+    int year, month, day;
+    timezone_date_from_days(timezone_local_day(timezone_to_local(when)), &year, &month, &day);
+    return water_budget_percent(program_percent, month);
+}
+
+uint16_t water_budget_max_percent(uint8_t program_percent)
+{
+    const water_budget_t *budget = active_budget;
+    uint8_t largest = budget->percent;
+    if (budget->monthly)
+    {
+        largest = 0;
+        for (int i = 0; i < WATER_BUDGET_MONTHS; i++)
+        {
+            largest = budget->monthly_percent[i] > largest ? budget->monthly_percent[i] : largest;
+        }
+    }
+    return (uint16_t)largest * program_percent / 100;
+}
@@ -0,0 +1,61 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+// Budgets are percentages of the zone durations entered in programs
+#define WATER_BUDGET_DEFAULT_PERCENT 100
+#define WATER_BUDGET_MAX_PERCENT 200
+#define WATER_BUDGET_MONTHS 12
+
+// Global budget, applied to every program on top of its own
+typedef struct
+{
+    uint8_t percent;                              // Used when the monthly schedule is off
+    bool monthly;                                 // Use the percentage of the local month instead
+    uint8_t monthly_percent[WATER_BUDGET_MONTHS]; // January first
+} water_budget_t;
+
+// Zone watering time once budgeted, with an extra scale on top (the finish-by plan's, 100 otherwise).
+// Everything that times zones goes through here so the executor, recovery and projections agree.
+static inline uint32_t water_budget_zone_seconds(uint16_t minutes, uint16_t budget_percent, uint8_t scale_percent)
+{
+    return (uint32_t)((uint64_t)minutes * 60 * budget_percent * scale_percent / 10000);
+}
+
+/**
+ * @brief Load the global budget from NVS, 100% until set
+ */
+esp_err_t water_budget_init(void);
+
+/**
+ * @brief Validate, persist and publish the global budget, programs must be recompiled afterwards
+ *
+ * @param budget New budget
+ * @return esp_err_t ESP_ERR_INVALID_ARG if a percentage is above WATER_BUDGET_MAX_PERCENT
+ */
+esp_err_t water_budget_set(const water_budget_t *budget);
+void water_budget_get(water_budget_t *budget);
+
+/**
+ * @brief Effective budget of a program in a month, the global one times the program's
+ *
+ * @param program_percent Program budget
+ * @param month Local month, 1 to 12
+ * @return uint16_t Percentage of the zone durations
+ */
+uint16_t water_budget_percent(uint8_t program_percent, int month);
+
+/**
+ * @brief Effective budget of a program at a time, in the local month of that time
+ */
+uint16_t water_budget_percent_at(uint8_t program_percent, time_t when);
+
+/**
+ * @brief Largest effective budget of a program over the year, for conflict windows
+ */
+uint16_t water_budget_max_percent(uint8_t program_percent);
@@ -0,0 +1,362 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#include "watering_plan.h"
+
+#include "schedule_engine.h"
+#include "change_events.h"
+#include "water_budget.h"
+#include "storage.h"
+#include "timezone.h"
+#include "utils.h"
+
+#include <string.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+
+static const char *TAG = "WATERING_PLAN";
+
+#define PLAN_WINDOW_KEY "plan_window"
+
+static plan_window_t window = {0};
+static portMUX_TYPE window_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Published plan and the one being built, both only touched with the sprinkler data locked
+static watering_plan_t plan;
+static watering_plan_t next_plan;
+
+static bool is_valid_window(const plan_window_t *candidate)
+{
+    return candidate->window_start < MINUTES_PER_DAY && candidate->finish_by < MINUTES_PER_DAY &&
+           candidate->window_start != candidate->finish_by;
+}
+
+// Window length in minutes, wrapping midnight when the deadline is before the start
+static uint32_t window_minutes(const plan_window_t *config)
+{
+    return (config->finish_by + MINUTES_PER_DAY - config->window_start) % MINUTES_PER_DAY;
+}
+
+// Watering time of a program's enabled zones, budgeted and scaled zone by zone like the executor
+static uint32_t program_seconds(const sprinkler_data_t *data, const program_t *program, time_t start, uint8_t scale_percent)
+{
+    uint16_t budget_percent = water_budget_percent_at(program->budget_percent, start);
+    uint32_t seconds = 0;
+    for (int i = 0; i < program->zone_count; i++)
+    {
+        const program_zone_t *pz = &sprinkler_program_zones(data, program)[i];
+        if (pz->zone_id > 0 && pz->zone_id <= MAX_ZONES && data->zones[pz->zone_id - 1].enabled)
+        {
+            seconds += water_budget_zone_seconds(pz->duration, budget_percent, scale_percent);
+        }
+    }
+    return seconds;
+}
+
+static bool in_window(time_t start)
+{
+    return plan.deadline && start >= plan.window_open && start < plan.deadline;
+}
+
+static bool is_planned(const watering_plan_t *candidate, int count, uint8_t program_id, time_t nominal)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (candidate->runs[i].program_id == program_id && candidate->runs[i].nominal == nominal)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Insert a run keeping [from, run_count) ordered by nominal start, programs sharing a start keep their id order
+static void insert_by_nominal(watering_plan_t *candidate, int from, const planned_run_t *run)
+{
+    int j = candidate->run_count++;
+    while (j > from && candidate->runs[j - 1].nominal > run->nominal)
+    {
+        candidate->runs[j] = candidate->runs[j - 1];
+        j--;
+    }
+    candidate->runs[j] = *run;
+}
+
+esp_err_t watering_plan_init(void)
+{
+    plan_window_t stored;
+    size_t required_size = sizeof(stored);
+    if (read_blob(PLAN_WINDOW_KEY, &stored, &required_size) != ESP_OK || required_size != sizeof(stored) ||
+        !is_valid_window(&stored))
+    {
+        ESP_LOGI(TAG, "No finish-by window set");
+        return ESP_OK;
+    }
+
+    taskENTER_CRITICAL(&window_lock);
+    window = stored;
+    taskEXIT_CRITICAL(&window_lock);
+
+    ESP_LOGI(TAG, "Finish-by window %02d:%02d-%02d:%02d%s", stored.window_start / 60, stored.window_start % 60,
+             stored.finish_by / 60, stored.finish_by % 60, stored.enabled ? "" : " (disabled)");
+    return ESP_OK;
+}
+
+esp_err_t watering_plan_set_window(const plan_window_t *config)
+{
+    if (!is_valid_window(config))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_err_t ret = write_blob(PLAN_WINDOW_KEY, config, sizeof(*config));
+    if (ret == ESP_OK)
+    {
+        taskENTER_CRITICAL(&window_lock);
+        window = *config;
+        taskEXIT_CRITICAL(&window_lock);
+    }
+    return ret;
+}
+
+void watering_plan_get_window(plan_window_t *config)
+{
+    taskENTER_CRITICAL(&window_lock);
+    *config = window;
+    taskEXIT_CRITICAL(&window_lock);
+}
+
+bool watering_plan_rebuild(const sprinkler_data_t *data, time_t now)
+{
+    plan_window_t config;
+    watering_plan_get_window(&config);
+
+    // Zeroed as a whole, plans are compared bytewise
+    memset(&next_plan, 0, sizeof(next_plan));
+    if (config.enabled)
+    {
+        // Next deadline after now and the window it closes, in local time so they follow DST
+        int64_t local_deadline = timezone_local_day(timezone_to_local(now)) * SECONDS_PER_DAY + config.finish_by * 60;
+        time_t deadline = timezone_to_utc(local_deadline);
+        if (deadline <= now)
+        {
+            local_deadline += SECONDS_PER_DAY;
+            deadline = timezone_to_utc(local_deadline);
+        }
+        next_plan.deadline = deadline;
+        next_plan.window_open = timezone_to_utc(local_deadline - window_minutes(&config) * 60);
+
+        // Runs that already started in this window stay where they are, the rest fits after them
+        time_t begin = max(next_plan.window_open, now);
+        if (plan.deadline == deadline)
+        {
+            for (int i = 0; i < plan.run_count; i++)
+            {
+                if (plan.runs[i].start <= now)
+                {
+                    next_plan.runs[next_plan.run_count++] = plan.runs[i];
+                    begin = max(begin, plan.runs[i].start + (time_t)plan.runs[i].seconds);
+                }
+            }
+        }
+        int started = next_plan.run_count;
+
+        // Scheduled starts inside the window, those served before a reboot are recognized by the last run
+        for (int i = 0; i < MAX_PROGRAMS; i++)
+        {
+            const program_t *program = &data->programs[i];
+            if (!program->id || !program->enabled)
+                continue;
+
+            time_t nominal = schedule_engine_next_run(program->id, next_plan.window_open - 1);
+            for (; nominal && nominal < deadline; nominal = schedule_engine_next_run(program->id, nominal))
+            {
+                uint32_t seconds = program_seconds(data, program, nominal, 100);
+                time_t last_run = sprinkler_time_from_offset(program->last_run);
+                bool served = last_run >= next_plan.window_open && nominal <= last_run;
+                if (!seconds || served || is_planned(&next_plan, started, program->id, nominal))
+                    continue;
+                if (next_plan.run_count >= PLAN_MAX_RUNS)
+                {
+                    ESP_LOGW(TAG, "Too many runs in the window, program %d at %lld left out", program->id, (long long)nominal);
+                    break;
+                }
+
+                planned_run_t run = {.nominal = nominal, .seconds = seconds, .program_id = program->id, .scale_percent = 100};
+                insert_by_nominal(&next_plan, started, &run);
+            }
+        }
+
+        // Scale proportionally when the runs don't fit, scaled zones round down so the sum stays within the window
+        uint64_t available = deadline > begin ? deadline - begin : 0;
+        uint64_t total = 0;
+        for (int i = started; i < next_plan.run_count; i++)
+        {
+            total += next_plan.runs[i].seconds;
+        }
+        uint8_t scale = total > available ? available * 100 / total : 100;
+        if (scale < 100 && next_plan.run_count > started)
+        {
+            ESP_LOGW(TAG, "Runs exceed the window by %llu minutes, durations scaled to %d%%",
+                     (unsigned long long)(total - available) / 60, scale);
+            total = 0;
+            for (int i = started; i < next_plan.run_count; i++)
+            {
+                planned_run_t *run = &next_plan.runs[i];
+                run->scale_percent = scale;
+                run->seconds = program_seconds(data, &data->programs[run->program_id - 1], run->nominal, scale);
+                total += run->seconds;
+            }
+        }
+        if (scale == 0)
+        {
+            ESP_LOGW(TAG, "No time left before the deadline, %d runs dropped", next_plan.run_count - started);
+            next_plan.run_count = started;
+        }
+        next_plan.scale_percent = scale;
+
+        // Back to back, against the deadline when they fit, from the window start when scaled
+        time_t start = scale == 100 ? deadline - (time_t)total : begin;
+        for (int i = started; i < next_plan.run_count; i++)
+        {
+            next_plan.runs[i].start = start;
+            start += next_plan.runs[i].seconds;
+        }
+    }
+
+    bool changed = memcmp(&next_plan, &plan, sizeof(plan)) != 0;
+    if (changed)
+    {
+        plan = next_plan;
+        change_events_publish(CHANGE_PLAN, 0, CHANGE_RUNS);
+    }
+    return changed;
+}
+
+time_t watering_plan_next_run(uint8_t program_id, time_t now)
+{
+    time_t next = 0;
+    for (int i = 0; i < plan.run_count; i++)
+    {
+        const planned_run_t *run = &plan.runs[i];
+        if (run->program_id == program_id && run->start > now && (!next || run->start < next))
+        {
+            next = run->start;
+        }
+    }
+
+    // Scheduled starts inside the window belong to the plan, even when it dropped them
+    time_t nominal = schedule_engine_next_run(program_id, now);
+    while (nominal && in_window(nominal))
+    {
+        nominal = schedule_engine_next_run(program_id, nominal);
+    }
+    return nominal && (!next || nominal < next) ? nominal : next;
+}
+
+time_t watering_plan_last_start(uint8_t program_id, time_t now)
+{
+    time_t last = 0;
+    for (int i = 0; i < plan.run_count; i++)
+    {
+        const planned_run_t *run = &plan.runs[i];
+        if (run->program_id == program_id && run->start <= now && run->start > last)
+        {
+            last = run->start;
+        }
+    }
+
+    time_t nominal = schedule_engine_last_start(program_id, now);
+    return !in_window(nominal) && nominal > last ? nominal : last;
+}
+
+uint8_t watering_plan_scale(uint8_t program_id, time_t start)
+{
+    for (int i = 0; i < plan.run_count; i++)
+    {
+        if (plan.runs[i].program_id == program_id && plan.runs[i].start == start)
+        {
+            return plan.runs[i].scale_percent;
+        }
+    }
+    return 100;
+}
+
+// Next start of a program after the cursor, ties at the cursor time resolved by program id
+static time_t next_start_after_cursor(uint8_t program_id, const calendar_cursor_t *cursor)
+{
+    time_t next = watering_plan_next_run(program_id, cursor->time - 1);
+    if (next == cursor->time && program_id <= cursor->program_id)
+    {
+        next = watering_plan_next_run(program_id, cursor->time);
+    }
+    return next;
+}
+
+size_t watering_plan_expand(const sprinkler_data_t *data, calendar_cursor_t *cursor, time_t until,
+                            calendar_run_t *runs, size_t max_runs)
+{
+    size_t count = 0;
+
+    while (true)
+    {
+        // Earliest next start across programs, a k-way merge of their starts
+        uint8_t program_id = 0;
+        time_t start = 0;
+        for (int i = 0; i < MAX_PROGRAMS; i++)
+        {
+            if (!data->programs[i].id || !data->programs[i].enabled)
+                continue;
+
+            time_t next = next_start_after_cursor(i + 1, cursor);
+            if (next && (!program_id || next < start))
+            {
+                program_id = i + 1;
+                start = next;
+            }
+        }
+
+        if (!program_id || start > until)
+        {
+            break;
+        }
+
+        const program_t *program = &data->programs[program_id - 1];
+        if (count + program->zone_count > max_runs)
+        {
+            break;
+        }
+
+        // Budgeted and scaled like the executor does at the start of the run
+        uint16_t budget_percent = water_budget_percent_at(program->budget_percent, start);
+        uint8_t scale_percent = watering_plan_scale(program_id, start);
+        time_t zone_start = start;
+        for (int j = 0; j < program->zone_count; j++)
+        {
+            const program_zone_t *pz = &sprinkler_program_zones(data, program)[j];
+            if (pz->zone_id == 0 || pz->zone_id > MAX_ZONES || !data->zones[pz->zone_id - 1].enabled || !pz->duration)
+                continue;
+
+            calendar_run_t *run = &runs[count++];
+            run->start = zone_start;
+            run->program_id = program_id;
+            run->zone_id = pz->zone_id;
+            run->seconds = water_budget_zone_seconds(pz->duration, budget_percent, scale_percent);
+            zone_start += run->seconds;
+        }
+
+        cursor->time = start;
+        cursor->program_id = program_id;
+    }
+
+    return count;
+}
+
+bool watering_plan_expired(time_t now)
+{
+    return plan.deadline && now >= plan.deadline;
+}
+
+const watering_plan_t *watering_plan_get(void)
+{
+    return &plan;
+}
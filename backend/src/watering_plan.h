@@ -0,0 +1,142 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+#pragma once
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "sprinkler_storage.h"
+
+// Runs planned in one window. It could hold MAX_PROGRAMS * MAX_START_TIMES * 2 of them, the plan is
+// kept twice so it is capped, starts beyond it are dropped from the window with a warning.
+#define PLAN_MAX_RUNS 64
+
+// Daily window every scheduled start inside it must fit in, minutes of the local day
+typedef struct
+{
+    bool enabled;
+    uint16_t window_start; // Earliest planned start
+    uint16_t finish_by;    // Hard deadline, before window_start when the window wraps midnight
+} plan_window_t;
+
+// One program run moved by the planner
+typedef struct
+{
+    time_t start;     // Planned start
+    time_t nominal;   // Start from the program schedule
+    uint32_t seconds; // Watering time of the enabled zones, once budgeted and scaled
+    uint8_t program_id;
+    uint8_t scale_percent; // On top of the water budget
+} planned_run_t;
+
+typedef struct
+{
+    time_t window_open;
+    time_t deadline; // 0 when planning is disabled
+    uint8_t scale_percent; // Applied to the runs laid out by the last rebuild
+    uint8_t run_count;
+    planned_run_t runs[PLAN_MAX_RUNS]; // Ordered by planned start
+} watering_plan_t;
+
+// One zone watering in the calendar projection
+typedef struct
+{
+    time_t start;
+    uint8_t program_id;
+    uint8_t zone_id;
+    uint32_t seconds;
+} calendar_run_t;
+
+// Position in a calendar expansion, to resume after the last returned program start
+typedef struct
+{
+    time_t time;
+    uint8_t program_id;
+} calendar_cursor_t;
+
+/**
+ * @brief Load the planning window from NVS
+ */
+esp_err_t watering_plan_init(void);
+
+/**
+ * @brief Validate and persist the planning window, programs must be recompiled afterwards
+ *
+ * @param window New window
+ * @return esp_err_t ESP_ERR_INVALID_ARG if a time is out of range or the window is empty
+ */
+esp_err_t watering_plan_set_window(const plan_window_t *window);
+void watering_plan_get_window(plan_window_t *window);
+
+/**
+ * @brief Plan the runs due in the next window closing after now, backwards from its deadline
+ * Runs last as long as their water budget makes them and are packed against the deadline in nominal order.
+ * When they don't fit, they are laid out from the window start with durations scaled down proportionally,
+ * and dropped if nothing is left.
+ * Runs of the current plan that already started are kept as is.
+ * Must be called with the sprinkler data locked, right after schedule_engine_compile.
+ *
+ * @param data Sprinkler data
+ * @param now Current time
+ * @return bool true if the plan changed, it is broadcast then
+ */
+bool watering_plan_rebuild(const sprinkler_data_t *data, time_t now);
+
+/**
+ * @brief Next start of a program after now, scheduled starts inside the planned window are replaced by the plan
+ * Must be called with the sprinkler data locked.
+ *
+ * @param program_id Program to query
+ * @param now Current time
+ * @return time_t Next start, 0 if the program never runs
+ */
+time_t watering_plan_next_run(uint8_t program_id, time_t now);
+
+/**
+ * @brief Most recent start of a program at or before now, planned or scheduled
+ * Must be called with the sprinkler data locked.
+ *
+ * @param program_id Program to query
+ * @param now Current time
+ * @return time_t Last start, 0 if none
+ */
+time_t watering_plan_last_start(uint8_t program_id, time_t now);
+
+/**
+ * @brief Duration scale of a program run, applied on top of its water budget
+ * Must be called with the sprinkler data locked.
+ *
+ * @param program_id Program
+ * @param start Start of the run
+ * @return uint8_t Percentage of the budgeted zone durations, 100 for runs outside the plan
+ */
+uint8_t watering_plan_scale(uint8_t program_id, time_t start);
+
+/**
+ * @brief Expand program starts in [cursor, until] into zone runs, in chronological order
+ * Runs follow the executor: planned starts and scales inside the planned window, scheduled ones elsewhere, zones in
+ * program order, disabled zones skipped. Later windows show their scheduled starts until they are planned.
+ * A program start is never split across calls, so max_runs must be at least MAX_ZONES_PER_PROGRAM.
+ * Must be called with the sprinkler data locked.
+ *
+ * @param data Sprinkler data
+ * @param cursor Where to start, updated to resume on the next call. Initialize with {from, 0}
+ * @param until End of the horizon, inclusive
+ * @param runs Output runs
+ * @param max_runs Capacity of runs
+ * @return size_t Number of runs written, 0 once the horizon is exhausted
+ */
+size_t watering_plan_expand(const sprinkler_data_t *data, calendar_cursor_t *cursor, time_t until,
+                            calendar_run_t *runs, size_t max_runs);
+
+/**
+ * @brief Whether the planned window is over and the next one must be planned
+ */
+bool watering_plan_expired(time_t now);
+
+/**
+ * @brief Current plan, must be read with the sprinkler data locked
+ */
+const watering_plan_t *watering_plan_get(void);
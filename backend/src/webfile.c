@@ -10,19 +10,24 @@
 #include "esp_spiffs.h"
 #include "esp_vfs.h"
 #include "esp_random.h"
+#include "esp_timer.h"
 
 #include "utils.h"
 #include "websocket.h"
 #include "webserver.h"
 #include "spiffs.h"
 #include "constants.h"
+#include "buffer_pool.h"
 
 static const char *TAG = "webfile";
 
 #define OTA_PASSWORD_HEADER "X-OTA-Password"
 #define MAX_PASSWORD_LEN 64
 
-#define SCRATCH_BUFSIZE 8192
+// Transfer chunk, leased from the buffer pool for one chunk at a time. A medium buffer, as the lease is held
+// across socket I/O and the single large one is needed for transaction snapshots and list broadcasts
+#define SCRATCH_BUFSIZE 2048
+_Static_assert(SCRATCH_BUFSIZE <= BUFFER_MEDIUM_SIZE, "Transfer chunks must not take the large buffer");
 // Max length a file path can have on storage
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + CONFIG_SPIFFS_OBJ_NAME_LEN)
 // Max size of an individual file. Make sure this value is consistent with webpage
@@ -37,8 +42,9 @@ static const char *TAG = "webfile";
 
 static esp_ota_handle_t ota_handle;
 
-// Buffer for temporary storage during file transfer
-static char scratch_buffer[SCRATCH_BUFSIZE];
+// Created at startup, an upload doesn't allocate a task to restart
+static esp_timer_handle_t restart_timer = NULL;
+#define RESTART_DELAY_MS 1000
 
 #define IS_FILE_EXTENSION(filename, ext) \
   (strcasecmp(&filename[strlen(filename) - sizeof(ext) + 1], ext) == 0)
@@ -116,10 +122,9 @@ static const char *get_path_from_uri(char *dest, const char *base_path, const ch
   return dest + base_pathlen;
 }
 
-// Delayed restart by 1s
-static void restart_task(void *pvParameter)
+// Delayed restart, once the response is sent
+static void restart_timer_callback(void *arg)
 {
-  vTaskDelay(1000 / portTICK_PERIOD_MS);
   esp_restart();
 }
 
@@ -301,18 +306,24 @@ static esp_err_t download_get_handler(httpd_req_t *req)
   size_t chunksize;
   do
   {
+    char *scratch_buffer = buffer_lease(SCRATCH_BUFSIZE, TAG);
+    if (!scratch_buffer)
+    {
+      ret = ESP_FAIL;
+      break;
+    }
+
     // Read file in chunks into the scratch buffer
     chunksize = fread(scratch_buffer, 1, SCRATCH_BUFSIZE, fd);
 
-    if (chunksize > 0)
+    // Send the buffer contents as HTTP response chunk
+    esp_err_t sent = chunksize > 0 ? httpd_resp_send_chunk(req, scratch_buffer, chunksize) : ESP_OK;
+    buffer_release(scratch_buffer);
+    if (sent != ESP_OK)
     {
-      // Send the buffer contents as HTTP response chunk
-      if (httpd_resp_send_chunk(req, scratch_buffer, chunksize) != ESP_OK)
-      {
-        ESP_LOGE(TAG, "File sending failed!");
-        ret = ESP_FAIL;
-        break; // Break instead of multiple returns
-      }
+      ESP_LOGE(TAG, "File sending failed!");
+      ret = ESP_FAIL;
+      break; // Break instead of multiple returns
     }
 
     // Keep looping till the whole file is sent
@@ -367,8 +378,11 @@ static esp_err_t upload_ota_handler(httpd_req_t *req, const char *session_token)
     }
 
     // Receive the file part by part into a buffer
-    if ((received = httpd_req_recv(req, scratch_buffer, min(remaining, SCRATCH_BUFSIZE))) <= 0)
+    char *scratch_buffer = buffer_lease(SCRATCH_BUFSIZE, TAG);
+    received = scratch_buffer ? httpd_req_recv(req, scratch_buffer, min(remaining, SCRATCH_BUFSIZE)) : HTTPD_SOCK_ERR_FAIL;
+    if (received <= 0)
     {
+      buffer_release(scratch_buffer);
       if (received == HTTPD_SOCK_ERR_TIMEOUT)
       {
         // Retry if timeout occurred
@@ -387,7 +401,9 @@ static esp_err_t upload_ota_handler(httpd_req_t *req, const char *session_token)
     }
 
     // Write buffer content to OTA partition
-    if (received && esp_ota_write(ota_handle, scratch_buffer, received) != ESP_OK)
+    esp_err_t written = esp_ota_write(ota_handle, scratch_buffer, received);
+    buffer_release(scratch_buffer);
+    if (written != ESP_OK)
     {
       // Couldn't write everything to OTA partition!
       esp_ota_abort(ota_handle);
@@ -426,7 +442,11 @@ static esp_err_t upload_ota_handler(httpd_req_t *req, const char *session_token)
   // Respond with success message
   httpd_resp_sendstr(req, "Firmware uploaded successfully. Restarting now!");
 
-  xTaskCreate(&restart_task, "restart_task", 2048, NULL, 10, NULL);
+  if (restart_timer == NULL || esp_timer_start_once(restart_timer, RESTART_DELAY_MS * 1000) != ESP_OK)
+  {
+    ESP_LOGW(TAG, "No restart timer, restarting now");
+    esp_restart();
+  }
   return ESP_OK;
 }
 
@@ -479,8 +499,11 @@ static esp_err_t upload_file_handler(httpd_req_t *req, const char *session_token
     }
 
     // Receive the file part by part into a buffer
-    if ((received = httpd_req_recv(req, scratch_buffer, min(remaining, SCRATCH_BUFSIZE))) <= 0)
+    char *scratch_buffer = buffer_lease(SCRATCH_BUFSIZE, TAG);
+    received = scratch_buffer ? httpd_req_recv(req, scratch_buffer, min(remaining, SCRATCH_BUFSIZE)) : HTTPD_SOCK_ERR_FAIL;
+    if (received <= 0)
     {
+      buffer_release(scratch_buffer);
       if (received == HTTPD_SOCK_ERR_TIMEOUT)
       {
         // Retry if timeout occurred
@@ -495,7 +518,9 @@ static esp_err_t upload_file_handler(httpd_req_t *req, const char *session_token
     }
 
     // Write buffer content to temporary file
-    if (received && (received != fwrite(scratch_buffer, 1, received, fd)))
+    size_t written = fwrite(scratch_buffer, 1, received, fd);
+    buffer_release(scratch_buffer);
+    if (received != written)
     {
       // Couldn't write everything to file!
       ret = ESP_FAIL;
@@ -679,6 +704,14 @@ void start_web_file(httpd_handle_t server)
   // Clean up any leftover temporary files from interrupted uploads
   cleanup_temp_files_on_startup();
 
+  const esp_timer_create_args_t restart_timer_args = {
+      .callback = restart_timer_callback,
+      .name = "ota_restart"};
+  if (esp_timer_create(&restart_timer_args, &restart_timer) != ESP_OK)
+  {
+    ESP_LOGE(TAG, "Failed to create restart timer");
+  }
+
   // URI handler for accessing files from server
   httpd_uri_t file_download = {
       .uri = "/*", // Match all URIs of type /path/to/file
@@ -7,8 +7,12 @@
 #include <esp_log.h>
 #include <esp_http_server.h>
 #include <esp_timer.h>
+#include <stdarg.h>
 
 #include "webserver.h"
+#include "buffer_pool.h"
+#include "message_arena.h"
+#include "heap_diagnostics.h"
 
 // Local variables
 
@@ -32,9 +36,7 @@ typedef struct
 static client_info_t clients_info[MAX_CLIENTS];
 static esp_timer_handle_t ping_timer = NULL;
 
-#define MAX_CALLBACKS 20
-
-static char json[1024];
+#define MAX_CALLBACKS 32
 
 typedef struct
 {
@@ -166,9 +168,7 @@ static void send_ping_to_client(int sockfd)
   if (server == NULL)
     return;
 
-  snprintf(json, sizeof(json), "{\"type\":\"ping\",\"timestamp\":%lld}", esp_timer_get_time() / 1000);
-
-  send_message_sockfd(json, sockfd);
+  send_format_sockfd(sockfd, "{\"type\":\"ping\",\"timestamp\":%lld}", esp_timer_get_time() / 1000);
 }
 
 static void ws_handle_ping_message(const cJSON *root, int sockfd)
@@ -180,14 +180,12 @@ static void ws_handle_ping_message(const cJSON *root, int sockfd)
   cJSON *timestamp = cJSON_GetObjectItem(root, "timestamp");
   if (timestamp && cJSON_IsNumber(timestamp))
   {
-    snprintf(json, sizeof(json), "{\"type\":\"pong\",\"timestamp\":%f}", timestamp->valuedouble);
+    send_format_sockfd(sockfd, "{\"type\":\"pong\",\"timestamp\":%f}", timestamp->valuedouble);
   }
   else
   {
-    snprintf(json, sizeof(json), "{\"type\":\"pong\"}");
+    send_format_sockfd(sockfd, "{\"type\":\"pong\"}");
   }
-
-  send_message_sockfd(json, sockfd);
 }
 
 static void ws_handle_pong_message(const cJSON *root, int sockfd)
@@ -244,7 +242,7 @@ static int find_client_by_session_token(const char *token)
 
 // Manage messages
 
-esp_err_t send_message_token(char *msg, char *token)
+esp_err_t send_message_token(const char *msg, char *token)
 {
   if (server == NULL)
   {
@@ -262,7 +260,7 @@ esp_err_t send_message_token(char *msg, char *token)
   return send_message_sockfd(msg, sockfd);
 }
 
-esp_err_t send_message_sockfd(char *msg, int sockfd)
+esp_err_t send_message_sockfd(const char *msg, int sockfd)
 {
   if (server == NULL)
   {
@@ -285,7 +283,7 @@ esp_err_t send_message_sockfd(char *msg, int sockfd)
   return ret;
 }
 
-esp_err_t broadcast_message(char *msg)
+esp_err_t broadcast_message(const char *msg)
 {
   if (server == NULL)
   {
@@ -306,6 +304,54 @@ esp_err_t broadcast_message(char *msg)
   return ESP_OK;
 }
 
+// Format into a buffer leased for the time of the send
+static char *format_message(const char *format, va_list args)
+{
+  va_list measure;
+  va_copy(measure, args);
+  int len = vsnprintf(NULL, 0, format, measure);
+  va_end(measure);
+
+  char *msg = len >= 0 ? buffer_lease(len + 1, TAG) : NULL;
+  if (msg)
+  {
+    vsnprintf(msg, len + 1, format, args);
+  }
+  return msg;
+}
+
+esp_err_t send_format_sockfd(int sockfd, const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  char *msg = format_message(format, args);
+  va_end(args);
+  if (msg == NULL)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+
+  esp_err_t ret = send_message_sockfd(msg, sockfd);
+  buffer_release(msg);
+  return ret;
+}
+
+esp_err_t broadcast_format(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  char *msg = format_message(format, args);
+  va_end(args);
+  if (msg == NULL)
+  {
+    return ESP_ERR_NO_MEM;
+  }
+
+  esp_err_t ret = broadcast_message(msg);
+  buffer_release(msg);
+  return ret;
+}
+
 // Handle received messages and forward to listener meaningful messages
 esp_err_t receive_ws_message(httpd_req_t *req)
 {
@@ -340,13 +386,18 @@ esp_err_t receive_ws_message(httpd_req_t *req)
 
   if (ws_pkt.len)
   {
+    // The frame, its JSON tree and the scratch memory of the handlers are dropped together once handled
+    message_arena_begin();
+
     // ws_pkt.len + 1 is for NULL termination as we are expecting a string
-    buffer = calloc(1, ws_pkt.len + 1);
+    buffer = message_arena_alloc(ws_pkt.len + 1);
     if (buffer == NULL)
     {
-      ESP_LOGE(TAG, "Failed to calloc memory for buffer");
+      ESP_LOGE(TAG, "Failed to allocate memory for buffer");
+      message_arena_end();
       return ESP_ERR_NO_MEM;
     }
+    buffer[ws_pkt.len] = '\0';
     ws_pkt.payload = buffer;
 
     // Set max_len = ws_pkt.len to get the frame payload
@@ -354,7 +405,8 @@ esp_err_t receive_ws_message(httpd_req_t *req)
     if (ret != ESP_OK)
     {
       ESP_LOGE(TAG, "httpd_ws_recv_frame failed with %d", ret);
-      free(buffer);
+      message_arena_free(buffer);
+      message_arena_end();
       return ret;
     }
 
@@ -373,13 +425,16 @@ esp_err_t receive_ws_message(httpd_req_t *req)
           if (receive_callbacks[i].callback &&
               strcmp(receive_callbacks[i].type, type->valuestring) == 0)
           {
+            size_t heap_mark = heap_diagnostics_message_begin(receive_callbacks[i].type);
             receive_callbacks[i].callback(root, sockfd);
+            heap_diagnostics_message_end(receive_callbacks[i].type, heap_mark);
           }
         }
       }
       cJSON_Delete(root);
     }
-    free(buffer);
+    message_arena_free(buffer);
+    message_arena_end();
   }
 
   ESP_LOGI(TAG, "Packet type: %d", ws_pkt.type);
@@ -436,6 +491,9 @@ void start_websocket(httpd_handle_t new_server)
 
   server = new_server;
 
+  // Frames are parsed in the arena of the server task
+  message_arena_init();
+
   // Init clients
   for (int i = 0; i < MAX_CLIENTS; ++i)
   {
@@ -13,9 +13,13 @@ void on_ws_client_disconnected(int sockfd);
 
 // Send message
 
-esp_err_t send_message_sockfd(char *msg, int sockfd);
-esp_err_t send_message_token(char *msg, char *token);
-esp_err_t broadcast_message(char *msg);
+esp_err_t send_message_sockfd(const char *msg, int sockfd);
+esp_err_t send_message_token(const char *msg, char *token);
+esp_err_t broadcast_message(const char *msg);
+
+// Format a message into a leased buffer and send it, ESP_ERR_NO_MEM if no buffer got free
+esp_err_t send_format_sockfd(int sockfd, const char *format, ...) __attribute__((format(printf, 2, 3)));
+esp_err_t broadcast_format(const char *format, ...) __attribute__((format(printf, 1, 2)));
 
 // Listen to message received through callbacks
 
@@ -3,6 +3,9 @@
 #include "wifi.h"
 
 #include "ws_wifi.h"
+#include "storage.h"
+#include "utils.h"
+#include "boot.h"
 
 #include <string.h>
 #include "freertos/FreeRTOS.h"
@@ -12,6 +15,9 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_attr.h"
 #include "nvs.h"
 #include "freertos/event_groups.h"
 
@@ -23,6 +29,15 @@
 #define AP_WIFI_CHANNEL 10
 #define MAX_AP_CONN 2
 
+// Reconnection policy
+#define WIFI_RETRY_BASE_MS 250
+#define WIFI_RETRY_MAX_MS 60000
+#define WIFI_AP_FALLBACK_TIMEOUT_MS 10000
+
+// Fast-connect cache
+#define WIFI_CACHE_KEY "wifi_cache"
+#define WIFI_CACHE_MAGIC 0x57464331 // "WFC1"
+
 static const char *TAG = "wifi";
 
 typedef struct
@@ -31,6 +46,25 @@ typedef struct
     char password[64];
 } wifi_credentials_t;
 
+// Last access point we got an IP from, used to skip the full channel scan on next boot
+typedef struct
+{
+    uint32_t magic;
+    uint8_t ssid[32];
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_fast_connect_cache_t;
+
+// Network given to wifi_start_sta_connection, read by the connect task created at boot
+static wifi_credentials_t s_connect_credentials;
+static TaskHandle_t s_connect_task = NULL;
+
+// Work handed to the connect task, as notification bits
+#define WIFI_TASK_CONNECT BIT0    // Connect to s_connect_credentials
+#define WIFI_TASK_SAVE_CACHE BIT1 // Persist the access point we got an IP from
+#define WIFI_TASK_RETRY BIT2      // Reconnect after a backoff, without the fast-connect pin once it failed
+#define WIFI_TASK_RESULT BIT3     // The connection succeeded or ran out of retries
+
 // WiFi event group
 static EventGroupHandle_t s_wifi_event_group = NULL;
 static const int WIFI_CONNECTED_BIT = BIT0;
@@ -39,9 +73,21 @@ static const int WIFI_FAIL_BIT = BIT1;
 // Connection state
 static bool wifi_connecting = false;
 static bool wifi_connected = false;
+static bool sta_configured = false;
+static bool manual_disconnect = false;
 static int s_retry_num = 0;
 static const int WIFI_MAXIMUM_RETRY = 5;
 
+// Background reconnection backoff, the timer only wakes the connect task
+static esp_timer_handle_t s_retry_timer = NULL;
+
+// Fast-connect state. The RTC copy survives software resets, the NVS copy survives power loss
+static RTC_NOINIT_ATTR wifi_fast_connect_cache_t s_rtc_cache;
+static wifi_fast_connect_cache_t s_cache = {0};
+static wifi_fast_connect_cache_t s_pending_cache = {0};
+static bool s_fast_connect_attempt = false;
+static bool s_fast_connect_failed = false;
+
 static void setup_apsta(void)
 {
     // Check if AP is already setup
@@ -76,6 +122,126 @@ static void setup_apsta(void)
     ESP_LOGI(TAG, "WiFi AP init finished. SSID:%s password:%s channel:%d", AP_WIFI_SSID, AP_WIFI_PASS, AP_WIFI_CHANNEL);
 }
 
+
+static void load_fast_connect_cache(void)
+{
+    if (s_rtc_cache.magic == WIFI_CACHE_MAGIC)
+    {
+        s_cache = s_rtc_cache;
+        return;
+    }
+
+    size_t required_size = sizeof(s_cache);
+    if (read_blob(WIFI_CACHE_KEY, &s_cache, &required_size) != ESP_OK || s_cache.magic != WIFI_CACHE_MAGIC)
+    {
+        memset(&s_cache, 0, sizeof(s_cache));
+    }
+    s_rtc_cache = s_cache;
+}
+
+// NVS writes block on flash, so this runs in the connect task rather than the event loop or esp_timer task
+static void save_fast_connect_cache(void)
+{
+    // Only touch flash when the access point actually changed
+    if (memcmp(&s_cache, &s_pending_cache, sizeof(s_cache)) == 0)
+    {
+        return;
+    }
+
+    s_cache = s_pending_cache;
+    s_rtc_cache = s_cache;
+    esp_err_t ret = write_blob(WIFI_CACHE_KEY, &s_cache, sizeof(s_cache));
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "Failed to save fast-connect cache: %s", esp_err_to_name(ret));
+        return;
+    }
+    ESP_LOGI(TAG, "Saved fast-connect cache: " MACSTR " channel %d", MAC2STR(s_cache.bssid), s_cache.channel);
+}
+
+// Pin the STA config to the cached BSSID/channel, or make sure a stale pin is removed.
+// The pin only lives in RAM: the config stored in flash keeps scanning, so a replaced access point can't strand it.
+static void apply_fast_connect_config(bool use_cache)
+{
+    wifi_config_t wifi_config;
+    if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK)
+    {
+        return;
+    }
+
+    sta_configured = wifi_config.sta.ssid[0] != '\0';
+    s_fast_connect_attempt = use_cache && sta_configured &&
+                             s_cache.magic == WIFI_CACHE_MAGIC &&
+                             memcmp(wifi_config.sta.ssid, s_cache.ssid, sizeof(s_cache.ssid)) == 0;
+
+    if (s_fast_connect_attempt)
+    {
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, s_cache.bssid, sizeof(wifi_config.sta.bssid));
+        wifi_config.sta.channel = s_cache.channel;
+        wifi_config.sta.scan_method = WIFI_FAST_SCAN;
+        ESP_LOGI(TAG, "Fast-connect to " MACSTR " on channel %d", MAC2STR(s_cache.bssid), s_cache.channel);
+    }
+    else if (wifi_config.sta.bssid_set || wifi_config.sta.channel != 0)
+    {
+        wifi_config.sta.bssid_set = false;
+        wifi_config.sta.channel = 0;
+        wifi_config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+    }
+    else
+    {
+        return;
+    }
+
+    esp_wifi_set_storage(WIFI_STORAGE_RAM);
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_set_storage(WIFI_STORAGE_FLASH);
+}
+
+// Changing the STA config from here would race the connect task setting new credentials, it does the retry itself
+static void retry_timer_callback(void *arg)
+{
+    if (s_connect_task)
+    {
+        xTaskNotify(s_connect_task, WIFI_TASK_RETRY, eSetBits);
+    }
+}
+
+static void retry_connection(void)
+{
+    if (manual_disconnect || !sta_configured)
+    {
+        return;
+    }
+
+    // The cached access point didn't answer, fall back to a full scan from now on
+    if (s_fast_connect_failed)
+    {
+        ESP_LOGW(TAG, "Fast-connect failed, falling back to full scan");
+        s_fast_connect_failed = false;
+        s_rtc_cache.magic = 0;
+        apply_fast_connect_config(false);
+    }
+
+    ESP_LOGI(TAG, "Retry to connect to the AP (attempt %d)", s_retry_num);
+    esp_wifi_connect();
+}
+
+// Exponential backoff with jitter, so controllers sharing an AP don't retry in lockstep after a power cut
+static uint32_t next_retry_delay_ms(void)
+{
+    uint32_t delay_ms = min((uint32_t)WIFI_RETRY_BASE_MS << min(s_retry_num, 8), (uint32_t)WIFI_RETRY_MAX_MS);
+    return delay_ms / 2 + esp_random() % (delay_ms / 2 + 1);
+}
+
+static void schedule_retry(void)
+{
+    uint32_t delay_ms = next_retry_delay_ms();
+    esp_timer_stop(s_retry_timer);
+    esp_timer_start_once(s_retry_timer, (uint64_t)delay_ms * 1000);
+    ESP_LOGI(TAG, "Next connection attempt in %lu ms", (unsigned long)delay_ms);
+}
+
 static esp_err_t setup_sta(void)
 {
     esp_netif_create_default_wifi_sta();
@@ -83,6 +249,10 @@ static esp_err_t setup_sta(void)
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+    load_fast_connect_cache();
+    apply_fast_connect_config(true);
+
     ESP_ERROR_CHECK(esp_wifi_start());
 
     ESP_LOGI(TAG, "WiFi STA init finished.");
@@ -94,7 +264,6 @@ static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_START)
     {
         printf("WiFi AP started successfully!\n");
-        xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
     }
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_STACONNECTED)
     {
@@ -109,103 +278,174 @@ static void event_handler(void *arg, esp_event_base_t event_base, int32_t event_
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START)
     {
         ESP_LOGI(TAG, "WIFI_EVENT_STA_START");
-        esp_wifi_connect();
+        if (sta_configured)
+        {
+            wifi_connecting = true;
+            esp_wifi_connect();
+        }
+    }
+    else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED)
+    {
+        const wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+        ESP_LOGI(TAG, "WIFI_EVENT_STA_CONNECTED to " MACSTR " channel %d", MAC2STR(event->bssid), event->channel);
+
+        // Remember the access point, persisted once we get an IP
+        s_pending_cache.magic = WIFI_CACHE_MAGIC;
+        memset(s_pending_cache.ssid, 0, sizeof(s_pending_cache.ssid));
+        memcpy(s_pending_cache.ssid, event->ssid, min(event->ssid_len, sizeof(s_pending_cache.ssid)));
+        memcpy(s_pending_cache.bssid, event->bssid, sizeof(s_pending_cache.bssid));
+        s_pending_cache.channel = event->channel;
     }
     else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED)
     {
         wifi_connected = false;
+        xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+
         const wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
         ESP_LOGI(TAG, "WIFI_EVENT_STA_DISCONNECTED reason %d", event->reason);
         // Don't retry if it's intented disconnection
-        if (event->reason < 200) // see wifi_err_reason_t
+        if (manual_disconnect || !sta_configured)
         {
             return;
         }
 
-        if (s_retry_num < WIFI_MAXIMUM_RETRY)
+        if (s_fast_connect_attempt)
         {
-            esp_wifi_connect();
-            s_retry_num++;
-            ESP_LOGI(TAG, "Retry to connect to the AP");
+            s_fast_connect_attempt = false;
+            s_fast_connect_failed = true;
         }
-        else
+
+        // Report the failure to waiters, but keep retrying in the background
+        if (s_retry_num == WIFI_MAXIMUM_RETRY)
         {
+            ESP_LOGW(TAG, "Connect to the AP fail, retrying in the background");
             xEventGroupSetBits(s_wifi_event_group, WIFI_FAIL_BIT);
             wifi_connecting = false;
+            if (s_connect_task)
+            {
+                xTaskNotify(s_connect_task, WIFI_TASK_RESULT, eSetBits);
+            }
+        }
+        if (s_retry_num < INT16_MAX)
+        {
+            s_retry_num++;
         }
-        ESP_LOGI(TAG, "Connect to the AP fail");
+        schedule_retry();
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
     {
         ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
-        ESP_LOGI(TAG, "STA Got IP:" IPSTR, IP2STR(&event->ip_info.ip));
+        ESP_LOGI(TAG, "STA Got IP:" IPSTR " after %lld ms", IP2STR(&event->ip_info.ip), esp_timer_get_time() / 1000);
+        boot_mark_milestone(BOOT_MILESTONE_NETWORK);
         s_retry_num = 0;
+        s_fast_connect_attempt = false;
         wifi_connected = true;
         wifi_connecting = false;
+        xEventGroupClearBits(s_wifi_event_group, WIFI_FAIL_BIT);
         xEventGroupSetBits(s_wifi_event_group, WIFI_CONNECTED_BIT);
+
+        if (s_connect_task)
+        {
+            xTaskNotify(s_connect_task, WIFI_TASK_SAVE_CACHE | WIFI_TASK_RESULT, eSetBits);
+        }
     }
 }
 
+// Every change of the STA config happens here, so a retry never writes old settings over new credentials
 static void wifi_connect_task(void *pvParameters)
 {
-    wifi_credentials_t *creds = (wifi_credentials_t *)pvParameters;
+    const wifi_credentials_t *creds = &s_connect_credentials;
+    bool reporting = false; // A connection asked over WS waits for its result
 
-    ESP_LOGI(TAG, "Starting WiFi connection to SSID: %s", creds->ssid);
+    while (1)
+    {
+        uint32_t work = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &work, portMAX_DELAY);
 
-    // Configure WiFi
-    wifi_config_t wifi_config = {0};
-    strncpy((char *)wifi_config.sta.ssid, creds->ssid, sizeof(wifi_config.sta.ssid) - 1);
-    strncpy((char *)wifi_config.sta.password, creds->password, sizeof(wifi_config.sta.password) - 1);
-    wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
-    wifi_config.sta.pmf_cfg.capable = true;
-    wifi_config.sta.pmf_cfg.required = false;
+        if (work & WIFI_TASK_SAVE_CACHE)
+        {
+            save_fast_connect_cache();
+        }
 
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
-    ESP_ERROR_CHECK(esp_wifi_connect());
+        if (work & WIFI_TASK_CONNECT)
+        {
+            ESP_LOGI(TAG, "Starting WiFi connection to SSID: %s", creds->ssid);
+
+            // Configure WiFi
+            wifi_config_t wifi_config = {0};
+            strncpy((char *)wifi_config.sta.ssid, creds->ssid, sizeof(wifi_config.sta.ssid) - 1);
+            strncpy((char *)wifi_config.sta.password, creds->password, sizeof(wifi_config.sta.password) - 1);
+            wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
+            wifi_config.sta.pmf_cfg.capable = true;
+            wifi_config.sta.pmf_cfg.required = false;
+
+            ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+            sta_configured = true;
+            manual_disconnect = false;
+            ESP_ERROR_CHECK(esp_wifi_connect());
+            reporting = true;
+        }
+        else if (work & WIFI_TASK_RETRY)
+        {
+            // A retry set for the previous network is dropped, the new connection has just started
+            retry_connection();
+        }
 
-    // Wait for connection result
-    EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
-                                           WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                           pdFALSE,
-                                           pdFALSE,
-                                           portMAX_DELAY);
+        // Send connection result
+        EventBits_t bits = xEventGroupGetBits(s_wifi_event_group);
+        if (reporting && (bits & (WIFI_CONNECTED_BIT | WIFI_FAIL_BIT)))
+        {
+            if (bits & WIFI_CONNECTED_BIT)
+            {
+                ESP_LOGI(TAG, "Connected to AP SSID:%s", creds->ssid);
+            }
+            else
+            {
+                ESP_LOGI(TAG, "Failed to connect to SSID:%s", creds->ssid);
+            }
+
+            // Broadcast new values
+            ws_handle_wifi_status(NULL, 0);
+            reporting = false;
+        }
+    }
+}
 
-    // Send connection result
-    if (bits & WIFI_CONNECTED_BIT)
+// Bring up the AP if the stored network doesn't show up in time, STA retries keep going alongside
+static void wifi_ap_fallback_task(void *pvParameters)
+{
+    if (!wait_wifi_connection_timeout(pdMS_TO_TICKS(WIFI_AP_FALLBACK_TIMEOUT_MS)))
     {
-        ESP_LOGI(TAG, "Connected to AP SSID:%s", creds->ssid);
+        ESP_LOGW(TAG, "Auto-connect failed or timed out, starting AP mode");
+        setup_apsta();
     }
-    else if (bits & WIFI_FAIL_BIT)
+    else
     {
-        ESP_LOGI(TAG, "Failed to connect to SSID:%s", creds->ssid);
+        ESP_LOGI(TAG, "Auto-connect successful");
     }
 
-    // Broadcast new values
-    ws_handle_wifi_status(NULL, 0);
-
-    // Clean up
-    free(creds);
     vTaskDelete(NULL);
 }
 
-bool wait_wifi_connection(void)
+bool wait_wifi_connection_timeout(TickType_t timeout)
 {
     EventBits_t bits = xEventGroupWaitBits(s_wifi_event_group,
                                            WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
                                            pdFALSE,
                                            pdFALSE,
-                                           pdMS_TO_TICKS(10000)); // Wait 10 seconds
+                                           timeout);
 
-    wifi_connecting = false;
+    return (bits & WIFI_CONNECTED_BIT) != 0;
+}
 
-    if (bits & WIFI_CONNECTED_BIT)
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+bool wait_wifi_connection(void)
+{
+    return wait_wifi_connection_timeout(pdMS_TO_TICKS(10000)); // Wait 10 seconds
+}
+
+void wait_wifi_sta_connected(void)
+{
+    xEventGroupWaitBits(s_wifi_event_group, WIFI_CONNECTED_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
 }
 
 esp_err_t setup_wifi(void)
@@ -226,6 +466,17 @@ esp_err_t setup_wifi(void)
         s_wifi_event_group = xEventGroupCreate();
     }
 
+    const esp_timer_create_args_t retry_timer_args = {
+        .callback = retry_timer_callback,
+        .name = "wifi_retry"};
+    ESP_ERROR_CHECK(esp_timer_create(&retry_timer_args, &s_retry_timer));
+
+    // Connections asked over WS and fast-connect cache saves run in this task, created once rather than per connection
+    if (xTaskCreate(wifi_connect_task, "wifi_connect_task", 4096, NULL, 5, &s_connect_task) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Failed to create WiFi connect task");
+    }
+
     // Initialize WiFi
     esp_err_t ret = setup_sta();
     if (ret != ESP_OK)
@@ -235,24 +486,22 @@ esp_err_t setup_wifi(void)
         return ret;
     }
 
-    // ESP-IDF will automatically try to connect with stored credentials
-    // If connection fails, we'll get a disconnect event
-
-    // Wait a bit to see if connection succeeds
-    bool is_connected = wait_wifi_connection();
-
-    if (is_connected)
+    // Nothing to connect to, no need to wait before exposing the AP
+    if (!sta_configured)
     {
-        ESP_LOGI(TAG, "Auto-connect successful");
+        ESP_LOGI(TAG, "No stored credentials, starting AP mode");
+        setup_apsta();
         return ESP_OK;
     }
-    else
+
+    // ESP-IDF connects with the stored credentials in the background, don't hold the boot for it
+    if (xTaskCreate(wifi_ap_fallback_task, "wifi_ap_fallback", 3072, NULL, 5, NULL) != pdPASS)
     {
-        ESP_LOGW(TAG, "Auto-connect failed or timed out, starting AP mode");
-        setup_apsta(); // Fall back to AP mode
-        wait_wifi_connection();
-        return ESP_FAIL;
+        ESP_LOGE(TAG, "Failed to create AP fallback task");
+        setup_apsta();
     }
+
+    return ESP_OK;
 }
 
 bool is_wifi_connected(void)
@@ -292,40 +541,41 @@ bool is_wifi_setup(void)
 
 esp_err_t wifi_start_sta_connection(const char *ssid, const char *password)
 {
-    wifi_connecting = true;
-
-    wifi_credentials_t *creds = malloc(sizeof(wifi_credentials_t));
-    if (!creds)
+    if (!s_connect_task)
     {
-        wifi_connecting = false;
-        return ESP_ERR_NO_MEM;
+        return ESP_FAIL;
     }
+    wifi_connecting = true;
+
+    // The connect task is idle while not connecting, only one connection is started at a time
+    wifi_credentials_t *creds = &s_connect_credentials;
     strncpy(creds->ssid, ssid, sizeof(creds->ssid) - 1);
     strncpy(creds->password, password, sizeof(creds->password) - 1);
     creds->ssid[sizeof(creds->ssid) - 1] = '\0';
     creds->password[sizeof(creds->password) - 1] = '\0';
 
-    // Reset retry counter and event group
+    // Reset retry counter, pending retries and event group
     s_retry_num = 0;
+    s_fast_connect_attempt = false;
+    s_fast_connect_failed = false;
+    esp_timer_stop(s_retry_timer);
     if (s_wifi_event_group)
     {
         xEventGroupClearBits(s_wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
     }
 
-    // Create task to handle WiFi connection
-    BaseType_t result = xTaskCreate(wifi_connect_task, "wifi_connect_task", 4096, creds, 5, NULL);
-    if (result != pdPASS)
-    {
-        wifi_connecting = false;
-        free(creds);
-        return ESP_FAIL;
-    }
+    // Hand the connection to the connect task
+    xTaskNotify(s_connect_task, WIFI_TASK_CONNECT, eSetBits);
 
     return ESP_OK;
 }
 
 void wifi_stop_sta_connection(void)
 {
+    manual_disconnect = true;
+    sta_configured = false;
+    esp_timer_stop(s_retry_timer);
+
     esp_err_t ret = esp_wifi_disconnect();
     if (ret != ESP_OK)
     {
@@ -347,10 +597,15 @@ void wifi_stop_sta_connection(void)
         nvs_close(nvs_handle);
     }
 
+    // Forget the cached access point
+    memset(&s_cache, 0, sizeof(s_cache));
+    memset(&s_pending_cache, 0, sizeof(s_pending_cache));
+    s_rtc_cache = s_cache;
+    delete_blob(WIFI_CACHE_KEY);
+
     // Restart in AP mode
     setup_apsta();
-    wait_wifi_connection();
 
     // Broadcast new values
     ws_handle_wifi_status(NULL, 0);
-}
\ No newline at end of file
+}
@@ -4,10 +4,13 @@
 
 #include <stdbool.h>
 #include "esp_err.h"
+#include "freertos/FreeRTOS.h"
 
 esp_err_t setup_wifi(void);
 
 bool wait_wifi_connection(void);
+bool wait_wifi_connection_timeout(TickType_t timeout);
+void wait_wifi_sta_connected(void);
 bool is_wifi_connected(void);
 bool is_wifi_connecting(void);
 bool is_wifi_setup(void);
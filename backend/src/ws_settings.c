@@ -30,40 +30,165 @@
 #include "esp_wifi.h"
 
 #include "wifi.h"
+#include "boot.h"
+#include "time_service.h"
+#include "timezone.h"
+#include "solar.h"
 #include "sprinkler_controller.h"
+#include "watering_plan.h"
+#include "water_budget.h"
+#include "valve_sequencer.h"
+#include "valve_outputs.h"
+#include "change_events.h"
+#include "buffer_pool.h"
+#include "message_arena.h"
+#include "alloc_accounting.h"
+#include "heap_diagnostics.h"
+#include "task_telemetry.h"
+#include "days_utils.h"
 #include "constants.h"
 
 const char *TAG = "WS_SETTINGS";
 
-static char json[2176];
-static char system_info[2048]; // Increased size for SPIFFS info
+#define SETTINGS_JSON_SIZE 2176
+#ifdef CONFIG_SPRINKLER_ALLOC_ACCOUNTING
+#define SYSTEM_INFO_JSON_SIZE 3584 // With the allocations of every task
+#else
+#define SYSTEM_INFO_JSON_SIZE 2304 // Increased size for SPIFFS info
+#endif
+#define DIAGNOSTICS_JSON_SIZE 2048 // One chunk of the task telemetry or heap diagnostics
 
 void get_settings_info(char *buffer, size_t buffer_size)
 {
     bool isWifiConnected = is_wifi_connected();
     bool isWifiSetup = is_wifi_setup();
     bool requiresOTAPassword = strlen(OTA_PASSWORD) != 0;
+
+    // Location is null until set, sunrise and sunset starts need it
+    char location[64] = "null";
+    float latitude, longitude;
+    if (solar_get_location(&latitude, &longitude))
+    {
+        snprintf(location, sizeof(location), "{\"latitude\":%.4f,\"longitude\":%.4f}", latitude, longitude);
+    }
+
+    // Finish-by window, null until set
+    char finish_by[80] = "null";
+    plan_window_t window;
+    watering_plan_get_window(&window);
+    if (window.window_start != window.finish_by)
+    {
+        snprintf(finish_by, sizeof(finish_by), "{\"enabled\":%s,\"windowStart\":\"%02d:%02d\",\"finishBy\":\"%02d:%02d\"}",
+                 window.enabled ? "true" : "false", window.window_start / 60, window.window_start % 60,
+                 window.finish_by / 60, window.finish_by % 60);
+    }
+
+    // Global water budget, the monthly percentages are always sent so they can be edited before being enabled
+    char budget[128];
+    water_budget_t water_budget;
+    water_budget_get(&water_budget);
+    int len = snprintf(budget, sizeof(budget), "{\"percent\":%d,\"monthly\":%s,\"months\":[",
+                       water_budget.percent, water_budget.monthly ? "true" : "false");
+    for (int i = 0; i < WATER_BUDGET_MONTHS; i++)
+    {
+        len += snprintf(budget + len, sizeof(budget) - len, "%s%d", i ? "," : "", water_budget.monthly_percent[i]);
+    }
+    snprintf(budget + len, sizeof(budget) - len, "]}");
+
+    // Master valve and pump outputs, null when not wired
+    char valves[160];
+    char master[8] = "null";
+    char pump[8] = "null";
+    valve_sequence_t sequence;
+    valve_sequencer_get(&sequence);
+    if (sequence.master_output != VALVE_OUTPUT_NONE)
+    {
+        snprintf(master, sizeof(master), "%d", sequence.master_output);
+    }
+    if (sequence.pump_output != VALVE_OUTPUT_NONE)
+    {
+        snprintf(pump, sizeof(pump), "%d", sequence.pump_output);
+    }
+    snprintf(valves, sizeof(valves), "{\"master\":%s,\"pump\":%s,\"masterLeadMs\":%d,\"pumpDelayMs\":%d,\"overlapMs\":%d}",
+             master, pump, sequence.master_lead_ms, sequence.pump_delay_ms, sequence.overlap_ms);
+
+    // Valve driver as stored, active is false until a restart applies it
+    char driver[320];
+    char enable[8] = "null";
+    valve_driver_config_t driver_config;
+    bool driver_active = valve_outputs_get_driver(&driver_config);
+    if (driver_config.enable_pin != VALVE_DRIVER_PIN_NONE)
+    {
+        snprintf(enable, sizeof(enable), "%d", driver_config.enable_pin);
+    }
+    // Bus counters of the running expanders or shift registers, so a flaky cable shows up before a valve gets stuck
+    char bus[160] = "null";
+    valve_bus_stats_t bus_stats;
+    if (driver_active && valve_outputs_get_bus_stats(&bus_stats))
+    {
+        snprintf(bus, sizeof(bus),
+                 "{\"transactions\":%lu,\"retries\":%lu,\"failures\":%lu,\"lastUs\":%lu,\"maxUs\":%lu,\"averageUs\":%lu}",
+                 (unsigned long)bus_stats.transactions, (unsigned long)bus_stats.retries,
+                 (unsigned long)bus_stats.failures, (unsigned long)bus_stats.last_us, (unsigned long)bus_stats.max_us,
+                 (unsigned long)bus_stats.average_us);
+    }
+    if (driver_config.type == VALVE_DRIVER_MCP23017 || driver_config.type == VALVE_DRIVER_PCF8575)
+    {
+        snprintf(driver, sizeof(driver),
+                 "{\"type\":\"%s\",\"active\":%s,\"sdaPin\":%d,\"sclPin\":%d,\"address\":%d,\"chips\":%d,\"bus\":%s}",
+                 valve_driver_type_to_string(driver_config.type), driver_active ? "true" : "false", driver_config.data_pin,
+                 driver_config.clock_pin, driver_config.address, driver_config.chip_count, bus);
+    }
+    else if (driver_config.type == VALVE_DRIVER_SHIFT_REGISTER)
+    {
+        snprintf(driver, sizeof(driver),
+                 "{\"type\":\"%s\",\"active\":%s,\"dataPin\":%d,\"clockPin\":%d,\"latchPin\":%d,\"enablePin\":%s,\"chips\":%d,\"bus\":%s}",
+                 valve_driver_type_to_string(driver_config.type), driver_active ? "true" : "false", driver_config.data_pin,
+                 driver_config.clock_pin, driver_config.latch_pin, enable, driver_config.chip_count, bus);
+    }
+    else
+    {
+        snprintf(driver, sizeof(driver), "{\"type\":\"%s\",\"active\":%s}",
+                 valve_driver_type_to_string(driver_config.type), driver_active ? "true" : "false");
+    }
+
     snprintf(buffer, buffer_size,
-             "{\"type\":\"settings\",\"ota\":{\"requiresPassword\":%s},\"wifi\":{\"connected\":%s,\"setup\":%s}}",
-             requiresOTAPassword ? "true" : "false", isWifiConnected ? "true" : "false", isWifiSetup ? "true" : "false");
+             "{\"type\":\"settings\",\"ota\":{\"requiresPassword\":%s},\"wifi\":{\"connected\":%s,\"setup\":%s},\"time\":{\"confidence\":\"%s\",\"timezone\":\"%s\"},\"scheduler\":{\"queuePolicy\":\"%s\",\"finishBy\":%s},\"budget\":%s,\"valves\":%s,\"valveDriver\":%s,\"location\":%s}",
+             requiresOTAPassword ? "true" : "false", isWifiConnected ? "true" : "false", isWifiSetup ? "true" : "false",
+             time_confidence_to_string(time_service_get_confidence()), timezone_get(),
+             program_queue_policy_to_string(sprinkler_controller_get_queue_policy()), finish_by, budget, valves, driver, location);
 }
 
 void ws_handle_get_settings(const cJSON *root, int sockfd)
 {
     ESP_LOGI(TAG, "Received get_settings request");
 
-    get_settings_info(json, sizeof(json));
+    char *json = buffer_lease(SETTINGS_JSON_SIZE, TAG);
+    if (!json)
+    {
+        return;
+    }
+
+    get_settings_info(json, SETTINGS_JSON_SIZE);
 
     send_message_sockfd(json, sockfd);
     ESP_LOGI(TAG, "Sent settings: %s", json);
+    buffer_release(json);
 }
 
 void broadcast_get_settings(void)
 {
-    get_settings_info(json, sizeof(json));
+    char *json = buffer_lease(SETTINGS_JSON_SIZE, TAG);
+    if (!json)
+    {
+        return;
+    }
+
+    get_settings_info(json, SETTINGS_JSON_SIZE);
 
     broadcast_message(json);
     ESP_LOGI(TAG, "Sent settings: %s", json);
+    buffer_release(json);
 }
 
 void ws_handle_time_update(const cJSON *root, int sockfd)
@@ -77,9 +202,7 @@ void ws_handle_time_update(const cJSON *root, int sockfd)
         ESP_LOGE(TAG, "Missing 'time' field in JSON");
 
         // Send error response
-        snprintf(json, sizeof(json),
-                 "{\"type\":\"time_update_response\",\"success\":false,\"error\":\"Missing time field\"}");
-        broadcast_message(json);
+        broadcast_message("{\"type\":\"time_update_response\",\"success\":false,\"error\":\"Missing time field\"}");
         return;
     }
 
@@ -90,47 +213,300 @@ void ws_handle_time_update(const cJSON *root, int sockfd)
     if (new_time < 1000000000 || new_time > 2147483647)
     { // Roughly 2001-2038 range
         ESP_LOGE(TAG, "Time value out of reasonable range: %lld", new_time);
-        snprintf(json, sizeof(json),
-                 "{\"type\":\"time_update_response\",\"success\":false,\"error\":\"Time out of valid range\"}");
-        broadcast_message(json);
+        broadcast_message("{\"type\":\"time_update_response\",\"success\":false,\"error\":\"Time out of valid range\"}");
         return;
     }
 
-    // Update system time
+    // Hand the time to the time service, it only corrects the clock if no better source is available
     struct timeval tv;
     tv.tv_sec = new_time;
     tv.tv_usec = 0;
+    time_adjust_t adjust = time_service_submit(TIME_SOURCE_BROWSER, &tv);
+
+    // Get current time for confirmation
+    time_t current_time;
+    struct tm timeinfo;
+    char time_str[64];
+
+    time(&current_time);
+    localtime_r(&current_time, &timeinfo);
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &timeinfo);
+
+    ESP_LOGI(TAG, "Browser time %s, system time is %s", time_adjust_to_string(adjust), time_str);
+
+    // Only the sender cares about the outcome
+    send_format_sockfd(sockfd,
+                       "{\"type\":\"time_update_response\",\"success\":true,\"action\":\"%s\",\"source\":\"%s\",\"current_time\":%lld,\"formatted_time\":\"%.63s\"}",
+                       time_adjust_to_string(adjust), time_source_to_string(time_service_get_source()), current_time, time_str);
+    ESP_LOGI(TAG, "Sent time_update_response");
+}
+
+void ws_handle_set_timezone(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received set_timezone request");
 
-    if (settimeofday(&tv, NULL) == 0)
+    cJSON *timezone_node = cJSON_GetObjectItem(root, "timezone");
+    esp_err_t ret = cJSON_IsString(timezone_node) ? timezone_set(timezone_node->valuestring) : ESP_ERR_INVALID_ARG;
+    if (ret != ESP_OK)
     {
-        // Get updated time for confirmation
-        time_t current_time;
-        struct tm timeinfo;
-        char time_str[64];
+        ESP_LOGE(TAG, "Failed to set timezone: %s", esp_err_to_name(ret));
+        send_format_sockfd(sockfd,
+                 "{\"type\":\"set_timezone_response\",\"success\":false,\"error\":\"%s\"}",
+                 ret == ESP_ERR_INVALID_ARG ? "Invalid timezone" : "Failed to save timezone");
+        return;
+    }
 
-        time(&current_time);
-        localtime_r(&current_time, &timeinfo);
-        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &timeinfo);
+    // Local schedule times now map to different instants
+    sprinkler_controller_update_all_next_runs();
 
-        ESP_LOGI(TAG, "System time updated successfully to: %s", time_str);
+    send_message_sockfd("{\"type\":\"set_timezone_response\",\"success\":true}", sockfd);
 
-        // Start sprinkler controller
-        sprinkler_controller_start();
+    broadcast_get_settings();
+}
+
+void ws_handle_set_location(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received set_location request");
 
-        // Send success response with updated time
-        snprintf(json, sizeof(json),
-                 "{\"type\":\"time_update_response\",\"success\":true,\"current_time\":%lld,\"formatted_time\":\"%.63s\"}",
-                 current_time, time_str);
+    // Expected format: {"type":"set_location","latitude":37.77,"longitude":-122.42}
+    cJSON *latitude_node = cJSON_GetObjectItem(root, "latitude");
+    cJSON *longitude_node = cJSON_GetObjectItem(root, "longitude");
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    if (cJSON_IsNumber(latitude_node) && cJSON_IsNumber(longitude_node))
+    {
+        ret = solar_set_location(latitude_node->valuedouble, longitude_node->valuedouble);
     }
-    else
+
+    if (ret != ESP_OK)
     {
-        ESP_LOGE(TAG, "Failed to set system time");
-        snprintf(json, sizeof(json),
-                 "{\"type\":\"time_update_response\",\"success\":false,\"error\":\"Failed to set system time\"}");
+        ESP_LOGE(TAG, "Failed to set location: %s", esp_err_to_name(ret));
+        send_format_sockfd(sockfd,
+                 "{\"type\":\"set_location_response\",\"success\":false,\"error\":\"%s\"}",
+                 ret == ESP_ERR_INVALID_ARG ? "Invalid location" : "Failed to save location");
+        return;
     }
 
-    broadcast_message(json);
-    ESP_LOGI(TAG, "Sent time_update_response: %s", json);
+    // Sunrise and sunset starts move with the location
+    sprinkler_controller_update_all_next_runs();
+
+    send_message_sockfd("{\"type\":\"set_location_response\",\"success\":true}", sockfd);
+
+    broadcast_get_settings();
+}
+
+void ws_handle_set_queue_policy(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received set_queue_policy request");
+
+    // Expected format: {"type":"set_queue_policy","policy":"append"|"preempt"|"skip"}
+    cJSON *policy_node = cJSON_GetObjectItem(root, "policy");
+    program_queue_policy_t policy;
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    if (cJSON_IsString(policy_node) && program_queue_policy_from_string(policy_node->valuestring, &policy) == ESP_OK)
+    {
+        ret = sprinkler_controller_set_queue_policy(policy);
+    }
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set queue policy: %s", esp_err_to_name(ret));
+        send_message_sockfd("{\"type\":\"error\",\"message\":\"Failed to set queue policy\"}", sockfd);
+        return;
+    }
+
+    broadcast_get_settings();
+}
+
+void ws_handle_set_finish_by(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received set_finish_by request");
+
+    // Expected format: {"type":"set_finish_by","enabled":true,"window_start":"22:00","finish_by":"06:00"}
+    cJSON *enabled_node = cJSON_GetObjectItem(root, "enabled");
+    cJSON *window_start_node = cJSON_GetObjectItem(root, "window_start");
+    cJSON *finish_by_node = cJSON_GetObjectItem(root, "finish_by");
+    plan_window_t window = {.enabled = cJSON_IsTrue(enabled_node)};
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    if (cJSON_IsBool(enabled_node) && cJSON_IsString(window_start_node) && cJSON_IsString(finish_by_node) &&
+        start_time_from_string(window_start_node->valuestring, &window.window_start) &&
+        start_time_from_string(finish_by_node->valuestring, &window.finish_by) &&
+        start_time_ref(window.window_start) == START_REF_CLOCK && start_time_ref(window.finish_by) == START_REF_CLOCK)
+    {
+        ret = watering_plan_set_window(&window);
+    }
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set finish-by window: %s", esp_err_to_name(ret));
+        send_format_sockfd(sockfd,
+                 "{\"type\":\"error\",\"message\":\"%s\"}",
+                 ret == ESP_ERR_INVALID_ARG ? "Invalid finish-by window" : "Failed to save finish-by window");
+        return;
+    }
+
+    // Re-plans the window, the new plan is broadcast on its own
+    sprinkler_controller_update_all_next_runs();
+
+    broadcast_get_settings();
+}
+
+void ws_handle_set_water_budget(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received set_water_budget request");
+
+    // Expected format: {"type":"set_water_budget","percent":80,"monthly":true,"months":[40,50,70,90,110,130,150,150,120,90,60,40]}
+    cJSON *percent_node = cJSON_GetObjectItem(root, "percent");
+    cJSON *monthly_node = cJSON_GetObjectItem(root, "monthly");
+    cJSON *months_node = cJSON_GetObjectItem(root, "months");
+    water_budget_t budget;
+    water_budget_get(&budget);
+
+    bool valid = cJSON_IsNumber(percent_node) && percent_node->valueint >= 0 && percent_node->valueint <= WATER_BUDGET_MAX_PERCENT;
+    if (valid)
+    {
+        budget.percent = percent_node->valueint;
+        budget.monthly = cJSON_IsTrue(monthly_node);
+    }
+    // Months are optional, the stored ones are kept when missing
+    if (valid && cJSON_IsArray(months_node))
+    {
+        valid = cJSON_GetArraySize(months_node) == WATER_BUDGET_MONTHS;
+        for (int i = 0; valid && i < WATER_BUDGET_MONTHS; i++)
+        {
+            cJSON *month_node = cJSON_GetArrayItem(months_node, i);
+            valid = cJSON_IsNumber(month_node) && month_node->valueint >= 0 && month_node->valueint <= WATER_BUDGET_MAX_PERCENT;
+            budget.monthly_percent[i] = valid ? month_node->valueint : 0;
+        }
+    }
+
+    esp_err_t ret = valid ? water_budget_set(&budget) : ESP_ERR_INVALID_ARG;
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set water budget: %s", esp_err_to_name(ret));
+        send_format_sockfd(sockfd,
+                 "{\"type\":\"error\",\"message\":\"%s\"}",
+                 ret == ESP_ERR_INVALID_ARG ? "Invalid water budget" : "Failed to save water budget");
+        return;
+    }
+
+    // Finish by sunrise starts, overlaps and the finish-by plan follow the durations, programs themselves are untouched
+    sprinkler_controller_update_all_next_runs();
+    change_events_publish(CHANGE_PROGRAM, 0, CHANGE_TIMING);
+
+    broadcast_get_settings();
+}
+
+// Optional output of set_valve_sequence, null or missing when not wired
+static bool parse_valve_output(const cJSON *node, uint8_t *output)
+{
+    if (!node || cJSON_IsNull(node))
+    {
+        *output = VALVE_OUTPUT_NONE;
+        return true;
+    }
+    if (!cJSON_IsNumber(node) || node->valueint < 0 || node->valueint >= VALVE_OUTPUT_NONE)
+    {
+        return false;
+    }
+    *output = node->valueint;
+    return true;
+}
+
+static bool parse_valve_delay(const cJSON *node, uint16_t *delay_ms)
+{
+    if (!cJSON_IsNumber(node) || node->valueint < 0 || node->valueint > VALVE_SEQUENCE_MAX_DELAY_MS)
+    {
+        return false;
+    }
+    *delay_ms = node->valueint;
+    return true;
+}
+
+void ws_handle_set_valve_sequence(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received set_valve_sequence request");
+
+    // Expected format: {"type":"set_valve_sequence","master":25,"pump":null,"master_lead_ms":500,"pump_delay_ms":2000,"overlap_ms":3000}
+    valve_sequence_t sequence;
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    if (parse_valve_output(cJSON_GetObjectItem(root, "master"), &sequence.master_output) &&
+        parse_valve_output(cJSON_GetObjectItem(root, "pump"), &sequence.pump_output) &&
+        parse_valve_delay(cJSON_GetObjectItem(root, "master_lead_ms"), &sequence.master_lead_ms) &&
+        parse_valve_delay(cJSON_GetObjectItem(root, "pump_delay_ms"), &sequence.pump_delay_ms) &&
+        parse_valve_delay(cJSON_GetObjectItem(root, "overlap_ms"), &sequence.overlap_ms))
+    {
+        ret = valve_sequencer_set(&sequence);
+    }
+
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set valve sequence: %s", esp_err_to_name(ret));
+        send_format_sockfd(sockfd,
+                 "{\"type\":\"error\",\"message\":\"%s\"}",
+                 ret == ESP_ERR_INVALID_ARG ? "Invalid valve sequence" : "Failed to save valve sequence");
+        return;
+    }
+
+    broadcast_get_settings();
+}
+
+static bool parse_driver_pin(const cJSON *node, uint8_t *pin)
+{
+    if (!cJSON_IsNumber(node) || node->valueint < 0 || node->valueint >= VALVE_OUTPUTS_MAX)
+    {
+        return false;
+    }
+    *pin = node->valueint;
+    return true;
+}
+
+void ws_handle_set_valve_driver(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received set_valve_driver request");
+
+    // Expected format: {"type":"set_valve_driver","driver":"gpio"}
+    // or {"type":"set_valve_driver","driver":"shift_register","data_pin":23,"clock_pin":18,"latch_pin":5,"enable_pin":4,"chips":4}
+    // or {"type":"set_valve_driver","driver":"mcp23017","sda_pin":21,"scl_pin":22,"address":32,"chips":2}, same for pcf8575
+    cJSON *driver_node = cJSON_GetObjectItem(root, "driver");
+    cJSON *enable_node = cJSON_GetObjectItem(root, "enable_pin");
+    cJSON *chips_node = cJSON_GetObjectItem(root, "chips");
+    valve_driver_config_t config = {
+        .data_pin = VALVE_DRIVER_PIN_NONE,
+        .clock_pin = VALVE_DRIVER_PIN_NONE,
+        .latch_pin = VALVE_DRIVER_PIN_NONE,
+        .enable_pin = VALVE_DRIVER_PIN_NONE,
+    };
+    bool valid = cJSON_IsString(driver_node) && valve_driver_type_from_string(driver_node->valuestring, &config.type) == ESP_OK;
+    if (valid && config.type == VALVE_DRIVER_SHIFT_REGISTER)
+    {
+        valid = parse_driver_pin(cJSON_GetObjectItem(root, "data_pin"), &config.data_pin) &&
+                parse_driver_pin(cJSON_GetObjectItem(root, "clock_pin"), &config.clock_pin) &&
+                parse_driver_pin(cJSON_GetObjectItem(root, "latch_pin"), &config.latch_pin) &&
+                (!enable_node || cJSON_IsNull(enable_node) || parse_driver_pin(enable_node, &config.enable_pin)) &&
+                cJSON_IsNumber(chips_node);
+        config.chip_count = valid ? chips_node->valueint : 0;
+    }
+    else if (valid && (config.type == VALVE_DRIVER_MCP23017 || config.type == VALVE_DRIVER_PCF8575))
+    {
+        cJSON *address_node = cJSON_GetObjectItem(root, "address");
+        valid = parse_driver_pin(cJSON_GetObjectItem(root, "sda_pin"), &config.data_pin) &&
+                parse_driver_pin(cJSON_GetObjectItem(root, "scl_pin"), &config.clock_pin) &&
+                cJSON_IsNumber(address_node) && cJSON_IsNumber(chips_node);
+        config.address = valid ? address_node->valueint : 0;
+        config.chip_count = valid ? chips_node->valueint : 0;
+    }
+
+    esp_err_t ret = valid ? valve_outputs_set_driver(&config) : ESP_ERR_INVALID_ARG;
+    if (ret != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to set valve driver: %s", esp_err_to_name(ret));
+        send_format_sockfd(sockfd,
+                 "{\"type\":\"error\",\"message\":\"%s\"}",
+                 ret == ESP_ERR_INVALID_ARG ? "Invalid valve driver" : "Failed to save valve driver");
+        return;
+    }
+
+    broadcast_get_settings();
 }
 
 // Helper function to format uptime
@@ -296,6 +672,34 @@ void get_spiffs_info(char *buffer, size_t buffer_size)
              files_size_str);
 }
 
+// Leases of the shared message buffers and use of the message arena since boot
+static void get_buffer_pool_info(char *buffer, size_t buffer_size)
+{
+    static const char *class_names[BUFFER_CLASS_COUNT] = {"small", "medium", "large"};
+
+    int len = snprintf(buffer, buffer_size, "\"buffers\": {");
+    for (int c = 0; c < BUFFER_CLASS_COUNT && len < buffer_size; c++)
+    {
+        buffer_pool_stats_t stats;
+        buffer_pool_get_stats(c, &stats);
+        len += snprintf(buffer + len, buffer_size - len,
+                        "%s\"%s\": \"%d/%d in use, peak %d, largest request %d of %d bytes, %lu waits, %lu failures\"",
+                        c ? "," : "", class_names[c], stats.in_use, stats.count, stats.high_water,
+                        (int)stats.largest_request, (int)stats.size, (unsigned long)stats.waits, (unsigned long)stats.failures);
+    }
+
+    // Received messages and their JSON trees
+    message_arena_stats_t arena;
+    message_arena_get_stats(&arena);
+    if (len < buffer_size)
+    {
+        snprintf(buffer + len, buffer_size - len,
+                 ",\"message_arena\": \"peak %d of %d bytes over %lu messages, %lu overflows, %lu outside messages\"}",
+                 (int)arena.high_water, (int)arena.size, (unsigned long)arena.messages,
+                 (unsigned long)arena.overflows, (unsigned long)arena.unbound);
+    }
+}
+
 // Function to get comprehensive system information
 void get_system_info(char *buffer, size_t buffer_size)
 {
@@ -399,6 +803,10 @@ void get_system_info(char *buffer, size_t buffer_size)
     char spiffs_info[512];
     get_spiffs_info(spiffs_info, sizeof(spiffs_info));
 
+    // Get shared buffer usage
+    char buffers_info[512];
+    get_buffer_pool_info(buffers_info, sizeof(buffers_info));
+
     // Build the JSON response with grouped sections
     snprintf(buffer, buffer_size,
              "\"device\": {"
@@ -433,6 +841,7 @@ void get_system_info(char *buffer, size_t buffer_size)
              "\"psram_free\": \"%s\","
              "\"psram_usage\": \"%d%%\""
              "},"
+             "%s,"
              "%s",
              // Device section
              reset_reason_str,
@@ -468,7 +877,21 @@ void get_system_info(char *buffer, size_t buffer_size)
              psram_free_str,
              psram_usage_percent,
              // Storage section
-             spiffs_info);
+             spiffs_info,
+             // Buffers section
+             buffers_info);
+
+    // Heap allocations since boot, when built with CONFIG_SPRINKLER_ALLOC_ACCOUNTING
+    size_t len = strlen(buffer);
+    if (len + 1 < buffer_size)
+    {
+        buffer[len] = ',';
+        alloc_accounting_to_json(buffer + len + 1, buffer_size - len - 1);
+        if (!buffer[len + 1])
+        {
+            buffer[len] = '\0';
+        }
+    }
 }
 
 // Main WebSocket handler function
@@ -476,11 +899,141 @@ void ws_handle_system_info(const cJSON *root, int sockfd)
 {
     ESP_LOGI(TAG, "Received system_info request");
 
-    // Get comprehensive system information
-    get_system_info(system_info, sizeof(system_info));
+    char *json = buffer_lease(SYSTEM_INFO_JSON_SIZE, TAG);
+    if (!json)
+    {
+        return;
+    }
+
+    // Build JSON response with comprehensive system information
+    int len = snprintf(json, SYSTEM_INFO_JSON_SIZE, "{\"type\":\"system_info\",\"settings\":{");
+    get_system_info(json + len, SYSTEM_INFO_JSON_SIZE - len - 2);
+    strcat(json, "}}");
+
+    send_message_sockfd(json, sockfd);
+    buffer_release(json);
+}
+
+void ws_handle_boot_timeline(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received get_boot_timeline request");
+
+    char *json = buffer_lease(SETTINGS_JSON_SIZE, TAG);
+    if (!json)
+    {
+        return;
+    }
 
-    // Build JSON response with system information
-    snprintf(json, sizeof(json), "{\"type\":\"system_info\",\"settings\":{%s}}", system_info);
+    if (boot_timeline_to_json(json, SETTINGS_JSON_SIZE) != ESP_OK)
+    {
+        strcpy(json, "{\"type\":\"error\",\"message\":\"Failed to serialize boot timeline\"}");
+    }
 
     send_message_sockfd(json, sockfd);
-}
\ No newline at end of file
+    buffer_release(json);
+}
+static void send_heap_diagnostics(int sockfd)
+{
+    char *json = buffer_lease(DIAGNOSTICS_JSON_SIZE, TAG);
+    if (!json)
+    {
+        return;
+    }
+
+    // Stream the samples, messages and trace in chunks, like the calendar, rather than holding the large buffer over the sends
+    heap_diagnostics_cursor_t cursor = {0};
+    bool final = false;
+    while (!final)
+    {
+        if (heap_diagnostics_to_json(json, DIAGNOSTICS_JSON_SIZE, &cursor, &final) != ESP_OK)
+        {
+            send_message_sockfd("{\"type\":\"error\",\"message\":\"Failed to serialize heap diagnostics\"}", sockfd);
+            break;
+        }
+
+        send_message_sockfd(json, sockfd);
+    }
+
+    buffer_release(json);
+}
+
+void ws_handle_heap_diagnostics(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received get_heap_diagnostics request");
+    send_heap_diagnostics(sockfd);
+}
+
+void ws_handle_heap_trace(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received heap_trace request");
+
+    const cJSON *action = cJSON_GetObjectItem(root, "action");
+    if (!cJSON_IsString(action))
+    {
+        send_message_sockfd("{\"type\":\"error\",\"message\":\"Missing heap trace action\"}", sockfd);
+        return;
+    }
+
+    esp_err_t err;
+    if (strcmp(action->valuestring, "start") == 0)
+    {
+        const cJSON *message = cJSON_GetObjectItem(root, "message");
+        err = heap_diagnostics_trace_start(cJSON_IsString(message) ? message->valuestring : NULL);
+    }
+    else if (strcmp(action->valuestring, "stop") == 0)
+    {
+        err = heap_diagnostics_trace_stop();
+    }
+    else
+    {
+        send_message_sockfd("{\"type\":\"error\",\"message\":\"Unknown heap trace action\"}", sockfd);
+        return;
+    }
+
+    if (err == ESP_ERR_NOT_SUPPORTED)
+    {
+        send_message_sockfd("{\"type\":\"error\",\"message\":\"Heap tracing is not built in\"}", sockfd);
+        return;
+    }
+    if (err != ESP_OK)
+    {
+        send_format_sockfd(sockfd, "{\"type\":\"error\",\"message\":\"Heap trace %s failed: %s\"}",
+                           action->valuestring, esp_err_to_name(err));
+        return;
+    }
+
+    send_heap_diagnostics(sockfd);
+}
+
+void ws_handle_task_telemetry(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received get_task_telemetry request");
+
+    char *json = buffer_lease(DIAGNOSTICS_JSON_SIZE, TAG);
+    if (!json)
+    {
+        return;
+    }
+
+    // Stream the tasks and samples in chunks, like the calendar, rather than holding the large buffer over the sends
+    task_telemetry_cursor_t cursor = {0};
+    bool final = false;
+    while (!final)
+    {
+        esp_err_t err = task_telemetry_to_json(json, DIAGNOSTICS_JSON_SIZE, &cursor, &final);
+        if (err == ESP_ERR_NOT_SUPPORTED)
+        {
+            send_message_sockfd("{\"type\":\"error\",\"message\":\"Task telemetry is not built in\"}", sockfd);
+            break;
+        }
+        else if (err != ESP_OK)
+        {
+            send_message_sockfd("{\"type\":\"error\",\"message\":\"Failed to serialize task telemetry\"}", sockfd);
+            break;
+        }
+
+        send_message_sockfd(json, sockfd);
+    }
+
+    buffer_release(json);
+}
@@ -7,4 +7,14 @@
 void ws_handle_get_settings(const cJSON *root, int sockfd);
 void broadcast_get_settings(void);
 void ws_handle_time_update(const cJSON *root, int sockfd);
-void ws_handle_system_info(const cJSON *root, int sockfd);
\ No newline at end of file
+void ws_handle_set_timezone(const cJSON *root, int sockfd);
+void ws_handle_set_location(const cJSON *root, int sockfd);
+void ws_handle_set_queue_policy(const cJSON *root, int sockfd);
+void ws_handle_set_finish_by(const cJSON *root, int sockfd);
+void ws_handle_set_water_budget(const cJSON *root, int sockfd);
+void ws_handle_set_valve_sequence(const cJSON *root, int sockfd);
+void ws_handle_set_valve_driver(const cJSON *root, int sockfd);
+void ws_handle_system_info(const cJSON *root, int sockfd);
+void ws_handle_boot_timeline(const cJSON *root, int sockfd);void ws_handle_heap_diagnostics(const cJSON *root, int sockfd);
+void ws_handle_heap_trace(const cJSON *root, int sockfd);
+void ws_handle_task_telemetry(const cJSON *root, int sockfd);
@@ -6,21 +6,36 @@
 #include "sprinkler_repository.h"
 #include "sprinkler_serialization.h"
 #include "sprinkler_controller.h"
+#include "schedule_engine.h"
+#include "watering_plan.h"
 #include "esp_wifi.h"
 #include "days_utils.h"
+#include "timezone.h"
+#include "water_budget.h"
+#include "utils.h"
+#include "change_events.h"
+#include "buffer_pool.h"
 
 #include "esp_log.h"
 #include <stdio.h>
 #include <string.h>
 
 static const char *TAG = "SPRINKLER_WS";
-static char json[JSON_BUFFER_SIZE];
+
+_Static_assert(JSON_BUFFER_SIZE <= BUFFER_LARGE_SIZE, "Zone and program lists are formatted in a leased buffer");
+
+// Calendar projection, streamed in chunks that fit the JSON buffer
+#define CALENDAR_DEFAULT_DAYS 7
+#define CALENDAR_MAX_DAYS 31
+#define CALENDAR_CHUNK_RUNS 48 // Each run is at most ~36 characters
+#define CALENDAR_JSON_SIZE 2048
+static calendar_run_t calendar_runs[CALENDAR_CHUNK_RUNS];
 
 // Queue system for handling broadcasts
 #define WS_QUEUE_SIZE 10
 #define WS_TASK_STACK_SIZE 4096
 #define WS_TASK_PRIORITY 5
-#define WS_UPDATE_TYPE_COUNT 2
+#define WS_UPDATE_TYPE_COUNT 3
 
 // Function pointer type for serialization functions
 typedef esp_err_t (*serializer_func_t)(const sprinkler_data_t *data, char *json, size_t size);
@@ -43,19 +58,21 @@ typedef enum
 {
     WS_UPDATE_ZONES,
     WS_UPDATE_PROGRAMS,
+    WS_UPDATE_PLAN,
 } ws_update_type_t;
 
 static const update_info_t update_handlers[WS_UPDATE_TYPE_COUNT] = {
     [WS_UPDATE_ZONES] = {
         .serializer = sprinkler_zones_to_json,
         .name = "zones"},
-    [WS_UPDATE_PROGRAMS] = {.serializer = sprinkler_programs_to_json, .name = "programs"}};
+    [WS_UPDATE_PROGRAMS] = {.serializer = sprinkler_programs_to_json, .name = "programs"},
+    [WS_UPDATE_PLAN] = {.serializer = sprinkler_plan_to_json, .name = "plan"}};
 
 static esp_err_t process_serializer(const sprinkler_data_t *data, void *user_data)
 {
     serialize_json_info_t *info = (serialize_json_info_t *)user_data;
 
-    return info->serializer(data, json, sizeof(json));
+    return info->serializer(data, info->json_buffer, info->buffer_size);
 }
 
 typedef struct
@@ -99,24 +116,25 @@ static void ws_update_task(void *pvParameters)
                 {
                     const update_info_t *info = &update_handlers[i];
 
+                    // The buffer is only held while serializing and sending
+                    char *json = buffer_lease(JSON_BUFFER_SIZE, TAG);
                     serialize_json_info_t params = {
                         .serializer = info->serializer,
                         .json_buffer = json,
-                        sizeof(json)};
-                    esp_err_t ret = safe_sprinklerdata_operation(process_serializer, &params);
+                        JSON_BUFFER_SIZE};
+                    esp_err_t ret = json ? safe_sprinklerdata_operation(process_serializer, &params) : ESP_ERR_NO_MEM;
 
                     if (ret == ESP_OK)
                     {
                         broadcast_message(json);
                         ESP_LOGD(TAG, "Broadcasted %s update", info->name);
                     }
-                    else
+                    buffer_release(json);
+
+                    if (ret != ESP_OK)
                     {
                         ESP_LOGE(TAG, "Failed to serialize %s", info->name);
-                        snprintf(json, sizeof(json),
-                                 "{\"type\":\"error\",\"message\":\"Failed to serialize %s\"}",
-                                 info->name);
-                        broadcast_message(json);
+                        broadcast_format("{\"type\":\"error\",\"message\":\"Failed to serialize %s\"}", info->name);
                     }
 
                     has_pending[i] = false;
@@ -146,6 +164,37 @@ static void queue_update(ws_update_type_t type)
     }
 }
 
+// Each list goes out once per batch of changes, whatever changed in it
+static void on_changes(const change_event_t *events, size_t count, void *context)
+{
+    bool changed[WS_UPDATE_TYPE_COUNT] = {false};
+    for (size_t i = 0; i < count; i++)
+    {
+        switch (events[i].entity)
+        {
+        case CHANGE_ZONE:
+            changed[WS_UPDATE_ZONES] = true;
+            break;
+        case CHANGE_PROGRAM:
+            changed[WS_UPDATE_PROGRAMS] = true;
+            break;
+        case CHANGE_PLAN:
+            changed[WS_UPDATE_PLAN] = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (int i = 0; i < WS_UPDATE_TYPE_COUNT; i++)
+    {
+        if (changed[i])
+        {
+            queue_update(i);
+        }
+    }
+}
+
 esp_err_t ws_update_system_init(void)
 {
     // Create queue for update messages
@@ -172,6 +221,12 @@ esp_err_t ws_update_system_init(void)
         return ESP_ERR_NO_MEM;
     }
 
+    esp_err_t err = change_events_subscribe(on_changes, NULL);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+
     ESP_LOGI(TAG, "WebSocket update system initialized");
     return ESP_OK;
 }
@@ -188,10 +243,22 @@ void ws_handle_get_programs(const cJSON *root, int sockfd)
     broadcast_program_update();
 }
 
-void ws_handle_create_or_update_zone(const cJSON *root, int sockfd)
+void ws_handle_get_plan(const cJSON *root, int sockfd)
 {
-    ESP_LOGI(TAG, "Received add_zone request");
+    ESP_LOGI(TAG, "Received get_plan request");
+    broadcast_plan_update();
+}
+
+// Changes to zones and programs, sent alone or as commands of a batch. On failure message says why.
+typedef esp_err_t (*change_handler_t)(const cJSON *root, const char **message);
 
+static void send_change_error(const char *message)
+{
+    broadcast_format("{\"type\":\"error\",\"message\":\"%s\"}", message);
+}
+
+static esp_err_t apply_create_or_update_zone(const cJSON *root, const char **message)
+{
     // Expected format: {"type":"create_or_update_zone","id":1,"name":"New Zone","output":4}
     // No id means creation
     cJSON *zone_id_node = cJSON_GetObjectItem(root, "zone_id");
@@ -200,9 +267,8 @@ void ws_handle_create_or_update_zone(const cJSON *root, int sockfd)
     if (!cJSON_IsString(zone_name_node) || !cJSON_IsNumber(output_node))
     {
         ESP_LOGE(TAG, "Invalid JSON");
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Invalid JSON\"}");
-        broadcast_message(json);
-        return;
+        *message = "Invalid JSON";
+        return ESP_ERR_INVALID_ARG;
     }
 
     const char *zone_name = zone_name_node->valuestring;
@@ -219,50 +285,111 @@ void ws_handle_create_or_update_zone(const cJSON *root, int sockfd)
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to add zone: %s", zone_name);
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Failed to add zone\"}");
-        broadcast_message(json);
+        *message = ret == ESP_ERR_INVALID_ARG ? "Output doesn't exist on the valve driver"
+                   : ret == ESP_ERR_NO_MEM    ? "No room left for zone names"
+                                              : "Failed to add zone";
     }
+    return ret;
 }
 
-void ws_handle_delete_zone(const cJSON *root, int sockfd)
+static esp_err_t apply_delete_zone(const cJSON *root, const char **message)
 {
-    ESP_LOGI(TAG, "Received delete_zone request");
-
     // Expected format: {"type":"delete_zone","zone_id":2}
     cJSON *zone_id_node = cJSON_GetObjectItem(root, "zone_id");
     if (!cJSON_IsNumber(zone_id_node))
     {
         ESP_LOGE(TAG, "Invalid JSON");
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Invalid JSON\"}");
-        broadcast_message(json);
-        return;
+        *message = "Invalid JSON";
+        return ESP_ERR_INVALID_ARG;
     }
 
-    const int zone_id = zone_id_node->valueint;
-
-    esp_err_t ret = sprinkler_remove_zone(zone_id);
+    esp_err_t ret = sprinkler_remove_zone(zone_id_node->valueint);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to delete zone");
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Failed to delete zone\"}");
-        broadcast_message(json);
-        return;
+        *message = "Failed to delete zone";
     }
+    return ret;
 }
 
-void ws_handle_create_or_update_program(const cJSON *root, int sockfd)
+// "18:30" or "sunrise-30", see start_time_from_string
+static bool parse_start_time(const cJSON *node, uint16_t *start_time)
 {
-    ESP_LOGI(TAG, "Received create_or_update_program request");
+    return cJSON_IsString(node) && start_time_from_string(node->valuestring, start_time);
+}
 
-    // Expected format: {"type":"create_or_update_program","id":1,"name":"Evening","schedule"{"days":[1,3,5],"start_time":"18:00"},"zones":[{"id":1,"order":1,"duration":30},{"id":2,"order":2,"duration":60}]}
-    cJSON *program_id_node = cJSON_GetObjectItem(root, "id");
-    cJSON *name_node = cJSON_GetObjectItem(root, "name");
+static bool parse_schedule(const cJSON *schedule_node, schedule_t *schedule)
+{
+    memset(schedule, 0, sizeof(schedule_t));
 
-    cJSON *schedule_node = cJSON_GetObjectItem(root, "schedule");
+    // Mode defaults to weekdays, as sent by older clients
+    schedule_mode_t mode = SCHEDULE_MODE_WEEKDAYS;
+    cJSON *mode_node = cJSON_GetObjectItem(schedule_node, "mode");
+    if (cJSON_IsString(mode_node) && !schedule_mode_from_string(mode_node->valuestring, &mode))
+    {
+        return false;
+    }
+    schedule->mode = mode;
+
+    // parse days
     cJSON *days_node = cJSON_GetObjectItem(schedule_node, "days");
-    cJSON *start_time_node = cJSON_GetObjectItem(schedule_node, "start_time");
+    cJSON *day;
+    cJSON_ArrayForEach(day, days_node)
+    {
+        if (cJSON_IsNumber(day) && day->valueint >= DAY_SUNDAY && day->valueint <= DAY_SATURDAY)
+        {
+            add_day(&schedule->days, day->valueint);
+        }
+    }
+
+    // Start times, a single "start_time" is still accepted
+    cJSON *start_times_node = cJSON_GetObjectItem(schedule_node, "start_times");
+    cJSON *start_time_node;
+    if (cJSON_IsArray(start_times_node))
+    {
+        cJSON_ArrayForEach(start_time_node, start_times_node)
+        {
+            if (schedule->start_count >= MAX_START_TIMES ||
+                !parse_start_time(start_time_node, &schedule->start_times[schedule->start_count++]))
+            {
+                return false;
+            }
+        }
+    }
+    else if (!parse_start_time(cJSON_GetObjectItem(schedule_node, "start_time"), &schedule->start_times[schedule->start_count++]))
+    {
+        return false;
+    }
 
+    // Interval cycle counts from start_date ("2025-06-01"), today when omitted
+    cJSON *interval_node = cJSON_GetObjectItem(schedule_node, "interval");
+    schedule->interval_days = cJSON_IsNumber(interval_node) ? interval_node->valueint : 1;
+    cJSON *start_date_node = cJSON_GetObjectItem(schedule_node, "start_date");
+    int year, month, day_of_month;
+    if (cJSON_IsString(start_date_node) && sscanf(start_date_node->valuestring, "%d-%d-%d", &year, &month, &day_of_month) == 3)
+    {
+        schedule->interval_anchor = timezone_days_from_date(year, month, day_of_month);
+    }
+    else
+    {
+        schedule->interval_anchor = timezone_local_day(timezone_to_local(time(NULL)));
+    }
+
+    return true;
+}
+
+static esp_err_t apply_create_or_update_program(const cJSON *root, const char **message)
+{
+    // Expected format: {"type":"create_or_update_program","id":1,"name":"Evening","schedule":{"mode":"weekdays","days":[1,3,5],"start_times":["06:00","18:00"]},"zones":[{"id":1,"order":1,"duration":30},{"id":2,"order":2,"duration":60}]}
+    // Other modes: {"mode":"interval","interval":3,"start_date":"2025-06-01",...}, {"mode":"odd",...}, {"mode":"even",...}
+    // Start times can follow the sun: "sunrise", "sunset+30", "finish_by_sunrise-15"
+    // Optional "budget":80 waters for 80% of the zone durations, on top of the global water budget
+    cJSON *program_id_node = cJSON_GetObjectItem(root, "id");
+    cJSON *name_node = cJSON_GetObjectItem(root, "name");
+    cJSON *schedule_node = cJSON_GetObjectItem(root, "schedule");
     cJSON *zones_node = cJSON_GetObjectItem(root, "zones");
+    cJSON *budget_node = cJSON_GetObjectItem(root, "budget");
+
     // program_id is used to update an existing program
     int program_id = 0;
     if (cJSON_IsNumber(program_id_node))
@@ -270,39 +397,20 @@ void ws_handle_create_or_update_program(const cJSON *root, int sockfd)
         program_id = program_id_node->valueint;
     }
 
-    if (!cJSON_IsString(name_node) || !cJSON_IsArray(days_node) || !cJSON_IsString(start_time_node) || !cJSON_IsArray(zones_node))
+    if (!cJSON_IsString(name_node) || !cJSON_IsObject(schedule_node) || !cJSON_IsArray(zones_node))
     {
         ESP_LOGE(TAG, "Invalid JSON");
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Invalid JSON\"}");
-        broadcast_message(json);
-        return;
+        *message = "Invalid JSON";
+        return ESP_ERR_INVALID_ARG;
     }
 
-    // parse days
-    uint8_t days = 0;
-    cJSON *day;
-    for (uint8_t i = 0; i < cJSON_GetArraySize(days_node); i++)
-    {
-        day = cJSON_GetArrayItem(days_node, i);
-        if (!cJSON_IsNumber(day))
-        {
-            continue;
-        }
-        add_day(&days, day->valueint);
-    }
-    // split start_time_node "12:30" into 12 and 30
-    char *start_time_str = start_time_node->valuestring;
-    char *start_hour_str = strtok(start_time_str, ":");
-    char *start_minute_str = strtok(NULL, ":");
-    if (!start_hour_str || !start_minute_str)
+    schedule_t schedule;
+    if (!parse_schedule(schedule_node, &schedule))
     {
-        ESP_LOGE(TAG, "Invalid start time format");
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Invalid JSON\"}");
-        broadcast_message(json);
-        return;
+        ESP_LOGE(TAG, "Invalid schedule");
+        *message = "Invalid schedule";
+        return ESP_ERR_INVALID_ARG;
     }
-    uint8_t start_hour = atoi(start_hour_str);
-    uint8_t start_minute = atoi(start_minute_str);
 
     // Parse zones
     uint8_t zone_count = 0;
@@ -325,51 +433,49 @@ void ws_handle_create_or_update_program(const cJSON *root, int sockfd)
         {
             continue;
         }
+        zones[zone_count].zone_id = zone_id_node->valueint;
+        zones[zone_count].order = zone_order_node->valueint;
+        zones[zone_count].duration = zone_duration_node->valueint;
         zone_count++;
-        zones[i].zone_id = zone_id_node->valueint;
-        zones[i].order = zone_order_node->valueint;
-        zones[i].duration = zone_duration_node->valueint;
     }
 
-    esp_err_t ret = sprinkler_create_or_update_program(program_id, name_node->valuestring, days, start_hour, start_minute, zones, zone_count);
+    int budget_percent = cJSON_IsNumber(budget_node) ? budget_node->valueint : WATER_BUDGET_DEFAULT_PERCENT;
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
+    if (budget_percent > 0 && budget_percent <= WATER_BUDGET_MAX_PERCENT)
+    {
+        ret = sprinkler_create_or_update_program(program_id, name_node->valuestring, &schedule, zones, zone_count, budget_percent);
+    }
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to create program: %s", name_node->valuestring);
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Failed to create program\"}");
-        broadcast_message(json);
+        *message = ret == ESP_ERR_NO_MEM ? "No room left for program names or zones" : "Failed to create program";
     }
+    return ret;
 }
 
-void ws_handle_delete_program(const cJSON *root, int sockfd)
+static esp_err_t apply_delete_program(const cJSON *root, const char **message)
 {
-    ESP_LOGI(TAG, "Received delete_program request");
-
     // Expected format: {"type":"delete_program","program_id":2}
     cJSON *program_id_node = cJSON_GetObjectItem(root, "program_id");
     if (!cJSON_IsNumber(program_id_node))
     {
         ESP_LOGE(TAG, "Invalid JSON");
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Invalid JSON\"}");
-        broadcast_message(json);
-        return;
+        *message = "Invalid JSON";
+        return ESP_ERR_INVALID_ARG;
     }
 
-    const int program_id = program_id_node->valueint;
-
-    esp_err_t ret = sprinkler_remove_program(program_id);
+    esp_err_t ret = sprinkler_remove_program(program_id_node->valueint);
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to delete program");
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Failed to delete program\"}");
-        broadcast_message(json);
-        return;
+        *message = "Failed to delete program";
     }
+    return ret;
 }
 
-void ws_handle_enable(const cJSON *root, int sockfd)
+static esp_err_t apply_enable(const cJSON *root, const char **message)
 {
-    ESP_LOGI(TAG, "Received enable request");
-
+    // Expected format: {"type":"enable","zone_id":1,"is_enabled":false} or with "program_id"
     cJSON *zone_id_node = cJSON_GetObjectItem(root, "zone_id");
     cJSON *program_id_node = cJSON_GetObjectItem(root, "program_id");
     cJSON *is_enabled_node = cJSON_GetObjectItem(root, "is_enabled");
@@ -377,18 +483,126 @@ void ws_handle_enable(const cJSON *root, int sockfd)
     if ((zone_id_node && !cJSON_IsNumber(zone_id_node)) || (program_id_node && !cJSON_IsNumber(program_id_node)) || !cJSON_IsBool(is_enabled_node))
     {
         ESP_LOGE(TAG, "Invalid JSON");
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Invalid JSON\"}");
-        broadcast_message(json);
-        return;
+        *message = "Invalid JSON";
+        return ESP_ERR_INVALID_ARG;
     }
 
+    esp_err_t ret = ESP_ERR_INVALID_ARG;
     if (zone_id_node)
     {
-        sprinkler_enable_zone(zone_id_node->valueint, is_enabled_node->valueint);
+        ret = sprinkler_enable_zone(zone_id_node->valueint, is_enabled_node->valueint);
     }
     else if (program_id_node)
     {
-        sprinkler_enable_program(program_id_node->valueint, is_enabled_node->valueint);
+        ret = sprinkler_enable_program(program_id_node->valueint, is_enabled_node->valueint);
+    }
+    if (ret != ESP_OK)
+    {
+        *message = zone_id_node ? "Failed to enable zone" : "Failed to enable program";
+    }
+    return ret;
+}
+
+// Commands accepted alone and in a batch
+static const struct
+{
+    const char *type;
+    change_handler_t apply;
+} change_handlers[] = {
+    {"create_or_update_zone", apply_create_or_update_zone},
+    {"delete_zone", apply_delete_zone},
+    {"create_or_update_program", apply_create_or_update_program},
+    {"delete_program", apply_delete_program},
+    {"enable", apply_enable},
+};
+
+static void handle_change(change_handler_t apply, const cJSON *root)
+{
+    const char *message = NULL;
+    if (apply(root, &message) != ESP_OK)
+    {
+        send_change_error(message);
+    }
+}
+
+void ws_handle_create_or_update_zone(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received add_zone request");
+    handle_change(apply_create_or_update_zone, root);
+}
+
+void ws_handle_delete_zone(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received delete_zone request");
+    handle_change(apply_delete_zone, root);
+}
+
+void ws_handle_create_or_update_program(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received create_or_update_program request");
+    handle_change(apply_create_or_update_program, root);
+}
+
+void ws_handle_delete_program(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received delete_program request");
+    handle_change(apply_delete_program, root);
+}
+
+void ws_handle_enable(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received enable request");
+    handle_change(apply_enable, root);
+}
+
+void ws_handle_batch(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received batch request");
+
+    // Expected format: {"type":"batch","commands":[{"type":"create_or_update_zone",...},{"type":"delete_program",...}]}
+    // Commands apply in order and all together, or none of them
+    cJSON *commands_node = cJSON_GetObjectItem(root, "commands");
+    if (!cJSON_IsArray(commands_node) || cJSON_GetArraySize(commands_node) == 0)
+    {
+        ESP_LOGE(TAG, "Invalid JSON");
+        send_change_error("Invalid JSON");
+        return;
+    }
+
+    if (sprinkler_transaction_begin() != ESP_OK)
+    {
+        send_change_error("Failed to start batch");
+        return;
+    }
+
+    int index = 0;
+    cJSON *command;
+    cJSON_ArrayForEach(command, commands_node)
+    {
+        cJSON *type_node = cJSON_GetObjectItem(command, "type");
+        change_handler_t apply = NULL;
+        for (int i = 0; cJSON_IsString(type_node) && i < sizeof(change_handlers) / sizeof(change_handlers[0]); i++)
+        {
+            if (!strcmp(type_node->valuestring, change_handlers[i].type))
+            {
+                apply = change_handlers[i].apply;
+            }
+        }
+
+        const char *message = "Unknown command";
+        if (!apply || apply(command, &message) != ESP_OK)
+        {
+            sprinkler_transaction_abort();
+            ESP_LOGE(TAG, "Batch command %d failed, nothing applied", index);
+            broadcast_format("{\"type\":\"error\",\"message\":\"Batch command %d: %s\"}", index, message);
+            return;
+        }
+        index++;
+    }
+
+    if (sprinkler_transaction_commit() != ESP_OK)
+    {
+        send_change_error("Failed to save batch");
     }
 }
 
@@ -403,8 +617,7 @@ void ws_handle_test_manual(const cJSON *root, int sockfd)
     if ((zone_id_node && !cJSON_IsNumber(zone_id_node)) || (program_id_node && !cJSON_IsNumber(program_id_node)) || !cJSON_IsString(action_node))
     {
         ESP_LOGE(TAG, "Invalid JSON");
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Invalid JSON\"}");
-        broadcast_message(json);
+        broadcast_message("{\"type\":\"error\",\"message\":\"Invalid JSON\"}");
         return;
     }
 
@@ -430,12 +643,86 @@ void ws_handle_test_manual(const cJSON *root, int sockfd)
     if (ret != ESP_OK)
     {
         ESP_LOGE(TAG, "Failed to run manual test");
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Failed to run manual test\"}");
-        broadcast_message(json);
+        broadcast_message("{\"type\":\"error\",\"message\":\"Failed to run manual test\"}");
         return;
     }
 }
 
+typedef struct
+{
+    calendar_cursor_t cursor;
+    time_t until;
+    size_t count;
+} calendar_chunk_t;
+
+static esp_err_t expand_calendar_operation(const sprinkler_data_t *data, void *user_data)
+{
+    calendar_chunk_t *chunk = (calendar_chunk_t *)user_data;
+    chunk->count = watering_plan_expand(data, &chunk->cursor, chunk->until, calendar_runs, CALENDAR_CHUNK_RUNS);
+    return ESP_OK;
+}
+
+void ws_handle_get_calendar(const cJSON *root, int sockfd)
+{
+    ESP_LOGI(TAG, "Received get_calendar request");
+
+    // Expected format: {"type":"get_calendar","days":7}
+    int days = CALENDAR_DEFAULT_DAYS;
+    cJSON *days_node = cJSON_GetObjectItem(root, "days");
+    if (cJSON_IsNumber(days_node))
+    {
+        days = max(1, min(days_node->valueint, CALENDAR_MAX_DAYS));
+    }
+
+    time_t from = time(NULL);
+    calendar_chunk_t chunk = {
+        .cursor = {.time = from, .program_id = 0},
+        .until = from + (time_t)days * 24 * 60 * 60};
+
+    char *calendar_json = buffer_lease(CALENDAR_JSON_SIZE, TAG);
+    if (!calendar_json)
+    {
+        return;
+    }
+
+    // Stream compact [start,program,zone,seconds] tuples, the lock is only held while expanding a chunk
+    int index = 0;
+    bool final = false;
+    while (!final)
+    {
+        if (safe_sprinklerdata_operation(expand_calendar_operation, &chunk) != ESP_OK)
+        {
+            send_message_sockfd("{\"type\":\"error\",\"message\":\"Failed to build calendar\"}", sockfd);
+            break;
+        }
+        // Expansion only stops early when the next program start doesn't fit, which needs a nearly full chunk
+        final = chunk.count < CALENDAR_CHUNK_RUNS - MAX_ZONES_PER_PROGRAM;
+
+        int len = snprintf(calendar_json, CALENDAR_JSON_SIZE,
+                           "{\"type\":\"calendar\",\"from\":%lld,\"to\":%lld,\"chunk\":%d,\"final\":%s,\"runs\":[",
+                           (long long)from, (long long)chunk.until, index++, final ? "true" : "false");
+        for (size_t i = 0; i < chunk.count && len < CALENDAR_JSON_SIZE; i++)
+        {
+            const calendar_run_t *run = &calendar_runs[i];
+            len += snprintf(calendar_json + len, CALENDAR_JSON_SIZE - len, "%s[%lld,%d,%d,%lu]",
+                            i ? "," : "", (long long)run->start, run->program_id, run->zone_id, (unsigned long)run->seconds);
+        }
+        if (len < CALENDAR_JSON_SIZE)
+        {
+            len += snprintf(calendar_json + len, CALENDAR_JSON_SIZE - len, "]}");
+        }
+        if (len >= CALENDAR_JSON_SIZE)
+        {
+            ESP_LOGE(TAG, "JSON buffer too small for calendar chunk");
+            break;
+        }
+
+        send_message_sockfd(calendar_json, sockfd);
+    }
+
+    buffer_release(calendar_json);
+}
+
 // Utility function to broadcast zones status updates
 void broadcast_zone_update(void)
 {
@@ -447,3 +734,9 @@ void broadcast_program_update(void)
 {
     queue_update(WS_UPDATE_PROGRAMS);
 }
+
+// Utility function to broadcast the finish-by plan
+void broadcast_plan_update(void)
+{
+    queue_update(WS_UPDATE_PLAN);
+}
@@ -9,6 +9,7 @@ esp_err_t ws_update_system_init(void);
 
 void ws_handle_get_zones(const cJSON *root, int sockfd);
 void ws_handle_get_programs(const cJSON *root, int sockfd);
+void ws_handle_get_plan(const cJSON *root, int sockfd);
 void ws_handle_get_all_data(const cJSON *root, int sockfd);
 
 void ws_handle_create_or_update_zone(const cJSON *root, int sockfd);
@@ -17,8 +18,14 @@ void ws_handle_delete_zone(const cJSON *root, int sockfd);
 void ws_handle_create_or_update_program(const cJSON *root, int sockfd);
 void ws_handle_delete_program(const cJSON *root, int sockfd);
 
+void ws_handle_get_calendar(const cJSON *root, int sockfd);
+
 void ws_handle_test_manual(const cJSON *root, int sockfd);
 void ws_handle_enable(const cJSON *root, int sockfd);
 
+// Zone and program changes applied together, see change_handlers in ws_sprinkler.c
+void ws_handle_batch(const cJSON *root, int sockfd);
+
 void broadcast_zone_update(void);
-void broadcast_program_update(void);
\ No newline at end of file
+void broadcast_program_update(void);
+void broadcast_plan_update(void);
\ No newline at end of file
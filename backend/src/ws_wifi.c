@@ -10,12 +10,12 @@
 #include <string.h>
 
 #include "ws_settings.h"
+#include "buffer_pool.h"
 
 #define MAX_APs 10
+#define WIFI_STATUS_JSON_SIZE 768
+#define WIFI_LIST_JSON_SIZE 2048
 static const char *TAG = "ws_wifi_scan";
-static char json[2048];
-static char entry[128];
-static char status_info[512];
 
 static const char *wifi_mode_to_string(wifi_mode_t mode)
 {
@@ -163,14 +163,20 @@ void ws_handle_wifi_status(const cJSON *root, int sockfd)
 {
     ESP_LOGI(TAG, "Received wifi_status request");
 
-    // Get current WiFi status
-    get_wifi_status_info(status_info, sizeof(status_info));
+    char *json = buffer_lease(WIFI_STATUS_JSON_SIZE, TAG);
+    if (!json)
+    {
+        return;
+    }
 
     // Build JSON response with just status information
-    snprintf(json, sizeof(json), "{\"type\":\"wifi_status\",%s}", status_info);
+    int len = snprintf(json, WIFI_STATUS_JSON_SIZE, "{\"type\":\"wifi_status\",");
+    get_wifi_status_info(json + len, WIFI_STATUS_JSON_SIZE - len - 1);
+    strcat(json, "}");
 
     broadcast_message(json);
     ESP_LOGI(TAG, "Sent wifi_status: %s", json);
+    buffer_release(json);
 }
 
 // ServiceReturns available networks
@@ -184,11 +190,18 @@ void ws_handle_wifi_scan(const cJSON *root, int sockfd)
     wifi_ap_record_t ap_records[MAX_APs];
     ESP_ERROR_CHECK(esp_wifi_scan_get_ap_records(&ap_num, ap_records));
 
+    char *json = buffer_lease(WIFI_LIST_JSON_SIZE, TAG);
+    if (!json)
+    {
+        return;
+    }
+
     // Build JSON response with just scan results
     strcpy(json, "{\"type\":\"wifi_list\",\"networks\":[");
 
     for (int i = 0; i < ap_num; ++i)
     {
+        char entry[128];
         snprintf(entry, sizeof(entry),
                  "%s{\"ssid\":\"%s\",\"rssi\":%d,\"channel\":%d,\"auth_mode\":\"%s\",\"secure\":%s}",
                  (i > 0 ? "," : ""),
@@ -197,12 +210,13 @@ void ws_handle_wifi_scan(const cJSON *root, int sockfd)
                  ap_records[i].primary,
                  wifi_auth_mode_to_string(ap_records[i].authmode),
                  (ap_records[i].authmode == WIFI_AUTH_OPEN ? "false" : "true"));
-        strncat(json, entry, sizeof(json) - strlen(json) - 1);
+        strncat(json, entry, WIFI_LIST_JSON_SIZE - strlen(json) - 1);
     }
-    strncat(json, "]}", sizeof(json) - strlen(json) - 1);
+    strncat(json, "]}", WIFI_LIST_JSON_SIZE - strlen(json) - 1);
 
     send_message_sockfd(json, sockfd);
     ESP_LOGI(TAG, "Sent wifi_list: %s", json);
+    buffer_release(json);
 }
 
 void ws_handle_wifi_connect(const cJSON *root, int sockfd)
@@ -212,8 +226,7 @@ void ws_handle_wifi_connect(const cJSON *root, int sockfd)
     // Check if already connecting
     if (is_wifi_connecting())
     {
-        strcpy(json, "{\"type\":\"error\",\"message\":\"WiFi connection already in progress\"}");
-        send_message_sockfd(json, sockfd);
+        send_message_sockfd("{\"type\":\"error\",\"message\":\"WiFi connection already in progress\"}", sockfd);
         return;
     }
 
@@ -224,8 +237,7 @@ void ws_handle_wifi_connect(const cJSON *root, int sockfd)
     if (!cJSON_IsString(ssid_json) || !cJSON_IsString(password_json))
     {
         ESP_LOGE(TAG, "Invalid JSON");
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Invalid JSON\"}");
-        send_message_sockfd(json, sockfd);
+        send_message_sockfd("{\"type\":\"error\",\"message\":\"Invalid JSON\"}", sockfd);
         return;
     }
 
@@ -235,16 +247,14 @@ void ws_handle_wifi_connect(const cJSON *root, int sockfd)
     // Validate input
     if (strlen(ssid) == 0 || strlen(ssid) >= 32 || strlen(password) >= 64)
     {
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Invalid inputs\"}");
-        send_message_sockfd(json, sockfd);
+        send_message_sockfd("{\"type\":\"error\",\"message\":\"Invalid inputs\"}", sockfd);
         return;
     }
 
     esp_err_t ret = wifi_start_sta_connection(ssid, password);
     if (ret != ESP_OK)
     {
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Failed to start connection\"}");
-        send_message_sockfd(json, sockfd);
+        send_message_sockfd("{\"type\":\"error\",\"message\":\"Failed to start connection\"}", sockfd);
         return;
     }
 
@@ -253,13 +263,11 @@ void ws_handle_wifi_connect(const cJSON *root, int sockfd)
 
     if (!is_connected)
     {
-        strcpy(json, "{\"type\":\"error\",\"message\":\"Couldn't connect, check that your are in range and that your password is correct\"}");
-        send_message_sockfd(json, sockfd);
+        send_message_sockfd("{\"type\":\"error\",\"message\":\"Couldn't connect, check that your are in range and that your password is correct\"}", sockfd);
         return;
     }
 
-    strcpy(json, "{\"type\":\"wifi_connect_success\"}");
-    send_message_sockfd(json, sockfd);
+    send_message_sockfd("{\"type\":\"wifi_connect_success\"}", sockfd);
 
     broadcast_get_settings();
 }
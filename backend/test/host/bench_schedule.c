@@ -0,0 +1,85 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// Next run of weekdays programs from the compiled weekly index against the libc day walk it replaced
+
+#include <stdio.h>
+#include <string.h>
+
+#include "schedule_engine.h"
+#include "timezone.h"
+#include "water_budget.h"
+#include "host_bench.h"
+#include "host_test.h"
+
+#define BENCH_PROGRAMS 4
+
+static sprinkler_data_t data;
+
+// One start of the day through localtime and mktime, as before the schedules were compiled
+static time_t libc_next_run(uint8_t days, uint16_t start_minute, time_t now)
+{
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+    struct tm tm_target = tm_now;
+    tm_target.tm_hour = start_minute / 60;
+    tm_target.tm_min = start_minute % 60;
+    tm_target.tm_sec = 0;
+    time_t target_today = mktime(&tm_target);
+    if ((days & (1 << tm_now.tm_wday)) && target_today > now)
+    {
+        return target_today;
+    }
+
+    for (int days_ahead = 1; days_ahead <= 7; days_ahead++)
+    {
+        time_t future_time = now + days_ahead * SECONDS_PER_DAY;
+        struct tm tm_future;
+        localtime_r(&future_time, &tm_future);
+        if (days & (1 << tm_future.tm_wday))
+        {
+            tm_future.tm_hour = start_minute / 60;
+            tm_future.tm_min = start_minute % 60;
+            tm_future.tm_sec = 0;
+            tm_future.tm_isdst = -1;
+            return mktime(&tm_future);
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    static const uint8_t days[BENCH_PROGRAMS] = {0x7F, 0x2A, 0x41, 0x10};
+    static const uint16_t starts[BENCH_PROGRAMS] = {6 * 60, 6 * 60 + 30, 20 * 60, 23 * 60 + 45};
+
+    water_budget_init();
+    timezone_init();
+    timezone_set(host_test_zones[0]);
+
+    for (int i = 0; i < BENCH_PROGRAMS; i++)
+    {
+        program_t *program = &data.programs[i];
+        program->id = i + 1;
+        program->enabled = true;
+        program->budget_percent = 100;
+        program->schedule.mode = SCHEDULE_MODE_WEEKDAYS;
+        program->schedule.days = days[i];
+        program->schedule.start_count = 1;
+        program->schedule.start_times[0] = starts[i];
+    }
+    data.program_count = BENCH_PROGRAMS;
+
+    double libc_ns, compiled_ns;
+    double start = host_bench_seconds();
+    schedule_engine_compile(&data);
+    double compile_us = (host_bench_seconds() - start) * 1e6;
+
+    time_t base = time(NULL);
+    volatile time_t sink = 0;
+    HOST_BENCH(libc_ns, sink += libc_next_run(days[i % BENCH_PROGRAMS], starts[i % BENCH_PROGRAMS],
+                                              base + (time_t)(i % 100000) * 997));
+    HOST_BENCH(compiled_ns, sink += schedule_engine_next_run(i % BENCH_PROGRAMS + 1, base + (time_t)(i % 100000) * 997));
+
+    printf("compile %.1f us of %d programs, next_run %.1f ns (libc %.1f)\n", compile_us, BENCH_PROGRAMS, compiled_ns, libc_ns);
+    return 0;
+}
@@ -0,0 +1,38 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// Local time conversions through the transition table against libc, which rescans the TZ rules each call
+
+#include <stdio.h>
+
+#include "timezone.h"
+#include "host_bench.h"
+#include "host_test.h"
+
+int main(void)
+{
+    timezone_init();
+
+    // Spread over three years of the table, which starts a year before now
+    time_t base = time(NULL);
+    volatile int64_t sink = 0;
+    for (size_t z = 0; z < HOST_TEST_ZONE_COUNT; z++)
+    {
+        timezone_set(host_test_zones[z]);
+
+        double libc_local, table_local, libc_utc, table_utc;
+        HOST_BENCH(libc_local, sink += host_local(base + (time_t)(i % 100000) * 997));
+        HOST_BENCH(table_local, sink += timezone_to_local(base + (time_t)(i % 100000) * 997));
+        HOST_BENCH(libc_utc, {
+            time_t local = base + (time_t)(i % 100000) * 997;
+            struct tm tm;
+            gmtime_r(&local, &tm);
+            tm.tm_isdst = -1;
+            sink += mktime(&tm);
+        });
+        HOST_BENCH(table_utc, sink += timezone_to_utc(base + (int64_t)(i % 100000) * 997));
+
+        printf("%-40s to_local %6.1f ns (libc %6.1f)   to_utc %6.1f ns (libc %6.1f)\n", host_test_zones[z], table_local,
+               libc_local, table_utc, libc_utc);
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// Shared by the host benchmarks, which are built but not run by ctest
+
+#pragma once
+
+#include <time.h>
+
+#define HOST_BENCH_CALLS 1000000
+
+static inline double host_bench_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// Nanoseconds per call of the loop body
+#define HOST_BENCH(result_ns, body)                                    \
+    do                                                                 \
+    {                                                                  \
+        double start = host_bench_seconds();                           \
+        for (int i = 0; i < HOST_BENCH_CALLS; i++)                     \
+        {                                                              \
+            body;                                                      \
+        }                                                              \
+        (result_ns) = (host_bench_seconds() - start) * 1e9 / HOST_BENCH_CALLS; \
+    } while (0)
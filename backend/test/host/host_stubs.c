@@ -0,0 +1,179 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// Storage and IDF functions the sources under test link against, nothing is persisted and time is virtual
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "storage.h"
+
+#define HOST_MAX_TASKS 4
+#define HOST_MAX_TIMERS 4
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    static char name[16];
+    snprintf(name, sizeof(name), "0x%x", code);
+    return name;
+}
+
+esp_err_t read_blob(const char *key, void *outValue, size_t *required_size)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t write_blob(const char *key, const void *value, size_t required_size)
+{
+    return ESP_OK;
+}
+
+struct host_task
+{
+    TaskFunction_t function;
+    void *arg;
+    uint32_t notifications;
+};
+
+static struct host_task tasks[HOST_MAX_TASKS];
+static int task_count = 0;
+static struct host_task *current_task = NULL;
+static jmp_buf task_blocked; // Where a task waiting without a notification leaves to
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *arg, UBaseType_t priority,
+                       TaskHandle_t *created_task)
+{
+    if (task_count == HOST_MAX_TASKS)
+    {
+        return pdFALSE;
+    }
+    tasks[task_count] = (struct host_task){.function = function, .arg = arg};
+    *created_task = &tasks[task_count++];
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    task->notifications++;
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait)
+{
+    uint32_t count = current_task->notifications;
+    if (!count)
+    {
+        longjmp(task_blocked, 1);
+    }
+    current_task->notifications = clear_count_on_exit ? 0 : count - 1;
+    return count;
+}
+
+void host_tasks_run(void)
+{
+    for (int i = 0; i < task_count; i++)
+    {
+        if (tasks[i].notifications)
+        {
+            current_task = &tasks[i];
+            if (!setjmp(task_blocked))
+            {
+                tasks[i].function(tasks[i].arg);
+            }
+            current_task = NULL;
+            i = -1; // A task may have notified an earlier one
+        }
+    }
+}
+
+struct esp_timer
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    int64_t due_us;
+    bool armed;
+};
+
+static struct esp_timer timers[HOST_MAX_TIMERS];
+static int timer_count = 0;
+static int64_t now_us = 0;
+
+int64_t esp_timer_get_time(void)
+{
+    return now_us;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    if (timer_count == HOST_MAX_TIMERS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    timers[timer_count] = (struct esp_timer){.callback = create_args->callback, .arg = create_args->arg};
+    *out_handle = &timers[timer_count++];
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    if (timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->due_us = now_us + (int64_t)timeout_us;
+    timer->armed = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->armed = false;
+    return ESP_OK;
+}
+
+void host_timer_advance(int64_t us)
+{
+    int64_t until = now_us + us;
+    while (true)
+    {
+        struct esp_timer *next = NULL;
+        for (int i = 0; i < timer_count; i++)
+        {
+            if (timers[i].armed && timers[i].due_us <= until && (!next || timers[i].due_us < next->due_us))
+            {
+                next = &timers[i];
+            }
+        }
+        if (!next)
+        {
+            break;
+        }
+
+        now_us = next->due_us;
+        next->armed = false;
+        next->callback(next->arg);
+        host_tasks_run();
+    }
+    now_us = until;
+}
+
+#ifdef HOST_NEEDS_STRLCPY
+size_t strlcpy(char *dest, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size)
+    {
+        size_t copy = len < size ? len : size - 1;
+        memcpy(dest, src, copy);
+        dest[copy] = '\0';
+    }
+    return len;
+}
+#endif
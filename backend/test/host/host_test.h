@@ -0,0 +1,46 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// Shared by the host tests: the zones they run under and brute-force local time through libc
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Northern and southern DST, a zone without DST and one with a 30 minute change
+static const char *const host_test_zones[] = {
+    "CET-1CEST,M3.5.0,M10.5.0/3",
+    "PST8PDT,M3.2.0,M11.1.0",
+    "AEST-10AEDT,M10.1.0,M4.1.0/3",
+    "<+1030>-10:30<+11>-11,M10.1.0,M4.1.0",
+    "UTC0",
+};
+
+#define HOST_TEST_ZONE_COUNT (sizeof(host_test_zones) / sizeof(host_test_zones[0]))
+
+// The brute-force walks cover these years
+#define HOST_TEST_FROM 1735689600 // 2025-01-01 UTC
+#define HOST_TEST_TO 1830297600   // 2028-01-01 UTC
+
+// Local seconds since the epoch of a UTC time, straight from libc after setenv("TZ") and tzset()
+static inline int64_t host_local(time_t utc)
+{
+    struct tm tm;
+    localtime_r(&utc, &tm);
+    return (int64_t)timegm(&tm);
+}
+
+#define HOST_CHECK(failures, condition, ...) \
+    do                                       \
+    {                                        \
+        if (!(condition))                    \
+        {                                    \
+            if ((failures)++ < 10)           \
+            {                                \
+                printf("  FAIL " __VA_ARGS__); \
+                printf("\n");                \
+            }                                \
+        }                                    \
+    } while (0)
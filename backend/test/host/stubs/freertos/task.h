@@ -0,0 +1,21 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// Host stand-in for the FreeRTOS header. Tasks don't run on their own: a notified task runs from the top until it
+// waits for a notification again, which suits task loops that keep their state in statics.
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#define pdPASS pdTRUE
+
+typedef void (*TaskFunction_t)(void *arg);
+typedef struct host_task *TaskHandle_t;
+
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stack_depth, void *arg, UBaseType_t priority,
+                       TaskHandle_t *created_task);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait);
+
+// Host only: run the notified tasks until none is left
+void host_tasks_run(void);
@@ -0,0 +1,13 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// Force-included in every host build, for what newlib has and older glibc lacks
+
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__GLIBC__) && (__GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38))
+#define HOST_NEEDS_STRLCPY 1
+size_t strlcpy(char *dest, const char *src, size_t size);
+#endif
@@ -0,0 +1,7 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// Host stand-in for the lwIP header
+
+#pragma once
+
+typedef signed char err_t;
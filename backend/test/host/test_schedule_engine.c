@@ -0,0 +1,265 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// Brute-force check of the schedule engine over 2025-2027. Every start of random programs is placed on
+// the UTC timeline by walking each minute through libc, then next_run and last_start are compared
+// against it around every DST change and at a stride over the years.
+
+#include <string.h>
+
+#include "schedule_engine.h"
+#include "timezone.h"
+#include "water_budget.h"
+#include "host_test.h"
+
+#define TEST_PROGRAMS 24
+#define TEST_MARGIN (40 * SECONDS_PER_DAY) // Walked before and after the checked years, longer than any period
+#define TEST_STRIDE 7919                    // Seconds between checks away from the DST changes
+
+static sprinkler_data_t data;
+
+// UTC start of each local minute of the walk, by minutes after local_first
+static time_t *local_map;
+static size_t local_map_size;
+static int64_t local_first;
+
+// Starts of each program in chronological order
+static time_t *events[TEST_PROGRAMS];
+static size_t event_count[TEST_PROGRAMS];
+
+// Deterministic, so a failure reproduces
+static uint32_t random_state = 12345;
+
+static uint32_t random_next(uint32_t bound)
+{
+    random_state = random_state * 1664525 + 1013904223;
+    return (random_state >> 8) % bound;
+}
+
+static int compare_times(const void *a, const void *b)
+{
+    time_t x = *(const time_t *)a, y = *(const time_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int compare_starts(const void *a, const void *b)
+{
+    return *(const uint16_t *)a - *(const uint16_t *)b;
+}
+
+// Programs of every mode, with starts around midnight and the hours DST changes move
+static void make_programs(void)
+{
+    static const uint16_t dst_minutes[] = {0, 59, 60, 90, 119, 120, 121, 150, 179, 180, 181, 210, 1439};
+    memset(&data, 0, sizeof(data));
+    for (int i = 0; i < TEST_PROGRAMS; i++)
+    {
+        program_t *program = &data.programs[i];
+        program->id = i + 1;
+        program->enabled = i != TEST_PROGRAMS - 1; // The last one checks disabled programs never run
+        program->budget_percent = 100;
+
+        schedule_t *schedule = &program->schedule;
+        schedule->mode = i % 4;
+        schedule->days = i == 0 ? 0 : random_next(127) + 1; // The first one has no day selected
+        schedule->interval_days = random_next(MAX_INTERVAL_DAYS) + 1;
+        schedule->interval_anchor = 20000 + random_next(MAX_INTERVAL_DAYS);
+
+        uint8_t count = random_next(MAX_START_TIMES) + 1;
+        while (schedule->start_count < count)
+        {
+            uint16_t start = random_next(2) ? dst_minutes[random_next(sizeof(dst_minutes) / sizeof(dst_minutes[0]))]
+                                            : random_next(MINUTES_PER_DAY);
+            bool duplicate = false;
+            for (int k = 0; k < schedule->start_count; k++)
+            {
+                duplicate |= schedule->start_times[k] == start;
+            }
+            if (!duplicate)
+            {
+                schedule->start_times[schedule->start_count++] = start;
+            }
+        }
+        qsort(schedule->start_times, schedule->start_count, sizeof(uint16_t), compare_starts);
+    }
+    data.program_count = TEST_PROGRAMS;
+}
+
+// Whether a program waters on a local day, straight from libc
+static bool reference_day_matches(const program_t *program, int64_t day)
+{
+    const schedule_t *schedule = &program->schedule;
+    time_t midnight = (time_t)(day * SECONDS_PER_DAY);
+    struct tm tm;
+    gmtime_r(&midnight, &tm);
+    switch (schedule->mode)
+    {
+    case SCHEDULE_MODE_INTERVAL:
+        return ((day - schedule->interval_anchor) % schedule->interval_days + schedule->interval_days) %
+                   schedule->interval_days ==
+               0;
+    case SCHEDULE_MODE_ODD_DAYS:
+        return tm.tm_mday % 2 == 1;
+    case SCHEDULE_MODE_EVEN_DAYS:
+        return tm.tm_mday % 2 == 0;
+    default:
+        return schedule->days & (1 << tm.tm_wday);
+    }
+}
+
+// Map each local minute to the UTC time it starts at. A skipped minute keeps the offset from before the
+// change and a repeated one resolves to its first occurrence, like the firmware documents.
+static void build_local_map(void)
+{
+    time_t from = HOST_TEST_FROM - TEST_MARGIN, to = HOST_TEST_TO + TEST_MARGIN;
+    local_first = host_local(from);
+    local_map_size = (size_t)((to - from) / 60) + 2 * MINUTES_PER_DAY;
+    free(local_map);
+    local_map = calloc(local_map_size, sizeof(time_t));
+
+    int64_t previous_local = local_first;
+    local_map[0] = from;
+    for (time_t utc = from + 60; utc < to; utc += 60)
+    {
+        int64_t local = host_local(utc);
+        for (int64_t minute = previous_local + 60; minute <= local; minute += 60)
+        {
+            local_map[(minute - local_first) / 60] = minute == local ? utc : utc - 60 + (time_t)(minute - previous_local);
+        }
+        if (local > previous_local)
+        {
+            previous_local = local;
+        }
+    }
+}
+
+static void build_events(void)
+{
+    int64_t first_day = local_first / SECONDS_PER_DAY + 1;
+    int64_t last_day = (local_first + (int64_t)local_map_size * 60) / SECONDS_PER_DAY - 2;
+    for (int i = 0; i < TEST_PROGRAMS; i++)
+    {
+        const program_t *program = &data.programs[i];
+        free(events[i]);
+        events[i] = malloc((size_t)(last_day - first_day + 1) * MAX_START_TIMES * sizeof(time_t));
+        event_count[i] = 0;
+        if (!program->enabled)
+            continue;
+
+        for (int64_t day = first_day; day <= last_day; day++)
+        {
+            if (!reference_day_matches(program, day))
+                continue;
+
+            for (int k = 0; k < program->schedule.start_count; k++)
+            {
+                int64_t local = day * SECONDS_PER_DAY + program->schedule.start_times[k] * 60;
+                time_t utc = local_map[(local - local_first) / 60];
+                if (utc)
+                {
+                    events[i][event_count[i]++] = utc;
+                }
+            }
+        }
+        qsort(events[i], event_count[i], sizeof(time_t), compare_times);
+    }
+}
+
+// First event after now, 0 if none
+static time_t reference_next(int program_index, time_t now)
+{
+    size_t low = 0, high = event_count[program_index];
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if (events[program_index][middle] <= now)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low < event_count[program_index] ? events[program_index][low] : 0;
+}
+
+// Last event at or before now, 0 if none
+static time_t reference_last(int program_index, time_t now)
+{
+    size_t low = 0, high = event_count[program_index];
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if (events[program_index][middle] <= now)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low ? events[program_index][low - 1] : 0;
+}
+
+static void check_at(const char *zone, time_t now, int *failures)
+{
+    for (int i = 0; i < TEST_PROGRAMS; i++)
+    {
+        time_t next = reference_next(i, now);
+        time_t last = reference_last(i, now);
+        HOST_CHECK(*failures, schedule_engine_next_run(i + 1, now) == next, "%s program %d next_run(%ld) = %ld, expected %ld",
+                   zone, i + 1, (long)now, (long)schedule_engine_next_run(i + 1, now), (long)next);
+        HOST_CHECK(*failures, schedule_engine_last_start(i + 1, now) == last, "%s program %d last_start(%ld) = %ld, expected %ld",
+                   zone, i + 1, (long)now, (long)schedule_engine_last_start(i + 1, now), (long)last);
+    }
+}
+
+static int check_zone(const char *zone)
+{
+    if (timezone_set(zone) != ESP_OK)
+    {
+        printf("  FAIL timezone_set(%s)\n", zone);
+        return 1;
+    }
+    build_local_map();
+    build_events();
+    schedule_engine_compile(&data);
+
+    int failures = 0;
+    int checks = 0;
+    for (time_t now = HOST_TEST_FROM; now < HOST_TEST_TO; now += TEST_STRIDE)
+    {
+        check_at(zone, now, &failures);
+        checks++;
+    }
+
+    // Every minute and its edges for three hours either side of each change
+    int64_t previous_local = host_local(HOST_TEST_FROM - 60);
+    for (time_t utc = HOST_TEST_FROM; utc < HOST_TEST_TO; utc += 60)
+    {
+        int64_t local = host_local(utc);
+        if (local - previous_local != 60)
+        {
+            for (time_t now = utc - 3 * 3600; now <= utc + 3 * 3600; now += 60)
+            {
+                check_at(zone, now - 1, &failures);
+                check_at(zone, now, &failures);
+                check_at(zone, now + 1, &failures);
+                checks += 3;
+            }
+        }
+        previous_local = local;
+    }
+
+    printf("%-40s %d checks, %d mismatches\n", zone, checks, failures);
+    return failures;
+}
+
+int main(void)
+{
+    water_budget_init();
+    timezone_init();
+    make_programs();
+
+    int failures = 0;
+    for (size_t i = 0; i < HOST_TEST_ZONE_COUNT; i++)
+    {
+        failures += check_zone(host_test_zones[i]);
+    }
+
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
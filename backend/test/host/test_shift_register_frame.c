@@ -0,0 +1,70 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// 74HC595 frames for 1 to 8 chips, shifted through a model of the chain: each bit enters Q0 of the chip closest
+// to the ESP32 and pushes the others one place further, Q7 of a chip feeding Q0 of the next.
+
+#include "valve_backend.h"
+#include "host_test.h"
+
+#define TEST_STATES 10000
+#define FRAME_GUARD 0xA5
+
+// Deterministic, so a failure reproduces
+static uint64_t random_state = 12345;
+
+static uint64_t random_next(void)
+{
+    random_state = random_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return random_state;
+}
+
+// Outputs of the chain once the frame is shifted in and latched, output n on bit n
+static uint64_t shift_chain(const uint8_t *frame, uint8_t chip_count)
+{
+    uint64_t chain = 0;
+    for (int i = 0; i < chip_count; i++)
+    {
+        for (int bit = 7; bit >= 0; bit--)
+        {
+            chain = (chain << 1) | ((frame[i] >> bit) & 1);
+        }
+    }
+    return chain;
+}
+
+static int check_chips(uint8_t chip_count)
+{
+    int failures = 0;
+    uint64_t outputs = chip_count == 8 ? ~0ULL : (1ULL << (chip_count * 8)) - 1;
+    for (int i = 0; i < TEST_STATES; i++)
+    {
+        // Single outputs first, then random states
+        uint64_t state = i < 64 ? VALVE_OUTPUT_BIT(i) : random_next();
+
+        uint8_t frame[VALVE_SHIFT_REGISTER_MAX_CHIPS + 1];
+        memset(frame, FRAME_GUARD, sizeof(frame));
+        valve_shift_register_frame(state, chip_count, frame);
+
+        uint64_t latched = shift_chain(frame, chip_count);
+        HOST_CHECK(failures, latched == (state & outputs), "%d chips, state 0x%llx latched 0x%llx", chip_count,
+                   (unsigned long long)state, (unsigned long long)latched);
+        HOST_CHECK(failures, frame[chip_count] == FRAME_GUARD, "%d chips, frame written past %d bytes", chip_count, chip_count);
+    }
+
+    char label[16];
+    snprintf(label, sizeof(label), "%d chips", chip_count);
+    printf("%-40s %d mismatches\n", label, failures);
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+    for (uint8_t chips = 1; chips <= VALVE_SHIFT_REGISTER_MAX_CHIPS; chips++)
+    {
+        failures += check_chips(chips);
+    }
+
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// Brute-force check of timezone.c against libc, minute by minute over 2025-2027. The transition table
+// is built from the current date, so the walk covers both the table and the libc fallback before it.
+
+#include "timezone.h"
+#include "host_test.h"
+
+// Every day from 1900 to 2200 against gmtime
+static int check_calendar(void)
+{
+    int failures = 0;
+    for (int64_t day = -25567; day < 84006; day++)
+    {
+        time_t midnight = (time_t)(day * SECONDS_PER_DAY);
+        struct tm tm;
+        gmtime_r(&midnight, &tm);
+
+        int year, month, day_of_month;
+        timezone_date_from_days(day, &year, &month, &day_of_month);
+        HOST_CHECK(failures, timezone_days_from_date(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) == day,
+                   "days_from_date(%04d-%02d-%02d) != %lld", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, (long long)day);
+        HOST_CHECK(failures, year == tm.tm_year + 1900 && month == tm.tm_mon + 1 && day_of_month == tm.tm_mday,
+                   "date_from_days(%lld) = %04d-%02d-%02d", (long long)day, year, month, day_of_month);
+        HOST_CHECK(failures, timezone_local_weekday(day * SECONDS_PER_DAY) == tm.tm_wday,
+                   "weekday of %lld is %d", (long long)day, timezone_local_weekday(day * SECONDS_PER_DAY));
+    }
+    return failures;
+}
+
+static int check_zone(const char *zone)
+{
+    int failures = 0;
+    int transitions = 0;
+    if (timezone_set(zone) != ESP_OK)
+    {
+        printf("  FAIL timezone_set(%s)\n", zone);
+        return 1;
+    }
+
+    time_t previous = HOST_TEST_FROM - 60;
+    int64_t previous_local = host_local(previous);
+    int64_t highest_local = previous_local; // Local times up to here already happened, after a fall back
+    for (time_t utc = HOST_TEST_FROM; utc < HOST_TEST_TO; utc += 60)
+    {
+        int64_t local = host_local(utc);
+        transitions += local - previous_local != 60;
+        HOST_CHECK(failures, timezone_to_local(utc) == local, "%s to_local(%ld) = %lld, libc %lld", zone, (long)utc,
+                   (long long)timezone_to_local(utc), (long long)local);
+
+        if (local > highest_local)
+        {
+            // Local times skipped by a change keep the offset from before it, so they move forward
+            for (int64_t skipped = previous_local + 60; skipped < local; skipped += 60)
+            {
+                time_t expected = previous + (time_t)(skipped - previous_local);
+                HOST_CHECK(failures, timezone_to_utc(skipped) == expected, "%s skipped to_utc(%lld) = %ld, expected %ld",
+                           zone, (long long)skipped, (long)timezone_to_utc(skipped), (long)expected);
+            }
+            HOST_CHECK(failures, timezone_to_utc(local) == utc, "%s to_utc(%lld) = %ld, expected %ld", zone,
+                       (long long)local, (long)timezone_to_utc(local), (long)utc);
+            highest_local = local;
+        }
+        else
+        {
+            // Repeated local times resolve to their first occurrence, at most a few hours back
+            time_t first = utc;
+            for (time_t earlier = utc - 60; earlier > utc - 4 * 3600; earlier -= 60)
+            {
+                first = host_local(earlier) == local ? earlier : first;
+            }
+            HOST_CHECK(failures, timezone_to_utc(local) == first, "%s repeated to_utc(%lld) = %ld, expected %ld", zone,
+                       (long long)local, (long)timezone_to_utc(local), (long)first);
+        }
+
+        previous = utc;
+        previous_local = local;
+    }
+
+    printf("%-40s %d transitions, %d mismatches\n", zone, transitions, failures);
+    return failures;
+}
+
+int main(void)
+{
+    timezone_init();
+
+    int failures = check_calendar();
+    printf("%-40s %d mismatches\n", "calendar 1900-2200", failures);
+
+    for (size_t i = 0; i < HOST_TEST_ZONE_COUNT; i++)
+    {
+        failures += check_zone(host_test_zones[i]);
+    }
+
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
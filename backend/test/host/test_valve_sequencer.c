@@ -0,0 +1,144 @@
+// Copyright (c) 2025 David Bertet. Licensed under the MIT License.
+
+// Valve sequencing on the mock backend: the writes of a start, a zone handoff and a stop, in order and on time.
+
+#include "valve_outputs.h"
+#include "valve_sequencer.h"
+#include "esp_timer.h"
+#include "host_test.h"
+
+#define ZONE_A 1
+#define ZONE_B 2
+#define MASTER 10
+#define PUMP 11
+
+#define MASTER_LEAD_MS 500
+#define PUMP_DELAY_MS 300
+#define OVERLAP_MS 2000
+
+// Writes since the last call, so each phase is checked on its own
+static const valve_outputs_write_t *take_writes(int *count)
+{
+    static int taken = 0;
+    int total;
+    const valve_outputs_write_t *history = valve_outputs_mock_history(&total);
+    *count = total - taken;
+    const valve_outputs_write_t *writes = history + taken;
+    taken = total;
+    return writes;
+}
+
+static void check_write(int *failures, const char *phase, const valve_outputs_write_t *write, int64_t time_us, uint64_t set_mask,
+                        uint64_t clear_mask, uint64_t state)
+{
+    HOST_CHECK(*failures, write->time_us == time_us, "%s write at %lld us, expected %lld", phase, (long long)write->time_us,
+               (long long)time_us);
+    HOST_CHECK(*failures, write->set_mask == set_mask && write->clear_mask == clear_mask,
+               "%s write set 0x%llx clear 0x%llx, expected set 0x%llx clear 0x%llx", phase,
+               (unsigned long long)write->set_mask, (unsigned long long)write->clear_mask, (unsigned long long)set_mask,
+               (unsigned long long)clear_mask);
+    HOST_CHECK(*failures, write->state == state, "%s state 0x%llx, expected 0x%llx", phase, (unsigned long long)write->state,
+               (unsigned long long)state);
+}
+
+static int check_sequence(uint16_t overlap_ms)
+{
+    int failures = 0;
+    int count;
+    const valve_outputs_write_t *writes;
+    uint64_t a = VALVE_OUTPUT_BIT(ZONE_A), b = VALVE_OUTPUT_BIT(ZONE_B);
+    uint64_t master = VALVE_OUTPUT_BIT(MASTER), pump = VALVE_OUTPUT_BIT(PUMP);
+
+    const valve_sequence_t sequence = {
+        .master_output = MASTER,
+        .pump_output = PUMP,
+        .master_lead_ms = MASTER_LEAD_MS,
+        .pump_delay_ms = PUMP_DELAY_MS,
+        .overlap_ms = overlap_ms,
+    };
+    HOST_CHECK(failures, valve_sequencer_set(&sequence) == ESP_OK, "valve_sequencer_set");
+    take_writes(&count);
+
+    // Start: master valve, the zone once the lead is over, then the pump
+    int64_t start = esp_timer_get_time();
+    valve_sequencer_switch(ZONE_A);
+    host_timer_advance(5000 * 1000LL);
+    writes = take_writes(&count);
+    HOST_CHECK(failures, count == 3, "start made %d writes, expected 3", count);
+    if (count == 3)
+    {
+        check_write(&failures, "start master", &writes[0], start, master, 0, master);
+        check_write(&failures, "start zone", &writes[1], start + MASTER_LEAD_MS * 1000LL, a, 0, master | a);
+        check_write(&failures, "start pump", &writes[2], start + (MASTER_LEAD_MS + PUMP_DELAY_MS) * 1000LL, pump, 0,
+                    master | a | pump);
+    }
+
+    // Handoff: the next zone opens first, the previous one closes once the overlap is over
+    int64_t handoff = esp_timer_get_time();
+    valve_sequencer_switch(ZONE_B);
+    host_timer_advance(5000 * 1000LL);
+    writes = take_writes(&count);
+    if (overlap_ms)
+    {
+        HOST_CHECK(failures, count == 2, "handoff made %d writes, expected 2", count);
+        if (count == 2)
+        {
+            check_write(&failures, "handoff open", &writes[0], handoff, b | master | pump, 0, master | a | b | pump);
+            check_write(&failures, "handoff close", &writes[1], handoff + overlap_ms * 1000LL, 0, a, master | b | pump);
+        }
+    }
+    else
+    {
+        HOST_CHECK(failures, count == 1, "handoff without overlap made %d writes, expected 1", count);
+        if (count == 1)
+        {
+            check_write(&failures, "handoff", &writes[0], handoff, b | master | pump, a, master | b | pump);
+        }
+    }
+
+    // Stop: pump off, then everything that was on once it had time to spin down
+    int64_t stop = esp_timer_get_time();
+    valve_sequencer_switch(VALVE_OUTPUT_NONE);
+    host_timer_advance(5000 * 1000LL);
+    writes = take_writes(&count);
+    HOST_CHECK(failures, count == 2, "stop made %d writes, expected 2", count);
+    if (count == 2)
+    {
+        check_write(&failures, "stop pump", &writes[0], stop, 0, pump, master | b);
+        check_write(&failures, "stop valves", &writes[1], stop + PUMP_DELAY_MS * 1000LL, 0, master | b | pump, 0);
+    }
+
+    // A stop during the master lead drops the zone and pump edges still pending
+    int64_t aborted = esp_timer_get_time();
+    valve_sequencer_switch(ZONE_A);
+    host_timer_advance(MASTER_LEAD_MS / 2 * 1000LL);
+    valve_sequencer_switch(VALVE_OUTPUT_NONE);
+    host_timer_advance(5000 * 1000LL);
+    writes = take_writes(&count);
+    HOST_CHECK(failures, count == 3, "aborted start made %d writes, expected 3", count);
+    if (count == 3)
+    {
+        check_write(&failures, "aborted master", &writes[0], aborted, master, 0, master);
+        check_write(&failures, "aborted pump", &writes[1], aborted + MASTER_LEAD_MS / 2 * 1000LL, 0, pump, master);
+        check_write(&failures, "aborted valves", &writes[2], aborted + (MASTER_LEAD_MS / 2 + PUMP_DELAY_MS) * 1000LL, 0,
+                    master, 0);
+    }
+    HOST_CHECK(failures, valve_outputs_get() == 0, "outputs 0x%llx left on", (unsigned long long)valve_outputs_get());
+
+    printf("%-40s %d mismatches\n", overlap_ms ? "sequence with overlap" : "sequence without overlap", failures);
+    return failures;
+}
+
+int main(void)
+{
+    int failures = 0;
+    HOST_CHECK(failures, valve_outputs_init() == ESP_OK, "valve_outputs_init");
+    HOST_CHECK(failures, valve_sequencer_init(VALVE_OUTPUT_BIT(ZONE_A) | VALVE_OUTPUT_BIT(ZONE_B)) == ESP_OK,
+               "valve_sequencer_init");
+
+    failures += check_sequence(OVERLAP_MS);
+    failures += check_sequence(0);
+
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -16,6 +16,8 @@ export function generateMockResponse(data) {
         {
           type: 'time_update_response',
           success: true,
+          action: 'slewed',
+          source: 'browser',
           current_time: Math.floor(Date.now() / 1000),
           formatted_time: new Date().toISOString(),
         },
@@ -178,6 +180,171 @@ export function generateMockResponse(data) {
         ]
       }
 
+    case 'batch': {
+      // The demo only applies a batch made of commands it supports, otherwise nothing is applied
+      const supported = ['create_or_update_zone', 'enable']
+      const index = data.commands.findIndex((command) => !supported.includes(command.type))
+      if (index !== -1) {
+        return [
+          {
+            type: 'error',
+            message: `Batch command ${index}: This demo can't apply ${data.commands[index].type}`,
+          },
+        ]
+      }
+      data.commands.forEach((command) => generateMockResponse(command))
+      return [
+        {
+          type: 'zone_list',
+          zones: zones,
+        },
+        {
+          type: 'program_list',
+          programs: programs,
+        },
+      ]
+    }
+
+    case 'set_timezone':
+      settings.time.timezone = data.timezone
+      return [
+        {
+          type: 'set_timezone_response',
+          success: true,
+        },
+        {
+          type: 'settings',
+          ...settings,
+        },
+      ]
+
+    case 'get_calendar': {
+      // Expand mock programs over the horizon, like the device does
+      const from = Math.floor(Date.now() / 1000)
+      const to = from + (data.days || 7) * 24 * 60 * 60
+      const runs = []
+      const day = new Date(from * 1000)
+      for (; day.getTime() / 1000 <= to; day.setDate(day.getDate() + 1)) {
+        const dayPrograms = programs.filter((p) => p.enabled && wateringDay(p.schedule, day))
+        for (const program of dayPrograms) {
+          for (const startTime of program.schedule.startTimes) {
+            let start = mockStart(program, startTime, day)
+            if (start <= from || start > to) continue
+            const budget = mockBudget(program, start)
+            for (const programZone of program.zones) {
+              if (!zones.find((z) => z.id === programZone.id)?.enabled) continue
+              const seconds = Math.floor((programZone.duration * 60 * budget) / 100)
+              if (!seconds) continue
+              runs.push([start, program.id, programZone.id, seconds])
+              start += seconds
+            }
+          }
+        }
+      }
+      runs.sort((a, b) => a[0] - b[0])
+      return [{ type: 'calendar', from, to, chunk: 0, final: true, runs }]
+    }
+
+    case 'set_location':
+      settings.location = { latitude: data.latitude, longitude: data.longitude }
+      return [
+        {
+          type: 'set_location_response',
+          success: true,
+        },
+        {
+          type: 'settings',
+          ...settings,
+        },
+      ]
+
+    case 'set_queue_policy':
+      settings.scheduler.queuePolicy = data.policy
+      return [
+        {
+          type: 'settings',
+          ...settings,
+        },
+      ]
+
+    case 'set_finish_by':
+      settings.scheduler.finishBy = {
+        enabled: data.enabled,
+        windowStart: data.window_start,
+        finishBy: data.finish_by,
+      }
+      return [
+        {
+          type: 'settings',
+          ...settings,
+        },
+        mockPlan(),
+      ]
+
+    case 'get_plan':
+      return [mockPlan()]
+
+    case 'set_valve_driver':
+      if (data.driver === 'shift_register') {
+        settings.valveDriver = {
+          type: data.driver,
+          active: false,
+          dataPin: data.data_pin,
+          clockPin: data.clock_pin,
+          latchPin: data.latch_pin,
+          enablePin: data.enable_pin,
+          chips: data.chips,
+          bus: null,
+        }
+      } else if (data.driver === 'mcp23017' || data.driver === 'pcf8575') {
+        settings.valveDriver = {
+          type: data.driver,
+          active: false,
+          sdaPin: data.sda_pin,
+          sclPin: data.scl_pin,
+          address: data.address,
+          chips: data.chips,
+          bus: null,
+        }
+      } else {
+        settings.valveDriver = { type: data.driver, active: false }
+      }
+      return [
+        {
+          type: 'settings',
+          ...settings,
+        },
+      ]
+
+    case 'set_valve_sequence':
+      settings.valves = {
+        master: data.master,
+        pump: data.pump,
+        masterLeadMs: data.master_lead_ms,
+        pumpDelayMs: data.pump_delay_ms,
+        overlapMs: data.overlap_ms,
+      }
+      return [
+        {
+          type: 'settings',
+          ...settings,
+        },
+      ]
+
+    case 'set_water_budget':
+      settings.budget = {
+        percent: data.percent,
+        monthly: data.monthly,
+        months: data.months ?? settings.budget.months,
+      }
+      return [
+        {
+          type: 'settings',
+          ...settings,
+        },
+        mockPlan(),
+      ]
+
     case 'get_settings':
       return [
         {
@@ -188,6 +355,91 @@ export function generateMockResponse(data) {
   }
 }
 
+// Start of a program on a local date, the demo's sun rises at 06:30 and sets at 20:00
+function mockStart(program, startTime, day) {
+  const match = /^(sunrise|sunset|finish_by_sunrise)([+-]\d+)?$/.exec(startTime)
+  if (!match) {
+    const [hours, minutes] = startTime.split(':').map(Number)
+    return new Date(day).setHours(hours, minutes, 0, 0) / 1000
+  }
+
+  const duration = program.zones.reduce((total, zone) => total + zone.duration, 0)
+  let minutes = (match[1] === 'sunset' ? 20 * 60 : 6 * 60 + 30) + parseInt(match[2] ?? '0')
+  if (match[1] === 'finish_by_sunrise') {
+    minutes -= Math.floor((duration * mockBudget(program, day.getTime() / 1000)) / 100)
+  }
+  return new Date(day).setHours(0, minutes, 0, 0) / 1000
+}
+
+// Effective water budget of a program, the global one (or the month's) times the program's
+function mockBudget(program, time) {
+  const budget = settings.budget
+  const global = budget.monthly ? budget.months[new Date(time * 1000).getMonth()] : budget.percent
+  return Math.floor((global * (program.budget ?? 100)) / 100)
+}
+
+// Runs starting in the next finish-by window, packed against the deadline or scaled down to fit
+function mockPlan() {
+  const window = settings.scheduler.finishBy
+  if (!window?.enabled) return { type: 'plan', windowOpen: 0, deadline: 0, scalePercent: 100, runs: [] }
+
+  const now = Math.floor(Date.now() / 1000)
+  const minutes = (time) => {
+    const [hours, minute] = time.split(':').map(Number)
+    return hours * 60 + minute
+  }
+  let deadline = new Date().setHours(0, minutes(window.finishBy), 0, 0) / 1000
+  if (deadline <= now) deadline += 24 * 60 * 60
+  const length = (minutes(window.finishBy) - minutes(window.windowStart) + 24 * 60) % (24 * 60)
+  const windowOpen = deadline - length * 60
+
+  const runs = []
+  for (const day of [-1, 0, 1].map((offset) => new Date(Date.now() + offset * 86400000))) {
+    for (const program of programs.filter((p) => p.enabled && wateringDay(p.schedule, day))) {
+      for (const startTime of program.schedule.startTimes) {
+        const nominal = mockStart(program, startTime, day)
+        const budget = mockBudget(program, nominal)
+        const seconds = program.zones
+          .filter((zone) => zones.find((z) => z.id === zone.id)?.enabled)
+          .reduce((total, zone) => total + Math.floor((zone.duration * 60 * budget) / 100), 0)
+        if (nominal >= windowOpen && nominal < deadline && seconds) {
+          runs.push([0, program.id, seconds, 100, nominal])
+        }
+      }
+    }
+  }
+  runs.sort((a, b) => a[4] - b[4])
+
+  const begin = Math.max(windowOpen, now)
+  const total = runs.reduce((sum, run) => sum + run[2], 0)
+  const scalePercent = total > deadline - begin ? Math.floor(((deadline - begin) * 100) / total) : 100
+  let start = scalePercent === 100 ? deadline - total : begin
+  for (const run of runs) {
+    run[2] = Math.floor((run[2] * scalePercent) / 100)
+    run[3] = scalePercent
+    run[0] = start
+    start += run[2]
+  }
+  return { type: 'plan', windowOpen, deadline, scalePercent, runs }
+}
+
+// Whether a schedule waters on a local date
+function wateringDay(schedule, day) {
+  switch (schedule.mode) {
+    case 'interval': {
+      const anchor = new Date(`${schedule.startDate}T00:00`)
+      const days = Math.round((new Date(day).setHours(0, 0, 0, 0) - anchor) / 86400000)
+      return days % schedule.interval === 0
+    }
+    case 'odd':
+      return day.getDate() % 2 === 1
+    case 'even':
+      return day.getDate() % 2 === 0
+    default:
+      return schedule.days.includes(day.getDay())
+  }
+}
+
 let settings = {
   ota: {
     requiresPassword: true,
@@ -196,6 +448,38 @@ let settings = {
     connected: false,
     setup: false,
   },
+  time: {
+    confidence: 'high',
+    timezone: 'PST8PDT,M3.2.0,M11.1.0',
+  },
+  scheduler: {
+    queuePolicy: 'append',
+    finishBy: {
+      enabled: true,
+      windowStart: '20:00',
+      finishBy: '08:00',
+    },
+  },
+  budget: {
+    percent: 100,
+    monthly: true,
+    months: [40, 50, 70, 90, 110, 130, 150, 150, 120, 90, 60, 40],
+  },
+  valves: {
+    master: 25,
+    pump: null,
+    masterLeadMs: 500,
+    pumpDelayMs: 0,
+    overlapMs: 3000,
+  },
+  valveDriver: {
+    type: 'gpio',
+    active: true,
+  },
+  location: {
+    latitude: 37.7749,
+    longitude: -122.4194,
+  },
 }
 
 let zones = [
@@ -239,16 +523,21 @@ let programs = [
     name: 'Morning Routine  Demo',
     enabled: true,
     schedule: {
+      mode: 'weekdays',
       days: [0, 2, 3],
-      startTime: '06:00',
+      startTimes: ['06:00', 'sunset+30'],
+      interval: 1,
+      startDate: '2025-06-01',
     },
     zones: [
       { id: 1, duration: 999, order: 1 },
       { id: 2, duration: 999, order: 2 },
       { id: 3, duration: 999, order: 3 },
     ],
+    budget: 100,
     lastRun: (new Date().getTime() - 5000) / 1000,
     nextRun: (new Date().getTime() + 5000) / 1000,
+    conflicts: [2],
     status: 'scheduled',
   },
   {
@@ -256,16 +545,21 @@ let programs = [
     name: 'Weekend Deep Water',
     enabled: true,
     schedule: {
-      days: [5, 6],
-      startTime: '05:30',
+      mode: 'interval',
+      days: [],
+      startTimes: ['05:30'],
+      interval: 3,
+      startDate: '2025-06-01',
     },
     zones: [
       { id: 1, duration: 999, order: 1 },
       { id: 2, duration: 999, order: 2 },
       { id: 4, duration: 999, order: 3 },
     ],
+    budget: 80,
     lastRun: (new Date().getTime() - 8000) / 1000,
     nextRun: (new Date().getTime() + 8000) / 1000,
+    conflicts: [1],
     status: 'running',
   },
 ]
@@ -338,4 +632,10 @@ let systemInfo = {
     files_count: 4,
     total_size: '168.8 KB',
   },
+  buffers: {
+    small: '0/4 in use, peak 2, largest request 212 of 256 bytes, 0 waits, 0 failures',
+    medium: '0/3 in use, peak 1, largest request 2304 of 2304 bytes, 0 waits, 0 failures',
+    large: '0/1 in use, peak 1, largest request 16384 of 16384 bytes, 0 waits, 0 failures',
+    message_arena: 'peak 1184 of 8192 bytes over 57 messages, 0 overflows, 0 outside messages',
+  },
 }
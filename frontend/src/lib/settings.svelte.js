@@ -12,7 +12,58 @@ export function initializeSettings() {
   const unsubscribe = onMessageType('settings', (data) => {
     settingsState.ota = data.ota
     settingsState.wifi = data.wifi
+    settingsState.time = data.time
+    settingsState.scheduler = data.scheduler
+    settingsState.location = data.location
   })
 
   return unsubscribe
 }
+
+// Change the device timezone, as a POSIX TZ string
+export function setTimezone(timezone) {
+  sendMessage({ type: 'set_timezone', timezone })
+}
+
+// Location used for sunrise and sunset start times
+export function setLocation(latitude, longitude) {
+  sendMessage({ type: 'set_location', latitude, longitude })
+}
+
+// What happens when a scheduled program is due while another one runs
+export function setQueuePolicy(policy) {
+  sendMessage({ type: 'set_queue_policy', policy })
+}
+
+// Window all scheduled runs inside it must fit in, times are "HH:MM"
+export function setFinishBy(enabled, windowStart, finishBy) {
+  sendMessage({ type: 'set_finish_by', enabled, window_start: windowStart, finish_by: finishBy })
+}
+
+// Percentage applied to every program's zone durations, per month when monthly is set
+export function setWaterBudget(percent, monthly, months) {
+  sendMessage({ type: 'set_water_budget', percent, monthly, months })
+}
+
+// Hardware driving the valves, applied on the next restart. Wiring holds the snake_case fields of
+// the driver: data_pin, clock_pin, latch_pin, enable_pin (null when OE is tied low) and chips for
+// shift registers, sda_pin, scl_pin, address and chips for I2C expanders, nothing for GPIO.
+export function setValveDriver(driver, wiring) {
+  sendMessage({
+    type: 'set_valve_driver',
+    driver,
+    ...wiring,
+  })
+}
+
+// Master valve and pump outputs (null when not wired) and their timing around zone switches
+export function setValveSequence(master, pump, masterLeadMs, pumpDelayMs, overlapMs) {
+  sendMessage({
+    type: 'set_valve_sequence',
+    master,
+    pump,
+    master_lead_ms: masterLeadMs,
+    pump_delay_ms: pumpDelayMs,
+    overlap_ms: overlapMs,
+  })
+}